@@ -0,0 +1,75 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    CameraIntrinsics.cpp
+    Pinhole intrinsics and lens distortion of the depth camera, and the rays its pixels see.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "CameraIntrinsics.h"
+
+// Fixed-point iterations inverting the distortion, which converge to well under 0.01 pixels for the Kinect's lens
+#define UNDISTORT_ITERATIONS 10
+
+namespace virtualMonitor {
+
+/*
+ * Output: the pixel a ray (rayX, rayY, 1) lands on through the lens, as libfreenect2's Registration::distort()
+ */
+void distortRay(const CameraIntrinsics &intrinsics, float rayX, float rayY, float *pixelX, float *pixelY) {
+    float x2 = rayX * rayX;
+    float y2 = rayY * rayY;
+    float r2 = x2 + y2;
+    float xy2 = 2 * rayX * rayY;
+    float radial = 1 + ((intrinsics.k3 * r2 + intrinsics.k2) * r2 + intrinsics.k1) * r2;
+    *pixelX = intrinsics.fx * (rayX * radial + intrinsics.p2 * (r2 + 2 * x2) + intrinsics.p1 * xy2) + intrinsics.cx;
+    *pixelY = intrinsics.fy * (rayY * radial + intrinsics.p1 * (r2 + 2 * y2) + intrinsics.p2 * xy2) + intrinsics.cy;
+}
+
+/*
+ * Output: the ray (rayX, rayY, 1) a pixel sees, inverting distortRay() by fixed-point iteration
+ */
+void undistortPixel(const CameraIntrinsics &intrinsics, float pixelX, float pixelY, float *rayX, float *rayY) {
+    float distortedX = (pixelX - intrinsics.cx) / intrinsics.fx;
+    float distortedY = (pixelY - intrinsics.cy) / intrinsics.fy;
+    float x = distortedX;
+    float y = distortedY;
+    for (int i = 0; i < UNDISTORT_ITERATIONS; i++) {
+        float x2 = x * x;
+        float y2 = y * y;
+        float r2 = x2 + y2;
+        float xy2 = 2 * x * y;
+        float radial = 1 + ((intrinsics.k3 * r2 + intrinsics.k2) * r2 + intrinsics.k1) * r2;
+        x = (distortedX - (intrinsics.p2 * (r2 + 2 * x2) + intrinsics.p1 * xy2)) / radial;
+        y = (distortedY - (intrinsics.p1 * (r2 + 2 * y2) + intrinsics.p2 * xy2)) / radial;
+    }
+    *rayX = x;
+    *rayY = y;
+}
+
+/*
+ * Input: rayX and rayY each hold width * height floats, set to the ray each pixel sees, row by row
+ */
+void buildRayTable(const CameraIntrinsics &intrinsics, int width, int height, float *rayX, float *rayY) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            undistortPixel(intrinsics, x, y, &rayX[y * width + x], &rayY[y * width + x]);
+        }
+    }
+}
+
+} /* namespace virtualMonitor */
@@ -0,0 +1,54 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    CameraIntrinsics.h
+    Pinhole intrinsics and lens distortion of the depth camera, and the rays its pixels see.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CAMERAINTRINSICS_H
+#define CAMERAINTRINSICS_H
+
+namespace virtualMonitor {
+
+/*
+ * The depth (infrared) camera's intrinsics, as libfreenect2's IrCameraParams, which are stored in recordings and surface models
+ * A point seen at depth z (mm) along the ray (x, y, 1) is at z * (x, y, 1), and lands on the pixel
+ * (fx * x' + cx, fy * y' + cy), where (x', y') is (x, y) distorted by the radial (k) and tangential (p) coefficients
+ */
+struct CameraIntrinsics {
+    float fx;
+    float fy;
+    float cx;
+    float cy;
+    float k1;
+    float k2;
+    float k3;
+    float p1;
+    float p2;
+
+    CameraIntrinsics() : fx(0), fy(0), cx(0), cy(0), k1(0), k2(0), k3(0), p1(0), p2(0) {}
+    bool isValid() const { return this->fx > 0 && this->fy > 0; }
+};
+
+void distortRay(const CameraIntrinsics &intrinsics, float rayX, float rayY, float *pixelX, float *pixelY);
+void undistortPixel(const CameraIntrinsics &intrinsics, float pixelX, float pixelY, float *rayX, float *rayY);
+void buildRayTable(const CameraIntrinsics &intrinsics, int width, int height, float *rayX, float *rayY);
+
+} /* namespace virtualMonitor */
+
+#endif /* CAMERAINTRINSICS_H */
@@ -0,0 +1,52 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    Checksum.h
+    Checksums of the binary files saved between runs (calibration profiles, surface models).
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace virtualMonitor {
+
+// 64-bit FNV-1a, taken a 32-bit word at a time
+#define CHECKSUM_INITIAL 14695981039346656037ULL
+#define CHECKSUM_PRIME 1099511628211ULL
+
+/*
+ * Continues a checksum over data, starting from CHECKSUM_INITIAL
+ * Input: byteCount is a multiple of 4
+ */
+inline uint64_t checksumWords(uint64_t checksum, const void *data, size_t byteCount) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i + sizeof(uint32_t) <= byteCount; i += sizeof(uint32_t)) {
+        uint32_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        checksum = (checksum ^ word) * CHECKSUM_PRIME;
+    }
+    return checksum;
+}
+
+} /* namespace virtualMonitor */
+
+#endif /* CHECKSUM_H */
@@ -0,0 +1,198 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    DepthBuffer.cpp
+    Pooled, reference-counted depth frames shared between readers, the reference, and detection.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "DepthBuffer.h"
+
+#include <cstring>
+#include <iostream>
+
+// Kinect v2 depth frames
+#define DEPTH_FRAME_WIDTH 512
+#define DEPTH_FRAME_HEIGHT 424
+
+namespace virtualMonitor {
+
+DepthBuffer::DepthBuffer(DepthBufferPool *pool) {
+    this->pool = pool;
+    this->ownedData = NULL;
+    this->referenceCount = 0;
+}
+
+DepthBuffer::~DepthBuffer() {
+    if (this->releaseWrapped) {
+        this->releaseWrapped();
+    }
+    delete[] this->ownedData;
+}
+
+void DepthBuffer::retain() {
+    this->referenceCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void DepthBuffer::release() {
+    // The last holder's writes to the depths happen before they are reused
+    if (this->referenceCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        this->pool->recycle(this);
+    }
+}
+
+/*
+ * Input: dataBufferCount is how many pooled buffers of depths to allocate up front
+ */
+DepthBufferPool::DepthBufferPool(int width, int height, int dataBufferCount) {
+    this->width = width;
+    this->height = height;
+    this->acquiredCount = 0;
+    this->grownCount = 0;
+    for (int i = 0; i < dataBufferCount; i++) {
+        DepthBuffer *buffer = new DepthBuffer(this);
+        buffer->ownedData = new float[width * height];
+        this->buffers.push_back(buffer);
+        this->freeDataBuffers.push_back(buffer);
+    }
+}
+
+DepthBufferPool::~DepthBufferPool() {
+    int heldBufferCount = this->getHeldBufferCount();
+    if (heldBufferCount > 0) {
+        std::cout << "DepthBufferPool: " << heldBufferCount << " buffers not released before destroying the pool." << std::endl;
+    }
+    for (size_t i = 0; i < this->buffers.size(); i++) {
+        delete this->buffers[i];
+    }
+}
+
+/*
+ * Pool of Kinect depth frames, for frames read from files
+ */
+DepthBufferPool *DepthBufferPool::shared() {
+    static DepthBufferPool sharedPool(DEPTH_FRAME_WIDTH, DEPTH_FRAME_HEIGHT);
+    return &sharedPool;
+}
+
+/*
+ * Output: a buffer of the pool's size in millimeters, held once by the caller, to be filled through getData()
+ *          The depths are left from the buffer's last use
+ */
+DepthBuffer *DepthBufferPool::acquire() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    DepthBuffer *buffer;
+    if (!this->freeDataBuffers.empty()) {
+        buffer = this->freeDataBuffers.back();
+        this->freeDataBuffers.pop_back();
+    } else {
+        buffer = new DepthBuffer(this);
+        buffer->ownedData = new float[this->width * this->height];
+        this->buffers.push_back(buffer);
+        this->grownCount++;
+    }
+    buffer->view = DepthView(buffer->ownedData, this->width, this->height);
+    buffer->referenceCount.store(1, std::memory_order_relaxed);
+    this->acquiredCount++;
+    return buffer;
+}
+
+/*
+ * Copies view into a pooled buffer, so the depths it points to can be freed or returned right away
+ * Output: a buffer holding the copy in view's units, held once by the caller,
+ *          or NULL if view is larger than the pool's buffers
+ */
+DepthBuffer *DepthBufferPool::copy(const DepthView *view) {
+    if (view->width > this->width || view->height > this->height) {
+        std::cout << "DepthBufferPool: Cannot copy a " << view->width << "x" << view->height << " view into "
+                  << this->width << "x" << this->height << " buffers." << std::endl;
+        return NULL;
+    }
+    DepthBuffer *buffer = this->acquire();
+    float *data = buffer->getData();
+    for (int y = 0; y < view->height; y++) {
+        std::memcpy(data + (y * view->width), view->data + (y * view->stride), view->width * sizeof(float));
+    }
+    buffer->view = DepthView(data, view->width, view->height, 0, view->units);
+    buffer->view.timestamp = view->timestamp;
+    buffer->view.sequence = view->sequence;
+    return buffer;
+}
+
+/*
+ * Input: view is of depths of any size, and releaseWrapped (if set) frees them when the last holder releases the buffer
+ * Output: a buffer holding view, held once by the caller
+ */
+DepthBuffer *DepthBufferPool::wrap(DepthView view, std::function<void()> releaseWrapped) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    DepthBuffer *buffer;
+    if (!this->freeWrapBuffers.empty()) {
+        buffer = this->freeWrapBuffers.back();
+        this->freeWrapBuffers.pop_back();
+    } else {
+        buffer = new DepthBuffer(this);
+        this->buffers.push_back(buffer);
+    }
+    buffer->view = view;
+    buffer->releaseWrapped = releaseWrapped;
+    buffer->referenceCount.store(1, std::memory_order_relaxed);
+    this->acquiredCount++;
+    return buffer;
+}
+
+void DepthBufferPool::recycle(DepthBuffer *buffer) {
+    if (buffer->releaseWrapped) {
+        buffer->releaseWrapped();
+        buffer->releaseWrapped = std::function<void()>();
+    }
+    buffer->view = DepthView();
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (buffer->ownedData != NULL) {
+        this->freeDataBuffers.push_back(buffer);
+    } else {
+        this->freeWrapBuffers.push_back(buffer);
+    }
+}
+
+int DepthBufferPool::getBufferCount() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return (int)this->buffers.size();
+}
+
+int DepthBufferPool::getHeldBufferCount() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return (int)(this->buffers.size() - this->freeDataBuffers.size() - this->freeWrapBuffers.size());
+}
+
+/*
+ * Output: how many buffers have been handed out, including reused ones
+ */
+uint64_t DepthBufferPool::getAcquiredCount() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->acquiredCount;
+}
+
+/*
+ * Output: how many pooled buffers of depths were allocated after construction, because every one was held
+ */
+uint64_t DepthBufferPool::getGrownCount() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->grownCount;
+}
+
+} /* namespace virtualMonitor */
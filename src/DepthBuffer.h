@@ -0,0 +1,101 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    DepthBuffer.h
+    Pooled, reference-counted depth frames shared between readers, the reference, and detection.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEPTHBUFFER_H
+#define DEPTHBUFFER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "DepthView.h"
+
+namespace virtualMonitor {
+
+class DepthBufferPool;
+
+/*
+ * A depth frame with a reference count, so holders share it instead of copying it
+ * Each holder calls retain() to keep the buffer and release() when done with it,
+ * and the buffer returns to its pool when the last holder releases it
+ */
+class DepthBuffer {
+    friend class DepthBufferPool;
+
+    private:
+        DepthBufferPool *pool;
+        DepthView view;
+        float *ownedData;                       // pooled depths, or NULL if the buffer only wraps views
+        std::function<void()> releaseWrapped;   // frees a wrapped view's depths
+        std::atomic<int> referenceCount;
+
+        DepthBuffer(DepthBufferPool *pool);
+        virtual ~DepthBuffer();
+
+    public:
+        virtual DepthView *getView() { return &this->view; }
+        virtual float *getData() { return this->ownedData; }
+        virtual void retain();
+        virtual void release();
+};
+
+/*
+ * Buffers either hold pooled depths, which are reused as is, or wrap a view of depths from elsewhere
+ * (a Kinect frame or a recording), which are freed when the last holder releases it
+ * A pool grows when every buffer is held, so holders never wait for a buffer
+ */
+class DepthBufferPool {
+    friend class DepthBuffer;
+
+    private:
+        int width;
+        int height;
+        std::mutex mutex;
+        std::vector<DepthBuffer *> buffers;
+        std::vector<DepthBuffer *> freeDataBuffers;
+        std::vector<DepthBuffer *> freeWrapBuffers;
+        uint64_t acquiredCount;
+        uint64_t grownCount;
+
+    public:
+        DepthBufferPool(int width, int height, int dataBufferCount=0);
+        virtual ~DepthBufferPool();
+
+        static DepthBufferPool *shared();
+
+        virtual DepthBuffer *acquire();
+        virtual DepthBuffer *copy(const DepthView *view);
+        virtual DepthBuffer *wrap(DepthView view, std::function<void()> releaseWrapped=std::function<void()>());
+        virtual int getBufferCount();
+        virtual int getHeldBufferCount();
+        virtual uint64_t getAcquiredCount();
+        virtual uint64_t getGrownCount();
+
+    private:
+        virtual void recycle(DepthBuffer *buffer);
+};
+
+} /* namespace virtualMonitor */
+
+#endif /* DEPTHBUFFER_H */
@@ -0,0 +1,80 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    DepthView.h
+    Non-owning view of a depth image, the input to detection.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEPTHVIEW_H
+#define DEPTHVIEW_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace virtualMonitor {
+
+// What a depth value of 1 means (the Kinect reports millimeters)
+enum DepthUnits {
+    DepthUnitsMillimeters,
+    DepthUnitsMeters
+};
+
+/*
+ * Points at float depths owned elsewhere (a Kinect frame, a mapped recording, a pooled buffer, test data),
+ * which must outlive the view
+ * Rows start stride floats apart, so a view can cover part of a wider image
+ */
+struct DepthView {
+    const float *data;
+    int width;
+    int height;
+    int stride;
+    DepthUnits units;
+    uint32_t timestamp;
+    uint32_t sequence;
+
+    DepthView() {
+        this->data = NULL;
+        this->width = 0;
+        this->height = 0;
+        this->stride = 0;
+        this->units = DepthUnitsMillimeters;
+        this->timestamp = 0;
+        this->sequence = 0;
+    }
+
+    /*
+     * Input: stride is the number of floats from one row to the next (0 for rows of width floats)
+     */
+    DepthView(const float *data, int width, int height, int stride=0, DepthUnits units=DepthUnitsMillimeters) {
+        this->data = data;
+        this->width = width;
+        this->height = height;
+        this->stride = (stride > 0) ? stride : width;
+        this->units = units;
+        this->timestamp = 0;
+        this->sequence = 0;
+    }
+
+    const float *row(int y) const { return this->data + (size_t)y * this->stride; }
+    float millimetersPerUnit() const { return (this->units == DepthUnitsMeters) ? 1000.0f : 1.0f; }
+};
+
+} /* namespace virtualMonitor */
+
+#endif /* DEPTHVIEW_H */
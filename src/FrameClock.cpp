@@ -0,0 +1,80 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    FrameClock.cpp
+    Maps Kinect frame timestamps onto the host steady clock.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FrameClock.h"
+
+#include <algorithm>
+
+namespace virtualMonitor {
+
+#define DEVICE_TICK_NANOSECONDS 100000
+#define DEVICE_TICKS_PER_WRAP ((int64_t)1 << 32)
+
+FrameClock::FrameClock() {
+    this->reset();
+}
+
+void FrameClock::reset() {
+    this->offsetCount = 0;
+    this->offsetIndex = 0;
+    this->offsetNanoseconds = 0;
+    this->lastDeviceTimestamp = 0;
+    this->wrapTicks = 0;
+}
+
+/*
+ * Updates the offset with a frame that arrived at arrivalTime
+ * Frames must be observed in the order the device sent them
+ */
+void FrameClock::observeFrame(uint32_t deviceTimestamp, std::chrono::steady_clock::time_point arrivalTime) {
+    if (this->offsetCount > 0 && deviceTimestamp < this->lastDeviceTimestamp) {
+        this->wrapTicks += DEVICE_TICKS_PER_WRAP;
+    }
+    this->lastDeviceTimestamp = deviceTimestamp;
+
+    int64_t arrivalNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(arrivalTime.time_since_epoch()).count();
+    this->offsetsNanoseconds[this->offsetIndex] = arrivalNanoseconds - this->unwrappedDeviceNanoseconds(deviceTimestamp);
+    this->offsetIndex = (this->offsetIndex + 1) % FRAME_CLOCK_WINDOW;
+    this->offsetCount = std::min(this->offsetCount + 1, FRAME_CLOCK_WINDOW);
+
+    // A window (rather than the all-time minimum) lets the offset follow drift between the two clocks
+    this->offsetNanoseconds = *std::min_element(this->offsetsNanoseconds, this->offsetsNanoseconds + this->offsetCount);
+}
+
+/*
+ * Output: estimated host time a frame was captured, for the most recently observed frames
+ */
+std::chrono::steady_clock::time_point FrameClock::hostTimeForFrame(uint32_t deviceTimestamp) {
+    int64_t hostNanoseconds = this->unwrappedDeviceNanoseconds(deviceTimestamp) + this->offsetNanoseconds;
+    return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(hostNanoseconds)));
+}
+
+int64_t FrameClock::unwrappedDeviceNanoseconds(uint32_t deviceTimestamp) {
+    int64_t ticks = this->wrapTicks + deviceTimestamp;
+    // A timestamp from just before the last wrap belongs to the previous cycle
+    if (deviceTimestamp > this->lastDeviceTimestamp && deviceTimestamp - this->lastDeviceTimestamp > DEVICE_TICKS_PER_WRAP / 2) {
+        ticks -= DEVICE_TICKS_PER_WRAP;
+    }
+    return ticks * DEVICE_TICK_NANOSECONDS;
+}
+
+} /* namespace virtualMonitor */
@@ -0,0 +1,63 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    FrameClock.h
+    Maps Kinect frame timestamps onto the host steady clock.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAMECLOCK_H
+#define FRAMECLOCK_H
+
+#include <chrono>
+#include <cstdint>
+
+namespace virtualMonitor {
+
+// Number of recent frames whose smallest arrival delay sets the clock offset (about 10 seconds at 30 fps)
+#define FRAME_CLOCK_WINDOW 300
+
+/*
+ * The Kinect stamps frames on its own clock, in ticks of 0.1 ms that wrap around every 5 days
+ * Host time = device time + offset, where the offset is the smallest (arrival - device time) seen recently,
+ * since the least delayed frame arrived closest to when it was captured
+ */
+class FrameClock {
+    private:
+        int64_t offsetsNanoseconds[FRAME_CLOCK_WINDOW];
+        int offsetCount;
+        int offsetIndex;
+        int64_t offsetNanoseconds;
+        uint32_t lastDeviceTimestamp;
+        int64_t wrapTicks;
+
+    public:
+        FrameClock();
+        virtual ~FrameClock() {}
+
+        virtual void reset();
+        virtual void observeFrame(uint32_t deviceTimestamp, std::chrono::steady_clock::time_point arrivalTime);
+        virtual std::chrono::steady_clock::time_point hostTimeForFrame(uint32_t deviceTimestamp);
+        virtual bool isSynced() { return this->offsetCount > 0; }
+
+    private:
+        virtual int64_t unwrappedDeviceNanoseconds(uint32_t deviceTimestamp);
+};
+
+} /* namespace virtualMonitor */
+
+#endif /* FRAMECLOCK_H */
@@ -0,0 +1,297 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    FrameCorpus.cpp
+    Collects recorded depth frames and their reference frames for offline processing.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FrameCorpus.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace virtualMonitor {
+
+#define DEPTH_FRAME_WIDTH 512
+#define DEPTH_FRAME_HEIGHT 424
+#define DEPTH_FRAME_BYTES_PER_PIXEL 4
+
+#define REFERENCE_FRAME_FILENAME "surface.bin"
+#define FRAME_EXTENSION ".bin"
+#define RECORDING_EXTENSION ".vmrec"
+#define ANNOTATION_NONE "none"
+
+static bool hasExtension(std::string filename, std::string extension) {
+    return (filename.length() > extension.length() &&
+            filename.compare(filename.length() - extension.length(), extension.length(), extension) == 0);
+}
+
+static bool isDirectory(std::string path) {
+    struct stat pathStat;
+    return (stat(path.c_str(), &pathStat) == 0 && S_ISDIR(pathStat.st_mode));
+}
+
+FrameCorpus::FrameCorpus() {
+
+}
+
+FrameCorpus::~FrameCorpus() {
+    this->close();
+}
+
+/*
+ * Loads a recording, or a directory of recordings and .bin frames (searched recursively)
+ * Frames are ordered by source, then by position within the source
+ */
+int FrameCorpus::load(std::string path) {
+    this->close();
+
+    if (isDirectory(path)) {
+        this->rootPath = path;
+        if (this->addDirectory(path) < 0) {
+            return -1;
+        }
+    } else {
+        this->rootPath = path.substr(0, path.find_last_of('/') + 1);
+        if (this->addRecording(path) < 0) {
+            return -1;
+        }
+    }
+
+    if (this->frames.empty()) {
+        std::cout << "FrameCorpus: No frames found in " << path << "." << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int FrameCorpus::close() {
+    for (size_t i = 0; i < this->sources.size(); i++) {
+        CorpusSource &source = this->sources[i];
+        // Recording frames point into the recording, so they are released first
+        source.referenceBuffer->release();
+        delete source.recording;
+    }
+    this->sources.clear();
+    this->frames.clear();
+    return 0;
+}
+
+/*
+ * Reads a frame from the corpus
+ * Output: a buffer holding the frame, which the caller releases before closing the corpus,
+ *          or NULL if it could not be read
+ * Safe to call from several threads at once
+ */
+DepthBuffer *FrameCorpus::readFrame(int index) {
+    CorpusFrame &frame = this->frames[index];
+    CorpusSource &source = this->sources[frame.sourceIndex];
+    if (source.recording != NULL) {
+        // Recording frames point into the mapped recording, so they are wrapped rather than copied
+        DepthView depthFrame;
+        if (source.recording->readFrame(frame.frameIndex, &depthFrame) < 0) {
+            return NULL;
+        }
+        return DepthBufferPool::shared()->wrap(depthFrame);
+    }
+    return this->readDepthFrameFromFile(frame.filename);
+}
+
+/*
+ * Output: the reference frame for a source, owned by the corpus
+ */
+DepthView *FrameCorpus::getReferenceFrame(int sourceIndex) {
+    return this->sources[sourceIndex].referenceBuffer->getView();
+}
+
+int FrameCorpus::addDirectory(std::string dir) {
+    DIR *dirHandle = opendir(dir.c_str());
+    if (dirHandle == NULL) {
+        std::cout << "FrameCorpus: Could not open " << dir << "." << std::endl;
+        return -1;
+    }
+    std::vector<std::string> filenames;
+    struct dirent *entry;
+    while ((entry = readdir(dirHandle)) != NULL) {
+        std::string filename = entry->d_name;
+        if (filename != "." && filename != "..") {
+            filenames.push_back(filename);
+        }
+    }
+    closedir(dirHandle);
+    std::sort(filenames.begin(), filenames.end());
+
+    // .bin frames in this directory share surface.bin as their reference
+    int binSourceIndex = -1;
+    for (size_t i = 0; i < filenames.size(); i++) {
+        std::string path = dir + "/" + filenames[i];
+        if (hasExtension(filenames[i], RECORDING_EXTENSION)) {
+            if (this->addRecording(path) < 0) {
+                return -1;
+            }
+        } else if (hasExtension(filenames[i], FRAME_EXTENSION)) {
+            if (binSourceIndex < 0) {
+                CorpusSource source;
+                source.name = this->relativePath(dir);
+                source.dir = dir;
+                source.recording = NULL;
+                source.referenceBuffer = this->readDepthFrameFromFile(dir + "/" + REFERENCE_FRAME_FILENAME);
+                if (source.referenceBuffer == NULL) {
+                    std::cout << "FrameCorpus: No " << REFERENCE_FRAME_FILENAME << " reference in " << dir << "." << std::endl;
+                    return -1;
+                }
+                binSourceIndex = this->sources.size();
+                this->sources.push_back(source);
+            }
+            CorpusFrame frame;
+            frame.id = this->relativePath(path);
+            frame.sourceIndex = binSourceIndex;
+            frame.frameIndex = -1;
+            frame.filename = path;
+            this->frames.push_back(frame);
+        } else if (isDirectory(path)) {
+            if (this->addDirectory(path) < 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int FrameCorpus::addRecording(std::string recordingFilename) {
+    RecordingReader *recording = new RecordingReader();
+    if (recording->open(recordingFilename) < 0 || recording->getFrameCount() == 0) {
+        std::cout << "FrameCorpus: Could not read recording " << recordingFilename << "." << std::endl;
+        delete recording;
+        return -1;
+    }
+
+    CorpusSource source;
+    source.name = this->relativePath(recordingFilename);
+    source.dir = recordingFilename.substr(0, recordingFilename.find_last_of('/') + 1);
+    source.recording = recording;
+    DepthView referenceFrame;
+    recording->readFrame(0, &referenceFrame);
+    source.referenceBuffer = DepthBufferPool::shared()->wrap(referenceFrame);
+    int sourceIndex = this->sources.size();
+    this->sources.push_back(source);
+
+    for (int frameIndex = 0; frameIndex < recording->getFrameCount(); frameIndex++) {
+        CorpusFrame frame;
+        frame.id = source.name + "#" + std::to_string(frameIndex);
+        frame.sourceIndex = sourceIndex;
+        frame.frameIndex = frameIndex;
+        this->frames.push_back(frame);
+    }
+    return 0;
+}
+
+std::string FrameCorpus::relativePath(std::string path) {
+    std::string root = this->rootPath;
+    if (root.length() > 0 && root[root.length() - 1] != '/') {
+        root += "/";
+    }
+    if (path.compare(0, root.length(), root) == 0) {
+        return path.substr(root.length());
+    }
+    return path;
+}
+
+DepthBuffer *FrameCorpus::readDepthFrameFromFile(std::string depthFrameFilename) {
+    std::ifstream depthFile(depthFrameFilename, std::ios::binary | std::ios::ate);
+    if (!depthFile.is_open()) {
+        return NULL;
+    }
+
+    size_t byteCount = DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT * DEPTH_FRAME_BYTES_PER_PIXEL;
+    if ((size_t)depthFile.tellg() != byteCount) {
+        std::cout << "FrameCorpus: " << depthFrameFilename << " is not a depth frame." << std::endl;
+        return NULL;
+    }
+
+    // Read straight into a pooled frame, which is reused once released
+    DepthBuffer *depthBuffer = DepthBufferPool::shared()->acquire();
+    depthFile.seekg(0, std::ios::beg);
+    depthFile.read((char *)depthBuffer->getData(), byteCount);
+    depthFile.close();
+    return depthBuffer;
+}
+
+/*
+ * Reads annotations written as one "id x y z" line per contact, or "id none" for frames without contacts
+ * Input: idPrefix is prepended to each id, to match ids of frames in subdirectories
+ */
+int FrameCorpus::readAnnotationsFromFile(std::string annotationsFilename, CorpusAnnotations &annotations, std::string idPrefix) {
+    std::ifstream annotationsFile(annotationsFilename);
+    if (!annotationsFile.is_open()) {
+        return -1;
+    }
+
+    std::string line;
+    while (std::getline(annotationsFile, line)) {
+        std::istringstream lineStream(line);
+        std::string id, xField;
+        if (!(lineStream >> id >> xField)) {
+            continue;
+        }
+        std::vector<Coord3D> &contacts = annotations[idPrefix + id];
+        if (xField == ANNOTATION_NONE) {
+            continue;
+        }
+        Coord3D contact;
+        contact.x = std::atoi(xField.c_str());
+        contact.z = 0;
+        if (!(lineStream >> contact.y)) {
+            continue;
+        }
+        lineStream >> contact.z;
+        contacts.push_back(contact);
+    }
+
+    annotationsFile.close();
+    return 0;
+}
+
+int FrameCorpus::writeAnnotationsToFile(std::string annotationsFilename, std::vector<std::string> &ids, CorpusAnnotations &annotations) {
+    std::ofstream annotationsFile(annotationsFilename);
+    if (!annotationsFile.is_open()) {
+        std::cout << "FrameCorpus: Could not write annotations." << std::endl;
+        return -1;
+    }
+
+    for (size_t i = 0; i < ids.size(); i++) {
+        std::vector<Coord3D> &contacts = annotations[ids[i]];
+        if (contacts.empty()) {
+            annotationsFile << ids[i] << " " << ANNOTATION_NONE << "\n";
+        }
+        for (size_t j = 0; j < contacts.size(); j++) {
+            annotationsFile << ids[i] << " " << contacts[j].x << " " << contacts[j].y << " " << contacts[j].z << "\n";
+        }
+    }
+
+    annotationsFile.close();
+    return 0;
+}
+
+} /* namespace virtualMonitor */
@@ -0,0 +1,88 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    FrameCorpus.h
+    Collects recorded depth frames and their reference frames for offline processing.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAMECORPUS_H
+#define FRAMECORPUS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "DepthBuffer.h"
+#include "DepthView.h"
+#include "Location.h"
+#include "Recording.h"
+
+namespace virtualMonitor {
+
+// A directory of .bin frames (with surface.bin as reference), or a recording (with its first frame as reference)
+struct CorpusSource {
+    std::string name;
+    std::string dir;
+    RecordingReader *recording;
+    DepthBuffer *referenceBuffer;
+};
+
+struct CorpusFrame {
+    std::string id;         // path of a .bin frame, or recording path and frame index ("session.vmrec#12")
+    int sourceIndex;
+    int frameIndex;         // index within the recording, or -1 for a .bin frame
+    std::string filename;   // full path of a .bin frame
+};
+
+// Annotations map frame IDs to contact locations (empty for frames without contacts)
+typedef std::map<std::string, std::vector<Coord3D> > CorpusAnnotations;
+
+class FrameCorpus {
+    private:
+        std::string rootPath;
+        std::vector<CorpusSource> sources;
+        std::vector<CorpusFrame> frames;
+
+    public:
+        FrameCorpus();
+        virtual ~FrameCorpus();
+
+        virtual int load(std::string path);
+        virtual int close();
+
+        virtual int getFrameCount() { return this->frames.size(); }
+        virtual int getSourceCount() { return this->sources.size(); }
+        virtual CorpusFrame &getFrame(int index) { return this->frames[index]; }
+        virtual CorpusSource &getSource(int sourceIndex) { return this->sources[sourceIndex]; }
+
+        virtual DepthBuffer *readFrame(int index);
+        virtual DepthView *getReferenceFrame(int sourceIndex);
+
+        static int readAnnotationsFromFile(std::string annotationsFilename, CorpusAnnotations &annotations, std::string idPrefix="");
+        static int writeAnnotationsToFile(std::string annotationsFilename, std::vector<std::string> &ids, CorpusAnnotations &annotations);
+
+    private:
+        virtual int addDirectory(std::string dir);
+        virtual int addRecording(std::string recordingFilename);
+        virtual std::string relativePath(std::string path);
+        virtual DepthBuffer *readDepthFrameFromFile(std::string depthFrameFilename);
+};
+
+} /* namespace virtualMonitor */
+
+#endif /* FRAMECORPUS_H */
@@ -22,10 +22,17 @@
 
 #include "InteractionDetector.h"
 
-#include <cstring>
 #include <unistd.h>
 #include <iostream>
 
+#include "LatencyStats.h"
+
+#define READER_TIMEOUT 10000
+// How old the reference gets before it is recaptured in the background, so the surface follows slow changes
+#define REFERENCE_RECAPTURE_INTERVAL_SECONDS 300
+// Consecutive frames without an interaction before one is taken as the new reference (about a second)
+#define REFERENCE_RECAPTURE_QUIET_FRAMES 30
+
 #define DEPTH_PPM_FILENAME "output-depth.ppm"
 #define INTERACTION_PPM_FILENAME "output-interaction.ppm"
 #define SURFACEDEPTH_PPM_FILENAME "output-surfacedepth.ppm"
@@ -35,21 +42,31 @@ namespace virtualMonitor {
 
 /*
  * Constructor for InteractionDetector
+ * Input: captureProfile is which Kinect frames to read, where detection only needs depth
  */
-InteractionDetector::InteractionDetector() {
-    this->reader = new KinectReader();
+InteractionDetector::InteractionDetector(CaptureProfile captureProfile) {
+    // Read the latest frames, so latency stays bounded when detection falls behind the Kinect
+    this->reader = new KinectReader(captureProfile, READER_TIMEOUT, true);
     this->physicalManager = new PhysicalManager();
-    this->referenceDepthFrame = NULL;
+    this->referenceDepthBuffer = NULL;
+    this->referenceUpdater = new ReferenceUpdater();
+    this->quietFrameCount = 0;
+    this->shouldRecaptureReference = false;
     this->virtualManager = new VirtualManager();
+    this->recorder = new RecordingWriter();
+    this->frameClock = new FrameClock();
 }
 
 /*
  * Deconstructor for InteractionDetector
  */
 InteractionDetector::~InteractionDetector() {
+    delete this->referenceUpdater;
     delete this->reader;
     delete this->physicalManager;
     delete this->virtualManager;
+    delete this->recorder;
+    delete this->frameClock;
 }
 
 /*
@@ -69,13 +86,53 @@ int InteractionDetector::start() {
         return -1;
     }
 
-    // Copy data to a new frame and save as a reference
-    size_t byteCount = frames->depth->width * frames->depth->height * frames->depth->bytes_per_pixel;
-    char *referenceDepthData = (char *)malloc(sizeof(char) * byteCount);
-    std::memcpy(referenceDepthData, frames->depth->data, byteCount);
-    this->referenceDepthFrame = new libfreenect2::Frame(frames->depth->width, frames->depth->height, frames->depth->bytes_per_pixel, (unsigned char *)referenceDepthData);
+    // Copy the reference, since it is held for the whole session and the Kinect only has a few frames to fill
+    if (frames->depth != NULL) {
+        DepthView referenceView = KinectReader::viewOfDepthFrame(frames->depth);
+        this->referenceDepthBuffer = DepthBufferPool::shared()->copy(&referenceView);
+    }
     this->reader->releaseFrames(frames);
-    this->physicalManager->setReferenceFrame(this->referenceDepthFrame);
+    if (this->referenceDepthBuffer == NULL) {
+        std::cout << "InteractionDetector: Could not copy reference frame." << std::endl;
+        return -1;
+    }
+    DepthView *referenceDepthFrame = this->referenceDepthBuffer->getView();
+
+    // With the camera's intrinsics, the surface is fitted as a plane, here and when the reference is recaptured,
+    // and interactions are undistorted before they are mapped
+    CameraIntrinsics cameraIntrinsics;
+    if (this->reader->getCameraIntrinsics(&cameraIntrinsics) < 0) {
+        std::cout << "InteractionDetector: No camera intrinsics, so the surface is fitted and interactions mapped without them." << std::endl;
+    }
+    this->physicalManager->setCameraIntrinsics(cameraIntrinsics);
+    this->referenceUpdater->setCameraIntrinsics(cameraIntrinsics);
+    this->virtualManager->setCameraIntrinsics(cameraIntrinsics);
+
+    // The reference frame starts the recording, as it does in FrameCorpus
+    if (this->recordingFilename.length() > 0) {
+        if (this->recorder->open(this->recordingFilename, referenceDepthFrame->width, referenceDepthFrame->height, cameraIntrinsics) == 0) {
+            this->recorder->writeFrame(referenceDepthFrame);
+        }
+    }
+
+    // Reuse the saved surface model if the surface has not moved, and otherwise fit the surface and save its model
+    std::chrono::steady_clock::time_point surfaceStart = std::chrono::steady_clock::now();
+    bool isWarmStart = this->surfaceModelFilename.length() > 0 &&
+        this->physicalManager->setReferenceFrameFromSurfaceModel(referenceDepthFrame, this->surfaceModelFilename) == 0;
+    if (!isWarmStart) {
+        this->physicalManager->setReferenceFrame(referenceDepthFrame);
+        if (this->surfaceModelFilename.length() > 0) {
+            this->physicalManager->writeSurfaceModel(this->surfaceModelFilename);
+        }
+    }
+    double surfaceMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - surfaceStart).count();
+    std::cout << "InteractionDetector: Surface " << (isWarmStart ? "model reused (warm start)" : "fitted (cold start)")
+              << " in " << surfaceMilliseconds << " ms." << std::endl;
+    this->referenceTime = std::chrono::steady_clock::now();
+    this->quietFrameCount = 0;
+    this->shouldRecaptureReference = false;
+    this->referenceUpdater->start();
+    this->frameClock->reset();
 
     return 0;
 }
@@ -87,49 +144,171 @@ int InteractionDetector::start() {
  * Output: pointer to an Interaction (NULL if no interaction occurred)
  */
 Interaction *InteractionDetector::detectInteraction(bool isCalibrating, bool shouldOutputPPMData) {
+    LATENCY_SPAN_BEGIN(captureSpan);
     KinectReaderFrames *frames = this->reader->readFrames();
+    LATENCY_SPAN_END(captureSpan, LatencyStageCapture);
     // Check for issues reading frames
     if (frames == NULL) {
         std::cout << "VirtualMonitor: Could not read frames." << std::endl;
         return NULL;
     }
 
+    // Hold the depth frame and return the rest to the Kinect
+    DepthBuffer *depthBuffer = this->reader->takeDepthBuffer(frames);
+    this->reader->releaseFrames(frames);
+    DepthView *depthFrame = depthBuffer->getView();
+
+    // Estimate when the Kinect captured the frame, so handlers can measure latency from touch to cursor
+    this->frameClock->observeFrame(depthFrame->timestamp, std::chrono::steady_clock::now());
+    this->lastFrameTime = this->frameClock->hostTimeForFrame(depthFrame->timestamp);
+
     std::string interactionPPMFilename = "";
     if (shouldOutputPPMData) {
         interactionPPMFilename = INTERACTION_PPM_FILENAME;
     }
 
+    Interaction *interaction = this->detectInteractionInBuffer(depthBuffer, isCalibrating, interactionPPMFilename);
+
+    // If option set to output physical depth PPM data, visualize that data
+    if (shouldOutputPPMData) {
+        this->physicalManager->writeDepthFrameToPPM(depthFrame, DEPTH_PPM_FILENAME);
+        this->physicalManager->writeDepthFrameToSurfaceDepthPPM(depthFrame, SURFACEDEPTH_PPM_FILENAME);
+        this->physicalManager->writeDepthFrameToSurfaceSlopePPM(depthFrame, SURFACESLOPE_PPM_FILENAME);
+    }
+
+    if (this->recorder->isOpen()) {
+        this->recorder->writeFrame(depthFrame);
+    }
+
+    // The reference holds its own buffer, so a released frame is never mistaken for the reference
+    depthBuffer->release();
+
+    return interaction;
+}
+
+/*
+ * Gets depth frame from Kinect and holds it, so the Kinect's other frames are released before detection
+ * Used by the capture stage of InteractionPipeline, which calls getLastFrameTime() for the frame's capture time
+ * Input: depthBuffer is set to the held frame, after releasing the frame it held before (if any)
+ * Output: 0 on success, -1 on failure
+ */
+int InteractionDetector::captureFrame(DepthBuffer **depthBuffer) {
+    // Return the old frame first, so the Kinect can fill it while this one is read
+    if (*depthBuffer != NULL) {
+        (*depthBuffer)->release();
+        *depthBuffer = NULL;
+    }
+
+    LATENCY_SPAN_BEGIN(captureSpan);
+    KinectReaderFrames *frames = this->reader->readFrames();
+    LATENCY_SPAN_END(captureSpan, LatencyStageCapture);
+    if (frames == NULL) {
+        std::cout << "InteractionDetector: Could not read frames." << std::endl;
+        return -1;
+    }
+
+    *depthBuffer = this->reader->takeDepthBuffer(frames);
+    this->reader->releaseFrames(frames);
+    DepthView *depthFrame = (*depthBuffer)->getView();
+
+    this->frameClock->observeFrame(depthFrame->timestamp, std::chrono::steady_clock::now());
+    this->lastFrameTime = this->frameClock->hostTimeForFrame(depthFrame->timestamp);
+
+    if (this->recorder->isOpen()) {
+        this->recorder->writeFrame(depthFrame);
+    }
+
+    return 0;
+}
+
+/*
+ * Determines whether an interaction occurred in a depth frame, and maps it to virtual coordinates
+ * Input: isCalibrating is whether we are in calibration mode and should not use VirtualManager
+ *          interactionPPMFilename is where to visualize the interaction, if not empty
+ * Output: pointer to an Interaction (NULL if no interaction occurred)
+ */
+Interaction *InteractionDetector::detectInteractionInFrame(DepthView *depthFrame, bool isCalibrating, std::string interactionPPMFilename) {
     // Call PhysicalManager to check for an interaction and update physicalLocation coordiantes
-    Interaction *interaction = this->physicalManager->detectInteraction(frames->depth, interactionPPMFilename);
+    LATENCY_SPAN_BEGIN(classifySpan);
+    Interaction *interaction = this->physicalManager->detectInteraction(depthFrame, interactionPPMFilename);
+    LATENCY_SPAN_END(classifySpan, LatencyStageClassify);
+#if defined(VIRTUALMONITOR_LATENCY_STATS) || defined(VIRTUALMONITOR_TRACE)
+    std::chrono::steady_clock::time_point labelStart;
+    std::chrono::steady_clock::time_point labelEnd;
+    if (this->physicalManager->getLabelSpan(&labelStart, &labelEnd)) {
+        LATENCY_SPAN_RECORD(labelStart, labelEnd, LatencyStageLabel);
+    }
+#endif
 
     if (!isCalibrating && interaction != NULL) {
+        LATENCY_SPAN_BEGIN(mapSpan);
         this->virtualManager->setVirtualCoord(interaction);
+        LATENCY_SPAN_END(mapSpan, LatencyStageMap);
         std::cout << "VIRTUAL COORDINATE: (" << interaction->virtualLocation->x << ", " << interaction->virtualLocation->y << ")\n";
     }
 
-    // If option set to output physical depth PPM data, visualize that data
-    if (shouldOutputPPMData) {
-        this->physicalManager->writeDepthFrameToPPM(frames->depth, DEPTH_PPM_FILENAME);
-        this->physicalManager->writeDepthFrameToSurfaceDepthPPM(frames->depth, SURFACEDEPTH_PPM_FILENAME);
-        this->physicalManager->writeDepthFrameToSurfaceSlopePPM(frames->depth, SURFACESLOPE_PPM_FILENAME);
+    return interaction;
+}
+
+/*
+ * Determines whether an interaction occurred in a held depth frame, as detectInteractionInFrame() does,
+ * and keeps the reference current without holding up detection
+ * The surface follows slow drift on frames without an interaction, and a reference recaptured in the background is swapped in
+ * before detecting. Once the reference is old (or recaptureReference() was called), this frame is handed to the background
+ * after a stretch without interactions
+ * Input: depthBuffer is copied if it becomes the new reference
+ * Output: pointer to an Interaction (NULL if no interaction occurred)
+ */
+Interaction *InteractionDetector::detectInteractionInBuffer(DepthBuffer *depthBuffer, bool isCalibrating, std::string interactionPPMFilename) {
+    if (this->referenceUpdater->swapReference(&this->physicalManager, &this->referenceDepthBuffer)) {
+        this->referenceTime = std::chrono::steady_clock::now();
+        std::cout << "InteractionDetector: Reference recaptured." << std::endl;
     }
 
-    // If current frame is the reference frame, a new reference is needed
-    if (frames->depth == this->physicalManager->getReferenceFrame()) {
-        this->physicalManager->setReferenceFrame(NULL);
+    Interaction *interaction = this->detectInteractionInFrame(depthBuffer->getView(), isCalibrating, interactionPPMFilename);
+
+    // Between recaptures, frames without an interaction keep the surface fitted to slow drift
+    if (interaction == NULL) {
+        this->physicalManager->compensateDrift(depthBuffer->getView());
+    }
+
+    this->quietFrameCount = (interaction == NULL) ? this->quietFrameCount + 1 : 0;
+    bool isReferenceOld = std::chrono::steady_clock::now() - this->referenceTime > std::chrono::seconds(REFERENCE_RECAPTURE_INTERVAL_SECONDS);
+    if ((isReferenceOld || this->shouldRecaptureReference) && this->quietFrameCount >= REFERENCE_RECAPTURE_QUIET_FRAMES &&
+        this->referenceDepthBuffer != NULL && !this->referenceUpdater->isBusy()) {
+        // Copy the frame, since the new reference is held for a long time and this one may be the Kinect's own
+        DepthBuffer *referenceCopy = DepthBufferPool::shared()->copy(depthBuffer->getView());
+        if (referenceCopy != NULL &&
+            this->referenceUpdater->requestUpdate(referenceCopy, this->physicalManager->getDetectionParameters(), this->surfaceModelFilename)) {
+            // The interval restarts from the request, so a failed recapture is retried later rather than every frame
+            this->referenceTime = std::chrono::steady_clock::now();
+            this->shouldRecaptureReference = false;
+        }
+        if (referenceCopy != NULL) {
+            referenceCopy->release();
+        }
     }
-    this->reader->releaseFrames(frames);
 
     return interaction;
 }
 
 int InteractionDetector::stop() {
     this->reader->stop();
-
-    // Free the reference frames set in this->start()
-    delete[] this->referenceDepthFrame->data;
-    delete this->referenceDepthFrame;
-    this->referenceDepthFrame = NULL;
+    std::cout << "InteractionDetector: " << this->reader->getSkippedFrameCount() << " frames skipped for newer frames, "
+              << this->reader->getMissingFrameCount() << " missing from the sequence (largest gap "
+              << this->reader->getLargestSequenceGap() << "), frame pool exhausted "
+              << this->reader->getFramePoolExhaustedCount() << " times." << std::endl;
+    this->recorder->close();
+
+    // Stop recapturing, freeing a reference that was recaptured but not swapped in
+    this->referenceUpdater->stop();
+
+    // Release the reference frame held since this->start()
+    this->physicalManager->setReferenceFrame(NULL);
+    if (this->referenceDepthBuffer != NULL) {
+        this->referenceDepthBuffer->release();
+        this->referenceDepthBuffer = NULL;
+    }
 
     return 0;
 }
@@ -146,12 +325,23 @@ Interaction *InteractionDetector::testDetectInteraction(bool shouldOutputPPMData
     }
 
     std::string referenceFrameFilename = "inputs/surface.bin";
-    libfreenect2::Frame *referenceFrame = this->physicalManager->readDepthFrameFromFile(referenceFrameFilename);
+    DepthBuffer *referenceBuffer = this->physicalManager->readDepthFrameFromFile(referenceFrameFilename);
+    std::string depthFrameFilename = "inputs/nointeraction1.bin";
+    DepthBuffer *depthBuffer = this->physicalManager->readDepthFrameFromFile(depthFrameFilename);
+    if (referenceBuffer == NULL || depthBuffer == NULL) {
+        if (referenceBuffer != NULL) {
+            referenceBuffer->release();
+        }
+        if (depthBuffer != NULL) {
+            depthBuffer->release();
+        }
+        return NULL;
+    }
+
     std::cout << "InteractionDetector: Setting test reference frame..." << std::endl;
-    this->physicalManager->setReferenceFrame(referenceFrame);
+    this->physicalManager->setReferenceFrame(referenceBuffer->getView());
 
-    std::string depthFrameFilename = "inputs/nointeraction1.bin";
-    libfreenect2::Frame *depthFrame = this->physicalManager->readDepthFrameFromFile(depthFrameFilename);
+    DepthView *depthFrame = depthBuffer->getView();
     std::cout << "InteractionDetector: Detecting test interaction..." << std::endl;
     Interaction *interaction = this->physicalManager->detectInteraction(depthFrame, interactionPPMFilename);
     
@@ -167,11 +357,9 @@ Interaction *InteractionDetector::testDetectInteraction(bool shouldOutputPPMData
         this->physicalManager->writeDepthFrameToSurfaceSlopePPM(depthFrame, SURFACESLOPE_PPM_FILENAME);
     }
 
-    free(depthFrame->data);
-    delete depthFrame;
-
-    free(referenceFrame->data);
-    delete referenceFrame;
+    this->physicalManager->setReferenceFrame(NULL);
+    depthBuffer->release();
+    referenceBuffer->release();
 
     return interaction;
 }
@@ -203,4 +391,39 @@ void InteractionDetector::setCalibrationPoints(int rows, int cols, Coord3D **cal
     this->virtualManager->setCalibrationPoints(rows, cols, calibrationCoordsPhysical, calibrationCoordsVirtual);
 }
 
+int InteractionDetector::writeCalibrationProfile(std::string profileFilename, uint64_t calibrationHash, Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual) {
+    return this->virtualManager->writeCalibrationProfile(profileFilename, calibrationHash, calibrationCoordsPhysical, calibrationCoordsVirtual);
+}
+
+/*
+ * Restores the calibration points and screen size, in place of setCalibrationPoints() and setScreenVirtual()
+ * Input: calibrationHash is the hash the profile was written with for the calibration it should be for
+ * Output: 0 on success, -1 if the profile cannot be used, leaving the calibration unchanged
+ */
+int InteractionDetector::readCalibrationProfile(std::string profileFilename, int rows, int cols, int screenHeight, int screenWidth, uint64_t calibrationHash,
+                                                Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual) {
+    return this->virtualManager->readCalibrationProfile(profileFilename, rows, cols, screenHeight, screenWidth, calibrationHash,
+                                                        calibrationCoordsPhysical, calibrationCoordsVirtual);
+}
+
+/*
+ * Sets detection thresholds, such as values chosen with the threshold sweep
+ * Thresholds that fit the surface take effect at the next start()
+ */
+void InteractionDetector::setDetectionParameters(DetectionParameters parameters) {
+    this->physicalManager->setDetectionParameters(parameters);
+}
+
+/*
+ * Records the depth frames read between start() and stop() to recordingFilename
+ */
+void InteractionDetector::startRecording(std::string recordingFilename) {
+    this->recordingFilename = recordingFilename;
+}
+
+void InteractionDetector::stopRecording() {
+    this->recordingFilename = "";
+    this->recorder->close();
+}
+
 } /* namespace virtualMonitor */
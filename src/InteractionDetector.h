@@ -23,31 +23,60 @@
 #ifndef INTERACTIONDETECTOR_H
 #define INTERACTIONDETECTOR_H
 
+#include <atomic>
+#include <chrono>
+
+#include "DepthBuffer.h"
+#include "FrameClock.h"
 #include "KinectReader.h"
 #include "Interaction.h"
 #include "PhysicalManager.h"
+#include "Recording.h"
+#include "ReferenceUpdater.h"
 #include "VirtualManager.h"
 
 namespace virtualMonitor {
 
 class InteractionDetector {
     public:
-        InteractionDetector();
+        InteractionDetector(CaptureProfile captureProfile=CaptureProfileDepth);
         virtual ~InteractionDetector();
 
         virtual int start();
         virtual Interaction *detectInteraction(bool isCalibrating=false, bool shouldOutputPPMData=false);
         virtual int stop();
+        virtual int captureFrame(DepthBuffer **depthBuffer);
+        virtual Interaction *detectInteractionInFrame(DepthView *depthFrame, bool isCalibrating=false, std::string interactionPPMFilename="");
+        virtual Interaction *detectInteractionInBuffer(DepthBuffer *depthBuffer, bool isCalibrating=false, std::string interactionPPMFilename="");
+        virtual void recaptureReference() { this->shouldRecaptureReference = true; }
+        virtual uint64_t getReferenceUpdateCount() { return this->referenceUpdater->getPublishedCount(); }
         virtual Interaction *testDetectInteraction(bool shouldOutputPPMData=false);
         virtual int freeInteraction(Interaction *interaction);
         virtual void setScreenVirtual(int screenHeight, int screenWidth);
         virtual void setCalibrationPoints(int rows, int cols, Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual);
+        virtual int writeCalibrationProfile(std::string profileFilename, uint64_t calibrationHash, Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual);
+        virtual int readCalibrationProfile(std::string profileFilename, int rows, int cols, int screenHeight, int screenWidth, uint64_t calibrationHash,
+                                           Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual);
+        virtual void setDetectionParameters(DetectionParameters parameters);
+        virtual void startRecording(std::string recordingFilename);
+        virtual void stopRecording();
+        virtual void setSurfaceModelFilename(std::string surfaceModelFilename) { this->surfaceModelFilename = surfaceModelFilename; }
+        virtual std::chrono::steady_clock::time_point getLastFrameTime() { return this->lastFrameTime; }
 
     private:
         KinectReader *reader;
         PhysicalManager *physicalManager;
-        libfreenect2::Frame *referenceDepthFrame;
+        DepthBuffer *referenceDepthBuffer;
+        ReferenceUpdater *referenceUpdater;
+        std::chrono::steady_clock::time_point referenceTime;
+        int quietFrameCount;                        // consecutive frames without an interaction
+        std::atomic<bool> shouldRecaptureReference;
         VirtualManager *virtualManager;
+        RecordingWriter *recorder;
+        std::string recordingFilename;
+        std::string surfaceModelFilename;
+        FrameClock *frameClock;
+        std::chrono::steady_clock::time_point lastFrameTime;
 };
 
 } /* namespace virtualMonitor */
@@ -23,6 +23,7 @@
 #include "InteractionHandler.h"
 
 #include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <limits>
 
@@ -88,9 +89,12 @@ InteractionHandler::~InteractionHandler() {
 /*
  * Determines whether an interaction has occurred and if so what type it is
  * Input: interaction data
+ *        frameTime is the host time the interaction's frame was captured, if known
  * Output: 
  */
-bool InteractionHandler::handleInteraction(Interaction *interaction) {
+bool InteractionHandler::handleInteraction(Interaction *interaction, std::chrono::steady_clock::time_point frameTime) {
+    this->frameTime = frameTime;
+
     // Coordinates for a real interaction provided
     bool isInteraction = (interaction != NULL &&
                           interaction->virtualLocation->x >= 0 &&
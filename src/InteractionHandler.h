@@ -25,6 +25,7 @@
 
 #include "Interaction.h"
 
+#include <chrono>
 #include <sys/time.h>
 #include <time.h>
 #include <iostream>
@@ -55,12 +56,13 @@ protected:
     uint32_t firstTimestamp;
     Coord2D *lastLocation;
     uint32_t lastTimestamp;
+    std::chrono::steady_clock::time_point frameTime;
 private:
     HysteresisCounter *interactionCounter;
 public:
     InteractionHandler();
     virtual ~InteractionHandler();
-    virtual bool handleInteraction(Interaction *interaction);
+    virtual bool handleInteraction(Interaction *interaction, std::chrono::steady_clock::time_point frameTime=std::chrono::steady_clock::time_point());
     virtual void writeTapLocation(int xpos, int ypos);
 private:
     virtual int handleInteractionStartEvent();
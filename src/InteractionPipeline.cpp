@@ -0,0 +1,183 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    InteractionPipeline.cpp
+    Runs capture, detection, and interaction handling on separate threads.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "InteractionPipeline.h"
+
+#include <iomanip>
+#include <thread>
+
+#include "LatencyStats.h"
+
+namespace virtualMonitor {
+
+// Keep only the newest frames, since a stale frame is worth less than a fresh one
+#define CAPTURE_QUEUE_CAPACITY_DEFAULT 2
+// Never drop detection results, since the interaction handler counts consecutive frames to start and stop interactions
+#define DISPATCH_QUEUE_CAPACITY_DEFAULT 8
+
+PipelineParameters::PipelineParameters() {
+    this->captureQueueCapacity = CAPTURE_QUEUE_CAPACITY_DEFAULT;
+    this->captureOverflowPolicy = OverflowDropOldest;
+    this->dispatchQueueCapacity = DISPATCH_QUEUE_CAPACITY_DEFAULT;
+    this->dispatchOverflowPolicy = OverflowBlock;
+}
+
+CapturedFrame::CapturedFrame() {
+    this->depthBuffer = NULL;
+    this->frameIndex = -1;
+}
+
+CapturedFrame::~CapturedFrame() {
+    // Only set for frames still queued when the pipeline is destroyed
+    if (this->depthBuffer != NULL) {
+        this->depthBuffer->release();
+    }
+}
+
+DetectedInteraction::DetectedInteraction() {
+    this->isInteraction = false;
+    this->interaction.physicalLocation = &this->physicalLocation;
+    this->interaction.virtualLocation = &this->virtualLocation;
+    this->frameIndex = -1;
+}
+
+InteractionPipeline::InteractionPipeline(InteractionDetector *detector, InteractionHandler *handler, PipelineParameters parameters) {
+    this->detector = detector;
+    this->handler = handler;
+    this->parameters = parameters;
+    this->captureQueue = new StageQueue<CapturedFrame>(parameters.captureQueueCapacity, parameters.captureOverflowPolicy);
+    // A dropped frame goes back to the Kinect now, rather than when its slot is next captured into
+    this->captureQueue->setDropHandler([](CapturedFrame *frame) {
+        frame->depthBuffer->release();
+        frame->depthBuffer = NULL;
+    });
+    this->dispatchQueue = new StageQueue<DetectedInteraction>(parameters.dispatchQueueCapacity, parameters.dispatchOverflowPolicy);
+    this->captureFailureCount = 0;
+}
+
+InteractionPipeline::~InteractionPipeline() {
+    delete this->captureQueue;
+    delete this->dispatchQueue;
+}
+
+/*
+ * Runs capture on the calling thread, with detection and dispatch on their own threads, until shouldCancel is set
+ * Frames already captured are still detected and dispatched before returning
+ * Input: frameCountMax stops after that many frames (-1 for no limit)
+ */
+void InteractionPipeline::run(std::atomic<bool> *shouldCancel, int64_t frameCountMax) {
+    std::thread detectionThread(&InteractionPipeline::detectionThreadFn, this);
+    std::thread dispatchThread(&InteractionPipeline::dispatchThreadFn, this);
+
+    this->captureThreadFn(shouldCancel, frameCountMax);
+
+    detectionThread.join();
+    dispatchThread.join();
+}
+
+/*
+ * Writes each queue's capacity, overflow policy, items queued and dropped, and deepest backlog
+ */
+void InteractionPipeline::writeReport(std::ostream &stream) {
+    stream << std::left << std::setw(10) << "queue" << std::setw(13) << "policy" << std::right << std::setw(10) << "capacity"
+           << std::setw(10) << "queued" << std::setw(10) << "dropped" << std::setw(10) << "max depth" << std::endl;
+    stream << std::left << std::setw(10) << "capture" << std::setw(13) << overflowPolicyName(this->captureQueue->getPolicy()) << std::right
+           << std::setw(10) << this->captureQueue->getCapacity() << std::setw(10) << this->captureQueue->getPublishedCount()
+           << std::setw(10) << this->captureQueue->getDroppedCount() << std::setw(10) << this->captureQueue->getMaxDepth() << std::endl;
+    stream << std::left << std::setw(10) << "dispatch" << std::setw(13) << overflowPolicyName(this->dispatchQueue->getPolicy()) << std::right
+           << std::setw(10) << this->dispatchQueue->getCapacity() << std::setw(10) << this->dispatchQueue->getPublishedCount()
+           << std::setw(10) << this->dispatchQueue->getDroppedCount() << std::setw(10) << this->dispatchQueue->getMaxDepth() << std::endl;
+    stream << "failed captures: " << this->captureFailureCount.load(std::memory_order_relaxed) << std::endl;
+}
+
+void InteractionPipeline::captureThreadFn(std::atomic<bool> *shouldCancel, int64_t frameCountMax) {
+#ifdef VIRTUALMONITOR_TRACE
+    Tracer::shared()->setThreadName("capture");
+#endif
+    // A slot is kept after a failed read, since only the detection thread returns slots
+    CapturedFrame *frame = NULL;
+    for (int64_t frameIndex = 0; !*shouldCancel && (frameCountMax < 0 || frameIndex < frameCountMax); frameIndex++) {
+        TRACE_FRAME(frameIndex);
+        std::chrono::steady_clock::time_point captureStartTime = std::chrono::steady_clock::now();
+
+        if (frame == NULL) {
+            frame = this->captureQueue->acquireSlot();
+        }
+        if (this->detector->captureFrame(&frame->depthBuffer) < 0) {
+            this->captureFailureCount.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        frame->frameIndex = frameIndex;
+        frame->captureStartTime = captureStartTime;
+        frame->frameTime = this->detector->getLastFrameTime();
+        this->captureQueue->publish(frame);
+        frame = NULL;
+    }
+    this->captureQueue->close();
+}
+
+void InteractionPipeline::detectionThreadFn() {
+#ifdef VIRTUALMONITOR_TRACE
+    Tracer::shared()->setThreadName("detection");
+#endif
+    for (CapturedFrame *frame = this->captureQueue->consume(); frame != NULL; frame = this->captureQueue->consume()) {
+        TRACE_FRAME(frame->frameIndex);
+        Interaction *interaction = this->detector->detectInteractionInBuffer(frame->depthBuffer);
+        frame->depthBuffer->release();
+        frame->depthBuffer = NULL;
+
+        DetectedInteraction *detected = this->dispatchQueue->acquireSlot();
+        detected->isInteraction = (interaction != NULL);
+        if (interaction != NULL) {
+            detected->interaction.type = interaction->type;
+            detected->interaction.time = interaction->time;
+            detected->interaction.surfaceRegressionA = interaction->surfaceRegressionA;
+            detected->interaction.surfaceRegressionB = interaction->surfaceRegressionB;
+            detected->physicalLocation = *interaction->physicalLocation;
+            detected->virtualLocation = *interaction->virtualLocation;
+        }
+        detected->frameIndex = frame->frameIndex;
+        detected->captureStartTime = frame->captureStartTime;
+        detected->frameTime = frame->frameTime;
+        this->dispatchQueue->publish(detected);
+
+        this->detector->freeInteraction(interaction);
+        this->captureQueue->release(frame);
+    }
+    this->dispatchQueue->close();
+}
+
+void InteractionPipeline::dispatchThreadFn() {
+#ifdef VIRTUALMONITOR_TRACE
+    Tracer::shared()->setThreadName("dispatch");
+#endif
+    for (DetectedInteraction *detected = this->dispatchQueue->consume(); detected != NULL; detected = this->dispatchQueue->consume()) {
+        TRACE_FRAME(detected->frameIndex);
+        LATENCY_SPAN_BEGIN(handleSpan);
+        this->handler->handleInteraction(detected->isInteraction ? &detected->interaction : NULL, detected->frameTime);
+        LATENCY_SPAN_END(handleSpan, LatencyStageHandle);
+        LATENCY_SPAN_END(detected->captureStartTime, LatencyStageFrame);
+        this->dispatchQueue->release(detected);
+    }
+}
+
+} /* namespace virtualMonitor */
@@ -0,0 +1,99 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    InteractionPipeline.h
+    Runs capture, detection, and interaction handling on separate threads.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INTERACTIONPIPELINE_H
+#define INTERACTIONPIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+#include "DepthBuffer.h"
+#include "InteractionDetector.h"
+#include "InteractionHandler.h"
+#include "StageQueue.h"
+
+namespace virtualMonitor {
+
+struct PipelineParameters {
+    // Frames waiting between capture and detection
+    int captureQueueCapacity;
+    OverflowPolicy captureOverflowPolicy;
+    // Detection results waiting between detection and interaction handling
+    int dispatchQueueCapacity;
+    OverflowPolicy dispatchOverflowPolicy;
+
+    PipelineParameters();
+};
+
+struct CapturedFrame {
+    DepthBuffer *depthBuffer;
+    int64_t frameIndex;
+    std::chrono::steady_clock::time_point captureStartTime;
+    std::chrono::steady_clock::time_point frameTime;
+
+    CapturedFrame();
+    ~CapturedFrame();
+};
+
+struct DetectedInteraction {
+    bool isInteraction;
+    Interaction interaction;
+    Coord3D physicalLocation;
+    Coord2D virtualLocation;
+    int64_t frameIndex;
+    std::chrono::steady_clock::time_point captureStartTime;
+    std::chrono::steady_clock::time_point frameTime;
+
+    DetectedInteraction();
+};
+
+/*
+ * Capture reads and holds Kinect frames, detection finds interactions and maps them to virtual coordinates,
+ * and dispatch passes them to the interaction handler, so a slow mouse event never holds up reading frames
+ */
+class InteractionPipeline {
+    private:
+        InteractionDetector *detector;
+        InteractionHandler *handler;
+        PipelineParameters parameters;
+        StageQueue<CapturedFrame> *captureQueue;
+        StageQueue<DetectedInteraction> *dispatchQueue;
+        std::atomic<uint64_t> captureFailureCount;
+
+    public:
+        InteractionPipeline(InteractionDetector *detector, InteractionHandler *handler, PipelineParameters parameters=PipelineParameters());
+        virtual ~InteractionPipeline();
+
+        virtual void run(std::atomic<bool> *shouldCancel, int64_t frameCountMax=-1);
+        virtual void writeReport(std::ostream &stream);
+
+    private:
+        virtual void captureThreadFn(std::atomic<bool> *shouldCancel, int64_t frameCountMax);
+        virtual void detectionThreadFn();
+        virtual void dispatchThreadFn();
+};
+
+} /* namespace virtualMonitor */
+
+#endif /* INTERACTIONPIPELINE_H */
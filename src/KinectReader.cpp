@@ -22,7 +22,10 @@
 
 #include "KinectReader.h"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <string>
 
 #include <libfreenect2/logger.h>
 
@@ -31,46 +34,122 @@
 #define LIBFREENECT_FRAME_DEPTH libfreenect2::Frame::Depth
 #define LIBFREENECT_FRAME_INFRARED libfreenect2::Frame::Ir
 
+// Registered color is in depth resolution
+#define REGISTRATION_WIDTH 512
+#define REGISTRATION_HEIGHT 424
+#define REGISTRATION_BYTES_PER_PIXEL 4
+
+// Frames discarded after starting the streams, while the Kinect's exposure and depth settle
+#define WARMUP_FRAME_COUNT 10
+
+// Enough for a reader that releases each set of frames before reading the next, plus one held by another thread
+#define FRAME_POOL_SIZE_DEFAULT 2
+
 namespace virtualMonitor {
 
-KinectReader::KinectReader(bool readColor, bool readDepthAndInfrared, bool readColorDepth, int timeout) {
-    this->readColor = readColor;
-    this->readDepthAndInfrared = readDepthAndInfrared;
-    this->readColorDepth = readColorDepth;
-    this->timeout = timeout;
+LatestFrameListener::LatestFrameListener(unsigned int frameTypes) {
+    this->frameTypes = frameTypes;
+    this->hasLatestFrames = false;
+    this->skippedFrameCount = 0;
+}
 
-    // device is allocated in open()
-    this->device = NULL;
+LatestFrameListener::~LatestFrameListener() {
+    this->deleteFrames(this->pendingFrames);
+    this->deleteFrames(this->latestFrames);
+}
 
-    // Determine frame types
-    int frameTypes = LIBFREENECT_FRAME_NONE;
-    if (this->readColor || this->readColorDepth) {
-        frameTypes |= LIBFREENECT_FRAME_COLOR;
+/*
+ * Called by libfreenect2 on its own threads, taking ownership of each frame
+ * Once a frame of every type has arrived, the set replaces any set that has not been read yet
+ */
+bool LatestFrameListener::onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame) {
+    // Leave frames nobody reads to the source, as SyncMultiFrameListener does
+    if ((type & this->frameTypes) == 0) {
+        return false;
     }
-    if (this->readDepthAndInfrared || this->readColorDepth) {
-        frameTypes |= (LIBFREENECT_FRAME_DEPTH | LIBFREENECT_FRAME_INFRARED);
+    std::lock_guard<std::mutex> lock(this->mutex);
+    libfreenect2::FrameMap::iterator pendingFrame = this->pendingFrames.find(type);
+    if (pendingFrame != this->pendingFrames.end()) {
+        delete pendingFrame->second;
+    }
+    this->pendingFrames[type] = frame;
+
+    unsigned int pendingFrameTypes = 0;
+    for (libfreenect2::FrameMap::iterator it = this->pendingFrames.begin(); it != this->pendingFrames.end(); it++) {
+        pendingFrameTypes |= it->first;
+    }
+    if ((pendingFrameTypes & this->frameTypes) != this->frameTypes) {
+        return true;
     }
 
-    this->listener = new libfreenect2::SyncMultiFrameListener(frameTypes);
+    if (this->hasLatestFrames) {
+        this->deleteFrames(this->latestFrames);
+        this->skippedFrameCount++;
+    }
+    this->latestFrames.swap(this->pendingFrames);
+    this->pendingFrames.clear();
+    this->hasLatestFrames = true;
+    this->newFrameCondition.notify_one();
+    return true;
+}
+
+/*
+ * Input: timeout in milliseconds
+ * Output: true with the newest set of frames, which must be passed to release(), or false on timeout
+ */
+bool LatestFrameListener::waitForNewFrame(libfreenect2::FrameMap &frames, int timeout) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (!this->newFrameCondition.wait_for(lock, std::chrono::milliseconds(timeout), [this]() { return this->hasLatestFrames; })) {
+        return false;
+    }
+    frames.swap(this->latestFrames);
+    this->latestFrames.clear();
+    this->hasLatestFrames = false;
+    return true;
+}
+
+void LatestFrameListener::release(libfreenect2::FrameMap &frames) {
+    this->deleteFrames(frames);
+}
+
+/*
+ * Deletes any frames not read yet, so none from before the streams stopped are read after they restart
+ */
+void LatestFrameListener::clear() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->deleteFrames(this->pendingFrames);
+    this->deleteFrames(this->latestFrames);
+    this->hasLatestFrames = false;
+}
+
+uint64_t LatestFrameListener::getSkippedFrameCount() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->skippedFrameCount;
+}
 
+void LatestFrameListener::deleteFrames(libfreenect2::FrameMap &frames) {
+    for (libfreenect2::FrameMap::iterator it = frames.begin(); it != frames.end(); it++) {
+        delete it->second;
+    }
+    frames.clear();
+}
+
+Freenect2FrameSource::Freenect2FrameSource() {
+    // device and pipeline are allocated in open()
+    this->device = NULL;
+    this->pipeline = NULL;
     // registation is allocated in start()
     this->registration = NULL;
 
     // Disable libfreenect logging for now
     libfreenect2::setGlobalLogger(NULL);
-
-    // Open and connect to the Kinect
-    this->open();
 }
 
-KinectReader::~KinectReader() {
-    // Close and disconnect from the Kinect
+Freenect2FrameSource::~Freenect2FrameSource() {
     this->close();
-
-    delete this->listener;
 }
 
-int KinectReader::open() {
+int Freenect2FrameSource::open(libfreenect2::FrameListener *listener) {
     if(this->freenect.enumerateDevices() == 0) {
         std::cout << "KinectReader: No device connected." << std::endl;
         return -1;
@@ -85,15 +164,17 @@ int KinectReader::open() {
         return -1;
     }
 
-    this->device->setColorFrameListener(this->listener);
-    this->device->setIrAndDepthFrameListener(this->listener);
+    this->device->setColorFrameListener(listener);
+    this->device->setIrAndDepthFrameListener(listener);
 
     return 0;
 }
 
-int KinectReader::start() {
-    // Start device
-    if (!this->device->start()) {
+/*
+ * Streams that are not started are never decoded, which saves decoding color when it is not read
+ */
+int Freenect2FrameSource::start(bool streamColor, bool streamDepth) {
+    if (!this->device->startStreams(streamColor, streamDepth)) {
         std::cout << "KinectReader: Cannot start device." << std::endl;
         return -1;
     }
@@ -103,82 +184,459 @@ int KinectReader::start() {
     return 0;
 }
 
-KinectReaderFrames *KinectReader::readFrames() {
+/*
+ * Output: 0 with the depth camera's intrinsics, as the device reports them once streaming, or -1 without a device
+ */
+int Freenect2FrameSource::getCameraIntrinsics(CameraIntrinsics *cameraIntrinsics) {
     if (this->device == NULL) {
+        return -1;
+    }
+    libfreenect2::Freenect2Device::IrCameraParams params = this->device->getIrCameraParams();
+    cameraIntrinsics->fx = params.fx;
+    cameraIntrinsics->fy = params.fy;
+    cameraIntrinsics->cx = params.cx;
+    cameraIntrinsics->cy = params.cy;
+    cameraIntrinsics->k1 = params.k1;
+    cameraIntrinsics->k2 = params.k2;
+    cameraIntrinsics->k3 = params.k3;
+    cameraIntrinsics->p1 = params.p1;
+    cameraIntrinsics->p2 = params.p2;
+    return cameraIntrinsics->isValid() ? 0 : -1;
+}
+
+int Freenect2FrameSource::stop() {
+    if (this->registration != NULL) {
+        delete this->registration;
+        this->registration = NULL;
+    }
+
+    if (this->device != NULL) {
+        this->device->stop();
+    }
+    return 0;
+}
+
+int Freenect2FrameSource::close() {
+    if (this->device != NULL) {
+        this->device->close();
+        delete this->device;
+        this->device = NULL;
+    }
+    if (this->pipeline != NULL) {
+        delete this->pipeline;
+        this->pipeline = NULL;
+    }
+    return 0;
+}
+
+void Freenect2FrameSource::registerColorDepth(libfreenect2::Frame *color, libfreenect2::Frame *depth,
+                                              libfreenect2::Frame *colorDepthUndistorted, libfreenect2::Frame *colorDepthRegistered) {
+    this->registration->apply(color, depth, colorDepthUndistorted, colorDepthRegistered);
+}
+
+/*
+ * Input: readLatestFrame is whether readFrames() skips to the newest frames when it falls behind,
+ *          rather than returning each frame in order
+ */
+KinectReader::KinectReader(bool readColor, bool readDepthAndInfrared, bool readColorDepth, int timeout, bool readLatestFrame) {
+    // Determine frame types
+    unsigned int frameTypes = LIBFREENECT_FRAME_NONE;
+    if (readColor || readColorDepth) {
+        frameTypes |= LIBFREENECT_FRAME_COLOR;
+    }
+    if (readDepthAndInfrared || readColorDepth) {
+        frameTypes |= (LIBFREENECT_FRAME_DEPTH | LIBFREENECT_FRAME_INFRARED);
+    }
+    this->initialize(frameTypes, timeout, readLatestFrame, NULL);
+}
+
+/*
+ * Input: profile is which frames to read
+ *          source is where to read frames from, the Kinect if NULL (the reader does not take ownership)
+ */
+KinectReader::KinectReader(CaptureProfile profile, int timeout, bool readLatestFrame, KinectFrameSource *source) {
+    unsigned int frameTypes = LIBFREENECT_FRAME_DEPTH;
+    if (profile == CaptureProfileDepthInfrared || profile == CaptureProfileFull) {
+        frameTypes |= LIBFREENECT_FRAME_INFRARED;
+    }
+    if (profile == CaptureProfileFull) {
+        frameTypes |= LIBFREENECT_FRAME_COLOR;
+    }
+    this->initialize(frameTypes, timeout, readLatestFrame, source);
+}
+
+void KinectReader::initialize(unsigned int frameTypes, int timeout, bool readLatestFrame, KinectFrameSource *source) {
+    this->frameTypes = frameTypes;
+    this->timeout = timeout;
+    this->readLatestFrame = readLatestFrame;
+    this->hasLastSequence = false;
+    this->lastSequence = 0;
+    this->missingFrameCount = 0;
+    this->lastSequenceGap = 0;
+    this->largestSequenceGap = 0;
+    this->framePoolSize = FRAME_POOL_SIZE_DEFAULT;
+    this->framePoolExhaustedCount = 0;
+    this->retiredFrameCount = 0;
+
+    this->listener = NULL;
+    this->latestFrameListener = NULL;
+    if (this->readLatestFrame) {
+        this->latestFrameListener = new LatestFrameListener(frameTypes);
+    } else {
+        this->listener = new libfreenect2::SyncMultiFrameListener(frameTypes);
+    }
+
+    this->ownsSource = (source == NULL);
+    this->source = (source != NULL) ? source : new Freenect2FrameSource();
+
+    // Open, connect to, and warm up the Kinect in the background, since finding and opening it takes seconds
+    this->isOpen = false;
+    this->isStreaming = false;
+    this->readyResult = -1;
+    this->skippedFrameCountAtStart = 0;
+    this->readiness = std::async(std::launch::async, &KinectReader::prepare, this);
+}
+
+KinectReader::~KinectReader() {
+    // Close and disconnect from the Kinect, once the background open has finished with it
+    this->waitUntilReady();
+    if (this->isStreaming) {
+        this->stop();
+    }
+    this->destroyFramePool();
+    // Frames still held are released through this reader, so it waits for them
+    {
+        std::unique_lock<std::mutex> lock(this->framePoolMutex);
+        if (this->retiredFrameCount > 0) {
+            std::cout << "KinectReader: Waiting for " << this->retiredFrameCount << " frames to be released." << std::endl;
+        }
+        this->retiredFramesReleasedCondition.wait(lock, [this]() { return this->retiredFrameCount == 0; });
+    }
+    this->close();
+
+    if (this->ownsSource) {
+        delete this->source;
+    }
+    delete this->listener;
+    delete this->latestFrameListener;
+}
+
+/*
+ * Output: whether the Kinect has been opened and warmed up (or failed to), so start() will not wait
+ */
+bool KinectReader::isReady() {
+    return !this->readiness.valid() || this->readiness.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+/*
+ * Waits for the Kinect to be opened and warmed up, if that is still pending
+ * Output: 0 if the Kinect is open, -1 otherwise
+ */
+int KinectReader::waitUntilReady() {
+    if (this->readiness.valid()) {
+        this->readyResult = this->readiness.get();
+    }
+    return this->readyResult;
+}
+
+/*
+ * Opens the Kinect and warms up its streams, run in the background from the constructor
+ */
+int KinectReader::prepare() {
+    if (this->open() < 0) {
+        return -1;
+    }
+    if (this->startStreaming() < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int KinectReader::open() {
+    libfreenect2::FrameListener *frameListener = this->readLatestFrame ? (libfreenect2::FrameListener *)this->latestFrameListener : this->listener;
+    if (this->source->open(frameListener) < 0) {
+        return -1;
+    }
+    this->isOpen = true;
+    return 0;
+}
+
+/*
+ * Starts the streams in the profile and discards their first frames
+ */
+int KinectReader::startStreaming() {
+    bool streamColor = (this->frameTypes & LIBFREENECT_FRAME_COLOR) != 0;
+    bool streamDepth = (this->frameTypes & (LIBFREENECT_FRAME_DEPTH | LIBFREENECT_FRAME_INFRARED)) != 0;
+    if (this->source->start(streamColor, streamDepth) < 0) {
+        return -1;
+    }
+    this->isStreaming = true;
+
+    libfreenect2::FrameMap frameMap;
+    for (int i = 0; i < WARMUP_FRAME_COUNT; i++) {
+        if (!this->waitForFrameMap(frameMap)) {
+            std::cout << "KinectReader: Timeout on warm-up frame." << std::endl;
+            break;
+        }
+        this->releaseFrameMap(frameMap);
+    }
+    return 0;
+}
+
+int KinectReader::start() {
+    if (this->waitUntilReady() < 0 || !this->isOpen) {
+        std::cout << "KinectReader: No device connected." << std::endl;
+        return -1;
+    }
+
+    // Streams are already warmed up the first time, and restarted after stop()
+    if (!this->isStreaming && this->startStreaming() < 0) {
+        return -1;
+    }
+
+    this->skippedFrameCountAtStart = this->readLatestFrame ? this->latestFrameListener->getSkippedFrameCount() : 0;
+    this->hasLastSequence = false;
+    this->missingFrameCount = 0;
+    this->lastSequenceGap = 0;
+    this->largestSequenceGap = 0;
+
+    this->createFramePool();
+
+    return 0;
+}
+
+KinectReaderFrames *KinectReader::readFrames() {
+    if (!this->isOpen) {
         std::cout << "KinectReader: No device connected." << std::endl;
         return NULL;
     }
 
-    KinectReaderFrames *frames = new KinectReaderFrames;
-    frames->_frameMap = new libfreenect2::FrameMap;
+    KinectReaderFrames *frames = NULL;
+    {
+        std::lock_guard<std::mutex> lock(this->framePoolMutex);
+        if (!this->freeFrames.empty()) {
+            frames = this->freeFrames.back();
+            this->freeFrames.pop_back();
+        } else {
+            this->framePoolExhaustedCount++;
+        }
+    }
+    if (frames == NULL) {
+        std::cout << "KinectReader: Frame pool exhausted (" << this->framePool.size() << " frames), release frames before reading more." << std::endl;
+        return NULL;
+    }
 
     // Read frames
-    if (!this->listener->waitForNewFrame(*(frames->_frameMap), this->timeout)) {
+    if (!this->waitForFrameMap(*(frames->_frameMap))) {
         std::cout << "KinectReader: Timeout on new frame." << std::endl;
+        this->returnToFramePool(frames);
         return NULL;
     }
 
-    if (this->readColor || this->readColorDepth) {
+    if (this->frameTypes & LIBFREENECT_FRAME_COLOR) {
         frames->color = (*(frames->_frameMap))[LIBFREENECT_FRAME_COLOR];
     }
-    if (this->readDepthAndInfrared || this->readColorDepth) {
+    if (this->frameTypes & LIBFREENECT_FRAME_DEPTH) {
         frames->depth = (*(frames->_frameMap))[LIBFREENECT_FRAME_DEPTH];
+    }
+    if (this->frameTypes & LIBFREENECT_FRAME_INFRARED) {
         frames->infrared = (*(frames->_frameMap))[LIBFREENECT_FRAME_INFRARED];
     }
-    if (this->readColorDepth) {
-        frames->colorDepthRegistered = new libfreenect2::Frame(512, 424, 4);
-        frames->colorDepthUndistorted = new libfreenect2::Frame(512, 424, 4);
-        registration->apply(frames->color, frames->depth, frames->colorDepthUndistorted, frames->colorDepthRegistered);
+    frames->isColorDepthRegistered = false;
+
+    libfreenect2::Frame *sequenceFrame = (frames->depth != NULL) ? frames->depth : frames->color;
+    if (sequenceFrame != NULL) {
+        this->updateSequence(sequenceFrame->sequence);
     }
     return frames;
 }
 
-int KinectReader::releaseFrames(KinectReaderFrames *frames) {
-    if (frames->colorDepthRegistered != NULL) {
-        delete frames->colorDepthRegistered;
-        frames->colorDepthRegistered = NULL;
+/*
+ * Registers color to depth for frames from readFrames(), into frames->colorDepthRegistered and colorDepthUndistorted
+ * Only computed the first time it is asked for, since most readers never use it
+ * Output: 0 on success, -1 if the reader does not read both color and depth
+ */
+int KinectReader::registerColorDepth(KinectReaderFrames *frames) {
+    if (!this->canRegisterColorDepth()) {
+        std::cout << "KinectReader: Color registration needs color and depth frames." << std::endl;
+        return -1;
     }
+    if (!frames->isColorDepthRegistered) {
+        this->source->registerColorDepth(frames->color, frames->depth, frames->colorDepthUndistorted, frames->colorDepthRegistered);
+        frames->isColorDepthRegistered = true;
+    }
+    return 0;
+}
 
-    if (frames->colorDepthUndistorted != NULL) {
-        delete frames->colorDepthUndistorted;
-        frames->colorDepthUndistorted = NULL;
+/*
+ * Takes the depth frame out of frames, so it can be held after releaseFrames() without copying it
+ * frames->depth then belongs to the buffer, and is only valid while the buffer is held
+ * Output: a buffer holding the depth frame, which the caller releases,
+ *          or NULL if depth was not read or was already taken
+ */
+DepthBuffer *KinectReader::takeDepthBuffer(KinectReaderFrames *frames) {
+    libfreenect2::FrameMap::iterator depthIt = frames->_frameMap->find(libfreenect2::Frame::Depth);
+    if (depthIt == frames->_frameMap->end()) {
+        return NULL;
     }
+    libfreenect2::Frame *depth = depthIt->second;
+    // Releasing the frame map deletes the frames left in it, so the buffer deletes this one instead
+    frames->_frameMap->erase(depthIt);
+    return DepthBufferPool::shared()->wrap(KinectReader::viewOfDepthFrame(depth), [depth]() { delete depth; });
+}
+
+/*
+ * Output: a view of a Kinect depth frame, whose depths are float millimeters
+ */
+DepthView KinectReader::viewOfDepthFrame(libfreenect2::Frame *depthFrame) {
+    DepthView view((float *)depthFrame->data, depthFrame->width, depthFrame->height, 0, DepthUnitsMillimeters);
+    view.timestamp = depthFrame->timestamp;
+    view.sequence = depthFrame->sequence;
+    return view;
+}
 
-    this->listener->release(*(frames->_frameMap));
+/*
+ * Returns frames from readFrames() to the Kinect and to the frame pool
+ */
+int KinectReader::releaseFrames(KinectReaderFrames *frames) {
+    this->releaseFrameMap(*(frames->_frameMap));
     frames->color = NULL;
     frames->depth = NULL;
     frames->infrared = NULL;
-
-    delete frames->_frameMap;
-    frames->_frameMap = NULL;
-
-    delete frames;
+    this->returnToFramePool(frames);
     return 0;
 }
 
 int KinectReader::stop() {
-    if (this->registration != NULL) {
-        delete this->registration;
-        this->registration = NULL;
+    this->destroyFramePool();
+    this->isStreaming = false;
+    int result = this->source->stop();
+
+    // Frames from before stopping would be read as warm-up frames when restarting, in place of fresh ones
+    if (this->readLatestFrame) {
+        this->latestFrameListener->clear();
+    } else {
+        libfreenect2::FrameMap frameMap;
+        while (this->listener->hasNewFrame() && this->listener->waitForNewFrame(frameMap, 0)) {
+            this->listener->release(frameMap);
+        }
     }
+    return result;
+}
 
-    if (this->device != NULL) {
-        this->device->stop();
+bool KinectReader::waitForFrameMap(libfreenect2::FrameMap &frameMap) {
+    if (this->readLatestFrame) {
+        return this->latestFrameListener->waitForNewFrame(frameMap, this->timeout);
+    } else {
+        return this->listener->waitForNewFrame(frameMap, this->timeout);
     }
-    return 0;
 }
 
-int KinectReader::close() {
-    if (this->device != NULL) {
-        this->device->close();
-        delete this->device;
-        this->device = NULL;
+void KinectReader::releaseFrameMap(libfreenect2::FrameMap &frameMap) {
+    if (this->readLatestFrame) {
+        this->latestFrameListener->release(frameMap);
+    } else {
+        this->listener->release(frameMap);
     }
-    if (this->pipeline != NULL) {
-        delete this->pipeline;
-        this->pipeline = NULL;
+}
+
+bool KinectReader::canRegisterColorDepth() {
+    return (this->frameTypes & LIBFREENECT_FRAME_COLOR) && (this->frameTypes & LIBFREENECT_FRAME_DEPTH);
+}
+
+/*
+ * Sets how many sets of frames may be held at once, such as by each stage of a pipeline, from the next start()
+ */
+void KinectReader::setFramePoolSize(int framePoolSize) {
+    this->framePoolSize = std::max(1, framePoolSize);
+}
+
+void KinectReader::createFramePool() {
+    this->destroyFramePool();
+    std::lock_guard<std::mutex> lock(this->framePoolMutex);
+    for (int i = 0; i < this->framePoolSize; i++) {
+        KinectReaderFrames *frames = new KinectReaderFrames();
+        frames->_frameMap = new libfreenect2::FrameMap;
+        if (this->canRegisterColorDepth()) {
+            frames->colorDepthRegistered = new libfreenect2::Frame(REGISTRATION_WIDTH, REGISTRATION_HEIGHT, REGISTRATION_BYTES_PER_PIXEL);
+            frames->colorDepthUndistorted = new libfreenect2::Frame(REGISTRATION_WIDTH, REGISTRATION_HEIGHT, REGISTRATION_BYTES_PER_PIXEL);
+        }
+        this->framePool.push_back(frames);
+        this->freeFrames.push_back(frames);
     }
-    return 0;
+    this->framePoolExhaustedCount = 0;
+}
+
+/*
+ * Makes a released set of frames free to read into again,
+ * or frees it if its pool was destroyed while it was held
+ */
+void KinectReader::returnToFramePool(KinectReaderFrames *frames) {
+    std::lock_guard<std::mutex> lock(this->framePoolMutex);
+    if (std::find(this->framePool.begin(), this->framePool.end(), frames) == this->framePool.end()) {
+        this->deleteFrames(frames);
+        this->retiredFrameCount--;
+        this->retiredFramesReleasedCondition.notify_all();
+        return;
+    }
+    this->freeFrames.push_back(frames);
+}
+
+/*
+ * Frees the frame pool, leaving any set of frames still held to be freed when it is released
+ */
+void KinectReader::destroyFramePool() {
+    std::lock_guard<std::mutex> lock(this->framePoolMutex);
+    for (size_t i = 0; i < this->framePool.size(); i++) {
+        KinectReaderFrames *frames = this->framePool[i];
+        if (std::find(this->freeFrames.begin(), this->freeFrames.end(), frames) != this->freeFrames.end()) {
+            this->deleteFrames(frames);
+        } else {
+            this->retiredFrameCount++;
+        }
+    }
+    this->framePool.clear();
+    this->freeFrames.clear();
+}
+
+void KinectReader::deleteFrames(KinectReaderFrames *frames) {
+    delete frames->colorDepthRegistered;
+    delete frames->colorDepthUndistorted;
+    delete frames->_frameMap;
+    delete frames;
+}
+
+/*
+ * Output: 0 with the depth camera's intrinsics, or -1 if the source has none (it is not streaming, or is a fake)
+ */
+int KinectReader::getCameraIntrinsics(CameraIntrinsics *cameraIntrinsics) {
+    if (!this->isOpen) {
+        return -1;
+    }
+    return this->source->getCameraIntrinsics(cameraIntrinsics);
+}
+
+/*
+ * Output: number of frames replaced by newer frames before they were read (only when reading the latest frame)
+ */
+uint64_t KinectReader::getSkippedFrameCount() {
+    return this->readLatestFrame ? this->latestFrameListener->getSkippedFrameCount() - this->skippedFrameCountAtStart : 0;
+}
+
+/*
+ * Counts the sequence numbers missing since the last frame read
+ */
+void KinectReader::updateSequence(uint32_t sequence) {
+    this->lastSequenceGap = this->hasLastSequence ? sequence - this->lastSequence - 1 : 0;
+    this->missingFrameCount += this->lastSequenceGap;
+    this->largestSequenceGap = std::max(this->largestSequenceGap, this->lastSequenceGap);
+    this->lastSequence = sequence;
+    this->hasLastSequence = true;
+}
+
+int KinectReader::close() {
+    this->isOpen = false;
+    return this->source->close();
 }
 
 } /* namespace virtualMonitor */
@@ -23,45 +23,172 @@
 #ifndef KINECTREADER_H
 #define KINECTREADER_H
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <vector>
+
 #include <libfreenect2/libfreenect2.hpp>
 #include <libfreenect2/frame_listener_impl.h>
 #include <libfreenect2/packet_pipeline.h>
 #include <libfreenect2/registration.h>
 
+#include "CameraIntrinsics.h"
+#include "DepthBuffer.h"
+#include "DepthView.h"
+
 namespace virtualMonitor {
 
+// Which frames KinectReader reads, since decoding color and registering it to depth cost time every frame
+enum CaptureProfile {
+    CaptureProfileDepth,
+    CaptureProfileDepthInfrared,
+    CaptureProfileFull          // color, depth, and infrared, with color registered to depth on request
+};
+
 struct KinectReaderFrames {
     libfreenect2::Frame *color;
     libfreenect2::Frame *depth;
     libfreenect2::Frame *infrared;
+    // Set by KinectReader::registerColorDepth()
     libfreenect2::Frame *colorDepthRegistered;
     libfreenect2::Frame *colorDepthUndistorted;
+    bool isColorDepthRegistered;
     libfreenect2::FrameMap *_frameMap;
 };
 
-class KinectReader {
-
+/*
+ * Where KinectReader gets frames, which is the Kinect unless a test provides a fake
+ * The source delivers frames to the listener passed to open(), from its own threads
+ */
+class KinectFrameSource {
 public:
-    int timeout;
+    virtual ~KinectFrameSource() {}
+    virtual int open(libfreenect2::FrameListener *listener) = 0;
+    virtual int start(bool streamColor, bool streamDepth) = 0;
+    virtual int stop() = 0;
+    virtual int close() = 0;
+    virtual void registerColorDepth(libfreenect2::Frame *color, libfreenect2::Frame *depth,
+                                    libfreenect2::Frame *colorDepthUndistorted, libfreenect2::Frame *colorDepthRegistered) = 0;
+    virtual int getCameraIntrinsics(CameraIntrinsics *cameraIntrinsics) { return -1; }
+};
 
+class Freenect2FrameSource : public KinectFrameSource {
 private:
     libfreenect2::Freenect2 freenect;
     libfreenect2::Freenect2Device *device;
-    libfreenect2::SyncMultiFrameListener *listener;
     libfreenect2::PacketPipeline *pipeline;
     libfreenect2::Registration *registration;
-    bool readColor, readDepthAndInfrared, readColorDepth;
 
 public:
-    KinectReader(bool readColor=true, bool readDepthAndInfrared=true, bool readColorDepth=true, int timeout=10000);
+    Freenect2FrameSource();
+    virtual ~Freenect2FrameSource();
+
+    virtual int open(libfreenect2::FrameListener *listener);
+    virtual int start(bool streamColor, bool streamDepth);
+    virtual int stop();
+    virtual int close();
+    virtual void registerColorDepth(libfreenect2::Frame *color, libfreenect2::Frame *depth,
+                                    libfreenect2::Frame *colorDepthUndistorted, libfreenect2::Frame *colorDepthRegistered);
+    virtual int getCameraIntrinsics(CameraIntrinsics *cameraIntrinsics);
+};
+
+/*
+ * Keeps only the newest complete set of frames, so a slow reader gets the latest frames instead of a backlog
+ * A set that is replaced before it is read counts as skipped
+ */
+class LatestFrameListener : public libfreenect2::FrameListener {
+private:
+    unsigned int frameTypes;
+    std::mutex mutex;
+    std::condition_variable newFrameCondition;
+    libfreenect2::FrameMap pendingFrames;
+    libfreenect2::FrameMap latestFrames;
+    bool hasLatestFrames;
+    uint64_t skippedFrameCount;
+
+public:
+    LatestFrameListener(unsigned int frameTypes);
+    virtual ~LatestFrameListener();
+
+    virtual bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame);
+    virtual bool waitForNewFrame(libfreenect2::FrameMap &frames, int timeout);
+    virtual void release(libfreenect2::FrameMap &frames);
+    virtual void clear();
+    virtual uint64_t getSkippedFrameCount();
+private:
+    virtual void deleteFrames(libfreenect2::FrameMap &frames);
+};
+
+class KinectReader {
+
+public:
+    int timeout;
+
+private:
+    KinectFrameSource *source;
+    bool ownsSource;
+    std::atomic<bool> isOpen;
+    bool isStreaming;
+    std::future<int> readiness;
+    int readyResult;
+    libfreenect2::SyncMultiFrameListener *listener;
+    LatestFrameListener *latestFrameListener;
+    unsigned int frameTypes;
+    bool readLatestFrame;
+    // Sequence numbers missing between frames read, whether skipped here or dropped by libfreenect2
+    bool hasLastSequence;
+    uint32_t lastSequence;
+    uint64_t missingFrameCount;
+    uint32_t lastSequenceGap;
+    uint32_t largestSequenceGap;
+    // Frame holders and registration buffers, reused so that reading frames does not allocate
+    int framePoolSize;
+    std::mutex framePoolMutex;
+    std::vector<KinectReaderFrames *> framePool;
+    std::vector<KinectReaderFrames *> freeFrames;
+    // Frames still held when their pool was destroyed, which are freed when they are released
+    int retiredFrameCount;
+    std::condition_variable retiredFramesReleasedCondition;
+    uint64_t framePoolExhaustedCount;
+    uint64_t skippedFrameCountAtStart;
+
+public:
+    KinectReader(bool readColor=true, bool readDepthAndInfrared=true, bool readColorDepth=true, int timeout=10000, bool readLatestFrame=false);
+    KinectReader(CaptureProfile profile, int timeout=10000, bool readLatestFrame=false, KinectFrameSource *source=NULL);
     virtual ~KinectReader();
 
+    virtual bool isReady();
+    virtual int waitUntilReady();
     virtual int start();
     virtual KinectReaderFrames *readFrames();
+    virtual int registerColorDepth(KinectReaderFrames *frames);
+    virtual DepthBuffer *takeDepthBuffer(KinectReaderFrames *frames);
+    static DepthView viewOfDepthFrame(libfreenect2::Frame *depthFrame);
     virtual int releaseFrames(KinectReaderFrames *frames);
     virtual int stop();
+    virtual void setFramePoolSize(int framePoolSize);
+    virtual uint64_t getFramePoolExhaustedCount() { return this->framePoolExhaustedCount; }
+    virtual uint64_t getSkippedFrameCount();
+    virtual uint64_t getMissingFrameCount() { return this->missingFrameCount; }
+    virtual uint32_t getLastSequenceGap() { return this->lastSequenceGap; }
+    virtual uint32_t getLargestSequenceGap() { return this->largestSequenceGap; }
+    virtual int getCameraIntrinsics(CameraIntrinsics *cameraIntrinsics);
 private:
+    virtual void initialize(unsigned int frameTypes, int timeout, bool readLatestFrame, KinectFrameSource *source);
+    virtual bool canRegisterColorDepth();
+    virtual int prepare();
     virtual int open();
+    virtual int startStreaming();
+    virtual bool waitForFrameMap(libfreenect2::FrameMap &frameMap);
+    virtual void releaseFrameMap(libfreenect2::FrameMap &frameMap);
+    virtual void updateSequence(uint32_t sequence);
+    virtual void createFramePool();
+    virtual void returnToFramePool(KinectReaderFrames *frames);
+    virtual void destroyFramePool();
+    virtual void deleteFrames(KinectReaderFrames *frames);
     virtual int close();
 };
 
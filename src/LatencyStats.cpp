@@ -0,0 +1,175 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    LatencyStats.cpp
+    Records how long each stage of the detection loop takes.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LatencyStats.h"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace virtualMonitor {
+
+#define EXACT_BUCKET_COUNT 16
+#define SUBBUCKET_BITS 3
+#define SUBBUCKET_COUNT (1 << SUBBUCKET_BITS)
+
+LatencyHistogram::LatencyHistogram() {
+    this->reset();
+}
+
+void LatencyHistogram::record(uint64_t microseconds) {
+    this->bucketCounts[bucketForMicroseconds(microseconds)].fetch_add(1, std::memory_order_relaxed);
+    this->count.fetch_add(1, std::memory_order_relaxed);
+    this->sum.fetch_add(microseconds, std::memory_order_relaxed);
+
+    uint64_t currentMax = this->max.load(std::memory_order_relaxed);
+    while (microseconds > currentMax && !this->max.compare_exchange_weak(currentMax, microseconds, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::reset() {
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKET_COUNT; i++) {
+        this->bucketCounts[i].store(0, std::memory_order_relaxed);
+    }
+    this->count.store(0, std::memory_order_relaxed);
+    this->sum.store(0, std::memory_order_relaxed);
+    this->max.store(0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::getMean() {
+    uint64_t count = this->getCount();
+    return (count > 0) ? (double)this->sum.load(std::memory_order_relaxed) / count : 0;
+}
+
+/*
+ * Output: upper bound of the bucket holding the given fraction of samples (0.5 for the median), at most the max
+ */
+uint64_t LatencyHistogram::percentile(double fraction) {
+    uint64_t count = this->getCount();
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max((uint64_t)1, (uint64_t)(fraction * count + 0.5));
+    uint64_t cumulativeCount = 0;
+    for (int bucket = 0; bucket < LATENCY_HISTOGRAM_BUCKET_COUNT; bucket++) {
+        cumulativeCount += this->bucketCounts[bucket].load(std::memory_order_relaxed);
+        if (cumulativeCount >= rank) {
+            return std::min(bucketUpperBound(bucket), this->getMax());
+        }
+    }
+    return this->getMax();
+}
+
+int LatencyHistogram::bucketForMicroseconds(uint64_t microseconds) {
+    if (microseconds < EXACT_BUCKET_COUNT) {
+        return (int)microseconds;
+    }
+    // Position of the highest set bit picks the power of two, and the next SUBBUCKET_BITS bits pick the bucket within it
+    int highBit = 63 - __builtin_clzll(microseconds);
+    int subbucket = (int)(microseconds >> (highBit - SUBBUCKET_BITS)) & (SUBBUCKET_COUNT - 1);
+    int bucket = EXACT_BUCKET_COUNT + (highBit - 4) * SUBBUCKET_COUNT + subbucket;
+    return std::min(bucket, LATENCY_HISTOGRAM_BUCKET_COUNT - 1);
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(int bucket) {
+    if (bucket < EXACT_BUCKET_COUNT) {
+        return bucket;
+    }
+    int highBit = (bucket - EXACT_BUCKET_COUNT) / SUBBUCKET_COUNT + 4;
+    uint64_t subbucket = (bucket - EXACT_BUCKET_COUNT) % SUBBUCKET_COUNT;
+    uint64_t width = (uint64_t)1 << (highBit - SUBBUCKET_BITS);
+    return ((SUBBUCKET_COUNT + subbucket) << (highBit - SUBBUCKET_BITS)) + width - 1;
+}
+
+LatencyStats::LatencyStats() {
+    this->reset();
+}
+
+/*
+ * Output: the stats recorded by the detection loop's spans
+ */
+LatencyStats *LatencyStats::shared() {
+    static LatencyStats sharedStats;
+    return &sharedStats;
+}
+
+const char *LatencyStats::stageName(LatencyStage stage) {
+    switch (stage) {
+        case LatencyStageCapture: return "capture";
+        case LatencyStageClassify: return "classify";
+        case LatencyStageLabel: return "label";
+        case LatencyStageMap: return "map";
+        case LatencyStageHandle: return "handle";
+        case LatencyStageInject: return "inject";
+        case LatencyStageFrame: return "frame";
+        case LatencyStageTouchDown: return "down";
+        case LatencyStageTouchMove: return "move";
+        case LatencyStageTouchUp: return "up";
+        default: return "unknown";
+    }
+}
+
+void LatencyStats::record(LatencyStage stage, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    uint64_t startMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(start.time_since_epoch()).count();
+    uint64_t endMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(end.time_since_epoch()).count();
+    this->histograms[stage].record(endMicroseconds - startMicroseconds);
+
+    if (stage == LatencyStageFrame) {
+        uint64_t unset = 0;
+        this->firstFrameStart.compare_exchange_strong(unset, startMicroseconds, std::memory_order_relaxed);
+        this->lastFrameEnd.store(endMicroseconds, std::memory_order_relaxed);
+    }
+}
+
+void LatencyStats::reset() {
+    for (int stage = 0; stage < LatencyStageCount; stage++) {
+        this->histograms[stage].reset();
+    }
+    this->firstFrameStart.store(0, std::memory_order_relaxed);
+    this->lastFrameEnd.store(0, std::memory_order_relaxed);
+}
+
+double LatencyStats::framesPerSecond() {
+    uint64_t frameCount = this->histograms[LatencyStageFrame].getCount();
+    uint64_t elapsed = this->lastFrameEnd.load(std::memory_order_relaxed) - this->firstFrameStart.load(std::memory_order_relaxed);
+    return (frameCount > 0 && elapsed > 0) ? frameCount * 1000000.0 / elapsed : 0;
+}
+
+/*
+ * Writes count, mean, p50, p90, p99 and max in microseconds for each stage that ran, then frames per second
+ */
+void LatencyStats::writeReport(std::ostream &stream) {
+    stream << std::left << std::setw(8) << "stage" << std::right << std::setw(10) << "count" << std::setw(10) << "mean"
+           << std::setw(10) << "p50" << std::setw(10) << "p90" << std::setw(10) << "p99" << std::setw(10) << "max" << " (us)" << std::endl;
+    for (int stage = 0; stage < LatencyStageCount; stage++) {
+        LatencyHistogram &histogram = this->histograms[stage];
+        if (histogram.getCount() == 0) {
+            continue;
+        }
+        stream << std::left << std::setw(8) << stageName((LatencyStage)stage) << std::right
+               << std::setw(10) << histogram.getCount() << std::setw(10) << (uint64_t)histogram.getMean()
+               << std::setw(10) << histogram.percentile(0.5) << std::setw(10) << histogram.percentile(0.9)
+               << std::setw(10) << histogram.percentile(0.99) << std::setw(10) << histogram.getMax() << std::endl;
+    }
+    stream << "frames per second: " << this->framesPerSecond() << std::endl;
+}
+
+} /* namespace virtualMonitor */
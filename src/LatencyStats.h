@@ -0,0 +1,134 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    LatencyStats.h
+    Records how long each stage of the detection loop takes.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LATENCYSTATS_H
+#define LATENCYSTATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#include "Tracer.h"
+
+// Comment out to compile out the latency spans in the detection loop
+#define VIRTUALMONITOR_LATENCY_STATS
+
+namespace virtualMonitor {
+
+enum LatencyStage {
+    LatencyStageCapture,    // KinectReader::readFrames
+    LatencyStageClassify,   // PhysicalManager::detectInteraction
+    LatencyStageLabel,      // measuring anomalies' sizes in a frame, within classify
+    LatencyStageMap,        // VirtualManager::setVirtualCoord
+    LatencyStageHandle,     // InteractionHandler::handleInteraction, including inject
+    LatencyStageInject,     // MouseController events
+    LatencyStageFrame,      // one pass of the detection loop
+    LatencyStageTouchDown,  // end to end, from capturing a frame to injecting the events it caused
+    LatencyStageTouchMove,
+    LatencyStageTouchUp,
+    LatencyStageCount
+};
+
+// Buckets are exact below 16 us, then 8 per power of two (within 12.5%) up to about two hours
+#define LATENCY_HISTOGRAM_BUCKET_COUNT 248
+
+/*
+ * Counts latencies into fixed buckets with relaxed atomics, so any thread can record without locking
+ */
+class LatencyHistogram {
+    private:
+        std::atomic<uint64_t> bucketCounts[LATENCY_HISTOGRAM_BUCKET_COUNT];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> max;
+
+    public:
+        LatencyHistogram();
+        virtual ~LatencyHistogram() {}
+
+        virtual void record(uint64_t microseconds);
+        virtual void reset();
+
+        virtual uint64_t getCount() { return this->count.load(std::memory_order_relaxed); }
+        virtual uint64_t getMax() { return this->max.load(std::memory_order_relaxed); }
+        virtual double getMean();
+        virtual uint64_t percentile(double fraction);
+
+        static int bucketForMicroseconds(uint64_t microseconds);
+        static uint64_t bucketUpperBound(int bucket);
+};
+
+class LatencyStats {
+    private:
+        LatencyHistogram histograms[LatencyStageCount];
+        // Steady clock microseconds of the first frame start and last frame end, for frames per second
+        std::atomic<uint64_t> firstFrameStart;
+        std::atomic<uint64_t> lastFrameEnd;
+
+    public:
+        LatencyStats();
+        virtual ~LatencyStats() {}
+
+        static LatencyStats *shared();
+        static const char *stageName(LatencyStage stage);
+
+        virtual void record(LatencyStage stage, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+        virtual void reset();
+
+        virtual LatencyHistogram &getHistogram(LatencyStage stage) { return this->histograms[stage]; }
+        virtual double framesPerSecond();
+        virtual void writeReport(std::ostream &stream);
+};
+
+#if defined(VIRTUALMONITOR_LATENCY_STATS) || defined(VIRTUALMONITOR_TRACE)
+/*
+ * Records a span into the latency histograms and the trace, whichever are compiled in
+ */
+inline void recordLatencySpan(LatencyStage stage, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+#ifdef VIRTUALMONITOR_LATENCY_STATS
+    LatencyStats::shared()->record(stage, start, end);
+#endif
+#ifdef VIRTUALMONITOR_TRACE
+    Tracer::shared()->record(LatencyStats::stageName(stage), start, end);
+#endif
+}
+
+inline void endLatencySpan(LatencyStage stage, std::chrono::steady_clock::time_point start) {
+    recordLatencySpan(stage, start, std::chrono::steady_clock::now());
+}
+#endif
+
+} /* namespace virtualMonitor */
+
+// Spans time a stage on the steady clock, and compile to nothing without latency stats or tracing
+#if defined(VIRTUALMONITOR_LATENCY_STATS) || defined(VIRTUALMONITOR_TRACE)
+#define LATENCY_SPAN_BEGIN(span) std::chrono::steady_clock::time_point span = std::chrono::steady_clock::now()
+#define LATENCY_SPAN_END(span, stage) virtualMonitor::endLatencySpan(stage, span)
+#define LATENCY_SPAN_RECORD(start, end, stage) virtualMonitor::recordLatencySpan(stage, start, end)
+#else
+#define LATENCY_SPAN_BEGIN(span)
+#define LATENCY_SPAN_END(span, stage)
+#define LATENCY_SPAN_RECORD(start, end, stage)
+#endif
+
+#endif /* LATENCYSTATS_H */
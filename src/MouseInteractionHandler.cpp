@@ -23,22 +23,39 @@
 #include "MouseInteractionHandler.h"
 #include <iostream>
 
+#include "LatencyStats.h"
+
 namespace virtualMonitor {
 
 MouseInteractionHandler::MouseInteractionHandler() : InteractionHandler() {}
 
 int MouseInteractionHandler::handleInteractionStartEvent() {
+    LATENCY_SPAN_BEGIN(injectSpan);
     mouseController.leftMouseDown(this->lastLocation);
+    LATENCY_SPAN_END(injectSpan, LatencyStageInject);
+    if (this->frameTime != std::chrono::steady_clock::time_point()) {
+        LATENCY_SPAN_END(this->frameTime, LatencyStageTouchDown);
+    }
     return 0;
 }
 
 int MouseInteractionHandler::handleInteractionMoveEvent() {
+    LATENCY_SPAN_BEGIN(injectSpan);
     mouseController.move(this->lastLocation);
+    LATENCY_SPAN_END(injectSpan, LatencyStageInject);
+    if (this->frameTime != std::chrono::steady_clock::time_point()) {
+        LATENCY_SPAN_END(this->frameTime, LatencyStageTouchMove);
+    }
     return 0;
 }
 
 int MouseInteractionHandler::handleInteractionEndEvent() {
+    LATENCY_SPAN_BEGIN(injectSpan);
     mouseController.leftMouseUp(this->lastLocation);
+    LATENCY_SPAN_END(injectSpan, LatencyStageInject);
+    if (this->frameTime != std::chrono::steady_clock::time_point()) {
+        LATENCY_SPAN_END(this->frameTime, LatencyStageTouchUp);
+    }
     // write to output file
     writeTapLocation(this->lastLocation->x, this->lastLocation->y);
     return 0;
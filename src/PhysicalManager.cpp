@@ -28,21 +28,27 @@
 #include <fstream>
 #include <iostream>
 #include <queue>
+#include <random>
 #include <set>
 #include <sstream>
 #include <string>
+#include <vector>
 #include <assert.h>
 #include <unistd.h>
 
+#include "Checksum.h"
+#include "ThreadPool.h"
+
 namespace virtualMonitor {
 
 #define DEPTH_FRAME_WIDTH 512
 #define DEPTH_FRAME_HEIGHT 424
 #define DEPTH_FRAME_BYTES_PER_PIXEL 4
 
-#define DEPTH_VALID(x) (DEPTH_MIN <= x && x <= DEPTH_MAX)
+#define DEPTH_VALID(x) (this->parameters.depthMin <= x && x <= this->parameters.depthMax)
 #define DEPTH_FRAME_2D_TO_1D(x,y) (y * DEPTH_FRAME_WIDTH + x)
 
+// Defaults for DetectionParameters
 #define DEPTH_MIN 500
 #define DEPTH_MAX 9000
 
@@ -60,38 +66,344 @@ namespace virtualMonitor {
 #define INTERACTION_ANOMALY_SIZE_MIN 700
 #define INTERACTION_VARIANCE_MAX 2000
 
+// Surface models (see SurfaceModelHeader)
+#define SURFACE_MODEL_MAGIC "VMSURF\0\0"
+#define SURFACE_MODEL_MAGIC_LENGTH 8
+#define SURFACE_MODEL_VERSION 3
+// Depths are summarized from every SURFACE_SUMMARY_STRIDE pixels in each direction
+#define SURFACE_SUMMARY_STRIDE 4
+// How far a block's mean depth (mm) and fraction of valid depths may move before the surface is fitted again
+#define SURFACE_MODEL_DEPTH_TOLERANCE 10
+#define SURFACE_MODEL_VALID_FRACTION_TOLERANCE 0.05
+// Blocks with fewer valid depths than this fraction are compared only by that fraction
+#define SURFACE_SUMMARY_VALID_FRACTION_MIN 0.1
+
+// Drift compensation samples every DRIFT_SAMPLE_ROW_STRIDE rows of the REGRESSION_N the surface was fitted from
+#define DRIFT_SAMPLE_ROW_STRIDE 4
+// Weight each frame's samples keep per later frame (about 200 frames, or 7 seconds, of samples)
+#define DRIFT_DECAY 0.995
+// Frames sampled after an adjustment before the regression is adjusted again
+#define DRIFT_FRAMES_MIN 30
+// Change in surface depth at the sampled rows that adjusts the regression (mm)
+#define DRIFT_DEPTH_TOLERANCE 5
+// Rows whose bounds follow an adjusted regression each frame, and how far each edge moves at most (pixels)
+#define DRIFT_BOUNDS_ROWS_PER_FRAME 2
+#define DRIFT_BOUNDS_STEP_MAX 4
+// With a surface plane, drift is also sampled on columns this many quarters across the frame (the middle is the center column)
+#define DRIFT_PLANE_SAMPLE_COLS 3
+
+// The surface plane is fitted by RANSAC to every PLANE_SAMPLE_STRIDE pixels of the reference, from fixed seeds so fits repeat
+#define PLANE_SAMPLE_STRIDE 8
+#define PLANE_RANSAC_ITERATIONS 200
+#define PLANE_RANSAC_SEED 1
+// The iterations are split into this many runs on the shared thread pool, each seeded by its index rather than by the
+// worker it runs on, so fits repeat whatever the number of cores
+#define PLANE_RANSAC_RUN_COUNT 8
+// Farthest a sample is from a plane to support it (mm)
+#define PLANE_INLIER_DISTANCE 15
+// Least-squares fits to the supporting samples, each followed by finding them again
+#define PLANE_REFINE_ROUNDS 2
+
 #define PIXEL_DEFAULT "0 0 0"
 #define PIXEL_SURFACE "255 0 0"
 #define PIXEL_ANOMALY "0 255 0"
 #define PIXEL_INTERACTION "0 0 255"
 
-PhysicalManager::PhysicalManager() {
+DetectionParameters::DetectionParameters() {
+    this->depthMin = DEPTH_MIN;
+    this->depthMax = DEPTH_MAX;
+    this->depthSmoothingDelta = DEPTH_SMOOTHING_DELTA;
+    this->referenceDepthSmoothingDelta = REFERENCE_DEPTH_SMOOTHING_DELTA;
+    this->varianceBoxSideLength = VARIANCE_BOX_SIDE_LENGTH;
+    this->surfaceDepthDifferenceMin = INTERACTION_SURFACE_DEPTH_DIFFERENCE_MIN;
+    this->surfaceSlopeDifferenceMin = INTERACTION_SURFACE_SLOPE_DIFFERENCE_MIN;
+    this->referenceDepthDifferenceMin = INTERACTION_REFERENCE_DEPTH_DIFFERENCE_MIN;
+    this->referenceSlopeDifferenceMin = INTERACTION_REFERENCE_SLOPE_DIFFERENCE_MIN;
+    this->anomalySizeMin = INTERACTION_ANOMALY_SIZE_MIN;
+    this->varianceMax = INTERACTION_VARIANCE_MAX;
+}
+
+PhysicalManager::PhysicalManager(DetectionParameters parameters) {
+    this->parameters = parameters;
     this->referenceFrame = NULL;
     this->surfaceRegression = new float[DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT];
     this->surfaceLeftXForY = new int[DEPTH_FRAME_HEIGHT];
     this->surfaceRightXForY = new int[DEPTH_FRAME_HEIGHT];
+    this->rayX = NULL;
+    this->rayY = NULL;
+    this->hasSurfacePlane = false;
+    this->surfacePlaneFactors = new float[DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT];
+    this->surfaceRegressionBottomY = 0;
+    this->driftAdjustmentCount = 0;
+    this->labelDuration = std::chrono::steady_clock::duration::zero();
+    this->resetDrift();
 }
 
 PhysicalManager::~PhysicalManager() {
-    delete this->surfaceRegression;
+    delete[] this->surfaceRegression;
     delete[] this->surfaceLeftXForY;
     delete[] this->surfaceRightXForY;
+    delete[] this->rayX;
+    delete[] this->rayY;
+    delete[] this->surfacePlaneFactors;
     // Expect this->referenceFrame to be freed externally
 }
 
-int PhysicalManager::setReferenceFrame(libfreenect2::Frame *referenceFrame) {
-    this->referenceFrame = referenceFrame;
-    if (this->referenceFrame != NULL) {
+/*
+ * Input: referenceFrame is copied as a view, so its depths must outlive this PhysicalManager's use of them
+ */
+int PhysicalManager::setReferenceFrame(DepthView *referenceFrame) {
+    this->referenceFrame = NULL;
+    this->hasSurfacePlane = false;
+    if (referenceFrame != NULL) {
+        this->referenceView = *referenceFrame;
+        this->referenceFrame = &this->referenceView;
+        // The regression is fitted even with a plane, since virtual mapping follows its curve
         this->updateSurfaceRegressionForReference();
+        if (this->rayX != NULL) {
+            this->updateSurfacePlaneForReference();
+        }
         this->updateSurfaceBoundsForReference();
     }
+    this->resetDrift();
+    return 0;
+}
+
+/*
+ * Sets the intrinsics of the camera frames are from, so the surface is fitted as a plane, which follows a rolled sensor
+ * that the regression (a function of y alone) cannot
+ * Input: cameraIntrinsics take effect at the next setReferenceFrame(), and intrinsics without focal lengths go back to the regression
+ */
+int PhysicalManager::setCameraIntrinsics(CameraIntrinsics cameraIntrinsics) {
+    delete[] this->rayX;
+    delete[] this->rayY;
+    this->rayX = NULL;
+    this->rayY = NULL;
+    this->cameraIntrinsics = CameraIntrinsics();
+    if (!cameraIntrinsics.isValid()) {
+        return 0;
+    }
+
+    this->cameraIntrinsics = cameraIntrinsics;
+    this->rayX = new float[DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT];
+    this->rayY = new float[DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT];
+    buildRayTable(cameraIntrinsics, DEPTH_FRAME_WIDTH, DEPTH_FRAME_HEIGHT, this->rayX, this->rayY);
+    return 0;
+}
+
+/*
+ * Output: whether the surface is a plane, and if so its unit normal (3 floats) and distance, with normal . P = distance (mm)
+ */
+bool PhysicalManager::getSurfacePlane(float *normal, float *distance) {
+    if (!this->hasSurfacePlane) {
+        return false;
+    }
+    std::memcpy(normal, this->surfacePlaneNormal, sizeof(this->surfacePlaneNormal));
+    *distance = this->surfacePlaneDistance;
+    return true;
+}
+
+/*
+ * Output: how far a pixel's depth is in front of the surface (mm), along the plane's normal if the surface is a plane,
+ *          and otherwise along the ray; invalid depths are not checked for
+ */
+float PhysicalManager::pixelHeightAboveSurface(DepthView *depthFrame, int x, int y) {
+    return this->heightAboveSurface(x, y, depthFrame->row(y)[x] * depthFrame->millimetersPerUnit());
+}
+
+/*
+ * Output: how far a depth seen at a pixel is in front of the surface (mm), as pixelHeightAboveSurface()
+ */
+float PhysicalManager::heightAboveSurface(int x, int y, float depth) {
+    if (this->hasSurfacePlane) {
+        return this->surfacePlaneDistance - depth * this->surfacePlaneFactors[DEPTH_FRAME_2D_TO_1D(x,y)];
+    }
+    return this->pixelSurfaceRegression(x, y) - depth;
+}
+
+/*
+ * Shares the reference frame of another PhysicalManager, copying its surface data instead of recomputing it
+ * The reference frame is still owned externally, and must outlive both PhysicalManagers
+ */
+int PhysicalManager::copyReferenceFrom(PhysicalManager *physicalManager) {
+    this->referenceView = physicalManager->referenceView;
+    this->referenceFrame = (physicalManager->referenceFrame != NULL) ? &this->referenceView : NULL;
+    this->surfaceRegressionEqA = physicalManager->surfaceRegressionEqA;
+    this->surfaceRegressionEqB = physicalManager->surfaceRegressionEqB;
+    std::memcpy(this->surfaceRegression, physicalManager->surfaceRegression, sizeof(float) * DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT);
+    std::memcpy(this->surfaceLeftXForY, physicalManager->surfaceLeftXForY, sizeof(int) * DEPTH_FRAME_HEIGHT);
+    std::memcpy(this->surfaceRightXForY, physicalManager->surfaceRightXForY, sizeof(int) * DEPTH_FRAME_HEIGHT);
+    // Rays are copied rather than undistorted again
+    this->setCameraIntrinsics(CameraIntrinsics());
+    this->cameraIntrinsics = physicalManager->cameraIntrinsics;
+    if (physicalManager->rayX != NULL) {
+        this->rayX = new float[DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT];
+        this->rayY = new float[DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT];
+        std::memcpy(this->rayX, physicalManager->rayX, sizeof(float) * DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT);
+        std::memcpy(this->rayY, physicalManager->rayY, sizeof(float) * DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT);
+    }
+    this->hasSurfacePlane = physicalManager->hasSurfacePlane;
+    std::memcpy(this->surfacePlaneNormal, physicalManager->surfacePlaneNormal, sizeof(this->surfacePlaneNormal));
+    this->surfacePlaneDistance = physicalManager->surfacePlaneDistance;
+    std::memcpy(this->surfacePlaneFactors, physicalManager->surfacePlaneFactors, sizeof(float) * DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT);
+    this->surfaceRegressionBottomY = physicalManager->surfaceRegressionBottomY;
+    this->driftSums = physicalManager->driftSums;
+    this->driftPlaneSums = physicalManager->driftPlaneSums;
+    this->driftFrameCount = physicalManager->driftFrameCount;
+    this->driftBoundsY = physicalManager->driftBoundsY;
+    return 0;
+}
+
+/*
+ * Sets the reference frame, reusing the surface fitted to an earlier reference when the surface has not moved,
+ * rather than fitting it again
+ * Input: referenceFrame is copied as a view, as by setReferenceFrame()
+ * Output: 0 if the surface model was reused,
+ *          -1 if it is missing, corrupt, for other detection parameters, or of a surface that has moved since,
+ *          leaving the reference unchanged
+ */
+int PhysicalManager::setReferenceFrameFromSurfaceModel(DepthView *referenceFrame, std::string surfaceModelFilename) {
+    if (referenceFrame == NULL || referenceFrame->width != DEPTH_FRAME_WIDTH || referenceFrame->height != DEPTH_FRAME_HEIGHT) {
+        return -1;
+    }
+
+    std::ifstream surfaceModelFile(surfaceModelFilename, std::ios::binary);
+    if (!surfaceModelFile.is_open()) {
+        std::cout << "PhysicalManager: Could not open surface model." << std::endl;
+        return -1;
+    }
+    SurfaceModelHeader header;
+    int surfaceLeftXForY[DEPTH_FRAME_HEIGHT];
+    int surfaceRightXForY[DEPTH_FRAME_HEIGHT];
+    float modelMeanDepths[SURFACE_SUMMARY_ROWS * SURFACE_SUMMARY_COLS];
+    float modelValidFractions[SURFACE_SUMMARY_ROWS * SURFACE_SUMMARY_COLS];
+    surfaceModelFile.read((char *)&header, sizeof(header));
+    surfaceModelFile.read((char *)surfaceLeftXForY, sizeof(surfaceLeftXForY));
+    surfaceModelFile.read((char *)surfaceRightXForY, sizeof(surfaceRightXForY));
+    surfaceModelFile.read((char *)modelMeanDepths, sizeof(modelMeanDepths));
+    surfaceModelFile.read((char *)modelValidFractions, sizeof(modelValidFractions));
+    bool isComplete = !surfaceModelFile.fail() && surfaceModelFile.peek() == EOF;
+    surfaceModelFile.close();
+
+    if (!isComplete || std::memcmp(header.magic, SURFACE_MODEL_MAGIC, SURFACE_MODEL_MAGIC_LENGTH) != 0 ||
+        header.version != SURFACE_MODEL_VERSION || header.width != DEPTH_FRAME_WIDTH || header.height != DEPTH_FRAME_HEIGHT ||
+        header.summaryCols != SURFACE_SUMMARY_COLS || header.summaryRows != SURFACE_SUMMARY_ROWS) {
+        std::cout << "PhysicalManager: Not a surface model." << std::endl;
+        return -1;
+    }
+    // Copied bytewise, so padding is checksummed as it was written
+    SurfaceModelHeader checksummedHeader;
+    std::memcpy((void *)&checksummedHeader, &header, sizeof(header));
+    checksummedHeader.checksum = 0;
+    uint64_t checksum = CHECKSUM_INITIAL;
+    checksum = checksumWords(checksum, &checksummedHeader, sizeof(checksummedHeader));
+    checksum = checksumWords(checksum, surfaceLeftXForY, sizeof(surfaceLeftXForY));
+    checksum = checksumWords(checksum, surfaceRightXForY, sizeof(surfaceRightXForY));
+    checksum = checksumWords(checksum, modelMeanDepths, sizeof(modelMeanDepths));
+    checksum = checksumWords(checksum, modelValidFractions, sizeof(modelValidFractions));
+    if (checksum != header.checksum) {
+        std::cout << "PhysicalManager: Surface model is corrupt." << std::endl;
+        return -1;
+    }
+    // DetectionParameters and CameraIntrinsics are all 4-byte fields, so have no padding to differ
+    if (std::memcmp(&header.parameters, &this->parameters, sizeof(DetectionParameters)) != 0) {
+        std::cout << "PhysicalManager: Surface model is for other detection parameters." << std::endl;
+        return -1;
+    }
+    if (std::memcmp(&header.cameraIntrinsics, &this->cameraIntrinsics, sizeof(CameraIntrinsics)) != 0) {
+        std::cout << "PhysicalManager: Surface model is for other camera intrinsics." << std::endl;
+        return -1;
+    }
+
+    // Fingerprint the new reference as the model's was, and compare block by block
+    float meanDepths[SURFACE_SUMMARY_ROWS * SURFACE_SUMMARY_COLS];
+    float validFractions[SURFACE_SUMMARY_ROWS * SURFACE_SUMMARY_COLS];
+    this->summarizeDepths(referenceFrame, meanDepths, validFractions);
+    for (int i = 0; i < SURFACE_SUMMARY_ROWS * SURFACE_SUMMARY_COLS; i++) {
+        bool isValidSimilar = std::abs(validFractions[i] - modelValidFractions[i]) <= SURFACE_MODEL_VALID_FRACTION_TOLERANCE;
+        bool isMostlyValid = validFractions[i] >= SURFACE_SUMMARY_VALID_FRACTION_MIN && modelValidFractions[i] >= SURFACE_SUMMARY_VALID_FRACTION_MIN;
+        bool isDepthSimilar = !isMostlyValid || std::abs(meanDepths[i] - modelMeanDepths[i]) <= SURFACE_MODEL_DEPTH_TOLERANCE;
+        if (!isValidSimilar || !isDepthSimilar) {
+            std::cout << "PhysicalManager: Surface has moved since its surface model was saved." << std::endl;
+            return -1;
+        }
+    }
+
+    this->referenceView = *referenceFrame;
+    this->referenceFrame = &this->referenceView;
+    this->surfaceRegressionEqA = header.surfaceRegressionEqA;
+    this->surfaceRegressionEqB = header.surfaceRegressionEqB;
+    this->hasSurfacePlane = (header.hasSurfacePlane != 0);
+    std::memcpy(this->surfacePlaneNormal, header.surfacePlaneNormal, sizeof(this->surfacePlaneNormal));
+    this->surfacePlaneDistance = header.surfacePlaneDistance;
+    this->updateSurfaceRegressionDepths();
+    std::memcpy(this->surfaceLeftXForY, surfaceLeftXForY, sizeof(surfaceLeftXForY));
+    std::memcpy(this->surfaceRightXForY, surfaceRightXForY, sizeof(surfaceRightXForY));
+    this->resetDrift();
+    return 0;
+}
+
+/*
+ * Saves the surface fitted to the reference frame, with a summary of the reference's depths to recognize the surface by
+ * Output: 0 on success, -1 if there is no reference or the surface model could not be written
+ */
+int PhysicalManager::writeSurfaceModel(std::string surfaceModelFilename) {
+    if (this->referenceFrame == NULL) {
+        std::cout << "PhysicalManager: Surface model written before setting a reference frame." << std::endl;
+        return -1;
+    }
+
+    float meanDepths[SURFACE_SUMMARY_ROWS * SURFACE_SUMMARY_COLS];
+    float validFractions[SURFACE_SUMMARY_ROWS * SURFACE_SUMMARY_COLS];
+    this->summarizeDepths(this->referenceFrame, meanDepths, validFractions);
+
+    SurfaceModelHeader header;
+    std::memset((void *)&header, 0, sizeof(header));
+    std::memcpy(header.magic, SURFACE_MODEL_MAGIC, SURFACE_MODEL_MAGIC_LENGTH);
+    header.version = SURFACE_MODEL_VERSION;
+    header.width = DEPTH_FRAME_WIDTH;
+    header.height = DEPTH_FRAME_HEIGHT;
+    header.summaryCols = SURFACE_SUMMARY_COLS;
+    header.summaryRows = SURFACE_SUMMARY_ROWS;
+    header.parameters = this->parameters;
+    header.surfaceRegressionEqA = this->surfaceRegressionEqA;
+    header.surfaceRegressionEqB = this->surfaceRegressionEqB;
+    header.cameraIntrinsics = this->cameraIntrinsics;
+    if (this->hasSurfacePlane) {
+        header.hasSurfacePlane = 1;
+        std::memcpy(header.surfacePlaneNormal, this->surfacePlaneNormal, sizeof(this->surfacePlaneNormal));
+        header.surfacePlaneDistance = this->surfacePlaneDistance;
+    }
+    // The header is checksummed with checksum zeroed, so the surface it describes is covered too
+    uint64_t checksum = CHECKSUM_INITIAL;
+    checksum = checksumWords(checksum, &header, sizeof(header));
+    checksum = checksumWords(checksum, this->surfaceLeftXForY, sizeof(int) * DEPTH_FRAME_HEIGHT);
+    checksum = checksumWords(checksum, this->surfaceRightXForY, sizeof(int) * DEPTH_FRAME_HEIGHT);
+    checksum = checksumWords(checksum, meanDepths, sizeof(meanDepths));
+    checksum = checksumWords(checksum, validFractions, sizeof(validFractions));
+    header.checksum = checksum;
+
+    std::ofstream surfaceModelFile(surfaceModelFilename, std::ios::binary | std::ios::trunc);
+    if (!surfaceModelFile.is_open()) {
+        std::cout << "PhysicalManager: Could not write surface model." << std::endl;
+        return -1;
+    }
+    surfaceModelFile.write((char *)&header, sizeof(header));
+    surfaceModelFile.write((char *)this->surfaceLeftXForY, sizeof(int) * DEPTH_FRAME_HEIGHT);
+    surfaceModelFile.write((char *)this->surfaceRightXForY, sizeof(int) * DEPTH_FRAME_HEIGHT);
+    surfaceModelFile.write((char *)meanDepths, sizeof(meanDepths));
+    surfaceModelFile.write((char *)validFractions, sizeof(validFractions));
+    surfaceModelFile.close();
+    if (surfaceModelFile.fail()) {
+        std::cout << "PhysicalManager: Could not write surface model." << std::endl;
+        return -1;
+    }
     return 0;
 }
 
-Interaction *PhysicalManager::detectInteraction(libfreenect2::Frame *depthFrame, std::string interactionPPMFilename) {
+Interaction *PhysicalManager::detectInteraction(DepthView *depthFrame, std::string interactionPPMFilename) {
     assert(depthFrame->width == DEPTH_FRAME_WIDTH);
     assert(depthFrame->height == DEPTH_FRAME_HEIGHT);
-    assert(depthFrame->bytes_per_pixel == DEPTH_FRAME_BYTES_PER_PIXEL);
 
     // If there is no current referenceFrame, set depthFrame as the referenceFrame
     // This will set surfaceReference data if it does not already exist
@@ -99,6 +411,8 @@ Interaction *PhysicalManager::detectInteraction(libfreenect2::Frame *depthFrame,
         this->setReferenceFrame(depthFrame);
     }
 
+    this->labelDuration = std::chrono::steady_clock::duration::zero();
+
     bool shouldOutputInteractionPPM = interactionPPMFilename.length() > 0;
     std::string *pixelColors;
     if (shouldOutputInteractionPPM) {
@@ -118,7 +432,7 @@ Interaction *PhysicalManager::detectInteraction(libfreenect2::Frame *depthFrame,
         for (int x = surfaceLeftX; x < depthFrame->width && x < surfaceRightX; x++) {
 
             float pixelDepth = this->pixelDepth(depthFrame, x, y);
-            bool isPixelSurfaceAnomaly = this->isPixelSurfaceAnomaly(depthFrame, x, y, DEPTH_SMOOTHING_DELTA);
+            bool isPixelSurfaceAnomaly = this->isPixelSurfaceAnomaly(depthFrame, x, y, this->parameters.depthSmoothingDelta);
 
             std::string pixelColor = PIXEL_DEFAULT;
             if (isPixelSurfaceAnomaly) {
@@ -132,15 +446,20 @@ Interaction *PhysicalManager::detectInteraction(libfreenect2::Frame *depthFrame,
                 // Anomaly test: If the pixel depth differs significantly from the surface and reference
                 if (isPixelSurfaceAnomaly) {
                     // Anomaly edge test: If the pixel is on the edge of the anomaly (where the interaction would be)
-                    bool isPixelSurfaceAnomalyEdge = this->isPixelSurfaceAnomalyEdge(depthFrame, x, y, DEPTH_SMOOTHING_DELTA);
+                    bool isPixelSurfaceAnomalyEdge = this->isPixelSurfaceAnomalyEdge(depthFrame, x, y, this->parameters.depthSmoothingDelta);
                     if (isPixelSurfaceAnomalyEdge) {
                         // Variance test: If the variance around the pixel is small enough for it to be near the surface
-                        float variance = this->depthVariance(depthFrame, x, y, VARIANCE_BOX_SIDE_LENGTH);
-                        bool isAnomalyNearSurface = variance <= INTERACTION_VARIANCE_MAX;
+                        float variance = this->depthVariance(depthFrame, x, y, this->parameters.varianceBoxSideLength);
+                        bool isAnomalyNearSurface = variance <= this->parameters.varianceMax;
                         if (isAnomalyNearSurface) {
                             pixelColor = PIXEL_INTERACTION;
                             // Size test: If the anomaly is significantly large
-                            bool isAnomalySignificant = this->isAnomalySizeAtLeast(depthFrame, x, y, INTERACTION_ANOMALY_SIZE_MIN, DEPTH_SMOOTHING_DELTA);
+                            std::chrono::steady_clock::time_point labelStart = std::chrono::steady_clock::now();
+                            bool isAnomalySignificant = this->isAnomalySizeAtLeast(depthFrame, x, y, this->parameters.anomalySizeMin, this->parameters.depthSmoothingDelta);
+                            if (this->labelDuration == std::chrono::steady_clock::duration::zero()) {
+                                this->labelStartTime = labelStart;
+                            }
+                            this->labelDuration += std::chrono::steady_clock::now() - labelStart;
                             if (isAnomalySignificant) {
                                 // Pixel is confirmed a significant point of interaction with the surface
                                 interaction = new Interaction();
@@ -178,23 +497,161 @@ Interaction *PhysicalManager::detectInteraction(libfreenect2::Frame *depthFrame,
 }
 
 Interaction *PhysicalManager::detectInteraction(std::string depthFrameFilename, std::string interactionPPMFilename) {
-    libfreenect2::Frame *depthFrame = this->readDepthFrameFromFile(depthFrameFilename);
-    Interaction *interaction = this->detectInteraction(depthFrame, interactionPPMFilename);
-    free(depthFrame->data);
-    delete depthFrame;
+    DepthBuffer *depthBuffer = this->readDepthFrameFromFile(depthFrameFilename);
+    if (depthBuffer == NULL) {
+        return NULL;
+    }
+    Interaction *interaction = this->detectInteraction(depthBuffer->getView(), interactionPPMFilename);
+    depthBuffer->release();
     return interaction;
 }
 
-bool PhysicalManager::isPixelAnomaly(libfreenect2::Frame *depthFrame, int x, int y, int delta) {
+/*
+ * Gets the time the last detectInteraction() spent measuring anomalies' sizes, as one span from the first measurement
+ * Output: whether any anomaly was measured
+ */
+bool PhysicalManager::getLabelSpan(std::chrono::steady_clock::time_point *start, std::chrono::steady_clock::time_point *end) {
+    if (this->labelDuration == std::chrono::steady_clock::duration::zero()) {
+        return false;
+    }
+    *start = this->labelStartTime;
+    *end = this->labelStartTime + this->labelDuration;
+    return true;
+}
+
+/*
+ * Follows slow drift of the surface (as the Kinect warms up or its mount settles) without fitting the surface again
+ * Depths on the rows the regression was fitted from are added to rolling sums, and the regression is adjusted once
+ * it would move the surface more than DRIFT_DEPTH_TOLERANCE there, after which the bounds follow a few rows a frame
+ * A surface plane is followed the same way, from the same rows on columns across the surface
+ * Input: depthFrame had no interaction, so its surface pixels are untouched
+ * Output: 1 if the surface was adjusted, 0 if not, or -1 if there is no reference
+ */
+int PhysicalManager::compensateDrift(DepthView *depthFrame) {
+    if (this->referenceFrame == NULL) {
+        return -1;
+    }
+    if (this->isReferenceFrame(depthFrame)) {
+        return 0;
+    }
+
+    for (int i = 0; i < DRIFT_BOUNDS_ROWS_PER_FRAME && this->driftBoundsY >= 0; i++) {
+        this->adjustSurfaceBoundsForRow(depthFrame, this->driftBoundsY);
+        this->driftBoundsY--;
+    }
+
+    // Sample only pixels detection takes as surface, so a hand above the surface is not fitted
+    double lnYs[REGRESSION_N];
+    double lnDepths[REGRESSION_N];
+    float planePoints[DRIFT_PLANE_SAMPLE_COLS * REGRESSION_N][3];
+    int sampleCount = 0;
+    int planePointCount = 0;
+    for (int i = 0; i < REGRESSION_N; i += DRIFT_SAMPLE_ROW_STRIDE) {
+        int y = this->surfaceRegressionBottomY - i;
+        if (y <= 0) {
+            break;
+        }
+        for (int col = 0; col < DRIFT_PLANE_SAMPLE_COLS; col++) {
+            bool isCenter = (col == DRIFT_PLANE_SAMPLE_COLS / 2);
+            if (!isCenter && !this->hasSurfacePlane) {
+                continue;
+            }
+            int x = ((col + 1) * depthFrame->width) / (DRIFT_PLANE_SAMPLE_COLS + 1);
+            if (x < this->surfaceLeftXForY[y] || this->surfaceRightXForY[y] < x) {
+                continue;
+            }
+            float depth = this->pixelDepth(depthFrame, x, y);
+            if (!DEPTH_VALID(depth) || !this->isPixelOnSurface(depthFrame, x, y, this->parameters.depthSmoothingDelta)) {
+                continue;
+            }
+            if (isCenter) {
+                lnYs[sampleCount] = std::log((double)y);
+                lnDepths[sampleCount] = std::log((double)depth);
+                sampleCount++;
+            }
+            if (this->hasSurfacePlane) {
+                planePoints[planePointCount][0] = depth * this->rayX[DEPTH_FRAME_2D_TO_1D(x,y)];
+                planePoints[planePointCount][1] = depth * this->rayY[DEPTH_FRAME_2D_TO_1D(x,y)];
+                planePoints[planePointCount][2] = depth;
+                planePointCount++;
+            }
+        }
+    }
+    if (sampleCount == 0 && planePointCount == 0) {
+        return 0;
+    }
+    this->driftSums.decay(DRIFT_DECAY);
+    for (int i = 0; i < sampleCount; i++) {
+        this->driftSums.add(lnYs[i], lnDepths[i], 1);
+    }
+    this->driftPlaneSums.decay(DRIFT_DECAY);
+    for (int i = 0; i < planePointCount; i++) {
+        this->driftPlaneSums.add(planePoints[i][0], planePoints[i][1], planePoints[i][2], 1);
+    }
+    this->driftFrameCount++;
+    if (this->driftFrameCount < DRIFT_FRAMES_MIN) {
+        return 0;
+    }
+
+    // Compare the rolling regression to the current one at the lowest and highest sampled rows
+    int yBottom = this->surfaceRegressionBottomY;
+    int yTop = std::max(1, this->surfaceRegressionBottomY - REGRESSION_N + 1);
+    bool isRegressionAdjusted = false;
+    float A = 0;
+    float B = 0;
+    if (this->driftSums.solve(&A, &B)) {
+        float bottomChange = A * std::pow(yBottom, B) - this->surfaceRegressionEqA * std::pow(yBottom, this->surfaceRegressionEqB);
+        float topChange = A * std::pow(yTop, B) - this->surfaceRegressionEqA * std::pow(yTop, this->surfaceRegressionEqB);
+        if (std::abs(bottomChange) > DRIFT_DEPTH_TOLERANCE || std::abs(topChange) > DRIFT_DEPTH_TOLERANCE) {
+            this->surfaceRegressionEqA = A;
+            this->surfaceRegressionEqB = B;
+            isRegressionAdjusted = true;
+        }
+    }
+
+    // Compare the rolling plane to the current one at the corners of the sampled pixels
+    bool isPlaneAdjusted = false;
+    float normal[3];
+    float distance = 0;
+    if (this->hasSurfacePlane && this->driftPlaneSums.solve(normal, &distance)) {
+        int cornerXs[2] = {depthFrame->width / (DRIFT_PLANE_SAMPLE_COLS + 1), (DRIFT_PLANE_SAMPLE_COLS * depthFrame->width) / (DRIFT_PLANE_SAMPLE_COLS + 1)};
+        int cornerYs[2] = {yBottom, yTop};
+        for (int i = 0; i < 4 && !isPlaneAdjusted; i++) {
+            int pixel = DEPTH_FRAME_2D_TO_1D(cornerXs[i % 2], cornerYs[i / 2]);
+            float factor = normal[0] * this->rayX[pixel] + normal[1] * this->rayY[pixel] + normal[2];
+            float currentFactor = this->surfacePlaneFactors[pixel];
+            isPlaneAdjusted = factor <= 0 || currentFactor <= 0 ||
+                              std::abs(distance / factor - this->surfacePlaneDistance / currentFactor) > DRIFT_DEPTH_TOLERANCE;
+        }
+        if (isPlaneAdjusted) {
+            std::memcpy(this->surfacePlaneNormal, normal, sizeof(normal));
+            this->surfacePlaneDistance = distance;
+        }
+    }
+
+    if (!isRegressionAdjusted && !isPlaneAdjusted) {
+        return 0;
+    }
+    // With a plane, the regression only gives virtual mapping its curve, so the surface itself has not moved
+    if (isPlaneAdjusted || !this->hasSurfacePlane) {
+        this->updateSurfaceRegressionDepths();
+        this->driftBoundsY = depthFrame->height - 1;
+    }
+    this->driftFrameCount = 0;
+    this->driftAdjustmentCount++;
+    return 1;
+}
+
+bool PhysicalManager::isPixelAnomaly(DepthView *depthFrame, int x, int y, int delta) {
     return (
         // depthFrame is the reference (this is a weak constraint, so always set a reference), or
-        (depthFrame == this->referenceFrame) ||
+        this->isReferenceFrame(depthFrame) ||
         // Pixel is not similar to the reference frame
         !this->isPixelOnReference(depthFrame, x, y, delta)
     );
 }
 
-bool PhysicalManager::isPixelSurfaceAnomaly(libfreenect2::Frame *depthFrame, int x, int y, int delta) {
+bool PhysicalManager::isPixelSurfaceAnomaly(DepthView *depthFrame, int x, int y, int delta) {
     return (
         // Pixel is not on the surface, and
         !this->isPixelOnSurface(depthFrame, x, y, delta) &&
@@ -205,7 +662,7 @@ bool PhysicalManager::isPixelSurfaceAnomaly(libfreenect2::Frame *depthFrame, int
     );
 }
 
-bool PhysicalManager::isPixelSurfaceAnomalyEdge(libfreenect2::Frame *depthFrame, int x, int y, int delta) {
+bool PhysicalManager::isPixelSurfaceAnomalyEdge(DepthView *depthFrame, int x, int y, int delta) {
     // Pixel anomaly edge if a neighboring point to the side or below is not an anomaly
     for (int movingY = y; movingY <= y + 1; movingY++) {
         if (0 <= movingY && movingY < depthFrame->height) {
@@ -221,14 +678,14 @@ bool PhysicalManager::isPixelSurfaceAnomalyEdge(libfreenect2::Frame *depthFrame,
     return false;
 }
 
-bool PhysicalManager::isAnomalySizeAtLeast(libfreenect2::Frame *depthFrame, int x, int y, int minSize, int delta) {
+bool PhysicalManager::isAnomalySizeAtLeast(DepthView *depthFrame, int x, int y, int minSize, int delta) {
     int count = 0;
 
     if (!this->isPixelAnomaly(depthFrame, x, y, delta)) {
         return count;
     }
 
-    bool depthFrameIsNotReference = (depthFrame != this->referenceFrame);
+    bool depthFrameIsNotReference = !this->isReferenceFrame(depthFrame);
 
     // Queue of coordinates to check
     std::queue<Coord2D> coordsToCheck;
@@ -258,7 +715,7 @@ bool PhysicalManager::isAnomalySizeAtLeast(libfreenect2::Frame *depthFrame, int
                         // If the neighboring point is also a disturbance, add it to the queue to check
                         bool neighborIsAnomaly;
                         if (depthFrameIsNotReference) {
-                            neighborIsAnomaly = this->isPixelAnomaly(depthFrame, movingX, movingY, REFERENCE_DEPTH_SMOOTHING_DELTA);
+                            neighborIsAnomaly = this->isPixelAnomaly(depthFrame, movingX, movingY, this->parameters.referenceDepthSmoothingDelta);
                         } else {
                             neighborIsAnomaly = this->isPixelSurfaceAnomaly(depthFrame, movingX, movingY, delta);
                         }
@@ -276,21 +733,16 @@ bool PhysicalManager::isAnomalySizeAtLeast(libfreenect2::Frame *depthFrame, int
     return false;
 }
 
-float PhysicalManager::pixelDepth(libfreenect2::Frame *depthFrame, int x, int y, int delta) {
+float PhysicalManager::pixelDepth(DepthView *depthFrame, int x, int y, int delta) {
     float depthSum = 0;
     int depthSize = 0;
+    float millimetersPerUnit = depthFrame->millimetersPerUnit();
     for (int movingY = y - delta; movingY <= y + delta; movingY++) {
         if (0 <= movingY && movingY < depthFrame->height) {
+            const float *depthRow = depthFrame->row(movingY);
             for (int movingX = x - delta; movingX <= x + delta; movingX++) {
                 if (0 <= movingX && movingX < depthFrame->width) {
-                    int offset = (movingY * depthFrame->width) + movingX;
-                    int byte_offset = offset * depthFrame->bytes_per_pixel;
-                    unsigned char depthChar[4] = {depthFrame->data[byte_offset + 0],
-                                                  depthFrame->data[byte_offset + 1],
-                                                  depthFrame->data[byte_offset + 2],
-                                                  depthFrame->data[byte_offset + 3]};
-                    float depth;
-                    std::memcpy(&depth, &depthChar, sizeof(depth));
+                    float depth = depthRow[movingX] * millimetersPerUnit;
                     if (DEPTH_VALID(depth)) {
                         depthSum += depth;
                         depthSize++;
@@ -306,11 +758,18 @@ float PhysicalManager::pixelDepth(libfreenect2::Frame *depthFrame, int x, int y,
     return depthAvg;
 }
 
+/*
+ * Output: whether depthFrame views the same depths as the reference frame
+ */
+bool PhysicalManager::isReferenceFrame(DepthView *depthFrame) {
+    return this->referenceFrame != NULL && depthFrame->data == this->referenceFrame->data;
+}
+
 float PhysicalManager::pixelSurfaceRegression(int x, int y) {
     return this->surfaceRegression[DEPTH_FRAME_2D_TO_1D(x,y)];
 }
 
-bool PhysicalManager::isPixelOnSurface(libfreenect2::Frame *depthFrame, int x, int y, int delta) {
+bool PhysicalManager::isPixelOnSurface(DepthView *depthFrame, int x, int y, int delta) {
     int yNext = y - 1;
     if (y == 0) yNext = y + 1;
     
@@ -322,23 +781,23 @@ bool PhysicalManager::isPixelOnSurface(libfreenect2::Frame *depthFrame, int x, i
 
     float depth = this->pixelDepth(depthFrame, x, y, delta);
     float depthNext = this->pixelDepth(depthFrame, x, yNext, delta);
-    float depthChange = depth - depthNext;
 
-    float surfaceDepth = this->pixelSurfaceRegression(x, y);
-    float surfaceDepthNext = this->pixelSurfaceRegression(x, yNext);
-    float surfaceDepthChange = surfaceDepth - surfaceDepthNext;
+    // Heights above the surface, along the plane's normal if it is a plane and otherwise along the ray,
+    // so the surface is at height 0 with no change in height to an adjacent point
+    float height = this->heightAboveSurface(x, y, depth);
+    float heightNext = this->heightAboveSurface(x, yNext, depthNext);
 
     // Checks if depth is within 200 mm of expected surface depth
     // This is not very agressive to avoid dealing with Kinect innaccuracies
-    bool depthSimilarToSurface = std::abs(depth - surfaceDepth) < INTERACTION_SURFACE_DEPTH_DIFFERENCE_MIN;
+    bool depthSimilarToSurface = std::abs(height) < this->parameters.surfaceDepthDifferenceMin;
 
     // Checks if the change in depth to an adjacent point is within 5 mm of the expected surface change
-    bool slopeSimilarToSurface = std::abs(depthChange - surfaceDepthChange) < INTERACTION_SURFACE_SLOPE_DIFFERENCE_MIN;
+    bool slopeSimilarToSurface = std::abs(height - heightNext) < this->parameters.surfaceSlopeDifferenceMin;
 
     return depthSimilarToSurface && slopeSimilarToSurface;
 }
 
-bool PhysicalManager::isPixelOnReference(libfreenect2::Frame *depthFrame, int x, int y, int delta) {
+bool PhysicalManager::isPixelOnReference(DepthView *depthFrame, int x, int y, int delta) {
     int yNext = y - 1;
     if (y == 0) yNext = y + 1;
 
@@ -357,15 +816,34 @@ bool PhysicalManager::isPixelOnReference(libfreenect2::Frame *depthFrame, int x,
     float referenceDepthChange = referenceDepth - referenceDepthNext;
 
     // Checks if depth is within 100 mm of reference depth
-    bool depthSimilarToReference = std::abs(depth - referenceDepth) < INTERACTION_REFERENCE_DEPTH_DIFFERENCE_MIN;
+    bool depthSimilarToReference = std::abs(depth - referenceDepth) < this->parameters.referenceDepthDifferenceMin;
 
     // Checks if the change in depth to an adjacent point is within 5 mm of the reference change
-    bool slopeSimilarToReference = std::abs(depthChange - referenceDepthChange) < INTERACTION_REFERENCE_SLOPE_DIFFERENCE_MIN;
+    bool slopeSimilarToReference = std::abs(depthChange - referenceDepthChange) < this->parameters.referenceSlopeDifferenceMin;
 
     return (depthSimilarToReference && slopeSimilarToReference);
 }
 
-bool PhysicalManager::isPixelOnSurfaceEdge(libfreenect2::Frame *depthFrame, int x, int y) {
+/*
+ * Output: whether every pixel within depthSmoothingDelta of (x, y) is on the surface, as pixels within the surface bounds are
+ */
+bool PhysicalManager::isPixelSurfaceInterior(DepthView *depthFrame, int x, int y) {
+    int delta = this->parameters.depthSmoothingDelta;
+    for (int movingY = y - delta; movingY <= y + delta; movingY++) {
+        if (0 <= movingY && movingY < depthFrame->height) {
+            for (int movingX = x - delta; movingX <= x + delta; movingX++) {
+                if (0 <= movingX && movingX < depthFrame->width) {
+                    if (!this->isPixelOnSurface(depthFrame, movingX, movingY, this->parameters.depthSmoothingDelta)) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool PhysicalManager::isPixelOnSurfaceEdge(DepthView *depthFrame, int x, int y) {
     return (
         // Pixel is top of frame, or
         y - 1 < 0 ||
@@ -385,21 +863,13 @@ bool PhysicalManager::isPixelOnSurfaceEdge(libfreenect2::Frame *depthFrame, int
 }
 
 int PhysicalManager::updateSurfaceRegressionForReference() {
-    libfreenect2::Frame *depthFrame = this->referenceFrame;
+    DepthView *depthFrame = this->referenceFrame;
 
     // x reference is the center of the frame
     int surfaceCenterX = depthFrame->width / 2;
 
     // y reference is the bottom of the surface
-    int surfaceBottomY;
-    for (surfaceBottomY = depthFrame->height - 1; surfaceBottomY > 0; surfaceBottomY--) {
-        float depth = this->pixelDepth(depthFrame, surfaceCenterX, surfaceBottomY);
-        if (DEPTH_MIN < depth && depth < DEPTH_MAX) {
-            break;
-        }
-    }
-    // Subtract a few extra pixels just to be sure
-    surfaceBottomY -= 20;
+    int surfaceBottomY = this->findSurfaceRegressionBottomY(depthFrame);
 
     // Capture surface depth data, starting at the y reference and moving up on the x reference for REGRESSION_N pixels
     float yRefs[REGRESSION_N];
@@ -416,10 +886,38 @@ int PhysicalManager::updateSurfaceRegressionForReference() {
     this->surfaceRegressionEqA = A;
     this->surfaceRegressionEqB = B;
 
-    // Compute surfaceRegression depths
-    for (int y = 0; y < depthFrame->height; y++) {
+    return this->updateSurfaceRegressionDepths();
+}
+
+/*
+ * Output: the lowest row the surface regression is fitted from, a little above the bottom of the surface at the center column
+ */
+int PhysicalManager::findSurfaceRegressionBottomY(DepthView *depthFrame) {
+    int surfaceCenterX = depthFrame->width / 2;
+    int surfaceBottomY;
+    for (surfaceBottomY = depthFrame->height - 1; surfaceBottomY > 0; surfaceBottomY--) {
+        float depth = this->pixelDepth(depthFrame, surfaceCenterX, surfaceBottomY);
+        if (this->parameters.depthMin < depth && depth < this->parameters.depthMax) {
+            break;
+        }
+    }
+    // Subtract a few extra pixels just to be sure
+    return surfaceBottomY - 20;
+}
+
+/*
+ * Computes surfaceRegression depths from the surface plane, or else from the regression parameters A and B
+ */
+int PhysicalManager::updateSurfaceRegressionDepths() {
+    if (this->hasSurfacePlane) {
+        return this->updateSurfacePlaneDepths();
+    }
+
+    float A = this->surfaceRegressionEqA;
+    float B = this->surfaceRegressionEqB;
+    for (int y = 0; y < DEPTH_FRAME_HEIGHT; y++) {
         float expectedSurfaceDepth = (A) * std::pow(y, B);
-        for (int x = 0; x < depthFrame->width; x++) {
+        for (int x = 0; x < DEPTH_FRAME_WIDTH; x++) {
             this->surfaceRegression[DEPTH_FRAME_2D_TO_1D(x,y)] = expectedSurfaceDepth;
         }
     }
@@ -427,29 +925,145 @@ int PhysicalManager::updateSurfaceRegressionForReference() {
     return 0;
 }
 
+/*
+ * Fits the surface plane to the reference: RANSAC over sampled pixels finds the plane most of them are on,
+ * which least squares then refines over the samples on it
+ * Samples are only taken from the regression's band, above its bottom row and near its depths, so walls, the floor,
+ * and objects beside the surface cannot outvote it
+ * Output: 0 on success, -1 if there are too few samples, leaving the regression as the surface
+ */
+int PhysicalManager::updateSurfacePlaneForReference() {
+    DepthView *depthFrame = this->referenceFrame;
+    int surfaceBottomY = std::min(this->findSurfaceRegressionBottomY(depthFrame), depthFrame->height - 1);
+    std::vector<float> points;
+    for (int y = 0; y <= surfaceBottomY; y += PLANE_SAMPLE_STRIDE) {
+        for (int x = 0; x < depthFrame->width; x += PLANE_SAMPLE_STRIDE) {
+            float depth = this->pixelDepth(depthFrame, x, y);
+            if (DEPTH_VALID(depth) && std::abs(depth - this->pixelSurfaceRegression(x, y)) < this->parameters.surfaceDepthDifferenceMin) {
+                points.push_back(depth * this->rayX[DEPTH_FRAME_2D_TO_1D(x,y)]);
+                points.push_back(depth * this->rayY[DEPTH_FRAME_2D_TO_1D(x,y)]);
+                points.push_back(depth);
+            }
+        }
+    }
+    int pointCount = (int)points.size() / 3;
+    if (pointCount < 3) {
+        std::cout << "PhysicalManager: Too few depths to fit the surface plane." << std::endl;
+        return -1;
+    }
+
+    // Each run keeps its own best plane, and the first run with the most inliers wins, whichever finishes first
+    PlaneCandidate candidates[PLANE_RANSAC_RUN_COUNT];
+    ThreadPool::shared()->run(PLANE_RANSAC_RUN_COUNT, [&](int run) {
+        int iterations = (PLANE_RANSAC_ITERATIONS * (run + 1)) / PLANE_RANSAC_RUN_COUNT - (PLANE_RANSAC_ITERATIONS * run) / PLANE_RANSAC_RUN_COUNT;
+        findPlaneCandidate(points, PLANE_RANSAC_SEED + run, iterations, &candidates[run]);
+    });
+    PlaneCandidate *best = &candidates[0];
+    for (int run = 1; run < PLANE_RANSAC_RUN_COUNT; run++) {
+        if (candidates[run].inlierCount > best->inlierCount) {
+            best = &candidates[run];
+        }
+    }
+    float normal[3];
+    std::memcpy(normal, best->normal, sizeof(normal));
+    float distance = best->distance;
+    int inlierCount = best->inlierCount;
+
+    for (int round = 0; round < PLANE_REFINE_ROUNDS; round++) {
+        PlaneSums sums;
+        for (int i = 0; i < pointCount; i++) {
+            const float *point = &points[3 * i];
+            float pointDistance = normal[0] * point[0] + normal[1] * point[1] + normal[2] * point[2] - distance;
+            if (std::abs(pointDistance) < PLANE_INLIER_DISTANCE) {
+                sums.add(point[0], point[1], point[2], 1);
+            }
+        }
+        if (!sums.solve(normal, &distance)) {
+            break;
+        }
+    }
+    if (inlierCount < 3) {
+        std::cout << "PhysicalManager: Too few depths to fit the surface plane." << std::endl;
+        return -1;
+    }
+
+    std::memcpy(this->surfacePlaneNormal, normal, sizeof(normal));
+    this->surfacePlaneDistance = distance;
+    this->hasSurfacePlane = true;
+    return this->updateSurfacePlaneDepths();
+}
+
+/*
+ * Runs RANSAC iterations, each finding how many samples are on the plane through three random samples
+ * Input: samples as x, y, z triples (mm), seed of the samples chosen, number of iterations
+ * Output: the plane most samples were on, and how many (0 if every plane chosen was degenerate)
+ */
+void PhysicalManager::findPlaneCandidate(const std::vector<float> &points, unsigned int seed, int iterations, PlaneCandidate *candidate) {
+    int pointCount = (int)points.size() / 3;
+    std::mt19937 generator(seed);
+    std::uniform_int_distribution<int> pointDistribution(0, pointCount - 1);
+    candidate->normal[0] = 0;
+    candidate->normal[1] = 0;
+    candidate->normal[2] = 1;
+    candidate->distance = 0;
+    candidate->inlierCount = 0;
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        const float *p0 = &points[3 * pointDistribution(generator)];
+        const float *p1 = &points[3 * pointDistribution(generator)];
+        const float *p2 = &points[3 * pointDistribution(generator)];
+        double u[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+        double v[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+        double n[3] = {u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0]};
+        double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length == 0) {
+            continue;
+        }
+        // Orient the normal away from the camera, so the distance is positive
+        double d = (n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]) / length;
+        double sign = (d < 0) ? -1 : 1;
+        float candidateNormal[3] = {(float)(sign * n[0] / length), (float)(sign * n[1] / length), (float)(sign * n[2] / length)};
+        float candidateDistance = (float)(sign * d);
+
+        int candidateInlierCount = 0;
+        for (int i = 0; i < pointCount; i++) {
+            const float *point = &points[3 * i];
+            float pointDistance = candidateNormal[0] * point[0] + candidateNormal[1] * point[1] + candidateNormal[2] * point[2] - candidateDistance;
+            candidateInlierCount += (std::abs(pointDistance) < PLANE_INLIER_DISTANCE) ? 1 : 0;
+        }
+        if (candidateInlierCount > candidate->inlierCount) {
+            candidate->inlierCount = candidateInlierCount;
+            std::memcpy(candidate->normal, candidateNormal, sizeof(candidate->normal));
+            candidate->distance = candidateDistance;
+        }
+    }
+}
+
+/*
+ * Computes each pixel's plane factor (normal . ray), from which surfaceRegression depths are distance / factor
+ * Rays that do not meet the plane in front of the camera get no surface depth
+ */
+int PhysicalManager::updateSurfacePlaneDepths() {
+    float normalX = this->surfacePlaneNormal[0];
+    float normalY = this->surfacePlaneNormal[1];
+    float normalZ = this->surfacePlaneNormal[2];
+    float distance = this->surfacePlaneDistance;
+    for (int i = 0; i < DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT; i++) {
+        float factor = normalX * this->rayX[i] + (normalY * this->rayY[i] + normalZ);
+        this->surfacePlaneFactors[i] = factor;
+        this->surfaceRegression[i] = (factor > 0) ? distance / factor : 0;
+    }
+    return 0;
+}
+
 int PhysicalManager::updateSurfaceBoundsForReference() {
-    libfreenect2::Frame *depthFrame = this->referenceFrame;
+    DepthView *depthFrame = this->referenceFrame;
 
     for (int y = depthFrame->height - 1; 0 <= y; y--) {
         // Determine left and right bounds of the surface
         this->surfaceLeftXForY[y] = depthFrame->width;
         this->surfaceRightXForY[y] = -1;
         for (int x = 0; x < depthFrame->width; x++) {
-            bool isSurface = true;
-            int delta = DEPTH_SMOOTHING_DELTA;
-            for (int movingY = y - delta; movingY <= y + delta; movingY++) {
-                if (0 <= movingY && movingY < depthFrame->height) {
-                    for (int movingX = x - delta; movingX <= x + delta; movingX++) {
-                        if (0 <= movingX && movingX < depthFrame->width) {
-                            if (!this->isPixelOnSurface(depthFrame, movingX, movingY, DEPTH_SMOOTHING_DELTA)) {
-                                isSurface = false;
-                            }
-                        }
-                    }
-                }
-            }
-
-            if (isSurface) {
+            if (this->isPixelSurfaceInterior(depthFrame, x, y)) {
                 if (this->surfaceLeftXForY[y] >= depthFrame->width) {
                     this->surfaceLeftXForY[y] = x;
                 }
@@ -461,7 +1075,117 @@ int PhysicalManager::updateSurfaceBoundsForReference() {
     return 0;
 }
 
-float PhysicalManager::depthVariance(libfreenect2::Frame *depthFrame, int x, int y, int boxSideLength) {
+/*
+ * Starts drift compensation over from the current regression, seeding the rolling sums with its depths at the sampled rows
+ * as if every sample of a full window of frames matched it, so new samples move it gradually
+ */
+void PhysicalManager::resetDrift() {
+    this->driftSums = DriftSums();
+    this->driftPlaneSums = PlaneSums();
+    this->driftFrameCount = 0;
+    this->driftBoundsY = -1;
+    if (this->referenceFrame == NULL) {
+        return;
+    }
+
+    this->surfaceRegressionBottomY = this->findSurfaceRegressionBottomY(this->referenceFrame);
+    double windowWeight = 1.0 / (1.0 - DRIFT_DECAY);
+    double lnA = std::log((double)this->surfaceRegressionEqA);
+    for (int i = 0; i < REGRESSION_N; i += DRIFT_SAMPLE_ROW_STRIDE) {
+        int y = this->surfaceRegressionBottomY - i;
+        if (y <= 0) {
+            break;
+        }
+        double lnY = std::log((double)y);
+        this->driftSums.add(lnY, lnA + this->surfaceRegressionEqB * lnY, windowWeight);
+
+        for (int col = 0; col < DRIFT_PLANE_SAMPLE_COLS && this->hasSurfacePlane; col++) {
+            int pixel = DEPTH_FRAME_2D_TO_1D(((col + 1) * DEPTH_FRAME_WIDTH) / (DRIFT_PLANE_SAMPLE_COLS + 1), y);
+            float depth = this->surfaceRegression[pixel];
+            if (depth > 0) {
+                this->driftPlaneSums.add(depth * this->rayX[pixel], depth * this->rayY[pixel], depth, windowWeight);
+            }
+        }
+    }
+}
+
+/*
+ * Moves a row's surface bounds to where depthFrame is surface interior, as updateSurfaceBoundsForReference() finds them,
+ * by at most DRIFT_BOUNDS_STEP_MAX pixels a side
+ * Only the pixels at and beside each bound are tested, and rows without surface are left without it
+ */
+void PhysicalManager::adjustSurfaceBoundsForRow(DepthView *depthFrame, int y) {
+    int leftX = this->surfaceLeftXForY[y];
+    int rightX = this->surfaceRightXForY[y];
+    if (leftX > rightX) {
+        return;
+    }
+
+    // Each bound shrinks past pixels that are no longer surface, or else grows over neighbors that now are
+    if (!this->isPixelSurfaceInterior(depthFrame, leftX, y)) {
+        for (int step = 0; step < DRIFT_BOUNDS_STEP_MAX && leftX < rightX; step++) {
+            leftX++;
+            if (this->isPixelSurfaceInterior(depthFrame, leftX, y)) {
+                break;
+            }
+        }
+    } else {
+        for (int step = 0; step < DRIFT_BOUNDS_STEP_MAX && leftX > 0 && this->isPixelSurfaceInterior(depthFrame, leftX - 1, y); step++) {
+            leftX--;
+        }
+    }
+    if (!this->isPixelSurfaceInterior(depthFrame, rightX, y)) {
+        for (int step = 0; step < DRIFT_BOUNDS_STEP_MAX && rightX > leftX; step++) {
+            rightX--;
+            if (this->isPixelSurfaceInterior(depthFrame, rightX, y)) {
+                break;
+            }
+        }
+    } else {
+        for (int step = 0; step < DRIFT_BOUNDS_STEP_MAX && rightX < depthFrame->width - 1 && this->isPixelSurfaceInterior(depthFrame, rightX + 1, y); step++) {
+            rightX++;
+        }
+    }
+
+    this->surfaceLeftXForY[y] = leftX;
+    this->surfaceRightXForY[y] = rightX;
+}
+
+/*
+ * Summarizes a depth frame by blocks, sampling every SURFACE_SUMMARY_STRIDE pixels, to fingerprint its surface
+ * Input: meanDepths and validFractions each hold SURFACE_SUMMARY_ROWS x SURFACE_SUMMARY_COLS blocks, set to
+ *          the mean of each block's valid depths (0 if none) and the fraction of its depths that are valid
+ */
+void PhysicalManager::summarizeDepths(DepthView *depthFrame, float *meanDepths, float *validFractions) {
+    float millimetersPerUnit = depthFrame->millimetersPerUnit();
+    for (int blockRow = 0; blockRow < SURFACE_SUMMARY_ROWS; blockRow++) {
+        int yStart = (blockRow * depthFrame->height) / SURFACE_SUMMARY_ROWS;
+        int yEnd = ((blockRow + 1) * depthFrame->height) / SURFACE_SUMMARY_ROWS;
+        for (int blockCol = 0; blockCol < SURFACE_SUMMARY_COLS; blockCol++) {
+            int xStart = (blockCol * depthFrame->width) / SURFACE_SUMMARY_COLS;
+            int xEnd = ((blockCol + 1) * depthFrame->width) / SURFACE_SUMMARY_COLS;
+            double sumDepths = 0;
+            int validCount = 0;
+            int count = 0;
+            for (int y = yStart; y < yEnd; y += SURFACE_SUMMARY_STRIDE) {
+                const float *row = depthFrame->row(y);
+                for (int x = xStart; x < xEnd; x += SURFACE_SUMMARY_STRIDE) {
+                    float depth = row[x] * millimetersPerUnit;
+                    if (DEPTH_VALID(depth)) {
+                        sumDepths += depth;
+                        validCount++;
+                    }
+                    count++;
+                }
+            }
+            int block = blockRow * SURFACE_SUMMARY_COLS + blockCol;
+            meanDepths[block] = (validCount > 0) ? (float)(sumDepths / validCount) : 0;
+            validFractions[block] = (count > 0) ? (float)validCount / count : 0;
+        }
+    }
+}
+
+float PhysicalManager::depthVariance(DepthView *depthFrame, int x, int y, int boxSideLength) {
 
     // variance = E[X^2] - E[X]^2, ie (mean of squared data) - (mean of data)^2
 
@@ -495,6 +1219,94 @@ float PhysicalManager::depthVariance(libfreenect2::Frame *depthFrame, int x, int
     return variance;
 }
 
+void PhysicalManager::DriftSums::add(double lnY, double lnDepth, double sampleWeight) {
+    this->weight += sampleWeight;
+    this->sumLnY += sampleWeight * lnY;
+    this->sumLnDepth += sampleWeight * lnDepth;
+    this->sumLnYLnY += sampleWeight * lnY * lnY;
+    this->sumLnYLnDepth += sampleWeight * lnY * lnDepth;
+}
+
+void PhysicalManager::DriftSums::decay(double factor) {
+    this->weight *= factor;
+    this->sumLnY *= factor;
+    this->sumLnDepth *= factor;
+    this->sumLnYLnY *= factor;
+    this->sumLnYLnDepth *= factor;
+}
+
+/*
+ * Solves the weighted power regression, as powerRegression() does
+ * Output: whether the samples span enough rows to fit A and B
+ */
+bool PhysicalManager::DriftSums::solve(float *A, float *B) {
+    double denominator = this->weight * this->sumLnYLnY - this->sumLnY * this->sumLnY;
+    if (this->weight <= 0 || denominator <= 0) {
+        return false;
+    }
+    double b = (this->weight * this->sumLnYLnDepth - this->sumLnY * this->sumLnDepth) / denominator;
+    *B = (float)b;
+    *A = (float)std::exp((this->sumLnDepth - b * this->sumLnY) / this->weight);
+    return true;
+}
+
+void PhysicalManager::PlaneSums::add(double x, double y, double z, double sampleWeight) {
+    this->weight += sampleWeight;
+    this->sumX += sampleWeight * x;
+    this->sumY += sampleWeight * y;
+    this->sumZ += sampleWeight * z;
+    this->sumXX += sampleWeight * x * x;
+    this->sumXY += sampleWeight * x * y;
+    this->sumXZ += sampleWeight * x * z;
+    this->sumYY += sampleWeight * y * y;
+    this->sumYZ += sampleWeight * y * z;
+    this->sumZZ += sampleWeight * z * z;
+}
+
+void PhysicalManager::PlaneSums::decay(double factor) {
+    this->weight *= factor;
+    this->sumX *= factor;
+    this->sumY *= factor;
+    this->sumZ *= factor;
+    this->sumXX *= factor;
+    this->sumXY *= factor;
+    this->sumXZ *= factor;
+    this->sumYY *= factor;
+    this->sumYZ *= factor;
+    this->sumZZ *= factor;
+}
+
+/*
+ * Solves the normal equations (sum P P^T) n = sum P by Cramer's rule, for the plane n . P = 1
+ * Output: whether the points span a plane, and if so its unit normal (3 floats) and distance (mm), as normal . P = distance
+ */
+bool PhysicalManager::PlaneSums::solve(float *normal, float *distance) {
+    double a = this->sumXX, b = this->sumXY, c = this->sumXZ;
+    double e = this->sumYY, f = this->sumYZ, i = this->sumZZ;
+    double cofactorX = e * i - f * f;
+    double cofactorY = c * f - b * i;
+    double cofactorZ = b * f - c * e;
+    double determinant = a * cofactorX + b * cofactorY + c * cofactorZ;
+    if (this->weight <= 0 || std::abs(determinant) <= 1e-12 * std::abs(a * e * i)) {
+        return false;
+    }
+    // The matrix is symmetric, so its inverse is the cofactor matrix over the determinant
+    double n[3] = {
+        (cofactorX * this->sumX + cofactorY * this->sumY + cofactorZ * this->sumZ) / determinant,
+        (cofactorY * this->sumX + (a * i - c * c) * this->sumY + (b * c - a * f) * this->sumZ) / determinant,
+        (cofactorZ * this->sumX + (b * c - a * f) * this->sumY + (a * e - b * b) * this->sumZ) / determinant
+    };
+    double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length == 0) {
+        return false;
+    }
+    normal[0] = (float)(n[0] / length);
+    normal[1] = (float)(n[1] / length);
+    normal[2] = (float)(n[2] / length);
+    *distance = (float)(1 / length);
+    return true;
+}
+
 int PhysicalManager::powerRegression(float *x, float *y, int n, float *a, float *b) {
     float sumLnX = 0; // sum ln(x)
     float sumLnY = 0; // sum ln(y)
@@ -516,7 +1328,11 @@ int PhysicalManager::powerRegression(float *x, float *y, int n, float *a, float
     return 0;
 }
 
-libfreenect2::Frame *PhysicalManager::readDepthFrameFromFile(std::string depthFrameFilename) {
+/*
+ * Reads a depth frame straight into a pooled buffer
+ * Output: the buffer, which the caller releases, or NULL if the file could not be read
+ */
+DepthBuffer *PhysicalManager::readDepthFrameFromFile(std::string depthFrameFilename) {
     std::ifstream depthFile(depthFrameFilename, std::ios::binary | std::ios::ate);
     if (!depthFile.is_open()) {
         std::cout << "PhysicalManager: Could not read depth frame." << std::endl;
@@ -525,30 +1341,33 @@ libfreenect2::Frame *PhysicalManager::readDepthFrameFromFile(std::string depthFr
 
     std::ifstream::pos_type pos = depthFile.tellg();
     int byte_count = pos;
+    if (byte_count != DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT * DEPTH_FRAME_BYTES_PER_PIXEL) {
+        std::cout << "PhysicalManager: " << depthFrameFilename << " is not a depth frame." << std::endl;
+        return NULL;
+    }
 
-    char *data = (char *)malloc(sizeof(char) * byte_count);
+    DepthBuffer *depthBuffer = DepthBufferPool::shared()->acquire();
     depthFile.seekg(0, std::ios::beg);
-    depthFile.read(data, byte_count);
+    depthFile.read((char *)depthBuffer->getData(), byte_count);
     depthFile.close();
-
-    libfreenect2::Frame *depthFrame = new libfreenect2::Frame(DEPTH_FRAME_WIDTH, DEPTH_FRAME_HEIGHT, DEPTH_FRAME_BYTES_PER_PIXEL, (unsigned char *)data);
-    return depthFrame;
+    return depthBuffer;
 }
 
-int PhysicalManager::writeDepthFrameToFile(libfreenect2::Frame *depthFrame, std::string depthFrameFilename) {
+int PhysicalManager::writeDepthFrameToFile(DepthView *depthFrame, std::string depthFrameFilename) {
     std::ofstream depthFile(depthFrameFilename, std::ios::binary);
     if (!depthFile.is_open()) {
         std::cout << "PhysicalManager: Could not write depth frame." << std::endl;
         return -1;
     }
 
-    int byte_count = depthFrame->width * depthFrame->height * depthFrame->bytes_per_pixel;
-    depthFile.write((char *)depthFrame->data, byte_count);
+    for (int y = 0; y < depthFrame->height; y++) {
+        depthFile.write((char *)depthFrame->row(y), depthFrame->width * sizeof(float));
+    }
     depthFile.close();
     return 0;
 }
 
-int PhysicalManager::writeDepthFrameToPPM(libfreenect2::Frame *depthFrame, std::string ppmFilename) {
+int PhysicalManager::writeDepthFrameToPPM(DepthView *depthFrame, std::string ppmFilename) {
     std::string *pixelColors = new std::string[depthFrame->width * depthFrame->height];
 
     for (int y = 0; y < depthFrame->height; y++) {
@@ -567,7 +1386,7 @@ int PhysicalManager::writeDepthFrameToPPM(libfreenect2::Frame *depthFrame, std::
     return result;
 }
 
-int PhysicalManager::writeDepthFrameToSurfaceDepthPPM(libfreenect2::Frame *depthFrame, std::string ppmFilename) {
+int PhysicalManager::writeDepthFrameToSurfaceDepthPPM(DepthView *depthFrame, std::string ppmFilename) {
     std::string *pixelColors = new std::string[depthFrame->width * depthFrame->height];
 
     for (int y = 0; y < depthFrame->height; y++) {
@@ -577,7 +1396,7 @@ int PhysicalManager::writeDepthFrameToSurfaceDepthPPM(libfreenect2::Frame *depth
             float depthDifference = std::abs(depth - surfaceDepth);
             
             std::string pixelColor = PIXEL_DEFAULT;
-            if (DEPTH_MIN < depth && depth < DEPTH_MAX) {
+            if (this->parameters.depthMin < depth && depth < this->parameters.depthMax) {
                 pixelColor = "100 0 0"; // dark red
             }
             
@@ -615,7 +1434,7 @@ int PhysicalManager::writeDepthFrameToSurfaceDepthPPM(libfreenect2::Frame *depth
     return result;
 }
 
-int PhysicalManager::writeDepthFrameToSurfaceSlopePPM(libfreenect2::Frame *depthFrame, std::string ppmFilename) {
+int PhysicalManager::writeDepthFrameToSurfaceSlopePPM(DepthView *depthFrame, std::string ppmFilename) {
     std::string *pixelColors = new std::string[depthFrame->width * depthFrame->height];
 
     for (int y = 0; y < depthFrame->height; y++) {
@@ -623,8 +1442,8 @@ int PhysicalManager::writeDepthFrameToSurfaceSlopePPM(libfreenect2::Frame *depth
             int yNext = y - 1;
             if (y == 0) yNext = y + 1;
 
-            float depth = this->pixelDepth(depthFrame, x, y, DEPTH_SMOOTHING_DELTA);
-            float depthNext = this->pixelDepth(depthFrame, x, yNext, DEPTH_SMOOTHING_DELTA);
+            float depth = this->pixelDepth(depthFrame, x, y, this->parameters.depthSmoothingDelta);
+            float depthNext = this->pixelDepth(depthFrame, x, yNext, this->parameters.depthSmoothingDelta);
             float depthChange = depth - depthNext;
 
             float surfaceDepth = this->pixelSurfaceRegression(x, y);
@@ -633,11 +1452,11 @@ int PhysicalManager::writeDepthFrameToSurfaceSlopePPM(libfreenect2::Frame *depth
 
             std::string pixelColor = PIXEL_DEFAULT;
 
-            if (DEPTH_MIN < depth && depth < DEPTH_MAX) {
+            if (this->parameters.depthMin < depth && depth < this->parameters.depthMax) {
                 pixelColor = PIXEL_ANOMALY;
             }
 
-            if (std::abs(depthChange - surfaceDepthChange) < INTERACTION_REFERENCE_SLOPE_DIFFERENCE_MIN) {
+            if (std::abs(depthChange - surfaceDepthChange) < this->parameters.referenceSlopeDifferenceMin) {
                 pixelColor = PIXEL_SURFACE;
             }
             
@@ -23,56 +23,187 @@
 #ifndef PHYSICALMANAGER_H
 #define PHYSICALMANAGER_H
 
+#include <chrono>
+#include <cstdint>
 #include <string>
 #include <vector>
 
+#include "CameraIntrinsics.h"
+#include "DepthBuffer.h"
+#include "DepthView.h"
 #include "Interaction.h"
-#include "KinectReader.h"
 
 namespace virtualMonitor {
 
+// Thresholds used to fit the surface and detect interactions
+// The depth range, smoothing delta, and surface thresholds also fit the surface, so they take effect at the next setReferenceFrame()
+struct DetectionParameters {
+    // Valid depth range (mm)
+    float depthMin;
+    float depthMax;
+    // Half-width of the box averaged for each pixel depth (pixels), on frames and on the reference
+    int depthSmoothingDelta;
+    int referenceDepthSmoothingDelta;
+    // Side length of the box whose variance must stay under varianceMax for an anomaly to be near the surface (pixels)
+    int varianceBoxSideLength;
+    // Smallest depth and slope differences from the fitted surface or reference that count as an anomaly (mm)
+    float surfaceDepthDifferenceMin;
+    float surfaceSlopeDifferenceMin;
+    float referenceDepthDifferenceMin;
+    float referenceSlopeDifferenceMin;
+    // Smallest anomaly counted as an interaction (pixels)
+    int anomalySizeMin;
+    float varianceMax;
+
+    DetectionParameters();
+};
+
+// Sampled blocks of a reference frame, whose depths fingerprint the surface for a surface model
+#define SURFACE_SUMMARY_COLS 16
+#define SURFACE_SUMMARY_ROWS 8
+
+/*
+ * A surface model (.vmsurf) is a SurfaceModelHeader followed by the surface's left and right bounds for each row
+ * (height int32_t each), then the reference depth summary: the mean valid depth and the fraction of valid depths
+ * in each of SURFACE_SUMMARY_ROWS x SURFACE_SUMMARY_COLS blocks (float each).
+ * The surface is the plane if hasSurfacePlane, seen through cameraIntrinsics (all zero without them), and otherwise the regression.
+ * checksum is over the header, with checksum zero, and everything after it (see Checksum.h).
+ */
+struct SurfaceModelHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t summaryCols;
+    uint32_t summaryRows;
+    DetectionParameters parameters;
+    float surfaceRegressionEqA;
+    float surfaceRegressionEqB;
+    uint32_t hasSurfacePlane;
+    CameraIntrinsics cameraIntrinsics;
+    float surfacePlaneNormal[3];
+    float surfacePlaneDistance;
+    uint64_t checksum;
+};
+
 class PhysicalManager {
     private:
-        libfreenect2::Frame *referenceFrame;
+        // rolling sums of the surface regression in log space, ln(depth) = ln(A) + B ln(y), weighted by frame age
+        struct DriftSums {
+            double weight;
+            double sumLnY;
+            double sumLnDepth;
+            double sumLnYLnY;
+            double sumLnYLnDepth;
+
+            DriftSums() : weight(0), sumLnY(0), sumLnDepth(0), sumLnYLnY(0), sumLnYLnDepth(0) {}
+            void add(double lnY, double lnDepth, double sampleWeight);
+            void decay(double factor);
+            bool solve(float *A, float *B);
+        };
+
+        // sums of a least-squares plane n . P = 1 through points P (mm), weighted by frame age as DriftSums are
+        struct PlaneSums {
+            double weight;
+            double sumX, sumY, sumZ;
+            double sumXX, sumXY, sumXZ, sumYY, sumYZ, sumZZ;
+
+            PlaneSums() : weight(0), sumX(0), sumY(0), sumZ(0), sumXX(0), sumXY(0), sumXZ(0), sumYY(0), sumYZ(0), sumZZ(0) {}
+            void add(double x, double y, double z, double sampleWeight);
+            void decay(double factor);
+            bool solve(float *normal, float *distance);
+        };
+
+        // the plane one run of RANSAC iterations found most samples on
+        struct PlaneCandidate {
+            float normal[3];
+            float distance;
+            int inlierCount;
+        };
+
+        DetectionParameters parameters;
+        DepthView *referenceFrame;      // points at referenceView, or NULL if there is no reference
+        DepthView referenceView;
         float *surfaceRegression;
         float surfaceRegressionEqA;
         float surfaceRegressionEqB;
         int *surfaceLeftXForY;
         int *surfaceRightXForY;
+        // with camera intrinsics, the surface is a plane seen through each pixel's ray (rayX, rayY, 1)
+        CameraIntrinsics cameraIntrinsics;
+        float *rayX;                    // NULL without camera intrinsics
+        float *rayY;
+        bool hasSurfacePlane;           // whether surfaceRegression depths are of the plane rather than A and B
+        float surfacePlaneNormal[3];    // unit normal, away from the camera
+        float surfacePlaneDistance;     // the plane is normal . P = distance (mm)
+        float *surfacePlaneFactors;     // normal . ray for each pixel, so depth z is distance - z * factor above the plane
+        PlaneSums driftPlaneSums;
+        int surfaceRegressionBottomY;   // lowest row the regression is fitted from, at the center column
+        DriftSums driftSums;
+        int driftFrameCount;            // frames sampled since the regression was last adjusted
+        int driftBoundsY;               // next row whose bounds follow an adjusted regression, or -1 if they are current
+        uint64_t driftAdjustmentCount;
+        // time measuring anomalies' sizes in the last detectInteraction(), for the caller to record
+        std::chrono::steady_clock::time_point labelStartTime;
+        std::chrono::steady_clock::duration labelDuration;
 
     public:
-        PhysicalManager();
+        PhysicalManager(DetectionParameters parameters=DetectionParameters());
         virtual ~PhysicalManager();
 
-        virtual libfreenect2::Frame* getReferenceFrame() { return this->referenceFrame; };
-        virtual int setReferenceFrame(libfreenect2::Frame *referenceFrame);
-
-        virtual Interaction *detectInteraction(libfreenect2::Frame *depthFrame, std::string interactionPPMFilename="");
+        virtual DetectionParameters getDetectionParameters() { return this->parameters; }
+        virtual void setDetectionParameters(DetectionParameters parameters) { this->parameters = parameters; }
+
+        virtual DepthView *getReferenceFrame() { return this->referenceFrame; };
+        virtual int setReferenceFrame(DepthView *referenceFrame);
+        virtual int copyReferenceFrom(PhysicalManager *physicalManager);
+        virtual int setReferenceFrameFromSurfaceModel(DepthView *referenceFrame, std::string surfaceModelFilename);
+        virtual int writeSurfaceModel(std::string surfaceModelFilename);
+        virtual void getSurfaceRegression(float *A, float *B) { *A = this->surfaceRegressionEqA; *B = this->surfaceRegressionEqB; }
+        virtual int setCameraIntrinsics(CameraIntrinsics cameraIntrinsics);
+        virtual bool getSurfacePlane(float *normal, float *distance);
+        virtual float pixelHeightAboveSurface(DepthView *depthFrame, int x, int y);
+        virtual int compensateDrift(DepthView *depthFrame);
+        virtual uint64_t getDriftAdjustmentCount() { return this->driftAdjustmentCount; }
+
+        virtual Interaction *detectInteraction(DepthView *depthFrame, std::string interactionPPMFilename="");
         virtual Interaction *detectInteraction(std::string depthFrameFilename, std::string interactionPPMFilename="");
+        virtual bool getLabelSpan(std::chrono::steady_clock::time_point *start, std::chrono::steady_clock::time_point *end);
 
-        virtual libfreenect2::Frame *readDepthFrameFromFile(std::string depthFrameFilename);
-        virtual int writeDepthFrameToFile(libfreenect2::Frame *depthFrame, std::string depthFrameFilename);
-        virtual int writeDepthFrameToPPM(libfreenect2::Frame *depthFrame, std::string ppmFilename);
-        virtual int writeDepthFrameToSurfaceDepthPPM(libfreenect2::Frame *depthFrame, std::string ppmFilename);
-        virtual int writeDepthFrameToSurfaceSlopePPM(libfreenect2::Frame *depthFrame, std::string ppmFilename);
+        virtual DepthBuffer *readDepthFrameFromFile(std::string depthFrameFilename);
+        virtual int writeDepthFrameToFile(DepthView *depthFrame, std::string depthFrameFilename);
+        virtual int writeDepthFrameToPPM(DepthView *depthFrame, std::string ppmFilename);
+        virtual int writeDepthFrameToSurfaceDepthPPM(DepthView *depthFrame, std::string ppmFilename);
+        virtual int writeDepthFrameToSurfaceSlopePPM(DepthView *depthFrame, std::string ppmFilename);
         virtual int writeDepthPixelColorsToPPM(std::string pixelColors[], std::string ppmFilename);
 
     private:
-        virtual bool isPixelAnomaly(libfreenect2::Frame *depthFrame, int x, int y, int delta=0);
-        virtual bool isPixelSurfaceAnomaly(libfreenect2::Frame *depthFrame, int x, int y, int delta=0);
-        virtual bool isPixelSurfaceAnomalyEdge(libfreenect2::Frame *depthFrame, int x, int y, int delta=0);
-        virtual bool isAnomalySizeAtLeast(libfreenect2::Frame *depthFrame, int x, int y, int minSize, int delta=0);
+        virtual bool isPixelAnomaly(DepthView *depthFrame, int x, int y, int delta=0);
+        virtual bool isPixelSurfaceAnomaly(DepthView *depthFrame, int x, int y, int delta=0);
+        virtual bool isPixelSurfaceAnomalyEdge(DepthView *depthFrame, int x, int y, int delta=0);
+        virtual bool isAnomalySizeAtLeast(DepthView *depthFrame, int x, int y, int minSize, int delta=0);
 
-        virtual float pixelDepth(libfreenect2::Frame *depthFrame, int x, int y, int delta=0);
+        virtual float pixelDepth(DepthView *depthFrame, int x, int y, int delta=0);
         virtual float pixelSurfaceRegression(int x, int y);
-        virtual bool isPixelOnSurface(libfreenect2::Frame *depthFrame, int x, int y, int delta=0);
-        virtual bool isPixelOnReference(libfreenect2::Frame *depthFrame, int x, int y, int delta=0);
-        virtual bool isPixelOnSurfaceEdge(libfreenect2::Frame *depthFrame, int x, int y);
+        virtual float heightAboveSurface(int x, int y, float depth);
+        virtual bool isPixelOnSurface(DepthView *depthFrame, int x, int y, int delta=0);
+        virtual bool isPixelOnReference(DepthView *depthFrame, int x, int y, int delta=0);
+        virtual bool isPixelOnSurfaceEdge(DepthView *depthFrame, int x, int y);
+        virtual bool isPixelSurfaceInterior(DepthView *depthFrame, int x, int y);
+        virtual bool isReferenceFrame(DepthView *depthFrame);
 
         virtual int updateSurfaceRegressionForReference();
+        virtual int updateSurfaceRegressionDepths();
+        virtual int updateSurfacePlaneForReference();
+        static void findPlaneCandidate(const std::vector<float> &points, unsigned int seed, int iterations, PlaneCandidate *candidate);
+        virtual int updateSurfacePlaneDepths();
         virtual int updateSurfaceBoundsForReference();
+        virtual int findSurfaceRegressionBottomY(DepthView *depthFrame);
+        virtual void resetDrift();
+        virtual void adjustSurfaceBoundsForRow(DepthView *depthFrame, int y);
+        virtual void summarizeDepths(DepthView *depthFrame, float *meanDepths, float *validFractions);
 
-        virtual float depthVariance(libfreenect2::Frame *depthFrame, int x, int y, int boxSideLength);
+        virtual float depthVariance(DepthView *depthFrame, int x, int y, int boxSideLength);
         virtual int powerRegression(float *x, float *y, int n, float *a, float *b);
 };
 
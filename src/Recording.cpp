@@ -0,0 +1,243 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    Recording.cpp
+    Reads and writes recorded sequences of depth frames.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Recording.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+namespace virtualMonitor {
+
+#define RECORDING_MAGIC "VMREC\0\0\0"
+#define RECORDING_MAGIC_LENGTH 8
+#define RECORDING_VERSION 2
+// Version 1 recordings have no camera intrinsics, and are still read
+#define RECORDING_VERSION_WITHOUT_INTRINSICS 1
+
+/*** RecordingWriter ***/
+
+RecordingWriter::RecordingWriter() {
+    std::memset((void *)&this->header, 0, sizeof(this->header));
+}
+
+RecordingWriter::~RecordingWriter() {
+    this->close();
+}
+
+/*
+ * Input: cameraIntrinsics are of the camera the frames are from, and are not stored unless valid
+ */
+int RecordingWriter::open(std::string recordingFilename, int width, int height, CameraIntrinsics cameraIntrinsics) {
+    this->close();
+
+    this->file.open(recordingFilename, std::ios::binary | std::ios::trunc);
+    if (!this->file.is_open()) {
+        std::cout << "RecordingWriter: Could not open recording." << std::endl;
+        return -1;
+    }
+
+    std::memset((void *)&this->header, 0, sizeof(this->header));
+    std::memcpy(this->header.magic, RECORDING_MAGIC, RECORDING_MAGIC_LENGTH);
+    this->header.version = RECORDING_VERSION;
+    this->header.width = width;
+    this->header.height = height;
+    this->header.bytesPerPixel = sizeof(float);
+    this->header.frameCount = 0;
+    if (cameraIntrinsics.isValid()) {
+        this->header.hasCameraIntrinsics = 1;
+        this->header.cameraIntrinsics = cameraIntrinsics;
+    }
+
+    // frameCount is rewritten in close()
+    this->file.write((char *)&this->header, sizeof(this->header));
+    return 0;
+}
+
+int RecordingWriter::writeFrame(DepthView *depthFrame) {
+    if (!this->file.is_open()) {
+        return -1;
+    }
+    if ((uint32_t)depthFrame->width != this->header.width ||
+        (uint32_t)depthFrame->height != this->header.height ||
+        depthFrame->units != DepthUnitsMillimeters) {
+        std::cout << "RecordingWriter: Frame does not match recording size." << std::endl;
+        return -1;
+    }
+
+    RecordingFrameHeader frameHeader;
+    frameHeader.sequence = depthFrame->sequence;
+    frameHeader.timestamp = depthFrame->timestamp;
+    this->file.write((char *)&frameHeader, sizeof(frameHeader));
+    for (int y = 0; y < depthFrame->height; y++) {
+        this->file.write((char *)depthFrame->row(y), depthFrame->width * sizeof(float));
+    }
+    this->header.frameCount++;
+    return 0;
+}
+
+int RecordingWriter::close() {
+    if (!this->file.is_open()) {
+        return 0;
+    }
+    this->file.seekp(0, std::ios::beg);
+    this->file.write((char *)&this->header, sizeof(this->header));
+    this->file.close();
+    return 0;
+}
+
+/*** RecordingReader ***/
+
+RecordingReader::RecordingReader() {
+    this->mapping = NULL;
+    this->mappingByteCount = 0;
+    this->header = NULL;
+    this->headerByteCount = 0;
+    this->frameCount = 0;
+}
+
+RecordingReader::~RecordingReader() {
+    this->close();
+}
+
+/*
+ * Maps a recording into memory, so frames are read without copying
+ */
+int RecordingReader::open(std::string recordingFilename) {
+    this->close();
+
+    int fd = ::open(recordingFilename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cout << "RecordingReader: Could not open recording." << std::endl;
+        return -1;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) < 0 || (size_t)fileStat.st_size < offsetof(RecordingHeader, cameraIntrinsics)) {
+        std::cout << "RecordingReader: Recording is too small." << std::endl;
+        ::close(fd);
+        return -1;
+    }
+
+    void *mapping = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cout << "RecordingReader: Could not map recording." << std::endl;
+        return -1;
+    }
+    this->mapping = (unsigned char *)mapping;
+    this->mappingByteCount = fileStat.st_size;
+    this->header = (RecordingHeader *)this->mapping;
+
+    // The header is read only as far as its version has it
+    bool isVersion = this->header->version == RECORDING_VERSION || this->header->version == RECORDING_VERSION_WITHOUT_INTRINSICS;
+    this->headerByteCount = (this->header->version == RECORDING_VERSION_WITHOUT_INTRINSICS) ?
+        offsetof(RecordingHeader, cameraIntrinsics) : sizeof(RecordingHeader);
+    if (std::memcmp(this->header->magic, RECORDING_MAGIC, RECORDING_MAGIC_LENGTH) != 0 || !isVersion ||
+        this->mappingByteCount < this->headerByteCount ||
+        this->header->width * this->header->height == 0 ||
+        this->header->bytesPerPixel != sizeof(float)) {
+        std::cout << "RecordingReader: Not a recording." << std::endl;
+        this->close();
+        return -1;
+    }
+
+    // Recordings that were not closed cleanly are truncated to their last complete frame
+    size_t frameCapacity = (this->mappingByteCount - this->headerByteCount) / this->frameStride();
+    this->frameCount = this->header->frameCount;
+    if (this->header->frameCount > frameCapacity || this->header->frameCount == 0) {
+        this->frameCount = frameCapacity;
+    }
+
+    return 0;
+}
+
+int RecordingReader::close() {
+    if (this->mapping != NULL) {
+        munmap(this->mapping, this->mappingByteCount);
+        this->mapping = NULL;
+        this->mappingByteCount = 0;
+        this->header = NULL;
+        this->headerByteCount = 0;
+        this->frameCount = 0;
+    }
+    return 0;
+}
+
+int RecordingReader::getFrameCount() {
+    return this->frameCount;
+}
+
+int RecordingReader::getWidth() {
+    return (this->header != NULL) ? this->header->width : 0;
+}
+
+int RecordingReader::getHeight() {
+    return (this->header != NULL) ? this->header->height : 0;
+}
+
+int RecordingReader::getBytesPerPixel() {
+    return (this->header != NULL) ? this->header->bytesPerPixel : 0;
+}
+
+/*
+ * Output: 0 with the intrinsics of the camera the recording is from, or -1 if it has none
+ */
+int RecordingReader::getCameraIntrinsics(CameraIntrinsics *cameraIntrinsics) {
+    if (this->header == NULL || this->header->version == RECORDING_VERSION_WITHOUT_INTRINSICS || !this->header->hasCameraIntrinsics) {
+        return -1;
+    }
+    *cameraIntrinsics = this->header->cameraIntrinsics;
+    return 0;
+}
+
+/*
+ * Reads a frame from the recording
+ * Input: depthFrame is set to a view into the mapped recording, which does not outlive this reader
+ * Output: 0 on success, -1 if frameIndex is out of range
+ */
+int RecordingReader::readFrame(int frameIndex, DepthView *depthFrame) {
+    if (frameIndex < 0 || frameIndex >= this->getFrameCount()) {
+        return -1;
+    }
+
+    unsigned char *frameStart = this->mapping + this->headerByteCount + (frameIndex * this->frameStride());
+    RecordingFrameHeader *frameHeader = (RecordingFrameHeader *)frameStart;
+    // Headers are multiples of 4 bytes, so the depths stay aligned
+    float *data = (float *)(frameStart + sizeof(RecordingFrameHeader));
+
+    *depthFrame = DepthView(data, this->header->width, this->header->height);
+    depthFrame->sequence = frameHeader->sequence;
+    depthFrame->timestamp = frameHeader->timestamp;
+    return 0;
+}
+
+size_t RecordingReader::frameStride() {
+    return sizeof(RecordingFrameHeader) + (this->header->width * this->header->height * this->header->bytesPerPixel);
+}
+
+} /* namespace virtualMonitor */
@@ -0,0 +1,101 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    Recording.h
+    Reads and writes recorded sequences of depth frames.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include "CameraIntrinsics.h"
+#include "DepthView.h"
+
+namespace virtualMonitor {
+
+/*
+ * A recording (.vmrec) is a RecordingHeader followed by frameCount frames,
+ * each a RecordingFrameHeader and width * height * bytesPerPixel bytes of depth data (float millimeters).
+ * The first frame is the reference frame, as captured by InteractionDetector::start().
+ * Version 1 headers end before cameraIntrinsics, which are set if hasCameraIntrinsics.
+ */
+struct RecordingHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesPerPixel;
+    uint32_t frameCount;
+    uint32_t hasCameraIntrinsics;
+    uint32_t reserved[2];
+    CameraIntrinsics cameraIntrinsics;
+};
+
+struct RecordingFrameHeader {
+    uint32_t sequence;
+    uint32_t timestamp;
+};
+
+class RecordingWriter {
+    private:
+        std::ofstream file;
+        RecordingHeader header;
+
+    public:
+        RecordingWriter();
+        virtual ~RecordingWriter();
+
+        virtual int open(std::string recordingFilename, int width, int height, CameraIntrinsics cameraIntrinsics=CameraIntrinsics());
+        virtual bool isOpen() { return this->file.is_open(); }
+        virtual int writeFrame(DepthView *depthFrame);
+        virtual int close();
+};
+
+class RecordingReader {
+    private:
+        unsigned char *mapping;
+        size_t mappingByteCount;
+        RecordingHeader *header;
+        size_t headerByteCount;
+        int frameCount;
+
+    public:
+        RecordingReader();
+        virtual ~RecordingReader();
+
+        virtual int open(std::string recordingFilename);
+        virtual int close();
+
+        virtual int getFrameCount();
+        virtual int getWidth();
+        virtual int getHeight();
+        virtual int getBytesPerPixel();
+        virtual int getCameraIntrinsics(CameraIntrinsics *cameraIntrinsics);
+        virtual int readFrame(int frameIndex, DepthView *depthFrame);
+
+    private:
+        virtual size_t frameStride();
+};
+
+} /* namespace virtualMonitor */
+
+#endif /* RECORDING_H */
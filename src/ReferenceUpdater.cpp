@@ -0,0 +1,189 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    ReferenceUpdater.cpp
+    Recaptures the reference frame and fits its surface in the background, while detection uses the current one.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ReferenceUpdater.h"
+
+#include <chrono>
+#include <utility>
+
+#include "Tracer.h"
+
+// Requests are signaled without the mutex so requesters never wait on it, so the worker also checks this often
+#define REQUEST_POLL_MILLISECONDS 50
+
+namespace virtualMonitor {
+
+ReferenceModel::ReferenceModel(PhysicalManager *physicalManager, DepthBuffer *referenceBuffer) {
+    this->physicalManager = physicalManager;
+    this->referenceBuffer = referenceBuffer;
+    this->nextRetiredModel = NULL;
+}
+
+ReferenceModel::~ReferenceModel() {
+    delete this->physicalManager;
+    if (this->referenceBuffer != NULL) {
+        this->referenceBuffer->release();
+    }
+}
+
+ReferenceUpdater::ReferenceUpdater() {
+    this->shouldStop = false;
+    this->isUpdating = false;
+    this->requestedBuffer = NULL;
+    this->publishedModel = NULL;
+    this->retiredModels = NULL;
+    this->publishedCount = 0;
+}
+
+ReferenceUpdater::~ReferenceUpdater() {
+    this->stop();
+}
+
+void ReferenceUpdater::start() {
+    this->stop();
+    this->shouldStop = false;
+    this->workerThread = std::thread(&ReferenceUpdater::workerThreadFn, this);
+}
+
+/*
+ * Stops the worker, waiting for a model being built, and frees models that were not swapped in
+ */
+void ReferenceUpdater::stop() {
+    if (this->workerThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->shouldStop = true;
+        }
+        this->requestReady.notify_one();
+        this->workerThread.join();
+    }
+    this->freeModels();
+}
+
+/*
+ * Asks the worker to fit a new reference model to a frame, unless it is already updating
+ * Never waits, so it can be called from the detection thread
+ * Input: depthBuffer is retained as the new reference frame, and should show the surface without interactions
+ *          surfaceModelFilename (if not empty) is where to save the new surface model
+ * Output: whether the update was requested
+ */
+bool ReferenceUpdater::requestUpdate(DepthBuffer *depthBuffer, DetectionParameters parameters, std::string surfaceModelFilename) {
+    bool wasUpdating = false;
+    if (!this->isUpdating.compare_exchange_strong(wasUpdating, true, std::memory_order_acq_rel)) {
+        return false;
+    }
+    // Only this requester writes the request until the worker takes the buffer
+    this->requestedParameters = parameters;
+    this->requestedSurfaceModelFilename = surfaceModelFilename;
+    depthBuffer->retain();
+    this->requestedBuffer.store(depthBuffer, std::memory_order_release);
+    this->requestReady.notify_one();
+    return true;
+}
+
+/*
+ * Swaps in the newest published model, if there is one, in place of the current reference
+ * Called between frames by the one thread detecting with the reference, and never waits
+ * Input: physicalManager and referenceBuffer are the current model, and are set to the new one if swapped
+ * Output: whether a new model was swapped in
+ */
+bool ReferenceUpdater::swapReference(PhysicalManager **physicalManager, DepthBuffer **referenceBuffer) {
+    if (this->publishedModel.load(std::memory_order_acquire) == NULL) {
+        return false;
+    }
+    ReferenceModel *model = this->publishedModel.exchange(NULL, std::memory_order_acq_rel);
+    if (model == NULL) {
+        return false;
+    }
+
+    // The published model now holds the old reference, and is retired for the worker to free
+    // Models retired before it may not be freed yet, if the worker published again meanwhile, so they are kept with it
+    std::swap(model->physicalManager, *physicalManager);
+    std::swap(model->referenceBuffer, *referenceBuffer);
+    model->nextRetiredModel = this->retiredModels.load(std::memory_order_relaxed);
+    while (!this->retiredModels.compare_exchange_weak(model->nextRetiredModel, model, std::memory_order_acq_rel)) {
+    }
+    return true;
+}
+
+void ReferenceUpdater::workerThreadFn() {
+#ifdef VIRTUALMONITOR_TRACE
+    Tracer::shared()->setThreadName("reference");
+#endif
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->requestReady.wait_for(lock, std::chrono::milliseconds(REQUEST_POLL_MILLISECONDS), [this]() {
+                return this->shouldStop || this->requestedBuffer.load(std::memory_order_acquire) != NULL;
+            });
+            if (this->shouldStop) {
+                break;
+            }
+        }
+        DepthBuffer *depthBuffer = this->requestedBuffer.exchange(NULL, std::memory_order_acq_rel);
+        if (depthBuffer == NULL) {
+            continue;
+        }
+
+        // Free the models the detection thread retired, now that it no longer reads them
+        this->freeRetiredModels();
+
+        PhysicalManager *physicalManager = new PhysicalManager(this->requestedParameters);
+        physicalManager->setCameraIntrinsics(this->cameraIntrinsics);
+        physicalManager->setReferenceFrame(depthBuffer->getView());
+        if (this->requestedSurfaceModelFilename.length() > 0) {
+            physicalManager->writeSurfaceModel(this->requestedSurfaceModelFilename);
+        }
+
+        // A model published before but never swapped in is replaced
+        delete this->publishedModel.exchange(new ReferenceModel(physicalManager, depthBuffer), std::memory_order_acq_rel);
+        this->publishedCount.fetch_add(1, std::memory_order_relaxed);
+        this->isUpdating.store(false, std::memory_order_release);
+    }
+}
+
+/*
+ * Frees the models retired by swapReference(), on the worker thread or once it has stopped
+ */
+void ReferenceUpdater::freeRetiredModels() {
+    ReferenceModel *model = this->retiredModels.exchange(NULL, std::memory_order_acq_rel);
+    while (model != NULL) {
+        ReferenceModel *nextModel = model->nextRetiredModel;
+        delete model;
+        model = nextModel;
+    }
+}
+
+/*
+ * Frees a requested frame and models not yet swapped in or freed, once the worker has stopped
+ */
+void ReferenceUpdater::freeModels() {
+    DepthBuffer *depthBuffer = this->requestedBuffer.exchange(NULL);
+    if (depthBuffer != NULL) {
+        depthBuffer->release();
+    }
+    delete this->publishedModel.exchange(NULL);
+    this->freeRetiredModels();
+    this->isUpdating = false;
+}
+
+} /* namespace virtualMonitor */
@@ -0,0 +1,91 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    ReferenceUpdater.h
+    Recaptures the reference frame and fits its surface in the background, while detection uses the current one.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REFERENCEUPDATER_H
+#define REFERENCEUPDATER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "DepthBuffer.h"
+#include "PhysicalManager.h"
+
+namespace virtualMonitor {
+
+/*
+ * A reference frame and the PhysicalManager whose surface was fitted to it
+ * The model holds the frame's buffer, and frees both when deleted
+ */
+struct ReferenceModel {
+    PhysicalManager *physicalManager;
+    DepthBuffer *referenceBuffer;
+    ReferenceModel *nextRetiredModel;   // model retired before this one, not yet freed
+
+    ReferenceModel(PhysicalManager *physicalManager, DepthBuffer *referenceBuffer);
+    ~ReferenceModel();
+};
+
+/*
+ * Builds reference models on a worker thread and publishes them for a single detection thread, RCU-style:
+ * the detection thread swaps in a published model between frames with one atomic exchange, and hands its
+ * old model back to the worker to free, so it never waits for a model to be built or freed
+ */
+class ReferenceUpdater {
+    private:
+        std::thread workerThread;
+        std::mutex mutex;                           // guards shouldStop, and waiting for a request
+        std::condition_variable requestReady;
+        bool shouldStop;
+        std::atomic<bool> isUpdating;               // from a request until its model is published
+        std::atomic<DepthBuffer *> requestedBuffer;
+        DetectionParameters requestedParameters;    // written before requestedBuffer, by the one requester
+        std::string requestedSurfaceModelFilename;
+        CameraIntrinsics cameraIntrinsics;          // set before start(), so the worker reads it unguarded
+        std::atomic<ReferenceModel *> publishedModel;
+        std::atomic<ReferenceModel *> retiredModels;   // stack of models swapped out, for the worker to free
+        std::atomic<uint64_t> publishedCount;
+
+    public:
+        ReferenceUpdater();
+        virtual ~ReferenceUpdater();
+
+        virtual void start();
+        virtual void stop();
+        virtual void setCameraIntrinsics(CameraIntrinsics cameraIntrinsics) { this->cameraIntrinsics = cameraIntrinsics; }
+        virtual bool requestUpdate(DepthBuffer *depthBuffer, DetectionParameters parameters, std::string surfaceModelFilename="");
+        virtual bool swapReference(PhysicalManager **physicalManager, DepthBuffer **referenceBuffer);
+        virtual bool isBusy() { return this->isUpdating.load(std::memory_order_acquire); }
+        virtual uint64_t getPublishedCount() { return this->publishedCount.load(std::memory_order_relaxed); }
+
+    private:
+        virtual void workerThreadFn();
+        virtual void freeRetiredModels();
+        virtual void freeModels();
+};
+
+} /* namespace virtualMonitor */
+
+#endif /* REFERENCEUPDATER_H */
@@ -0,0 +1,277 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    StageQueue.h
+    Bounded lock-free queues of preallocated slots between pipeline stages.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STAGEQUEUE_H
+#define STAGEQUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+namespace virtualMonitor {
+
+// Empty or full queues are polled with yields this many times, then with sleeps
+#define STAGE_QUEUE_SPIN_COUNT 64
+#define STAGE_QUEUE_SLEEP_MICROSECONDS 100
+
+// What a producer does with a new item when the queue is full
+enum OverflowPolicy {
+    OverflowDropOldest,     // replace the oldest queued item, so the consumer always sees the newest
+    OverflowDropNewest,     // discard the new item
+    OverflowBlock           // wait for the consumer
+};
+
+inline const char *overflowPolicyName(OverflowPolicy policy) {
+    switch (policy) {
+        case OverflowDropOldest: return "drop-oldest";
+        case OverflowDropNewest: return "drop-newest";
+        case OverflowBlock: return "block";
+        default: return "unknown";
+    }
+}
+
+inline void stageQueueBackoff(int attempt) {
+    if (attempt < STAGE_QUEUE_SPIN_COUNT) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(STAGE_QUEUE_SLEEP_MICROSECONDS));
+    }
+}
+
+/*
+ * Bounded ring of pointers with a single pusher
+ * Pops claim an entry by advancing readIndex, so both the consumer and the producer (dropping the oldest entry) may pop
+ */
+template <typename T>
+class SlotRing {
+    private:
+        std::atomic<T *> *entries;
+        uint64_t capacity;
+        std::atomic<uint64_t> readIndex;
+        std::atomic<uint64_t> writeIndex;
+
+    public:
+        SlotRing(int capacity) {
+            this->capacity = capacity;
+            this->entries = new std::atomic<T *>[capacity];
+            for (int i = 0; i < capacity; i++) {
+                this->entries[i].store(NULL, std::memory_order_relaxed);
+            }
+            this->readIndex = 0;
+            this->writeIndex = 0;
+        }
+
+        virtual ~SlotRing() {
+            delete[] this->entries;
+        }
+
+        /*
+         * Output: whether there was room for the entry
+         */
+        virtual bool push(T *entry) {
+            uint64_t write = this->writeIndex.load(std::memory_order_relaxed);
+            if (write - this->readIndex.load(std::memory_order_acquire) >= this->capacity) {
+                return false;
+            }
+            this->entries[write % this->capacity].store(entry, std::memory_order_relaxed);
+            this->writeIndex.store(write + 1, std::memory_order_release);
+            return true;
+        }
+
+        /*
+         * Output: the oldest entry, or NULL if the ring is empty
+         */
+        virtual T *pop() {
+            uint64_t read = this->readIndex.load(std::memory_order_acquire);
+            while (read != this->writeIndex.load(std::memory_order_acquire)) {
+                // The entry can only be overwritten once readIndex moves past it, which fails the exchange
+                T *entry = this->entries[read % this->capacity].load(std::memory_order_relaxed);
+                if (this->readIndex.compare_exchange_weak(read, read + 1, std::memory_order_acq_rel)) {
+                    return entry;
+                }
+            }
+            return NULL;
+        }
+
+        virtual int size() {
+            return (int)(this->writeIndex.load(std::memory_order_acquire) - this->readIndex.load(std::memory_order_acquire));
+        }
+};
+
+/*
+ * Hands preallocated slots from one producer thread to one consumer thread
+ * The producer fills a slot from acquireSlot() and passes it on with publish(),
+ * and the consumer takes it with consume() and returns it with release()
+ * A full queue applies its overflow policy when publishing, so the producer never waits for a slot to fill
+ */
+template <typename T>
+class StageQueue {
+    private:
+        T *slots;
+        int capacity;
+        OverflowPolicy policy;
+        SlotRing<T> *readySlots;
+        SlotRing<T> *freeSlots;
+        T *spareSlot;   // dropped slot the producer reuses next, since only the consumer pushes free slots
+        std::function<void(T *)> dropHandler;   // frees what a dropped slot holds, so it is not held until the slot is reused
+        std::atomic<bool> isClosed;
+        std::atomic<uint64_t> publishedCount;
+        std::atomic<uint64_t> droppedCount;
+        std::atomic<int> maxDepth;
+
+    public:
+        /*
+         * Input: capacity is the number of items that may wait between the stages
+         */
+        StageQueue(int capacity, OverflowPolicy policy) {
+            this->capacity = capacity;
+            this->policy = policy;
+            // One more slot for each of the producer and the consumer to hold while the queue is full
+            int slotCount = capacity + 2;
+            this->slots = new T[slotCount];
+            this->readySlots = new SlotRing<T>(capacity);
+            this->freeSlots = new SlotRing<T>(slotCount);
+            for (int i = 0; i < slotCount; i++) {
+                this->freeSlots->push(&this->slots[i]);
+            }
+            this->spareSlot = NULL;
+            this->isClosed = false;
+            this->publishedCount = 0;
+            this->droppedCount = 0;
+            this->maxDepth = 0;
+        }
+
+        /*
+         * Input: dropHandler is called on the producer thread with each slot dropped by the overflow policy
+         */
+        virtual void setDropHandler(std::function<void(T *)> dropHandler) {
+            this->dropHandler = dropHandler;
+        }
+
+        virtual ~StageQueue() {
+            delete this->readySlots;
+            delete this->freeSlots;
+            delete[] this->slots;
+        }
+
+        /*
+         * Producer: gets a slot to fill
+         * One is always free, since ready slots never outnumber the capacity and the consumer holds at most one
+         */
+        virtual T *acquireSlot() {
+            if (this->spareSlot != NULL) {
+                T *slot = this->spareSlot;
+                this->spareSlot = NULL;
+                return slot;
+            }
+            for (int attempt = 0; ; attempt++) {
+                T *slot = this->freeSlots->pop();
+                if (slot != NULL) {
+                    return slot;
+                }
+                stageQueueBackoff(attempt);
+            }
+        }
+
+        /*
+         * Producer: passes a filled slot to the consumer, applying the overflow policy if the queue is full
+         * Output: whether this slot was queued (false if it was dropped)
+         */
+        virtual bool publish(T *slot) {
+            for (int attempt = 0; ; attempt++) {
+                if (this->readySlots->push(slot)) {
+                    this->publishedCount.fetch_add(1, std::memory_order_relaxed);
+                    int depth = this->readySlots->size();
+                    int currentMaxDepth = this->maxDepth.load(std::memory_order_relaxed);
+                    while (depth > currentMaxDepth && !this->maxDepth.compare_exchange_weak(currentMaxDepth, depth, std::memory_order_relaxed)) {
+                    }
+                    return true;
+                }
+
+                if (this->policy == OverflowDropOldest) {
+                    // The consumer may take the oldest slot first, which also makes room
+                    T *oldestSlot = this->readySlots->pop();
+                    if (oldestSlot != NULL) {
+                        if (this->dropHandler) {
+                            this->dropHandler(oldestSlot);
+                        }
+                        this->spareSlot = oldestSlot;
+                        this->droppedCount.fetch_add(1, std::memory_order_relaxed);
+                    }
+                } else if (this->policy == OverflowDropNewest) {
+                    if (this->dropHandler) {
+                        this->dropHandler(slot);
+                    }
+                    this->spareSlot = slot;
+                    this->droppedCount.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                } else {
+                    stageQueueBackoff(attempt);
+                }
+            }
+        }
+
+        /*
+         * Consumer: waits for the oldest filled slot
+         * Output: the slot, or NULL once the queue is closed and empty
+         */
+        virtual T *consume() {
+            for (int attempt = 0; ; attempt++) {
+                T *slot = this->readySlots->pop();
+                if (slot != NULL) {
+                    return slot;
+                }
+                if (this->isClosed.load(std::memory_order_acquire)) {
+                    // Catch a slot published just before closing
+                    return this->readySlots->pop();
+                }
+                stageQueueBackoff(attempt);
+            }
+        }
+
+        /*
+         * Consumer: returns a slot for the producer to reuse
+         */
+        virtual void release(T *slot) {
+            this->freeSlots->push(slot);
+        }
+
+        /*
+         * Producer: no more items will be published, so the consumer can drain the queue and stop
+         */
+        virtual void close() {
+            this->isClosed.store(true, std::memory_order_release);
+        }
+
+        virtual int getCapacity() { return this->capacity; }
+        virtual OverflowPolicy getPolicy() { return this->policy; }
+        virtual int getDepth() { return this->readySlots->size(); }
+        virtual int getMaxDepth() { return this->maxDepth.load(std::memory_order_relaxed); }
+        virtual uint64_t getPublishedCount() { return this->publishedCount.load(std::memory_order_relaxed); }
+        virtual uint64_t getDroppedCount() { return this->droppedCount.load(std::memory_order_relaxed); }
+};
+
+} /* namespace virtualMonitor */
+
+#endif /* STAGEQUEUE_H */
@@ -0,0 +1,311 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    SyntheticScene.cpp
+    Generates synthetic depth frames with known interactions.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SyntheticScene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace virtualMonitor {
+
+#define DEPTH_FRAME_WIDTH 512
+#define DEPTH_FRAME_HEIGHT 424
+#define DEPTH_FRAME_BYTES_PER_PIXEL 4
+
+#define DEPTH_INVALID 0
+
+// Fit to inputs/surface.bin
+#define SURFACE_REGRESSION_A 176000
+#define SURFACE_REGRESSION_B -0.98
+
+// Hands with a fingertip at most this high above the surface are touching it (mm)
+#define CONTACT_HEIGHT_MAX 10
+
+// Extra height at the center of an arm or finger, since they are round (mm)
+#define HAND_BULGE_HEIGHT 20
+
+// Salt so hand placement and noise draw from different streams for the same frame
+#define RANDOM_SALT_NOISE 1
+#define RANDOM_SALT_HANDS 2
+
+SyntheticSceneParameters::SyntheticSceneParameters() {
+    this->width = DEPTH_FRAME_WIDTH;
+    this->height = DEPTH_FRAME_HEIGHT;
+    this->surfaceRegressionA = SURFACE_REGRESSION_A;
+    this->surfaceRegressionB = SURFACE_REGRESSION_B;
+    this->surfaceTiltX = 0.03;
+    this->surfacePlaneNormal[0] = 0;
+    this->surfacePlaneNormal[1] = 0;
+    this->surfacePlaneNormal[2] = 1;
+    this->surfacePlaneDistance = 0;
+    this->surfaceTop = 0.2;
+    this->surfaceBottom = 0.93;
+    this->surfaceLeft = 0.03;
+    this->surfaceRight = 0.99;
+    this->backgroundDepth = 3200;
+    this->noiseScale = 1.5;
+    this->dropoutRate = 0.002;
+    this->edgeDropoutRate = 0.3;
+    this->seed = 0;
+}
+
+SyntheticScene::SyntheticScene(SyntheticSceneParameters parameters) {
+    this->parameters = parameters;
+}
+
+SyntheticScene::~SyntheticScene() {
+
+}
+
+int SyntheticScene::frameByteCount() {
+    return this->parameters.width * this->parameters.height * DEPTH_FRAME_BYTES_PER_PIXEL;
+}
+
+/*
+ * Depth of the (extended) surface under a pixel, following the power-law profile PhysicalManager fits,
+ * or the plane where the pixel's ray meets it (the background depth if it does not)
+ */
+float SyntheticScene::surfaceDepth(int x, int y) {
+    if (this->parameters.cameraIntrinsics.isValid()) {
+        // Rays are undistorted once, rather than for every pixel of every frame
+        int pixelCount = this->parameters.width * this->parameters.height;
+        if ((int)this->rayX.size() != pixelCount ||
+            std::memcmp(&this->rayIntrinsics, &this->parameters.cameraIntrinsics, sizeof(CameraIntrinsics)) != 0) {
+            this->rayIntrinsics = this->parameters.cameraIntrinsics;
+            this->rayX.resize(pixelCount);
+            this->rayY.resize(pixelCount);
+            buildRayTable(this->rayIntrinsics, this->parameters.width, this->parameters.height, this->rayX.data(), this->rayY.data());
+        }
+        int index = y * this->parameters.width + x;
+        const float *normal = this->parameters.surfacePlaneNormal;
+        float factor = normal[0] * this->rayX[index] + normal[1] * this->rayY[index] + normal[2];
+        return (factor > 0) ? this->parameters.surfacePlaneDistance / factor : this->parameters.backgroundDepth;
+    }
+
+    // Normalize y so the profile is the same at any resolution
+    float yNormalized = std::max(1.0f, ((float)y * DEPTH_FRAME_HEIGHT) / this->parameters.height);
+    float depth = this->parameters.surfaceRegressionA * std::pow(yNormalized, this->parameters.surfaceRegressionB);
+
+    // Tilt the surface across x, centered on the middle of the frame
+    float xFromCenter = ((float)x / this->parameters.width) - 0.5;
+    return depth * (1.0 + this->parameters.surfaceTiltX * xFromCenter);
+}
+
+/*
+ * Renders the scene (surface plus this->hands) as a depth frame, in the layout PhysicalManager reads
+ * Input: depthData has room for width * height floats
+ *          frameIndex selects the noise for this frame, so any frame can be regenerated on its own
+ *          contacts (optional) is filled with the ground-truth fingertip locations touching the surface
+ * Output: 0 on success
+ */
+int SyntheticScene::renderDepthFrame(float *depthData, int frameIndex, std::vector<Coord3D> *contacts) {
+    int width = this->parameters.width;
+    int height = this->parameters.height;
+
+    std::seed_seq seedSequence = {this->parameters.seed, (uint32_t)frameIndex, (uint32_t)RANDOM_SALT_NOISE};
+    std::mt19937 generator(seedSequence);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float depth;
+            if (this->isPixelOnSurface(x, y)) {
+                depth = this->surfaceDepth(x, y);
+            } else if (y < this->parameters.surfaceTop * height) {
+                depth = this->parameters.backgroundDepth;
+            } else {
+                depth = DEPTH_INVALID;
+            }
+
+            // Hands occlude whatever is behind them
+            bool isEdge = false;
+            for (size_t i = 0; i < this->hands.size(); i++) {
+                bool isHandEdge = false;
+                float handHeight = this->handHeightAbovePixel(this->hands[i], x, y, &isHandEdge);
+                if (handHeight >= 0) {
+                    float handDepth = this->surfaceDepth(x, y) - handHeight;
+                    if (depth == DEPTH_INVALID || handDepth < depth) {
+                        depth = handDepth;
+                        isEdge = isHandEdge;
+                    }
+                }
+            }
+
+            // Kinect noise grows with the square of depth, and readings drop out (especially on edges)
+            if (depth != DEPTH_INVALID) {
+                float depthMeters = depth / 1000.0;
+                depth += this->gaussian(generator) * this->parameters.noiseScale * depthMeters * depthMeters;
+            }
+            float dropoutRate = isEdge ? this->parameters.edgeDropoutRate : this->parameters.dropoutRate;
+            if (this->uniform(generator) < dropoutRate) {
+                depth = DEPTH_INVALID;
+            }
+
+            depthData[y * width + x] = depth;
+        }
+    }
+
+    if (contacts != NULL) {
+        contacts->clear();
+        for (size_t i = 0; i < this->hands.size(); i++) {
+            SyntheticHand &hand = this->hands[i];
+            if (hand.tipHeight <= CONTACT_HEIGHT_MAX) {
+                Coord3D contact;
+                contact.x = hand.tipX;
+                contact.y = hand.tipY;
+                contact.z = this->surfaceDepth(hand.tipX, hand.tipY) - hand.tipHeight;
+                contacts->push_back(contact);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Renders the scene without any hands, as used for the reference frame
+ */
+int SyntheticScene::renderReferenceFrame(float *depthData) {
+    std::vector<SyntheticHand> hands;
+    hands.swap(this->hands);
+    int result = this->renderDepthFrame(depthData, -1);
+    hands.swap(this->hands);
+    return result;
+}
+
+/*
+ * Replaces this->hands with up to maxHands hands placed over the surface, chosen by the seed and frameIndex
+ */
+void SyntheticScene::randomizeHands(int frameIndex, int maxHands, float touchProbability) {
+    std::seed_seq seedSequence = {this->parameters.seed, (uint32_t)frameIndex, (uint32_t)RANDOM_SALT_HANDS};
+    std::mt19937 generator(seedSequence);
+
+    int width = this->parameters.width;
+    int height = this->parameters.height;
+    float scale = (float)width / DEPTH_FRAME_WIDTH;
+
+    this->hands.clear();
+    int handCount = (int)this->uniform(generator, 0, maxHands + 1);
+    for (int i = 0; i < handCount; i++) {
+        SyntheticHand hand;
+        // Keep fingertips away from the surface edges, where PhysicalManager ignores pixels
+        hand.tipX = (int)this->uniform(generator, (this->parameters.surfaceLeft + 0.1) * width, (this->parameters.surfaceRight - 0.1) * width);
+        hand.tipY = (int)this->uniform(generator, (this->parameters.surfaceTop + 0.1) * height, (this->parameters.surfaceBottom - 0.1) * height);
+        hand.entryX = hand.tipX + (int)this->uniform(generator, -60 * scale, 60 * scale);
+        hand.armWidth = (int)(this->uniform(generator, 30, 45) * scale);
+        hand.fingerWidth = (int)(this->uniform(generator, 8, 12) * scale);
+        hand.fingerLength = (int)(this->uniform(generator, 20, 30) * scale);
+        hand.tipHeight = (this->uniform(generator) < touchProbability) ? 0 : this->uniform(generator, 50, 150);
+        hand.armHeight = this->uniform(generator, 400, 600);
+        this->hands.push_back(hand);
+    }
+}
+
+int SyntheticScene::writeDepthFrameToFile(float *depthData, std::string depthFrameFilename) {
+    std::ofstream depthFile(depthFrameFilename, std::ios::binary);
+    if (!depthFile.is_open()) {
+        std::cout << "SyntheticScene: Could not write depth frame." << std::endl;
+        return -1;
+    }
+
+    depthFile.write((char *)depthData, this->frameByteCount());
+    depthFile.close();
+    return 0;
+}
+
+/*
+ * Writes ground truth as one "frameId x y z" line per contact, or "frameId none" without contacts
+ */
+int SyntheticScene::writeContactsToStream(std::ostream &truthStream, std::string frameId, std::vector<Coord3D> &contacts) {
+    if (contacts.empty()) {
+        truthStream << frameId << " none" << std::endl;
+    }
+    for (size_t i = 0; i < contacts.size(); i++) {
+        truthStream << frameId << " " << contacts[i].x << " " << contacts[i].y << " " << contacts[i].z << std::endl;
+    }
+    return 0;
+}
+
+bool SyntheticScene::isPixelOnSurface(int x, int y) {
+    return (
+        this->parameters.surfaceLeft * this->parameters.width <= x &&
+        x < this->parameters.surfaceRight * this->parameters.width &&
+        this->parameters.surfaceTop * this->parameters.height <= y &&
+        y < this->parameters.surfaceBottom * this->parameters.height
+    );
+}
+
+/*
+ * Height of a hand above the surface at a pixel, or -1 if the hand does not cover the pixel
+ * The hand is a finger and arm along the line from its fingertip to where it enters the top of the frame
+ */
+float SyntheticScene::handHeightAbovePixel(SyntheticHand &hand, int x, int y, bool *isEdge) {
+    float lineX = hand.entryX - hand.tipX;
+    float lineY = -hand.tipY;
+    float lineLength = std::sqrt(lineX * lineX + lineY * lineY);
+    if (lineLength <= 0) {
+        return -1;
+    }
+
+    // Distance along the line from the fingertip, and distance from the line
+    float pixelX = x - hand.tipX;
+    float pixelY = y - hand.tipY;
+    float along = (pixelX * lineX + pixelY * lineY) / lineLength;
+    float across = std::abs(pixelX * lineY - pixelY * lineX) / lineLength;
+    if (along > lineLength) {
+        return -1;
+    }
+
+    float halfWidth = ((along < hand.fingerLength) ? hand.fingerWidth : hand.armWidth) / 2.0;
+    // Round off the fingertip
+    if (along < 0) {
+        across = std::sqrt(along * along + across * across);
+        along = 0;
+    }
+    if (across > halfWidth) {
+        return -1;
+    }
+
+    *isEdge = (across > halfWidth - 1);
+
+    // The hand rises steeply behind the fingertip, then levels off along the arm
+    float heightAlong = hand.tipHeight + (hand.armHeight - hand.tipHeight) * std::sqrt(along / lineLength);
+    float bulge = HAND_BULGE_HEIGHT * (1.0 - (across * across) / (halfWidth * halfWidth));
+    return heightAlong + bulge;
+}
+
+float SyntheticScene::uniform(std::mt19937 &generator, float min, float max) {
+    // Use the raw generator output, since std::uniform_real_distribution differs between standard libraries
+    double unit = (double)generator() / 4294967296.0;
+    return min + (float)(unit * (max - min));
+}
+
+float SyntheticScene::gaussian(std::mt19937 &generator) {
+    // Box-Muller transform
+    double u1 = ((double)generator() + 1.0) / 4294967297.0;
+    double u2 = (double)generator() / 4294967296.0;
+    return (float)(std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * M_PI * u2));
+}
+
+} /* namespace virtualMonitor */
@@ -0,0 +1,111 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    SyntheticScene.h
+    Generates synthetic depth frames with known interactions.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYNTHETICSCENE_H
+#define SYNTHETICSCENE_H
+
+#include <cstdint>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "CameraIntrinsics.h"
+#include "Location.h"
+
+namespace virtualMonitor {
+
+// An arm reaching in from the top of the frame, ending in a fingertip
+struct SyntheticHand {
+    int tipX;            // fingertip column (pixels)
+    int tipY;            // fingertip row (pixels)
+    int entryX;          // column where the arm enters the top of the frame (pixels)
+    int armWidth;        // width of the arm (pixels)
+    int fingerWidth;     // width of the finger (pixels)
+    int fingerLength;    // length of the finger before the arm starts (pixels)
+    float tipHeight;     // height of the fingertip above the surface (mm), 0 when touching
+    float armHeight;     // height of the arm above the surface at the top of the frame (mm)
+};
+
+struct SyntheticSceneParameters {
+    // Frame size (pixels)
+    int width;
+    int height;
+    // Surface depth follows A * y^B (mm), with y normalized to a 424 pixel tall frame
+    float surfaceRegressionA;
+    float surfaceRegressionB;
+    // Fractional depth change from the left to the right edge of the surface
+    float surfaceTiltX;
+    // With valid camera intrinsics, the surface is instead the plane normal . P = distance (mm) seen through them
+    CameraIntrinsics cameraIntrinsics;
+    float surfacePlaneNormal[3];
+    float surfacePlaneDistance;
+    // Surface bounds as fractions of the frame
+    float surfaceTop;
+    float surfaceBottom;
+    float surfaceLeft;
+    float surfaceRight;
+    // Depth of the wall behind the surface (mm)
+    float backgroundDepth;
+    // Depth noise standard deviation at 1 m (mm), growing with depth squared
+    float noiseScale;
+    // Probability of a pixel reading as invalid, anywhere and on object edges
+    float dropoutRate;
+    float edgeDropoutRate;
+    uint32_t seed;
+
+    SyntheticSceneParameters();
+};
+
+class SyntheticScene {
+    private:
+        // undistorted ray of each pixel, for the intrinsics they were built for
+        CameraIntrinsics rayIntrinsics;
+        std::vector<float> rayX;
+        std::vector<float> rayY;
+
+    public:
+        SyntheticSceneParameters parameters;
+        std::vector<SyntheticHand> hands;
+
+        SyntheticScene(SyntheticSceneParameters parameters=SyntheticSceneParameters());
+        virtual ~SyntheticScene();
+
+        virtual int frameByteCount();
+        virtual float surfaceDepth(int x, int y);
+        virtual int renderDepthFrame(float *depthData, int frameIndex, std::vector<Coord3D> *contacts=NULL);
+        virtual int renderReferenceFrame(float *depthData);
+        virtual void randomizeHands(int frameIndex, int maxHands, float touchProbability=0.5);
+
+        virtual int writeDepthFrameToFile(float *depthData, std::string depthFrameFilename);
+        virtual int writeContactsToStream(std::ostream &truthStream, std::string frameId, std::vector<Coord3D> &contacts);
+
+    private:
+        virtual bool isPixelOnSurface(int x, int y);
+        virtual float handHeightAbovePixel(SyntheticHand &hand, int x, int y, bool *isEdge);
+        virtual float uniform(std::mt19937 &generator, float min=0, float max=1);
+        virtual float gaussian(std::mt19937 &generator);
+};
+
+} /* namespace virtualMonitor */
+
+#endif /* SYNTHETICSCENE_H */
@@ -0,0 +1,200 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    ThreadPool.cpp
+    Runs tasks on a fixed set of worker threads that steal work from each other.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace virtualMonitor {
+
+// Pool and index of the worker running on this thread, so a task can tell its own pool's workers from another's
+struct WorkerIdentity {
+    ThreadPool *pool;
+    int workerIndex;
+};
+static thread_local WorkerIdentity workerForThread = {NULL, -1};
+
+/*
+ * Starts threadCount workers (or one per core if threadCount <= 0)
+ */
+ThreadPool::ThreadPool(int threadCount) {
+    if (threadCount <= 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    this->queuedCount = 0;
+    this->pendingCount = 0;
+    this->shouldStop = false;
+    this->nextQueueIndex = 0;
+
+    for (int i = 0; i < threadCount; i++) {
+        this->queues.push_back(new WorkerQueue());
+    }
+    for (int i = 0; i < threadCount; i++) {
+        this->threads.push_back(std::thread(&ThreadPool::workerThreadFn, this, i));
+    }
+}
+
+/*
+ * Finishes queued tasks, then stops the workers
+ */
+ThreadPool::~ThreadPool() {
+    this->wait();
+    {
+        std::lock_guard<std::mutex> lock(this->stateMutex);
+        this->shouldStop = true;
+    }
+    this->taskAvailable.notify_all();
+    for (size_t i = 0; i < this->threads.size(); i++) {
+        this->threads[i].join();
+    }
+    for (size_t i = 0; i < this->queues.size(); i++) {
+        delete this->queues[i];
+    }
+}
+
+/*
+ * Queues a task, on the current worker's own queue when called from a task
+ */
+void ThreadPool::submit(std::function<void()> task) {
+    int queueIndex = this->currentWorkerIndex();
+    if (queueIndex < 0) {
+        queueIndex = (this->nextQueueIndex++) % this->queues.size();
+    }
+
+    // Count the task before queueing it, so wait() cannot see it finish before it is counted
+    this->pendingCount.fetch_add(1, std::memory_order_acq_rel);
+    {
+        std::lock_guard<std::mutex> lock(this->queues[queueIndex]->mutex);
+        this->queues[queueIndex]->tasks.push_back(task);
+    }
+    this->queuedCount.fetch_add(1, std::memory_order_acq_rel);
+
+    // A worker checks queuedCount under stateMutex before sleeping, so it is either awake to see the task or already waiting
+    {
+        std::lock_guard<std::mutex> lock(this->stateMutex);
+    }
+    this->taskAvailable.notify_one();
+}
+
+/*
+ * Blocks until every submitted task has finished
+ */
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(this->stateMutex);
+    this->tasksDone.wait(lock, [this]() { return this->pendingCount.load(std::memory_order_acquire) == 0; });
+}
+
+/*
+ * Runs task(0) to task(taskCount - 1) on the pool, blocking until they have finished but not for other tasks
+ */
+void ThreadPool::run(int taskCount, std::function<void(int)> task) {
+    // A worker waiting on its own pool could leave no worker to run the tasks, so it runs them itself
+    if (this->currentWorkerIndex() >= 0) {
+        for (int i = 0; i < taskCount; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    std::mutex doneMutex;
+    std::condition_variable done;
+    int remainingCount = taskCount;
+    for (int i = 0; i < taskCount; i++) {
+        this->submit([&, i]() {
+            task(i);
+            // Notified under doneMutex, so run() cannot return and destroy done before it is notified
+            std::lock_guard<std::mutex> lock(doneMutex);
+            remainingCount--;
+            done.notify_all();
+        });
+    }
+    std::unique_lock<std::mutex> lock(doneMutex);
+    done.wait(lock, [&]() { return remainingCount == 0; });
+}
+
+/*
+ * Output: a pool of one worker per core, for work within the core library
+ */
+ThreadPool *ThreadPool::shared() {
+    static ThreadPool sharedPool;
+    return &sharedPool;
+}
+
+/*
+ * Output: the index of the worker running on this thread, or -1 if the thread is not one of this pool's workers
+ */
+int ThreadPool::currentWorkerIndex() {
+    return (workerForThread.pool == this) ? workerForThread.workerIndex : -1;
+}
+
+void ThreadPool::workerThreadFn(int workerIndex) {
+    workerForThread.pool = this;
+    workerForThread.workerIndex = workerIndex;
+
+    while (true) {
+        std::function<void()> task;
+        if (!this->takeTask(workerIndex, task)) {
+            std::unique_lock<std::mutex> lock(this->stateMutex);
+            this->taskAvailable.wait(lock, [this]() { return this->queuedCount.load(std::memory_order_acquire) > 0 || this->shouldStop; });
+            if (this->queuedCount.load(std::memory_order_acquire) <= 0 && this->shouldStop) {
+                return;
+            }
+            // Another worker may take it first, so look again
+            continue;
+        }
+
+        task();
+
+        // Like submit(), take stateMutex before waking, so wait() is either awake to see the count or already waiting
+        if (this->pendingCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            {
+                std::lock_guard<std::mutex> lock(this->stateMutex);
+            }
+            this->tasksDone.notify_all();
+        }
+    }
+}
+
+bool ThreadPool::takeTask(int workerIndex, std::function<void()> &task) {
+    int queueCount = this->queues.size();
+    for (int offset = 0; offset < queueCount; offset++) {
+        WorkerQueue *queue = this->queues[(workerIndex + offset) % queueCount];
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if (queue->tasks.empty()) {
+            continue;
+        }
+        // Newest from our own queue (still warm in cache), oldest when stealing
+        if (offset == 0) {
+            task = queue->tasks.back();
+            queue->tasks.pop_back();
+        } else {
+            task = queue->tasks.front();
+            queue->tasks.pop_front();
+        }
+        this->queuedCount.fetch_sub(1, std::memory_order_acq_rel);
+        return true;
+    }
+    return false;
+}
+
+} /* namespace virtualMonitor */
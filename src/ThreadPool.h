@@ -0,0 +1,75 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    ThreadPool.h
+    Runs tasks on a fixed set of worker threads that steal work from each other.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace virtualMonitor {
+
+class ThreadPool {
+    private:
+        // Each worker takes the newest task from its own queue, or steals the oldest task from another queue
+        struct WorkerQueue {
+            std::mutex mutex;
+            std::deque<std::function<void()> > tasks;
+        };
+
+        std::vector<WorkerQueue *> queues;
+        std::vector<std::thread> threads;
+        // Tasks are taken under their queue's mutex only, and stateMutex is only for sleeping and waking
+        std::mutex stateMutex;
+        std::condition_variable taskAvailable;
+        std::condition_variable tasksDone;
+        std::atomic<int> queuedCount;
+        std::atomic<int> pendingCount;
+        bool shouldStop;
+        std::atomic<unsigned int> nextQueueIndex;
+
+    public:
+        ThreadPool(int threadCount=0);
+        virtual ~ThreadPool();
+
+        virtual int getThreadCount() { return this->threads.size(); }
+        virtual void submit(std::function<void()> task);
+        virtual void wait();
+        virtual void run(int taskCount, std::function<void(int)> task);
+
+        static ThreadPool *shared();
+
+        virtual int currentWorkerIndex();
+
+    private:
+        virtual void workerThreadFn(int workerIndex);
+        virtual bool takeTask(int workerIndex, std::function<void()> &task);
+};
+
+} /* namespace virtualMonitor */
+
+#endif /* THREADPOOL_H */
@@ -0,0 +1,169 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    Tracer.cpp
+    Records timed spans per thread and writes them as Chrome trace events.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Tracer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+namespace virtualMonitor {
+
+#define TRACE_PROCESS_ID 1
+#define TRACE_CATEGORY "pipeline"
+
+// Buffer of Tracer::shared() spans recorded on this thread, created the first time the thread records
+static thread_local TraceBuffer *bufferForCurrentThread = NULL;
+
+static uint64_t nanosecondsSinceEpoch(std::chrono::steady_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+Tracer::Tracer() {
+    this->isEnabled = false;
+}
+
+/*
+ * Buffers outlive their threads, so they are only freed with the tracer
+ */
+Tracer::~Tracer() {
+    for (size_t i = 0; i < this->buffers.size(); i++) {
+        delete this->buffers[i];
+    }
+}
+
+Tracer *Tracer::shared() {
+    static Tracer sharedTracer;
+    return &sharedTracer;
+}
+
+void Tracer::start() {
+    this->isEnabled.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::stop() {
+    this->isEnabled.store(false, std::memory_order_relaxed);
+}
+
+/*
+ * Names the calling thread in the trace, and creates its buffer ahead of its first span
+ */
+void Tracer::setThreadName(std::string threadName) {
+    this->bufferForThread()->threadName = threadName;
+}
+
+/*
+ * Tags the calling thread's following spans with a frame number
+ */
+void Tracer::setFrame(int64_t frame) {
+    this->bufferForThread()->frame = frame;
+}
+
+/*
+ * Records a span into the calling thread's ring buffer, overwriting its oldest span when full
+ * Only the first span on a thread allocates (its buffer), and nothing locks after that
+ */
+void Tracer::record(const char *name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    if (!this->isTracing()) {
+        return;
+    }
+    TraceBuffer *buffer = this->bufferForThread();
+    uint64_t writeCount = buffer->writeCount.load(std::memory_order_relaxed);
+    TraceEvent &event = buffer->events[writeCount % TRACE_BUFFER_CAPACITY];
+    event.name = name;
+    event.startNanoseconds = nanosecondsSinceEpoch(start);
+    event.durationNanoseconds = nanosecondsSinceEpoch(end) - event.startNanoseconds;
+    event.frame = buffer->frame;
+    buffer->writeCount.store(writeCount + 1, std::memory_order_release);
+}
+
+/*
+ * Writes every buffered span as Chrome trace-event JSON
+ * Safe to call while threads are tracing, though spans overwritten during the copy are dropped
+ */
+int Tracer::writeTraceToFile(std::string traceFilename) {
+    std::ofstream traceFile(traceFilename);
+    if (!traceFile.is_open()) {
+        std::cout << "Tracer: Could not write " << traceFilename << "." << std::endl;
+        return -1;
+    }
+
+    std::vector<TraceBuffer *> buffers;
+    {
+        std::lock_guard<std::mutex> lock(this->buffersMutex);
+        buffers = this->buffers;
+    }
+
+    traceFile << "{\"traceEvents\":[";
+    bool isFirstEvent = true;
+    int eventCount = 0;
+    for (size_t i = 0; i < buffers.size(); i++) {
+        TraceBuffer *buffer = buffers[i];
+        traceFile << (isFirstEvent ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << TRACE_PROCESS_ID
+                  << ",\"tid\":" << buffer->threadIndex << ",\"args\":{\"name\":\"" << buffer->threadName << "\"}}";
+        isFirstEvent = false;
+
+        uint64_t endCount = buffer->writeCount.load(std::memory_order_acquire);
+        uint64_t beginCount = (endCount > TRACE_BUFFER_CAPACITY) ? endCount - TRACE_BUFFER_CAPACITY : 0;
+        std::vector<TraceEvent> events;
+        for (uint64_t count = beginCount; count < endCount; count++) {
+            events.push_back(buffer->events[count % TRACE_BUFFER_CAPACITY]);
+        }
+
+        // Spans the thread wrote over while they were being copied may be torn
+        uint64_t overwrittenCount = buffer->writeCount.load(std::memory_order_acquire);
+        uint64_t validBeginCount = (overwrittenCount > TRACE_BUFFER_CAPACITY) ? overwrittenCount - TRACE_BUFFER_CAPACITY : 0;
+        for (uint64_t count = std::max(beginCount, validBeginCount); count < endCount; count++) {
+            TraceEvent &event = events[count - beginCount];
+            traceFile << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << TRACE_CATEGORY << "\",\"ph\":\"X\""
+                      << ",\"ts\":" << event.startNanoseconds / 1000 << "." << (event.startNanoseconds % 1000) / 100
+                      << ",\"dur\":" << event.durationNanoseconds / 1000 << "." << (event.durationNanoseconds % 1000) / 100
+                      << ",\"pid\":" << TRACE_PROCESS_ID << ",\"tid\":" << buffer->threadIndex;
+            if (event.frame >= 0) {
+                traceFile << ",\"args\":{\"frame\":" << event.frame << "}";
+            }
+            traceFile << "}";
+            eventCount++;
+        }
+    }
+    traceFile << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    traceFile.close();
+
+    std::cout << "Tracer: Wrote " << eventCount << " spans to " << traceFilename << std::endl;
+    return 0;
+}
+
+TraceBuffer *Tracer::bufferForThread() {
+    if (bufferForCurrentThread == NULL) {
+        TraceBuffer *buffer = new TraceBuffer();
+        buffer->writeCount = 0;
+        buffer->frame = -1;
+        std::lock_guard<std::mutex> lock(this->buffersMutex);
+        buffer->threadIndex = this->buffers.size() + 1;
+        buffer->threadName = "thread " + std::to_string(buffer->threadIndex);
+        this->buffers.push_back(buffer);
+        bufferForCurrentThread = buffer;
+    }
+    return bufferForCurrentThread;
+}
+
+} /* namespace virtualMonitor */
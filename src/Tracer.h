@@ -0,0 +1,91 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    Tracer.h
+    Records timed spans per thread and writes them as Chrome trace events.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#undef VIRTUALMONITOR_TRACE
+
+// Uncomment to record detection loop spans and write them to trace.json (open in chrome://tracing or ui.perfetto.dev)
+//#define VIRTUALMONITOR_TRACE
+
+namespace virtualMonitor {
+
+// Each thread keeps the most recent spans it recorded (65536 spans, 2 MB)
+#define TRACE_BUFFER_CAPACITY 65536
+
+struct TraceEvent {
+    const char *name;       // must outlive the tracer, such as a string literal
+    uint64_t startNanoseconds;
+    uint64_t durationNanoseconds;
+    int64_t frame;
+};
+
+struct TraceBuffer {
+    TraceEvent events[TRACE_BUFFER_CAPACITY];
+    std::atomic<uint64_t> writeCount;
+    int64_t frame;
+    int threadIndex;
+    std::string threadName;
+};
+
+class Tracer {
+    private:
+        std::mutex buffersMutex;
+        std::vector<TraceBuffer *> buffers;
+        std::atomic<bool> isEnabled;
+
+    public:
+        Tracer();
+        virtual ~Tracer();
+
+        static Tracer *shared();
+
+        virtual void start();
+        virtual void stop();
+        virtual bool isTracing() { return this->isEnabled.load(std::memory_order_relaxed); }
+
+        virtual void setThreadName(std::string threadName);
+        virtual void setFrame(int64_t frame);
+        virtual void record(const char *name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+        virtual int writeTraceToFile(std::string traceFilename);
+
+    private:
+        virtual TraceBuffer *bufferForThread();
+};
+
+} /* namespace virtualMonitor */
+
+#ifdef VIRTUALMONITOR_TRACE
+#define TRACE_FRAME(frame) virtualMonitor::Tracer::shared()->setFrame(frame)
+#else
+#define TRACE_FRAME(frame)
+#endif
+
+#endif /* TRACER_H */
@@ -22,11 +22,70 @@
 
 #include "VirtualManager.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <math.h>
 
+#include "Checksum.h"
+
+// Kinect v2 depth frames, the physical coordinates covered by the mapping table
+#define DEPTH_FRAME_WIDTH 512
+#define DEPTH_FRAME_HEIGHT 424
+// fractional bits of the table's virtual coordinates (1/256 of a virtual pixel)
+#define MAPPING_FRACTION_BITS 8
+#define MAPPING_FIXED_ONE (1 << MAPPING_FRACTION_BITS)
+// coordinates clamped at once by mapPhysicalLocations() (two 16-byte vectors of int32_t)
+#define CLAMP_BLOCK_SIZE 8
+// how far past the screen's edge (as a fraction of its size) a coordinate is clamped to it, rather than an error
+#define SCREEN_EDGE_TOLERANCE 0.05
+// arc lengths are integrated to within this fraction of the curve's length, splitting at most this many times
+#define ARC_LENGTH_TOLERANCE 1e-9
+#define ARC_LENGTH_MAX_DEPTH 30
+// regressions whose coefficients differ by at most this fraction share a cached arc length
+#define ARC_LENGTH_CACHE_SIZE 8
+#define ARC_LENGTH_CACHE_TOLERANCE 1e-5
+// calibration profiles (see CalibrationProfileHeader)
+#define CALIBRATION_PROFILE_MAGIC "VMPROF\0\0"
+#define CALIBRATION_PROFILE_MAGIC_LENGTH 8
+#define CALIBRATION_PROFILE_VERSION 5
+
 namespace virtualMonitor {
 
+/* clamps a fixed-point virtual coordinate to the screen without branches, like setVirtualCoordFromCalibration()
+ * inputs: fixed-point virtual coordinate, screen size in pixels and in fixed point,
+           fixed-point limits beyond which the coordinate is an error
+ * output: pixel coordinate on the screen, or -screenSize if too far off the screen */
+static inline int32_t clampToScreen(int32_t virtualFixed, int32_t screenSize, int32_t screenSizeFixed, int32_t minFixed, int32_t maxFixed) {
+    int32_t clamped = std::min(std::max(virtualFixed, 0), screenSizeFixed) >> MAPPING_FRACTION_BITS;
+    // all ones past the limits, so the error value is selected with masks
+    int32_t isError = -(int32_t)((virtualFixed < minFixed) | (virtualFixed > maxFixed));
+    return (clamped & ~isError) | (-screenSize & isError);
+}
+
+/* clamps fixed-point virtual coordinates to the screen in place
+   blocks of a fixed size are vectorized by the compiler, even at -O2
+ * inputs: number of coordinates, the coordinates, screen size in pixels and in fixed point,
+           fixed-point limits beyond which a coordinate is an error */
+static void clampAllToScreen(int count, int32_t *coords, int32_t screenSize, int32_t screenSizeFixed, int32_t minFixed, int32_t maxFixed) {
+    int i = 0;
+    for (; i + CLAMP_BLOCK_SIZE <= count; i += CLAMP_BLOCK_SIZE) {
+        int32_t *block = coords + i;
+        for (int j = 0; j < CLAMP_BLOCK_SIZE; j++) {
+            block[j] = clampToScreen(block[j], screenSize, screenSizeFixed, minFixed, maxFixed);
+        }
+    }
+    for (; i < count; i++) {
+        coords[i] = clampToScreen(coords[i], screenSize, screenSizeFixed, minFixed, maxFixed);
+    }
+}
+
 /* initalizes private vars of Virtual Manager */
 VirtualManager::VirtualManager() {
     this->screenLength_d = 0.0;
@@ -34,97 +93,489 @@ VirtualManager::VirtualManager() {
     this->B_f = 0.0;
     this->calibrationNumRows = 0;
     this->calibrationNumCols = 0;
-    this->calibrationCoordsPhysical = NULL;
-    this->calibrationCoordsVirtual = NULL;
-    this->averageYValues = NULL;
-    this->avgCalCoords = NULL;
+    this->averageYValues_d = NULL;
+    this->calibrationPixelX = NULL;
+    this->calibrationPixelY = NULL;
+    this->calibrationPhysicalX_d = NULL;
+    this->calibrationVirtualX = NULL;
+    this->calibrationVirtualY = NULL;
+    this->columnLines = NULL;
+    this->calibrationCells = NULL;
+    this->areColumnsDescending = false;
     this->screenHeightVirtual = 0;
     this->screenWidthVirtual = 0;
+    this->mappingTable = NULL;
+    this->screenWidthFixed = 0;
+    this->screenHeightFixed = 0;
+    this->minXFixed = 0;
+    this->maxXFixed = 0;
+    this->minYFixed = 0;
+    this->maxYFixed = 0;
+    this->arcLengthCache.assign(ARC_LENGTH_CACHE_SIZE, ArcLengthCacheEntry());
+    this->arcLengthCacheNext = 0;
+    this->profileMapping = NULL;
+    this->profileMappingByteCount = 0;
+    this->undistortedX = NULL;
+    this->undistortedY = NULL;
 }
 
 /* frees everything that was created using new() */
 VirtualManager::~VirtualManager() {
     this->deleteCalibrationVars();
+    delete []this->undistortedX;
+    delete []this->undistortedY;
+}
+
+/* integrand of the length of the curve z = h(y) = (y/A) ^ (1/B), sqrt(1 + h'(y)^2)
+ * inputs: y, 1/A and 1/B
+ * output: sqrt(1 + h'(y)^2), where h'(y) = (1/B) * (y/A) ^ (1/B) / y */
+static inline double arcLengthIntegrand(double y_d, double invA_d, double invB_d) {
+    double slope_d = invB_d * pow(y_d * invA_d, invB_d) / y_d;
+    return sqrt(1.0 + slope_d * slope_d);
+}
+
+/* integrates arcLengthIntegrand() between two y-values with adaptive Simpson's rule,
+   splitting only where the curve bends enough for Simpson's rule to be off by more than the tolerance
+ * inputs: interval [a, b] and its midpoint m, the integrand at a, m and b,
+           Simpson's estimate over the whole interval, tolerance, remaining depth, 1/A and 1/B
+ * output: integral of the integrand over [a, b] */
+static double integrateArcLength(double a_d, double m_d, double b_d, double fa_d, double fm_d, double fb_d,
+                                 double whole_d, double tolerance_d, int depth, double invA_d, double invB_d) {
+    double lm_d = 0.5 * (a_d + m_d);
+    double rm_d = 0.5 * (m_d + b_d);
+    double flm_d = arcLengthIntegrand(lm_d, invA_d, invB_d);
+    double frm_d = arcLengthIntegrand(rm_d, invA_d, invB_d);
+    double left_d = (m_d - a_d) / 6.0 * (fa_d + 4.0 * flm_d + fm_d);
+    double right_d = (b_d - m_d) / 6.0 * (fm_d + 4.0 * frm_d + fb_d);
+    double delta_d = left_d + right_d - whole_d;
+    if (depth <= 0 || fabs(delta_d) <= 15.0 * tolerance_d) {
+        return left_d + right_d + delta_d / 15.0;
+    }
+    return integrateArcLength(a_d, lm_d, m_d, fa_d, flm_d, fm_d, left_d, 0.5 * tolerance_d, depth - 1, invA_d, invB_d)
+         + integrateArcLength(m_d, rm_d, b_d, fm_d, frm_d, fb_d, right_d, 0.5 * tolerance_d, depth - 1, invA_d, invB_d);
+}
+
+/* whether two regression coefficients are close enough to share an arc length */
+static inline bool isNearlyEqual(float a_f, float b_f) {
+    return fabs((double)a_f - (double)b_f) <= ARC_LENGTH_CACHE_TOLERANCE * fabs((double)a_f);
 }
 
 /* finds the length of a power regression curve between two y-points 
+   regressions recently seen (or within ARC_LENGTH_CACHE_TOLERANCE of one) reuse its length
  * inputs: coefficients for power regression (i.e. y = A*z^B),
            y1 and y2 where y1 is bottom-left point and y2 is top-left point 
  * output: length of curve between y1 and y2 */
 double VirtualManager::findArcLength(float A_f, float B_f, int y1, int y2) {
-    /* y = f(z) = A * z^B   <==>   z = h(y) = (y/A) ^ (1/B)
-       length of curve ~= sum from y = y1 to (y2-1) of sqrt(1 + (h(y+1) - h(y))^2)
-                        = sum of sqrt(1 + (((y+1)/A) ^ (1/B) - (y/A) ^ (1/B))^2)
-    */
-
-    double len_d = 0.0;
-    double A_d = (double)A_f;
-    double B_d = (double)B_f;
-    double invB_d = 1.0 / B_d;
-
     int yMax = (y1 > y2) ? y1 : y2;
     int yMin = (y1 <= y2) ? y1 : y2;
 
-    for (int y = yMin; y < yMax; y++) {
-        double y_d = (double)y;
-        double z_d = pow((y_d / A_d), invB_d);
-        double zPlus1_d = pow(((y_d+1.0)/A_d), invB_d);
+    for (size_t i = 0; i < this->arcLengthCache.size(); i++) {
+        ArcLengthCacheEntry *entry = &this->arcLengthCache[i];
+        if (entry->isValid && entry->yMin == yMin && entry->yMax == yMax
+            && isNearlyEqual(entry->A_f, A_f) && isNearlyEqual(entry->B_f, B_f)) {
+            return entry->length_d;
+        }
+    }
 
-        double zDistSqr_d = pow((zPlus1_d - z_d), 2);
-        len_d += sqrt(1.0 + zDistSqr_d);
+    /* y = f(z) = A * z^B   <==>   z = h(y) = (y/A) ^ (1/B)
+       length of curve = integral from y1 to y2 of sqrt(1 + h'(y)^2) dy
+    */
+    double len_d;
+    double A_d = (double)A_f;
+    double B_d = (double)B_f;
+    if (yMin == yMax) {
+        len_d = 0.0;
+    } else if (A_d == 0.0 || B_d == 0.0 || (double)yMin / A_d <= 0.0 || (double)yMax / A_d <= 0.0) {
+        // no curve through these y-values, so only their distance
+        len_d = (double)(yMax - yMin);
+    } else {
+        double invA_d = 1.0 / A_d;
+        double invB_d = 1.0 / B_d;
+        double a_d = (double)yMin;
+        double b_d = (double)yMax;
+        double m_d = 0.5 * (a_d + b_d);
+        double fa_d = arcLengthIntegrand(a_d, invA_d, invB_d);
+        double fm_d = arcLengthIntegrand(m_d, invA_d, invB_d);
+        double fb_d = arcLengthIntegrand(b_d, invA_d, invB_d);
+        double whole_d = (b_d - a_d) / 6.0 * (fa_d + 4.0 * fm_d + fb_d);
+        // the length is at least the distance, so this bounds the relative error
+        double tolerance_d = ARC_LENGTH_TOLERANCE * (b_d - a_d);
+        len_d = integrateArcLength(a_d, m_d, b_d, fa_d, fm_d, fb_d, whole_d, tolerance_d, ARC_LENGTH_MAX_DEPTH, invA_d, invB_d);
     }
 
-    // return abs(len_d)
-    return (len_d < 0.0) ? (-1.0 * len_d) : len_d;
+    // replace the oldest entry
+    ArcLengthCacheEntry *entry = &this->arcLengthCache[this->arcLengthCacheNext];
+    entry->A_f = A_f;
+    entry->B_f = B_f;
+    entry->yMin = yMin;
+    entry->yMax = yMax;
+    entry->length_d = len_d;
+    entry->isValid = true;
+    this->arcLengthCacheNext = (this->arcLengthCacheNext + 1) % (int)this->arcLengthCache.size();
+    return len_d;
 }
 
 /* sets private vars for calibration points of screen (ie physical coords of screen)
- * inputs: number of rows and number of cols of calibration points,
+   and precomputes each calibration cell and the mapping table
+ * inputs: number of rows and number of cols of calibration points (any grid, at least 2x2),
            array of (pointers to) 3D physical coordinates of calibration points,
            array of (pointers to) 2D virtual coordinates of calibration points */
 void VirtualManager::setCalibrationPoints(int rows, int cols, 
          Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual) {
+    // every interaction is mapped within a cell, so there must be at least one
+    if (rows < 2 || cols < 2) {
+        std::cout << "VirtualManager: Calibration needs at least 2 rows and 2 cols." << std::endl;
+        return;
+    }
     this->deleteCalibrationVars();
     // set private vars
     this->calibrationNumRows = rows;
     this->calibrationNumCols = cols;
-    this->calibrationCoordsPhysical = calibrationCoordsPhysical;
-    this->calibrationCoordsVirtual = calibrationCoordsVirtual;
-    this->averageYValues = new int[rows]; 
-    this->avgCalCoords = new Coord3D*[rows*cols];
-    // determine average y-value of each row of calibration points
-    // and copy cal points, with averaged y-value, to avgCalCoords
+    this->averageYValues_d = new double[rows];
+    this->calibrationPixelX = new int[rows*cols];
+    this->calibrationPixelY = new int[rows*cols];
+    this->calibrationPhysicalX_d = new double[rows*cols];
+    this->calibrationVirtualX = new int[rows*cols];
+    this->calibrationVirtualY = new int[rows*cols];
+    // copy cal points to contiguous arrays
+    for (int i = 0; i < rows*cols; i++) {
+        this->calibrationPixelX[i] = calibrationCoordsPhysical[i]->x;
+        this->calibrationPixelY[i] = calibrationCoordsPhysical[i]->y;
+        this->calibrationVirtualX[i] = calibrationCoordsVirtual[i]->x;
+        this->calibrationVirtualY[i] = calibrationCoordsVirtual[i]->y;
+    }
+    this->buildCalibration();
+}
+
+/* undistorts the calibration points, and precomputes each calibration cell and the mapping table from them
+   (replacing any read from a calibration profile) */
+void VirtualManager::buildCalibration() {
+    int rows = this->calibrationNumRows;
+    int cols = this->calibrationNumCols;
+    if (this->columnLines != NULL) {
+        delete []this->columnLines;
+        delete []this->calibrationCells;
+        this->columnLines = NULL;
+        this->calibrationCells = NULL;
+    }
+    if (this->profileMapping != NULL) {
+        // the mapping table is part of the profile
+        munmap(this->profileMapping, this->profileMappingByteCount);
+        this->profileMapping = NULL;
+        this->profileMappingByteCount = 0;
+        this->mappingTable = NULL;
+    }
+
+    // determine average y-value of each row of calibration points, which is now their y-value
     for (int row = 0; row < rows; row++) {
-        int sumYValues = 0;
+        double sumYValues_d = 0.0;
         for (int col = 0; col < cols; col++) {
-            sumYValues += calibrationCoordsPhysical[row*cols + col]->y;
+            double physicalY_d;
+            this->undistortCalibrationPoint(row*cols + col, &this->calibrationPhysicalX_d[row*cols + col], &physicalY_d);
+            sumYValues_d += physicalY_d;
         }
-        this->averageYValues[row] = sumYValues / cols;
+        this->averageYValues_d[row] = sumYValues_d / (double)cols;
         // possible TODO - also compute variance of y-values and print warning if it's high
         //     ie, print warning if the y-values of a row vary a lot
-        for (int col = 0; col < cols; col++) {
-            Coord3D *currCalPoint = new Coord3D;
-            currCalPoint->x = calibrationCoordsPhysical[row*cols + col]->x;
-            currCalPoint->y = this->averageYValues[row];
-            currCalPoint->z = calibrationCoordsPhysical[row*cols + col]->z;
-            this->avgCalCoords[row*cols + col] = currCalPoint;
+    }
+    this->buildCalibrationCells();
+    this->buildMappingTable();
+}
+
+/* finds where a calibration point's pixel would be without lens distortion, to a fraction of a pixel
+   (rounding it would move the calibration cells by up to half a pixel)
+ * inputs: index of the calibration point, physical x and y to set */
+void VirtualManager::undistortCalibrationPoint(int index, double *physicalX_d, double *physicalY_d) {
+    *physicalX_d = (double)this->calibrationPixelX[index];
+    *physicalY_d = (double)this->calibrationPixelY[index];
+    if (this->undistortedX != NULL) {
+        float undistortedX;
+        float undistortedY;
+        this->undistortLocation((float)this->calibrationPixelX[index], (float)this->calibrationPixelY[index], &undistortedX, &undistortedY);
+        *physicalX_d = (double)undistortedX;
+        *physicalY_d = (double)undistortedY;
+    }
+}
+
+/* size of a calibration profile's payload, in the order it is written
+ * inputs: number of rows and number of cols of calibration points */
+size_t VirtualManager::profilePayloadByteCount(int rows, int cols) {
+    return sizeof(ColumnLine) * (rows-1) * cols
+         + sizeof(CalibrationCell) * (rows-1) * (cols-1)
+         + sizeof(FixedCoord2D) * DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT
+         + sizeof(double) * rows
+         + sizeof(CalibrationProfilePoint) * rows * cols;
+}
+
+/* copies calibration points into the form a calibration profile stores them in
+ * inputs: number of points, arrays of (pointers to) physical and virtual coordinates, points to set */
+void VirtualManager::fillProfilePoints(int count, Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual,
+         CalibrationProfilePoint *points) {
+    memset((void *)points, 0, sizeof(CalibrationProfilePoint) * count);
+    for (int i = 0; i < count; i++) {
+        points[i].physicalX = calibrationCoordsPhysical[i]->x;
+        points[i].physicalY = calibrationCoordsPhysical[i]->y;
+        points[i].physicalZ = calibrationCoordsPhysical[i]->z;
+        points[i].virtualX = calibrationCoordsVirtual[i]->x;
+        points[i].virtualY = calibrationCoordsVirtual[i]->y;
+    }
+}
+
+/* hash of calibration points (64-bit FNV-1a), to tell whether a calibration profile was written for them
+ * inputs: number of points, arrays of (pointers to) physical and virtual coordinates
+ * output: the hash */
+uint64_t VirtualManager::hashCalibrationPoints(int count, Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual) {
+    std::vector<CalibrationProfilePoint> points(count);
+    fillProfilePoints(count, calibrationCoordsPhysical, calibrationCoordsVirtual, points.data());
+    return checksumWords(CHECKSUM_INITIAL, points.data(), sizeof(CalibrationProfilePoint) * count);
+}
+
+/* hash of a calibration file's size, modification time, and inode (64-bit FNV-1a), to tell whether a
+   calibration profile was written for it without reading it
+ * inputs: filename of the calibration file
+ * output: the hash, or 0 if the file is missing */
+uint64_t VirtualManager::hashCalibrationFile(std::string calibrationFilename) {
+    struct stat fileStat;
+    if (stat(calibrationFilename.c_str(), &fileStat) < 0) {
+        return 0;
+    }
+    uint64_t fields[] = {(uint64_t)fileStat.st_size, (uint64_t)fileStat.st_mtime, (uint64_t)fileStat.st_ino};
+    return checksumWords(CHECKSUM_INITIAL, fields, sizeof(fields));
+}
+
+/* writes the calibration, everything derived from it, and the screen size to a calibration profile,
+   so readCalibrationProfile() can restore them without recomputing them
+ * inputs: filename of the profile, hash identifying the calibration (see CalibrationProfileHeader),
+           the calibration points given to setCalibrationPoints()
+ * output: 0 on success, -1 if not calibrated or the profile could not be written */
+int VirtualManager::writeCalibrationProfile(std::string profileFilename, uint64_t calibrationHash,
+         Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual) {
+    if (this->mappingTable == NULL || this->screenHeightVirtual == 0) {
+        std::cout << "VirtualManager: Calibration profile written before calibration points and screen size are set." << std::endl;
+        return -1;
+    }
+    int rows = this->calibrationNumRows;
+    int cols = this->calibrationNumCols;
+
+    std::vector<CalibrationProfilePoint> points(rows * cols);
+    fillProfilePoints(rows * cols, calibrationCoordsPhysical, calibrationCoordsVirtual, points.data());
+
+    // payload sections, in order
+    const void *sections[] = {this->columnLines, this->calibrationCells, this->mappingTable, this->averageYValues_d, points.data()};
+    size_t sectionByteCounts[] = {
+        sizeof(ColumnLine) * (rows-1) * cols,
+        sizeof(CalibrationCell) * (rows-1) * (cols-1),
+        sizeof(FixedCoord2D) * DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT,
+        sizeof(double) * rows,
+        sizeof(CalibrationProfilePoint) * rows * cols
+    };
+    int sectionCount = sizeof(sectionByteCounts) / sizeof(sectionByteCounts[0]);
+
+    CalibrationProfileHeader header;
+    memset((void *)&header, 0, sizeof(header));
+    memcpy(header.magic, CALIBRATION_PROFILE_MAGIC, CALIBRATION_PROFILE_MAGIC_LENGTH);
+    header.version = CALIBRATION_PROFILE_VERSION;
+    header.rows = rows;
+    header.cols = cols;
+    header.screenWidth = this->screenWidthVirtual;
+    header.screenHeight = this->screenHeightVirtual;
+    header.depthWidth = DEPTH_FRAME_WIDTH;
+    header.depthHeight = DEPTH_FRAME_HEIGHT;
+    header.fractionBits = MAPPING_FRACTION_BITS;
+    header.areColumnsDescending = this->areColumnsDescending ? 1 : 0;
+    header.payloadByteCount = (uint32_t)this->profilePayloadByteCount(rows, cols);
+    header.cameraIntrinsics = this->cameraIntrinsics;
+    header.calibrationHash = calibrationHash;
+    // the header is checksummed with checksum zeroed, so the fields the reader trusts are covered too
+    uint64_t checksum = checksumWords(CHECKSUM_INITIAL, &header, sizeof(header));
+    for (int i = 0; i < sectionCount; i++) {
+        checksum = checksumWords(checksum, sections[i], sectionByteCounts[i]);
+    }
+    header.checksum = checksum;
+
+    std::ofstream profileFile(profileFilename, std::ios::binary | std::ios::trunc);
+    if (!profileFile.is_open()) {
+        std::cout << "VirtualManager: Could not write calibration profile." << std::endl;
+        return -1;
+    }
+    profileFile.write((const char *)&header, sizeof(header));
+    for (int i = 0; i < sectionCount; i++) {
+        profileFile.write((const char *)sections[i], sectionByteCounts[i]);
+    }
+    profileFile.close();
+    if (profileFile.fail()) {
+        std::cout << "VirtualManager: Could not write calibration profile." << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+/* restores the calibration and everything derived from it from a calibration profile, in place of
+   setCalibrationPoints() and setScreenVirtual(), mapping the profile into memory so the mapping table
+   is read from it rather than built or copied
+ * inputs: filename of the profile, the expected number of rows and cols and size of the screen,
+           hash identifying the calibration the profile should be for (as written),
+           arrays of (pointers to) physical and virtual coordinates to set to the calibration points (or NULL)
+ * output: 0 on success, -1 if the profile is missing, corrupt, or for another calibration, grid, or screen,
+           leaving the calibration unchanged */
+int VirtualManager::readCalibrationProfile(std::string profileFilename, int rows, int cols, int screenHeightVirtual, int screenWidthVirtual,
+         uint64_t calibrationHash, Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual) {
+    int fd = open(profileFilename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cout << "VirtualManager: Could not open calibration profile." << std::endl;
+        return -1;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) < 0 || (size_t)fileStat.st_size < sizeof(CalibrationProfileHeader)) {
+        std::cout << "VirtualManager: Calibration profile is too small." << std::endl;
+        close(fd);
+        return -1;
+    }
+    size_t mappingByteCount = fileStat.st_size;
+    void *mapping = mmap(NULL, mappingByteCount, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cout << "VirtualManager: Could not map calibration profile." << std::endl;
+        return -1;
+    }
+
+    const CalibrationProfileHeader *header = (const CalibrationProfileHeader *)mapping;
+    const unsigned char *payload = (const unsigned char *)mapping + sizeof(CalibrationProfileHeader);
+    // the whole file is checksummed before any header field is trusted, copying the header bytewise
+    // so its padding is checksummed as it was written
+    CalibrationProfileHeader checksummedHeader;
+    memcpy((void *)&checksummedHeader, header, sizeof(checksummedHeader));
+    checksummedHeader.checksum = 0;
+    uint64_t checksum = checksumWords(CHECKSUM_INITIAL, &checksummedHeader, sizeof(checksummedHeader));
+    checksum = checksumWords(checksum, payload, mappingByteCount - sizeof(CalibrationProfileHeader));
+    const char *error = NULL;
+    if (memcmp(header->magic, CALIBRATION_PROFILE_MAGIC, CALIBRATION_PROFILE_MAGIC_LENGTH) != 0 ||
+        header->version != CALIBRATION_PROFILE_VERSION) {
+        error = "Not a calibration profile";
+    } else if (checksum != header->checksum) {
+        error = "Calibration profile is corrupt";
+    } else if (header->depthWidth != DEPTH_FRAME_WIDTH || header->depthHeight != DEPTH_FRAME_HEIGHT ||
+               header->fractionBits != MAPPING_FRACTION_BITS) {
+        error = "Calibration profile is for another depth frame";
+    } else if (rows < 2 || cols < 2 || header->rows != (uint32_t)rows || header->cols != (uint32_t)cols) {
+        error = "Calibration profile is for another grid";
+    } else if (header->screenWidth != (uint32_t)screenWidthVirtual || header->screenHeight != (uint32_t)screenHeightVirtual) {
+        error = "Calibration profile is for another screen size";
+    } else if (header->calibrationHash != calibrationHash) {
+        error = "Calibration profile is for other calibration points";
+    } else if (memcmp(&header->cameraIntrinsics, &this->cameraIntrinsics, sizeof(CameraIntrinsics)) != 0) {
+        // CameraIntrinsics is all 4-byte fields, so has no padding to differ
+        error = "Calibration profile is for other camera intrinsics";
+    } else if (header->payloadByteCount != this->profilePayloadByteCount(rows, cols) ||
+               mappingByteCount != sizeof(CalibrationProfileHeader) + header->payloadByteCount) {
+        error = "Calibration profile is truncated";
+    }
+    // the calibration points end the payload
+    const CalibrationProfilePoint *points = NULL;
+    if (error == NULL) {
+        points = (const CalibrationProfilePoint *)(payload + header->payloadByteCount - sizeof(CalibrationProfilePoint) * rows * cols);
+        for (int i = 0; i < rows * cols && error == NULL; i++) {
+            if (points[i].virtualX < 0 || points[i].virtualX > screenWidthVirtual || points[i].virtualY < 0 || points[i].virtualY > screenHeightVirtual) {
+                error = "Calibration profile has points off the screen";
+            }
+        }
+    }
+    if (error != NULL) {
+        std::cout << "VirtualManager: " << error << "." << std::endl;
+        munmap(mapping, mappingByteCount);
+        return -1;
+    }
+
+    this->deleteCalibrationVars();
+    this->calibrationNumRows = rows;
+    this->calibrationNumCols = cols;
+    this->areColumnsDescending = (header->areColumnsDescending != 0);
+    const unsigned char *section = payload;
+    this->columnLines = new ColumnLine[(rows-1) * cols];
+    memcpy(this->columnLines, section, sizeof(ColumnLine) * (rows-1) * cols);
+    section += sizeof(ColumnLine) * (rows-1) * cols;
+    this->calibrationCells = new CalibrationCell[(rows-1) * (cols-1)];
+    memcpy(this->calibrationCells, section, sizeof(CalibrationCell) * (rows-1) * (cols-1));
+    section += sizeof(CalibrationCell) * (rows-1) * (cols-1);
+    // the table is only read, so it stays in the mapped profile
+    this->profileMapping = (unsigned char *)mapping;
+    this->profileMappingByteCount = mappingByteCount;
+    this->mappingTable = (FixedCoord2D *)section;
+    section += sizeof(FixedCoord2D) * DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT;
+    this->averageYValues_d = new double[rows];
+    memcpy(this->averageYValues_d, section, sizeof(double) * rows);
+
+    this->calibrationPixelX = new int[rows*cols];
+    this->calibrationPixelY = new int[rows*cols];
+    this->calibrationPhysicalX_d = new double[rows*cols];
+    this->calibrationVirtualX = new int[rows*cols];
+    this->calibrationVirtualY = new int[rows*cols];
+    for (int i = 0; i < rows * cols; i++) {
+        this->calibrationPixelX[i] = points[i].physicalX;
+        this->calibrationPixelY[i] = points[i].physicalY;
+        double physicalY_d;
+        this->undistortCalibrationPoint(i, &this->calibrationPhysicalX_d[i], &physicalY_d);
+        this->calibrationVirtualX[i] = points[i].virtualX;
+        this->calibrationVirtualY[i] = points[i].virtualY;
+        if (calibrationCoordsPhysical != NULL) {
+            calibrationCoordsPhysical[i]->x = points[i].physicalX;
+            calibrationCoordsPhysical[i]->y = points[i].physicalY;
+            calibrationCoordsPhysical[i]->z = points[i].physicalZ;
+        }
+        if (calibrationCoordsVirtual != NULL) {
+            calibrationCoordsVirtual[i]->x = points[i].virtualX;
+            calibrationCoordsVirtual[i]->y = points[i].virtualY;
         }
     }
+    this->setScreenVirtual(screenHeightVirtual, screenWidthVirtual);
+    return 0;
 }
 
 /* sets private vars for size of screen (in pixels) 
+   the mapping table does not depend on the screen size, so only the clamping limits change
  * inputs: height of screen, width of screen */
 void VirtualManager::setScreenVirtual(int screenHeightVirtual, int screenWidthVirtual) {
     this->screenHeightVirtual = screenHeightVirtual;
     this->screenWidthVirtual = screenWidthVirtual;
+
+    // a coordinate within SCREEN_EDGE_TOLERANCE of the screen is clamped to it, as in setVirtualCoordFromCalibration()
+    double screenWidthFixed_d = (double)screenWidthVirtual * MAPPING_FIXED_ONE;
+    double screenHeightFixed_d = (double)screenHeightVirtual * MAPPING_FIXED_ONE;
+    this->screenWidthFixed = (int32_t)screenWidthFixed_d;
+    this->screenHeightFixed = (int32_t)screenHeightFixed_d;
+    this->minXFixed = (int32_t)ceil(-SCREEN_EDGE_TOLERANCE * screenWidthFixed_d);
+    this->maxXFixed = (int32_t)floor((1.0 + SCREEN_EDGE_TOLERANCE) * screenWidthFixed_d);
+    this->minYFixed = (int32_t)ceil(-SCREEN_EDGE_TOLERANCE * screenHeightFixed_d);
+    this->maxYFixed = (int32_t)floor((1.0 + SCREEN_EDGE_TOLERANCE) * screenHeightFixed_d);
+}
+
+/* sets the intrinsics of the depth camera, so calibration points and interactions are undistorted before they are mapped,
+   each by a lookup in the undistortion table rather than by undistorting whole depth frames
+   the mapping is rebuilt in undistorted coordinates if already calibrated
+ * inputs: intrinsics of the depth camera, or intrinsics without focal lengths to map pixels as they are
+ * output: 1 if the mapping was rebuilt, 0 otherwise */
+int VirtualManager::setCameraIntrinsics(CameraIntrinsics cameraIntrinsics) {
+    if (!cameraIntrinsics.isValid()) {
+        cameraIntrinsics = CameraIntrinsics();
+    }
+    // CameraIntrinsics is all 4-byte fields, so has no padding to differ
+    if (memcmp(&cameraIntrinsics, &this->cameraIntrinsics, sizeof(CameraIntrinsics)) == 0) {
+        return 0;
+    }
+    this->buildUndistortionTable(cameraIntrinsics);
+    if (this->calibrationPixelX == NULL) {
+        return 0;
+    }
+    this->buildCalibration();
+    return 1;
 }
 
 /* takes the physical coordinate of an interaction and updates its 
-   virtual coordinate 
+   virtual coordinate, read from the mapping table (or computed, outside the depth frame)
  * inputs: interaction whose virtual coordinate should be updated */
 void VirtualManager::setVirtualCoord(Interaction *interaction) {
     // make sure VirtualManager private vars have been initialized
-    if (this->calibrationCoordsPhysical == NULL || this->screenHeightVirtual == 0) {
+    if (this->mappingTable == NULL || this->screenHeightVirtual == 0) {
         // TODO print error or check more values?
         std::cout << "setVirtualCoord() called before initial values have been set\n";
         return;
@@ -136,126 +587,389 @@ void VirtualManager::setVirtualCoord(Interaction *interaction) {
         
         this->A_f = interaction->surfaceRegressionA;
         this->B_f = interaction->surfaceRegressionB;
-        this->screenLength_d = findArcLength(this->A_f, this->B_f, this->averageYValues[0], this->averageYValues[this->calibrationNumRows - 1]);
+        this->screenLength_d = findArcLength(this->A_f, this->B_f, (int)this->averageYValues_d[0], (int)this->averageYValues_d[this->calibrationNumRows - 1]);
     }
 
-    // copy some long variable names to shorter names to make things easier to read
-    int interactionY = interaction->physicalLocation->y;
     int interactionX = interaction->physicalLocation->x;
-    int numCols = this->calibrationNumCols;
-    int numRows = this->calibrationNumRows;
-    double screenWidth_d = (double)this->screenWidthVirtual;
-    double screenHeight_d = (double)this->screenHeightVirtual;
-
-    /*** determine which calibration cell interaction is in ***/
-    // determine which calibration rows the interaction is between
-    int calibrationRow; // the first calibration row whose y-value >= interaction's y-value
-    for (calibrationRow = 1; calibrationRow < numRows-1; calibrationRow++) {
-        if (this->averageYValues[calibrationRow] >= interactionY) {
-            break; 
-        }
-    }
-    //std::cout << "calibrationRow: " << calibrationRow << std::endl;
-    // determine which calibration cols the interaction is between 
-    int calibrationCol; // the first calibration col whose x-value >= interaction's x-value
-    for (calibrationCol = numCols-2; calibrationCol >= 1; calibrationCol--) {
-        Coord3D *topPoint = this->avgCalCoords[(calibrationRow-1) * numCols + calibrationCol];
-        Coord3D *bottomPoint = this->avgCalCoords[calibrationRow * numCols + calibrationCol];
-        int colXValue = (int)(getXValue(topPoint, bottomPoint, interactionY));
-        if (colXValue >= interactionX) {
-            break;
-        }
+    int interactionY = interaction->physicalLocation->y;
+    FixedCoord2D virtualFixed;
+    if (this->undistortedX != NULL) {
+        virtualFixed = this->findUndistortedVirtualLocation(interactionX, interactionY);
+    } else if (interactionX >= 0 && interactionX < DEPTH_FRAME_WIDTH && interactionY >= 0 && interactionY < DEPTH_FRAME_HEIGHT) {
+        virtualFixed = this->mappingTable[interactionY * DEPTH_FRAME_WIDTH + interactionX];
+    } else {
+        virtualFixed = this->findFixedVirtualLocation(interactionX, interactionY);
     }
+    interaction->virtualLocation->x = clampToScreen(virtualFixed.x, this->screenWidthVirtual, this->screenWidthFixed, this->minXFixed, this->maxXFixed);
+    interaction->virtualLocation->y = clampToScreen(virtualFixed.y, this->screenHeightVirtual, this->screenHeightFixed, this->minYFixed, this->maxYFixed);
+}
 
-    // the indices of the calibration points around the interaction
-    int topLeftIndex = (calibrationRow-1) * numCols + calibrationCol;
-    int bottomLeftIndex = calibrationRow * numCols + calibrationCol;
-    int topRightIndex = (calibrationRow-1) * numCols + calibrationCol+1;
-    int bottomRightIndex = calibrationRow * numCols + calibrationCol+1;
+/* takes the physical coordinate of an interaction and updates its 
+   virtual coordinate, computed from the calibration cell around it
+   (what the mapping table holds, for coordinates outside the depth frame and for checking the table)
+ * inputs: interaction whose virtual coordinate should be updated */
+void VirtualManager::setVirtualCoordFromCalibration(Interaction *interaction) {
+    // make sure VirtualManager private vars have been initialized
+    if (this->mappingTable == NULL || this->screenHeightVirtual == 0) {
+        std::cout << "setVirtualCoordFromCalibration() called before initial values have been set\n";
+        return;
+    }
 
-    /*** calculate percentRight ***/
-    // calculate percentRight of calibrationCol
-    double leftVirtualX_d = (double)this->calibrationCoordsVirtual[topLeftIndex]->x;
-    double rightVirtualX_d = (double)this->calibrationCoordsVirtual[topRightIndex]->x;
-    double percentRightCol_d = leftVirtualX_d / screenWidth_d;
-    // calculate percentRight of interaction within calibration cell
-    Coord3D *topLeftPoint = this->avgCalCoords[topLeftIndex];
-    Coord3D *bottomLeftPoint = this->avgCalCoords[bottomLeftIndex];
-    double xLeft_d = getXValue(topLeftPoint, bottomLeftPoint, interactionY);
-    Coord3D *topRightPoint = this->avgCalCoords[topRightIndex];
-    Coord3D *bottomRightPoint = this->avgCalCoords[bottomRightIndex];
-    double xRight_d = getXValue(topRightPoint, bottomRightPoint, interactionY);
-    double x_d = (double)(interactionX);
-    double percentRightInteraction_d = (xLeft_d - x_d) / (xLeft_d - xRight_d);
-    // calculate percentRight
-    double scaleX_d = (rightVirtualX_d - leftVirtualX_d) / screenWidth_d;
-    double percentRight_d = percentRightCol_d + (percentRightInteraction_d * scaleX_d);
-
-    /*** calculate percentDown ***/
-    // calculate percentDown of calibrationRows
-    double topVirtualY_d = (double)this->calibrationCoordsVirtual[topLeftIndex]->y;
-    double bottomVirtualY_d = (double)this->calibrationCoordsVirtual[bottomLeftIndex]->y;
-    double percentDownRow_d = topVirtualY_d / screenHeight_d;
-    // calculate percentDown of interaction within calibration cell
-    double yGreater_d = (double)(this->averageYValues[calibrationRow]);
-    double yLess_d = (double)(this->averageYValues[calibrationRow-1]);
-    double y_d = (double)(interactionY);
-    double percentDownInteraction_d = (y_d - yLess_d) / (yGreater_d - yLess_d);
-    // calculate percentDown
-    double scaleY_d = (bottomVirtualY_d - topVirtualY_d) / screenHeight_d;
-    double percentDown_d = percentDownRow_d + (percentDownInteraction_d * scaleY_d);
+    double screenWidth_d = (double)this->screenWidthVirtual;
+    double screenHeight_d = (double)this->screenHeightVirtual;
+    float physicalX = (float)interaction->physicalLocation->x;
+    float physicalY = (float)interaction->physicalLocation->y;
+    if (this->undistortedX != NULL) {
+        this->undistortLocation(physicalX, physicalY, &physicalX, &physicalY);
+    }
+    double virtualX_d;
+    double virtualY_d;
+    this->findVirtualLocation(physicalX, physicalY, &virtualX_d, &virtualY_d);
+    double percentRight_d = virtualX_d / screenWidth_d;
+    double percentDown_d = virtualY_d / screenHeight_d;
 
     /*** make sure percentRight/Down are between 0.0 and 1.0, or error value **/
-    if (-0.05 <= percentRight_d && percentRight_d < 0.0) {
+    if (-SCREEN_EDGE_TOLERANCE <= percentRight_d && percentRight_d < 0.0) {
         percentRight_d = 0.0;
     }
-    if (1.0 < percentRight_d && percentRight_d <= 1.05) {
+    if (1.0 < percentRight_d && percentRight_d <= 1.0 + SCREEN_EDGE_TOLERANCE) {
         percentRight_d = 1.0;
     }
-    if (percentRight_d > 1.05 || percentRight_d < -0.05) {
+    if (percentRight_d > 1.0 + SCREEN_EDGE_TOLERANCE || percentRight_d < -SCREEN_EDGE_TOLERANCE) {
         percentRight_d = -1.0;
     }
-    if (-0.05 <= percentDown_d && percentDown_d < 0.0) {
+    if (-SCREEN_EDGE_TOLERANCE <= percentDown_d && percentDown_d < 0.0) {
         percentDown_d = 0.0;
     }
-    if (1.0 < percentDown_d && percentDown_d <= 1.05) {
+    if (1.0 < percentDown_d && percentDown_d <= 1.0 + SCREEN_EDGE_TOLERANCE) {
         percentDown_d = 1.0;
     }
-    if (percentDown_d > 1.05 || percentDown_d < -0.05) {
+    if (percentDown_d > 1.0 + SCREEN_EDGE_TOLERANCE || percentDown_d < -SCREEN_EDGE_TOLERANCE) {
         percentDown_d = -1.0;
     }
 
     /*** set virtual coords ***/
-    interaction->virtualLocation->x = (int)(screenWidth_d * percentRight_d);
-    interaction->virtualLocation->y = (int)(screenHeight_d * percentDown_d);
+    // truncated from the virtual coordinate itself on the screen, as screenWidth_d * percentRight_d can fall just short of a whole pixel
+    interaction->virtualLocation->x = (0.0 < percentRight_d && percentRight_d < 1.0) ? (int)virtualX_d : (int)(screenWidth_d * percentRight_d);
+    interaction->virtualLocation->y = (0.0 < percentDown_d && percentDown_d < 1.0) ? (int)virtualY_d : (int)(screenHeight_d * percentDown_d);
+}
 
+/* maps count physical coordinates to virtual coordinates, as setVirtualCoord() would one at a time, 
+   reading and writing contiguous arrays so many contacts or a whole session cost a single call
+ * inputs: number of coordinates, physical x and y of each, 
+           virtual x and y to set for each (which may not overlap the physical coordinates)
+ * output: 0 on success, -1 if the mapping is not set up */
+int VirtualManager::mapPhysicalLocations(int count, const int *physicalX, const int *physicalY, int *virtualX, int *virtualY) {
+    if (this->mappingTable == NULL || this->screenHeightVirtual == 0) {
+        return -1;
+    }
+
+    // read each fixed-point virtual coordinate from the table, or compute it outside the depth frame
+    const FixedCoord2D *mappingTable = this->mappingTable;
+    for (int i = 0; i < count; i++) {
+        int x = physicalX[i];
+        int y = physicalY[i];
+        FixedCoord2D virtualFixed;
+        if (this->undistortedX != NULL) {
+            virtualFixed = this->findUndistortedVirtualLocation(x, y);
+        } else if (x >= 0 && x < DEPTH_FRAME_WIDTH && y >= 0 && y < DEPTH_FRAME_HEIGHT) {
+            virtualFixed = mappingTable[y * DEPTH_FRAME_WIDTH + x];
+        } else {
+            virtualFixed = this->findFixedVirtualLocation(x, y);
+        }
+        virtualX[i] = virtualFixed.x;
+        virtualY[i] = virtualFixed.y;
+    }
+
+    // then clamp each axis in place, in loops without branches or calls that the compiler vectorizes
+    clampAllToScreen(count, virtualX, this->screenWidthVirtual, this->screenWidthFixed, this->minXFixed, this->maxXFixed);
+    clampAllToScreen(count, virtualY, this->screenHeightVirtual, this->screenHeightFixed, this->minYFixed, this->maxYFixed);
+    return 0;
 }
 
-/* returns the x-coordinate of the point with y-coordinate y, described by topPoint and bottomPoint *
- * inputs: topPoint and bottomPoint describe a line,
-           y is the y-coordinate of the point for which the x-coordinate will be returned */
-double VirtualManager::getXValue(Coord3D *topPoint, Coord3D *bottomPoint, int y) {
-    double yBottom_d = (double)(bottomPoint->y);
-    double yTop_d = (double)(topPoint->y);
-    double xBottom_d = (double)(bottomPoint->x);
-    double xTop_d = (double)(topPoint->x);
-    double y_d = (double)(y);
+/* maps a sub-pixel physical coordinate to a virtual coordinate, 
+   interpolating bilinearly between the four surrounding entries of the mapping table
+   (after undistorting the coordinate, with the camera's intrinsics)
+ * inputs: physical x and y (within the depth frame), virtual coordinate to set
+ * output: 0 on success, -1 if the coordinate is outside the depth frame or the mapping is not set up */
+int VirtualManager::mapPhysicalLocation(float physicalX, float physicalY, Coord2D *virtualLocation) {
+    if (this->mappingTable == NULL || this->screenHeightVirtual == 0) {
+        return -1;
+    }
+    if (!(physicalX >= 0.0f && physicalX <= DEPTH_FRAME_WIDTH - 1 && physicalY >= 0.0f && physicalY <= DEPTH_FRAME_HEIGHT - 1)) {
+        return -1;
+    }
+
+    if (this->undistortedX != NULL) {
+        this->undistortLocation(physicalX, physicalY, &physicalX, &physicalY);
+    }
+    FixedCoord2D virtualFixed = this->interpolateMappingTable(physicalX, physicalY);
+    virtualLocation->x = clampToScreen(virtualFixed.x, this->screenWidthVirtual, this->screenWidthFixed, this->minXFixed, this->maxXFixed);
+    virtualLocation->y = clampToScreen(virtualFixed.y, this->screenHeightVirtual, this->screenHeightFixed, this->minYFixed, this->maxYFixed);
+    return 0;
+}
 
-    // x = (y - y2) * ((x2 - x1)/(y2 - y1)) + x2
-    double slopeInverse_d = (xTop_d - xBottom_d) / (yTop_d - yBottom_d);
-    return (y_d - yTop_d) * slopeInverse_d + xTop_d;
+/* finds the fixed-point virtual coordinate of a pixel as detected, through the undistortion table,
+   at the sub-pixel location it undistorts to
+ * inputs: physical x and y of the interaction */
+VirtualManager::FixedCoord2D VirtualManager::findUndistortedVirtualLocation(int interactionX, int interactionY) {
+    float physicalX;
+    float physicalY;
+    this->undistortLocation((float)interactionX, (float)interactionY, &physicalX, &physicalY);
+    return this->interpolateMappingTable(physicalX, physicalY);
+}
 
+/* finds the fixed-point virtual coordinate of a sub-pixel physical coordinate,
+   interpolating bilinearly between the four surrounding entries of the mapping table (or computed, outside the depth frame)
+ * inputs: physical x and y */
+VirtualManager::FixedCoord2D VirtualManager::interpolateMappingTable(float physicalX, float physicalY) {
+    if (!(physicalX >= 0.0f && physicalX <= DEPTH_FRAME_WIDTH - 1 && physicalY >= 0.0f && physicalY <= DEPTH_FRAME_HEIGHT - 1)) {
+        return this->findFixedVirtualLocation(physicalX, physicalY);
+    }
+
+    // integer pixel and fixed-point weights of the next pixel right and down
+    int32_t physicalXFixed = (int32_t)(physicalX * MAPPING_FIXED_ONE);
+    int32_t physicalYFixed = (int32_t)(physicalY * MAPPING_FIXED_ONE);
+    int x0 = physicalXFixed >> MAPPING_FRACTION_BITS;
+    int y0 = physicalYFixed >> MAPPING_FRACTION_BITS;
+    int64_t weightX = physicalXFixed & (MAPPING_FIXED_ONE - 1);
+    int64_t weightY = physicalYFixed & (MAPPING_FIXED_ONE - 1);
+    int x1 = (x0 + 1 < DEPTH_FRAME_WIDTH) ? x0 + 1 : x0;
+    int y1 = (y0 + 1 < DEPTH_FRAME_HEIGHT) ? y0 + 1 : y0;
+
+    FixedCoord2D topLeft = this->mappingTable[y0 * DEPTH_FRAME_WIDTH + x0];
+    FixedCoord2D topRight = this->mappingTable[y0 * DEPTH_FRAME_WIDTH + x1];
+    FixedCoord2D bottomLeft = this->mappingTable[y1 * DEPTH_FRAME_WIDTH + x0];
+    FixedCoord2D bottomRight = this->mappingTable[y1 * DEPTH_FRAME_WIDTH + x1];
+
+    // weights sum to MAPPING_FIXED_ONE^2, so shift twice the fraction bits after summing
+    int64_t weightTopLeft = (MAPPING_FIXED_ONE - weightX) * (MAPPING_FIXED_ONE - weightY);
+    int64_t weightTopRight = weightX * (MAPPING_FIXED_ONE - weightY);
+    int64_t weightBottomLeft = (MAPPING_FIXED_ONE - weightX) * weightY;
+    int64_t weightBottomRight = weightX * weightY;
+    int64_t rounding = (int64_t)1 << (2 * MAPPING_FRACTION_BITS - 1);
+    FixedCoord2D virtualFixed;
+    virtualFixed.x = (int32_t)((topLeft.x * weightTopLeft + topRight.x * weightTopRight
+        + bottomLeft.x * weightBottomLeft + bottomRight.x * weightBottomRight + rounding) >> (2 * MAPPING_FRACTION_BITS));
+    virtualFixed.y = (int32_t)((topLeft.y * weightTopLeft + topRight.y * weightTopRight
+        + bottomLeft.y * weightBottomLeft + bottomRight.y * weightBottomRight + rounding) >> (2 * MAPPING_FRACTION_BITS));
+    return virtualFixed;
 }
 
-void VirtualManager::deleteCalibrationVars() {
-    if (this->averageYValues != NULL) {
-        delete []this->averageYValues;
+/* fills the undistortion table with where each pixel of the depth frame would be through a lens without distortion,
+   in the same pixel coordinates (so the mapping table covers both)
+ * inputs: intrinsics of the depth camera, or intrinsics without focal lengths for no table */
+void VirtualManager::buildUndistortionTable(CameraIntrinsics cameraIntrinsics) {
+    this->cameraIntrinsics = cameraIntrinsics;
+    if (!cameraIntrinsics.isValid()) {
+        delete []this->undistortedX;
+        delete []this->undistortedY;
+        this->undistortedX = NULL;
+        this->undistortedY = NULL;
+        return;
+    }
+    if (this->undistortedX == NULL) {
+        this->undistortedX = new float[DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT];
+        this->undistortedY = new float[DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT];
+    }
+    buildRayTable(cameraIntrinsics, DEPTH_FRAME_WIDTH, DEPTH_FRAME_HEIGHT, this->undistortedX, this->undistortedY);
+    for (int i = 0; i < DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT; i++) {
+        this->undistortedX[i] = this->undistortedX[i] * cameraIntrinsics.fx + cameraIntrinsics.cx;
+        this->undistortedY[i] = this->undistortedY[i] * cameraIntrinsics.fy + cameraIntrinsics.cy;
     }
-    if (this->avgCalCoords != NULL) {
-        for (int i = 0; i < this->calibrationNumRows * this->calibrationNumCols; i++) {
-            delete this->avgCalCoords[i];
+}
+
+/* finds where a sub-pixel physical coordinate would be without lens distortion, 
+   interpolating bilinearly between the four surrounding entries of the undistortion table (or computed, outside the depth frame)
+ * inputs: physical x and y as detected, undistorted x and y to set (which may be the same as the physical x and y) */
+void VirtualManager::undistortLocation(float physicalX, float physicalY, float *undistortedX, float *undistortedY) {
+    if (!(physicalX >= 0.0f && physicalX <= DEPTH_FRAME_WIDTH - 1 && physicalY >= 0.0f && physicalY <= DEPTH_FRAME_HEIGHT - 1)) {
+        float rayX;
+        float rayY;
+        undistortPixel(this->cameraIntrinsics, physicalX, physicalY, &rayX, &rayY);
+        *undistortedX = rayX * this->cameraIntrinsics.fx + this->cameraIntrinsics.cx;
+        *undistortedY = rayY * this->cameraIntrinsics.fy + this->cameraIntrinsics.cy;
+        return;
+    }
+
+    int x0 = (int)physicalX;
+    int y0 = (int)physicalY;
+    float weightX = physicalX - x0;
+    float weightY = physicalY - y0;
+    int x1 = (x0 + 1 < DEPTH_FRAME_WIDTH) ? x0 + 1 : x0;
+    int y1 = (y0 + 1 < DEPTH_FRAME_HEIGHT) ? y0 + 1 : y0;
+    int topLeft = y0 * DEPTH_FRAME_WIDTH + x0;
+    int topRight = y0 * DEPTH_FRAME_WIDTH + x1;
+    int bottomLeft = y1 * DEPTH_FRAME_WIDTH + x0;
+    int bottomRight = y1 * DEPTH_FRAME_WIDTH + x1;
+    float top = this->undistortedX[topLeft] + weightX * (this->undistortedX[topRight] - this->undistortedX[topLeft]);
+    float bottom = this->undistortedX[bottomLeft] + weightX * (this->undistortedX[bottomRight] - this->undistortedX[bottomLeft]);
+    float left = this->undistortedY[topLeft] + weightY * (this->undistortedY[bottomLeft] - this->undistortedY[topLeft]);
+    float right = this->undistortedY[topRight] + weightY * (this->undistortedY[bottomRight] - this->undistortedY[topRight]);
+    *undistortedX = top + weightY * (bottom - top);
+    *undistortedY = left + weightX * (right - left);
+}
+
+/* finds the virtual coordinate of a physical coordinate from the calibration cell around it, 
+   before it is clamped to the screen
+ * inputs: physical x and y of the interaction, virtual x and y to set */
+void VirtualManager::findVirtualLocation(double interactionX_d, double interactionY_d, double *virtualX_d, double *virtualY_d) {
+    /*** determine which calibration cell interaction is in ***/
+    int calibrationRow = this->findCalibrationRow(interactionY_d);
+    int calibrationCol = this->findCalibrationCol(calibrationRow, interactionX_d, interactionY_d);
+    ColumnLine *rowColumnLines = &this->columnLines[(calibrationRow-1) * this->calibrationNumCols];
+    CalibrationCell *cell = &this->calibrationCells[(calibrationRow-1) * (this->calibrationNumCols-1) + calibrationCol];
+
+    /*** calculate virtual x ***/
+    // calculate percentRight of interaction within calibration cell
+    double xLeft_d = getXValue(&rowColumnLines[calibrationCol], interactionY_d);
+    double xRight_d = getXValue(&rowColumnLines[calibrationCol+1], interactionY_d);
+    double percentRightInteraction_d = (xLeft_d - interactionX_d) / (xLeft_d - xRight_d);
+    *virtualX_d = cell->leftVirtualX_d + percentRightInteraction_d * cell->virtualWidth_d;
+
+    /*** calculate virtual y ***/
+    // calculate percentDown of interaction within calibration cell
+    double percentDownInteraction_d = (interactionY_d - cell->yLess_d) / cell->rowHeight_d;
+    *virtualY_d = cell->topVirtualY_d + percentDownInteraction_d * cell->virtualHeight_d;
+}
+
+/* precomputes the lines of each calibration column between each pair of rows, 
+   and the virtual extent of each calibration cell, for any number of rows and cols */
+void VirtualManager::buildCalibrationCells() {
+    int numCols = this->calibrationNumCols;
+    int numRows = this->calibrationNumRows;
+    this->columnLines = new ColumnLine[(numRows-1) * numCols];
+    this->calibrationCells = new CalibrationCell[(numRows-1) * (numCols-1)];
+    // the depth frame is mirrored if the first col is right of the last col
+    this->areColumnsDescending = (this->calibrationPhysicalX_d[0] > this->calibrationPhysicalX_d[numCols-1]);
+
+    for (int row = 1; row < numRows; row++) {
+        for (int col = 0; col < numCols; col++) {
+            double xTop_d = this->calibrationPhysicalX_d[(row-1) * numCols + col];
+            double xBottom_d = this->calibrationPhysicalX_d[row * numCols + col];
+            double yTop_d = this->averageYValues_d[row-1];
+            double yBottom_d = this->averageYValues_d[row];
+            ColumnLine *line = &this->columnLines[(row-1) * numCols + col];
+            line->xTop_d = xTop_d;
+            line->yTop_d = yTop_d;
+            line->slopeInverse_d = (xTop_d - xBottom_d) / (yTop_d - yBottom_d);
+        }
+        for (int col = 0; col < numCols-1; col++) {
+            // the indices of the calibration points around the cell
+            int topLeftIndex = (row-1) * numCols + col;
+            int topRightIndex = (row-1) * numCols + col+1;
+            int bottomLeftIndex = row * numCols + col;
+            CalibrationCell *cell = &this->calibrationCells[(row-1) * (numCols-1) + col];
+            cell->leftVirtualX_d = (double)this->calibrationVirtualX[topLeftIndex];
+            cell->virtualWidth_d = (double)this->calibrationVirtualX[topRightIndex] - cell->leftVirtualX_d;
+            cell->topVirtualY_d = (double)this->calibrationVirtualY[topLeftIndex];
+            cell->virtualHeight_d = (double)this->calibrationVirtualY[bottomLeftIndex] - cell->topVirtualY_d;
+            cell->yLess_d = this->averageYValues_d[row-1];
+            cell->rowHeight_d = this->averageYValues_d[row] - cell->yLess_d;
+        }
+    }
+}
+
+/* finds the calibration rows an interaction is between, by binary search of the rows' y-values
+ * inputs: physical y of the interaction
+ * output: the first calibration row whose y-value >= interaction's y-value, 
+           kept within 1 and rows-1 so interactions outside the calibration use the nearest cell */
+int VirtualManager::findCalibrationRow(double interactionY_d) {
+    double *firstRow = this->averageYValues_d + 1;
+    double *lastRow = this->averageYValues_d + this->calibrationNumRows - 1;
+    return (int)(std::lower_bound(firstRow, lastRow, interactionY_d) - this->averageYValues_d);
+}
+
+/* finds the calibration cols an interaction is between, by binary search of the cols' x-values at its y-value
+ * inputs: calibration row (from findCalibrationRow()), physical x and y of the interaction
+ * output: the last calibration col the interaction is past (in the direction the cols run), 
+           kept within 0 and cols-2 so interactions outside the calibration use the nearest cell */
+int VirtualManager::findCalibrationCol(int calibrationRow, double interactionX_d, double interactionY_d) {
+    ColumnLine *rowColumnLines = &this->columnLines[(calibrationRow-1) * this->calibrationNumCols];
+    int low = 0;
+    int high = this->calibrationNumCols - 2;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        int colXValue = (int)(getXValue(&rowColumnLines[mid], interactionY_d));
+        bool isPastCol = this->areColumnsDescending ? (colXValue >= interactionX_d) : (colXValue <= interactionX_d);
+        if (isPastCol) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+/* fills the mapping table with the virtual coordinate of every pixel of the depth frame, 
+   in fixed point, so setVirtualCoord() is a single read */
+void VirtualManager::buildMappingTable() {
+    if (this->mappingTable == NULL) {
+        this->mappingTable = new FixedCoord2D[DEPTH_FRAME_WIDTH * DEPTH_FRAME_HEIGHT];
+    }
+    for (int y = 0; y < DEPTH_FRAME_HEIGHT; y++) {
+        for (int x = 0; x < DEPTH_FRAME_WIDTH; x++) {
+            this->mappingTable[y * DEPTH_FRAME_WIDTH + x] = this->findFixedVirtualLocation(x, y);
         }
-        delete []avgCalCoords;
+    }
+}
+
+/* finds the virtual coordinate of a physical coordinate as the mapping table holds it, in fixed point, 
+   rounded down so whole pixels truncate as in setVirtualCoordFromCalibration()
+   (coordinates left of or above the screen are clamped to 0 or past the limit, so rounding them down changes no pixel)
+ * inputs: physical x and y */
+VirtualManager::FixedCoord2D VirtualManager::findFixedVirtualLocation(double interactionX_d, double interactionY_d) {
+    double virtualX_d;
+    double virtualY_d;
+    this->findVirtualLocation(interactionX_d, interactionY_d, &virtualX_d, &virtualY_d);
+    FixedCoord2D virtualFixed;
+    virtualFixed.x = (int32_t)floor(virtualX_d * MAPPING_FIXED_ONE);
+    virtualFixed.y = (int32_t)floor(virtualY_d * MAPPING_FIXED_ONE);
+    return virtualFixed;
+}
+
+/* returns the x-coordinate of the point with y-coordinate y on a calibration column's line
+ * inputs: line is a calibration column between two rows,
+           y is the y-coordinate of the point for which the x-coordinate will be returned */
+double VirtualManager::getXValue(ColumnLine *line, double y_d) {
+    return (y_d - line->yTop_d) * line->slopeInverse_d + line->xTop_d;
+}
+
+void VirtualManager::deleteCalibrationVars() {
+    if (this->averageYValues_d != NULL) {
+        delete []this->averageYValues_d;
+        this->averageYValues_d = NULL;
+    }
+    if (this->calibrationPhysicalX_d != NULL) {
+        delete []this->calibrationPixelX;
+        delete []this->calibrationPixelY;
+        delete []this->calibrationPhysicalX_d;
+        delete []this->calibrationVirtualX;
+        delete []this->calibrationVirtualY;
+        this->calibrationPixelX = NULL;
+        this->calibrationPixelY = NULL;
+        this->calibrationPhysicalX_d = NULL;
+        this->calibrationVirtualX = NULL;
+        this->calibrationVirtualY = NULL;
+    }
+    if (this->columnLines != NULL) {
+        delete []this->columnLines;
+        this->columnLines = NULL;
+    }
+    if (this->calibrationCells != NULL) {
+        delete []this->calibrationCells;
+        this->calibrationCells = NULL;
+    }
+    if (this->profileMapping != NULL) {
+        // the mapping table is part of the profile
+        munmap(this->profileMapping, this->profileMappingByteCount);
+        this->profileMapping = NULL;
+        this->profileMappingByteCount = 0;
+        this->mappingTable = NULL;
+    }
+    if (this->mappingTable != NULL) {
+        delete []this->mappingTable;
+        this->mappingTable = NULL;
     }
 }
 
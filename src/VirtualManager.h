@@ -23,12 +23,88 @@
 #ifndef VIRTUALMANAGER_H
 #define VIRTUALMANAGER_H
 
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "CameraIntrinsics.h"
 #include "Interaction.h"
 
 namespace virtualMonitor {
 
+/*
+ * A calibration profile (.vmprof) is a CalibrationProfileHeader followed by payloadByteCount bytes:
+ * the column lines, calibration cells, and mapping table VirtualManager derives from the calibration,
+ * the average y-value of each row, and the rows * cols calibration points (CalibrationProfilePoint).
+ * checksum is 64-bit FNV-1a over the 32-bit words of the header (with checksum zeroed) and the payload.
+ * cameraIntrinsics are those the calibration points were undistorted with (all zero if they were not).
+ * calibrationHash identifies the calibration the profile was written for, as hashCalibrationPoints() of its points
+ * or hashCalibrationFile() of the file they were imported from, so a profile is only used for that calibration.
+ */
+struct CalibrationProfileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t screenWidth;
+    uint32_t screenHeight;
+    uint32_t depthWidth;
+    uint32_t depthHeight;
+    uint32_t fractionBits;
+    uint32_t areColumnsDescending;
+    uint32_t payloadByteCount;
+    CameraIntrinsics cameraIntrinsics;
+    uint32_t reserved;
+    uint64_t calibrationHash;
+    uint64_t checksum;
+};
+
+struct CalibrationProfilePoint {
+    int32_t physicalX;
+    int32_t physicalY;
+    float physicalZ;
+    int32_t virtualX;
+    int32_t virtualY;
+};
+
 class VirtualManager {
     private:
+        // virtual coordinate of a physical pixel, in fixed point (see MAPPING_FRACTION_BITS)
+        struct FixedCoord2D {
+            int32_t x;
+            int32_t y;
+        };
+
+        // line through a calibration column between two rows: x = (y - yTop) * slopeInverse + xTop
+        struct ColumnLine {
+            double xTop_d;
+            double yTop_d;
+            double slopeInverse_d;
+        };
+
+        // virtual coordinates of a calibration cell's top-left corner and its extent, with its physical rows
+        struct CalibrationCell {
+            double leftVirtualX_d;
+            double virtualWidth_d;
+            double topVirtualY_d;
+            double virtualHeight_d;
+            double yLess_d;
+            double rowHeight_d;
+        };
+
+        // length of a regression curve between two y-values, as found by findArcLength()
+        struct ArcLengthCacheEntry {
+            float A_f;
+            float B_f;
+            int yMin;
+            int yMax;
+            double length_d;
+            bool isValid;
+
+            ArcLengthCacheEntry() : A_f(0.0f), B_f(0.0f), yMin(0), yMax(0), length_d(0.0), isValid(false) {}
+        };
+
         // vars about Kinect's view of screen
         double screenLength_d;
         float A_f;
@@ -36,24 +112,72 @@ class VirtualManager {
         // vars about calibration data
         int calibrationNumRows;
         int calibrationNumCols;
-        Coord3D **calibrationCoordsPhysical;
-        Coord2D **calibrationCoordsVirtual;
-        int *averageYValues; // average y-value of each calibration row
-        Coord3D **avgCalCoords; // calibration points with averaged y-values
+        double *averageYValues_d; // average y-value of each calibration row, the y-value of its points
+        int *calibrationPixelX; // pixel of each calibration point as detected (before undistortion), rows x cols
+        int *calibrationPixelY;
+        double *calibrationPhysicalX_d; // physical x-value of each calibration point (after undistortion, to a fraction of a pixel), rows x cols
+        int *calibrationVirtualX; // virtual coordinates of each calibration point, rows x cols
+        int *calibrationVirtualY;
+        ColumnLine *columnLines; // each column's line between each pair of rows, (rows-1) x cols
+        CalibrationCell *calibrationCells; // (rows-1) x (cols-1)
+        bool areColumnsDescending; // whether physical x decreases as virtual x increases (a mirrored depth frame)
         // vars about pixel size of screen
         int screenHeightVirtual;
         int screenWidthVirtual;
+        // dense physical-to-virtual table over the depth frame, independent of screen size
+        FixedCoord2D *mappingTable;
+        // screen size and clamping limits of each axis in fixed point, set with the screen size
+        int32_t screenWidthFixed;
+        int32_t screenHeightFixed;
+        int32_t minXFixed, maxXFixed;
+        int32_t minYFixed, maxYFixed;
+        // recent arc lengths, replaced oldest first
+        std::vector<ArcLengthCacheEntry> arcLengthCache;
+        int arcLengthCacheNext;
+        // calibration profile the mapping table is read from, or NULL if the table was built
+        unsigned char *profileMapping;
+        size_t profileMappingByteCount;
+        // intrinsics of the depth camera, and where each pixel of the depth frame would be without lens distortion
+        // (NULL without intrinsics), which calibration points and interactions are undistorted through
+        CameraIntrinsics cameraIntrinsics;
+        float *undistortedX;
+        float *undistortedY;
 
     public: 
         VirtualManager();
         virtual ~VirtualManager();
         virtual void setCalibrationPoints(int rows, int cols, Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual);
         virtual void setScreenVirtual(int screenHeightVirtual, int screenWidthVirtual);
+        virtual int setCameraIntrinsics(CameraIntrinsics cameraIntrinsics);
         virtual void setVirtualCoord(Interaction *interaction);
+        virtual void setVirtualCoordFromCalibration(Interaction *interaction);
+        virtual int mapPhysicalLocations(int count, const int *physicalX, const int *physicalY, int *virtualX, int *virtualY);
+        virtual int mapPhysicalLocation(float physicalX, float physicalY, Coord2D *virtualLocation);
+        virtual double findArcLength(float A_f, float B_f, int y1, int y2);
+        virtual int writeCalibrationProfile(std::string profileFilename, uint64_t calibrationHash,
+                                            Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual);
+        virtual int readCalibrationProfile(std::string profileFilename, int rows, int cols, int screenHeightVirtual, int screenWidthVirtual,
+                                           uint64_t calibrationHash, Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual);
+        static uint64_t hashCalibrationPoints(int count, Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual);
+        static uint64_t hashCalibrationFile(std::string calibrationFilename);
     
     private:
-        virtual double findArcLength(float A_f, float B_f, int y1, int y2);
-        virtual double getXValue(Coord3D *topPoint, Coord3D *bottomPoint, int y);
+        static void fillProfilePoints(int count, Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual,
+                                      CalibrationProfilePoint *points);
+        virtual size_t profilePayloadByteCount(int rows, int cols);
+        virtual void findVirtualLocation(double interactionX_d, double interactionY_d, double *virtualX_d, double *virtualY_d);
+        virtual void buildCalibration();
+        virtual void undistortCalibrationPoint(int index, double *physicalX_d, double *physicalY_d);
+        virtual void buildCalibrationCells();
+        virtual int findCalibrationRow(double interactionY_d);
+        virtual int findCalibrationCol(int calibrationRow, double interactionX_d, double interactionY_d);
+        virtual void buildMappingTable();
+        virtual void buildUndistortionTable(CameraIntrinsics cameraIntrinsics);
+        virtual void undistortLocation(float physicalX, float physicalY, float *undistortedX, float *undistortedY);
+        virtual FixedCoord2D findUndistortedVirtualLocation(int interactionX, int interactionY);
+        virtual FixedCoord2D interpolateMappingTable(float physicalX, float physicalY);
+        virtual FixedCoord2D findFixedVirtualLocation(double interactionX_d, double interactionY_d);
+        virtual double getXValue(ColumnLine *line, double y_d);
         virtual void deleteCalibrationVars();
 };
 
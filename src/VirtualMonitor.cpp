@@ -22,22 +22,34 @@
 
 #include "VirtualMonitor.h"
 
+#include <chrono>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <string>
 
 #include "CalibrationInteractionHandler.h"
 #include "InteractionDetector.h"
+#include "InteractionPipeline.h"
+#include "LatencyStats.h"
 #include "MouseInteractionHandler.h"
 
 #define LABEL_START_DETECTION "Start Detection"
 #define LABEL_STOP_DETECTION "Stop Detection"
 #define LABEL_CALIBRATE "Calibrate"
 
-// How many calibration rows and cols
-#define CALIBRATION_ROWS 3
-#define CALIBRATION_COLS 3
+// How many calibration rows and cols, unless given with --calibration-grid ROWSxCOLS
+#define CALIBRATION_ROWS_DEFAULT 3
+#define CALIBRATION_COLS_DEFAULT 3
+#define CALIBRATION_GRID_OPTION "--calibration-grid"
 
 #define CALIBRATION_DATA_FILENAME "calibration.vmcal"
+// Binary calibration data with the mapping derived from it, saved when detection first starts after calibrating
+#define CALIBRATION_PROFILE_FILENAME "calibration.vmprof"
+// The surface fitted when detection last started, reused while the surface has not moved
+#define SURFACE_MODEL_FILENAME "surface.vmsurf"
+#define RECORDING_FILENAME "session.vmrec"
+#define TRACE_FILENAME "trace.json"
 
 using namespace virtualMonitor;
 
@@ -45,9 +57,24 @@ using namespace virtualMonitor;
 wxIMPLEMENT_APP(VirtualMonitorApp);
 
 // Create and show visual frame
+// The Kinect opens in the background, so the window shows without waiting for it
 bool VirtualMonitorApp::OnInit() {
-    VirtualMonitorFrame *frame = new VirtualMonitorFrame();
+    std::chrono::steady_clock::time_point initStart = std::chrono::steady_clock::now();
+    // Denser grids calibrate large or curved surfaces more closely
+    int calibrationRows = CALIBRATION_ROWS_DEFAULT;
+    int calibrationCols = CALIBRATION_COLS_DEFAULT;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (argv[i].ToStdString() == CALIBRATION_GRID_OPTION) {
+            if (std::sscanf(argv[i + 1].ToStdString().c_str(), "%dx%d", &calibrationRows, &calibrationCols) != 2 || calibrationRows < 2 || calibrationCols < 2) {
+                std::cout << "VirtualMonitor: " << CALIBRATION_GRID_OPTION << " takes ROWSxCOLS, each at least 2." << std::endl;
+                return false;
+            }
+        }
+    }
+    VirtualMonitorFrame *frame = new VirtualMonitorFrame(calibrationRows, calibrationCols);
     frame->Show(true);
+    std::cout << "VirtualMonitor: Window shown in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - initStart).count() << " ms." << std::endl;
     return true;
 }
 
@@ -71,8 +98,10 @@ wxEND_EVENT_TABLE()
 /*
  * Visual frame constructor
  */
-VirtualMonitorFrame::VirtualMonitorFrame() : wxFrame(NULL, wxID_ANY, wxT("Virtual Monitor"), wxDefaultPosition, wxSize(180, 120)) {
+VirtualMonitorFrame::VirtualMonitorFrame(int calibrationRows, int calibrationCols) : wxFrame(NULL, wxID_ANY, wxT("Virtual Monitor"), wxDefaultPosition, wxSize(180, 120)) {
     this->state = VirtualMonitorState::Paused;
+    this->calibrationRows = calibrationRows;
+    this->calibrationCols = calibrationCols;
 
     // Create panel within frame
     this->panel = new wxPanel(this, wxID_ANY);
@@ -95,18 +124,19 @@ VirtualMonitorFrame::VirtualMonitorFrame() : wxFrame(NULL, wxID_ANY, wxT("Virtua
     panel->Fit();
 
     // Initialize arrays of physical and virtual calibration data
-    this->calibrationPhysicalCoords = new Coord3D* [CALIBRATION_ROWS * CALIBRATION_COLS];
-    for (int i = 0; i < CALIBRATION_ROWS * CALIBRATION_COLS; i++) {
+    this->calibrationPhysicalCoords = new Coord3D* [this->calibrationRows * this->calibrationCols];
+    for (int i = 0; i < this->calibrationRows * this->calibrationCols; i++) {
         this->calibrationPhysicalCoords[i] = new Coord3D();
     }
-    this->calibrationVirtualCoords = new Coord2D* [CALIBRATION_ROWS * CALIBRATION_COLS];
-    for (int i = 0; i < CALIBRATION_ROWS * CALIBRATION_COLS; i++) {
+    this->calibrationVirtualCoords = new Coord2D* [this->calibrationRows * this->calibrationCols];
+    for (int i = 0; i < this->calibrationRows * this->calibrationCols; i++) {
         this->calibrationVirtualCoords[i] = new Coord2D();
     }
 
     this->calibrationFrame = NULL;
 
     this->detector = new InteractionDetector();
+    this->detector->setSurfaceModelFilename(SURFACE_MODEL_FILENAME);
     this->calibrationHandler = new CalibrationInteractionHandler();
     this->mouseHandler = new MouseInteractionHandler();
 }
@@ -124,11 +154,11 @@ VirtualMonitorFrame::~VirtualMonitorFrame() {
     delete this->calibrateButton;
     delete this->detectButton;
     delete this->panel;
-    for (int i = 0; i < CALIBRATION_ROWS * CALIBRATION_COLS; i++) {
+    for (int i = 0; i < this->calibrationRows * this->calibrationCols; i++) {
         delete this->calibrationPhysicalCoords[i];
     }
     delete[] this->calibrationPhysicalCoords;
-    for (int i = 0; i < CALIBRATION_ROWS * CALIBRATION_COLS; i++) {
+    for (int i = 0; i < this->calibrationRows * this->calibrationCols; i++) {
         delete this->calibrationVirtualCoords[i];
     }
     delete[] this->calibrationVirtualCoords;
@@ -192,7 +222,7 @@ void VirtualMonitorFrame::OnCalibrate(wxCommandEvent& event) {
 void VirtualMonitorFrame::OnCalibrateThreadUpdate(wxCommandEvent& event) {
     std::cout << "Calibration update..." << std::endl;
     int calibrationIndex = event.GetInt();
-    if (calibrationIndex < (CALIBRATION_ROWS * CALIBRATION_COLS) - 1) {
+    if (calibrationIndex < (this->calibrationRows * this->calibrationCols) - 1) {
         // Show next calibration point
         this->calibrationFrame->displayNextCalibrationPoint();
     } else {
@@ -215,8 +245,6 @@ void VirtualMonitorFrame::OnExit(wxCommandEvent& event) {
  *  to continuously read Kinect data and look for interactions
  */
 int VirtualMonitorFrame::startDetection() {
-    // Read calibration from file
-    this->readCalibrationDataFromFile(this->calibrationPhysicalCoords, this->calibrationVirtualCoords, CALIBRATION_DATA_FILENAME);
     // Reset cancellation token
     this->detectionShouldCancel = false;
     // Start interaction detection/handling on new thread
@@ -247,33 +275,63 @@ void VirtualMonitorFrame::detectionThreadFn() {
         this->detector->freeInteraction(interaction);
     }
 #else
-    // Pass in calibration data to be used by virtualManager
-    this->detector->setCalibrationPoints(CALIBRATION_ROWS, CALIBRATION_COLS, this->calibrationPhysicalCoords, this->calibrationVirtualCoords);
-    this->detector->setScreenVirtual(wxSystemSettings::GetMetric(wxSYS_SCREEN_Y), wxSystemSettings::GetMetric(wxSYS_SCREEN_X));
+#ifdef VIRTUALMONITOR_RECORD_SESSION
+    this->detector->startRecording(RECORDING_FILENAME);
+#endif
 
     // Check for errors in starting detector
     if (this->detector->start() < 0) {
         return;
     }
 
+    // Restore the calibration and what is derived from it from its profile, unless the profile is for another version
+    // of the calibration file (it was edited or replaced since), or another grid, screen, or camera
+    // The detector has started, so the calibration is undistorted with the camera's intrinsics
+    int screenHeight = wxSystemSettings::GetMetric(wxSYS_SCREEN_Y);
+    int screenWidth = wxSystemSettings::GetMetric(wxSYS_SCREEN_X);
+    uint64_t calibrationHash = VirtualManager::hashCalibrationFile(CALIBRATION_DATA_FILENAME);
+    if (calibrationHash == 0 ||
+        this->detector->readCalibrationProfile(CALIBRATION_PROFILE_FILENAME, this->calibrationRows, this->calibrationCols, screenHeight, screenWidth,
+                                               calibrationHash, this->calibrationPhysicalCoords, this->calibrationVirtualCoords) < 0) {
+        // Otherwise import the calibration from file to be used by virtualManager, and save its profile for next time
+        int readResult = this->readCalibrationDataFromFile(this->calibrationPhysicalCoords, this->calibrationVirtualCoords, CALIBRATION_DATA_FILENAME);
+        this->detector->setCalibrationPoints(this->calibrationRows, this->calibrationCols, this->calibrationPhysicalCoords, this->calibrationVirtualCoords);
+        this->detector->setScreenVirtual(screenHeight, screenWidth);
+        if (readResult == 0) {
+            this->detector->writeCalibrationProfile(CALIBRATION_PROFILE_FILENAME, calibrationHash, this->calibrationPhysicalCoords, this->calibrationVirtualCoords);
+        }
+    }
+
     std::cout << "Starting detection..." << std::endl;
+    LatencyStats::shared()->reset();
+#ifdef VIRTUALMONITOR_TRACE
+    Tracer::shared()->start();
+#endif
 
-    // Run until cancellation token
-    while (!this->detectionShouldCancel) {
-        // Detect interaction with isCalibrating = false
-        Interaction *interaction = this->detector->detectInteraction();
-        // Handle interaction
-        this->mouseHandler->handleInteraction(interaction);
-        if (interaction != NULL) {
-            // Free interaction
-            this->detector->freeInteraction(interaction);
-        }
+    // Capture on this thread, with detection and mouse events on their own threads, until cancellation token
+    InteractionPipeline pipeline(this->detector, this->mouseHandler);
 #ifdef VIRTUALMONITOR_TEST_SNAPSHOT
-        break;
+    pipeline.run(&this->detectionShouldCancel, 1);
+#else
+    pipeline.run(&this->detectionShouldCancel);
 #endif
-    }
 
     this->detector->stop();
+
+#ifdef VIRTUALMONITOR_LATENCY_STATS
+    std::cout << "Detection latency:" << std::endl;
+    LatencyStats::shared()->writeReport(std::cout);
+#endif
+    std::cout << "Detection queues:" << std::endl;
+    pipeline.writeReport(std::cout);
+#ifdef VIRTUALMONITOR_TRACE
+    Tracer::shared()->stop();
+    Tracer::shared()->writeTraceToFile(TRACE_FILENAME);
+#endif
+
+#ifdef VIRTUALMONITOR_RECORD_SESSION
+    this->detector->stopRecording();
+#endif
 #endif
 }
 
@@ -287,7 +345,7 @@ int VirtualMonitorFrame::startCalibration() {
     if (this->calibrationFrame != NULL) {
         delete this->calibrationFrame;
     }
-    this->calibrationFrame = new CalibrationFrame(CALIBRATION_ROWS, CALIBRATION_COLS);
+    this->calibrationFrame = new CalibrationFrame(this->calibrationRows, this->calibrationCols);
     this->calibrationFrame->Show(true);
     
     this->calibrationThread = new VirtualMonitorCalibrationThread(this);
@@ -319,6 +377,11 @@ int VirtualMonitorFrame::readCalibrationDataFromFile(Coord3D **calibrationPhysic
     int physicalX, physicalY, virtualX, virtualY;
     float physicalZ;
     while (calibrationFile >> physicalX >> physicalY >> physicalZ >> virtualX >> virtualY) {
+        // Counts but skips points past the grid, to report them below
+        if (calibrationIndex >= this->calibrationRows * this->calibrationCols) {
+            calibrationIndex++;
+            continue;
+        }
         Coord3D *physicalCoord = this->calibrationPhysicalCoords[calibrationIndex];
         physicalCoord->x = physicalX;
         physicalCoord->y = physicalY;
@@ -330,6 +393,11 @@ int VirtualMonitorFrame::readCalibrationDataFromFile(Coord3D **calibrationPhysic
     }
 
     calibrationFile.close();
+    // Calibrated with another grid
+    if (calibrationIndex != this->calibrationRows * this->calibrationCols) {
+        std::cout << "VirtualMonitor: Calibration data is not for a " << this->calibrationRows << "x" << this->calibrationCols << " grid." << std::endl;
+        return -1;
+    }
     return 0;
 }
 
@@ -340,7 +408,7 @@ int VirtualMonitorFrame::writeCalibrationDataToFile(Coord3D **calibrationPhysica
         return -1;
     }
 
-    for (int calibrationIndex = 0; calibrationIndex < (CALIBRATION_ROWS * CALIBRATION_COLS); calibrationIndex++) {
+    for (int calibrationIndex = 0; calibrationIndex < (this->calibrationRows * this->calibrationCols); calibrationIndex++) {
         Coord3D *physicalCoord = this->calibrationPhysicalCoords[calibrationIndex];
         Coord2D *virtualCoord = this->calibrationVirtualCoords[calibrationIndex];
         calibrationFile << physicalCoord->x << " " << physicalCoord->y << " " << physicalCoord->z << " " << virtualCoord->x << " " << virtualCoord->y << std::endl;
@@ -367,7 +435,7 @@ wxThread::ExitCode VirtualMonitorCalibrationThread::Entry() {
 
     // Go through all calibration points
     int calibrationIndex = 0;
-    while (calibrationIndex < (CALIBRATION_ROWS * CALIBRATION_COLS)) {
+    while (calibrationIndex < (parentFrame->calibrationRows * parentFrame->calibrationCols)) {
         // Detect interaction with isCalibrating = true
         Interaction *interaction = parentFrame->detector->detectInteraction(true);
         // Determine whether this interaction was a click up
@@ -398,6 +466,8 @@ wxThread::ExitCode VirtualMonitorCalibrationThread::Entry() {
 
     // Write calibration to file
     parentFrame->writeCalibrationDataToFile(parentFrame->calibrationPhysicalCoords, parentFrame->calibrationVirtualCoords, CALIBRATION_DATA_FILENAME);
+    // The profile is of the previous calibration, so it is saved again when detection starts
+    std::remove(CALIBRATION_PROFILE_FILENAME);
 
     parentFrame->detector->stop();
     
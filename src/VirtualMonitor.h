@@ -35,6 +35,7 @@
 
 #undef VIRTUALMONITOR_TEST_INPUTS
 #undef VIRTUALMONITOR_TEST_SNAPSHOT
+#undef VIRTUALMONITOR_RECORD_SESSION
 
 // Uncomment to use test inputs instead of the live Kinect and output interaction data
 //#define VIRTUALMONITOR_TEST_INPUTS
@@ -42,6 +43,9 @@
 // Uncomment to use a single Kinect snapshot instead of the live Kinect
 //#define VIRTUALMONITOR_TEST_SNAPSHOT
 
+// Uncomment to record the depth frames read during detection (for DetectionRegressionTest and offline analysis)
+//#define VIRTUALMONITOR_RECORD_SESSION
+
 using namespace virtualMonitor;
 
 enum VirtualMonitorState {
@@ -74,7 +78,9 @@ public:
     InteractionDetector *detector;
     CalibrationInteractionHandler *calibrationHandler;
     MouseInteractionHandler *mouseHandler;
-    // Calibration data
+    // Calibration data, for a grid of calibrationRows x calibrationCols points
+    int calibrationRows;
+    int calibrationCols;
     Coord3D **calibrationPhysicalCoords;
     Coord2D **calibrationVirtualCoords;
     // Calibration frame interface
@@ -96,7 +102,7 @@ private:
 
 // Public methods
 public:
-    VirtualMonitorFrame();
+    VirtualMonitorFrame(int calibrationRows, int calibrationCols);
     virtual ~VirtualMonitorFrame();
     virtual int readCalibrationDataFromFile(Coord3D **calibrationPhysicalCoords, Coord2D **calibrationVirtualCoords, std::string calibrationDataFilename);
     virtual int writeCalibrationDataToFile(Coord3D **calibrationPhysicalCoords, Coord2D **calibrationVirtualCoords, std::string calibrationDataFilename);
@@ -0,0 +1,273 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    DetectionRegressionTest.cpp
+    Checks detected interactions over a corpus of frames against golden results.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FrameCorpus.h"
+#include "PhysicalManager.h"
+
+#define GOLDEN_FILENAME "golden.txt"
+#define TOLERANCE_DEFAULT 2
+// Surface models saved by --warm-start, one per source
+#define SURFACE_MODEL_FILENAME_PREFIX "/tmp/DetectionRegressionTest."
+#define SURFACE_MODEL_FILENAME_SUFFIX ".vmsurf"
+// How far the moved copy of each reference is from the surface (mm)
+#define MOVED_SURFACE_OFFSET 100
+
+using namespace virtualMonitor;
+
+struct TestOptions {
+    std::string corpusPath;
+    std::string goldenFilename;
+    int tolerance;
+    int threadCount;
+    bool shouldUpdate;
+    bool isWarmStart;
+};
+
+static std::string describeContacts(std::vector<Coord3D> &contacts) {
+    if (contacts.empty()) {
+        return "none";
+    }
+    std::ostringstream description;
+    description << "(" << contacts[0].x << ", " << contacts[0].y << ")";
+    return description.str();
+}
+
+/*
+ * Detects interactions on frames claimed from nextIndex, each thread with its own PhysicalManager
+ * With surface models, each reference reuses its source's surface model instead of fitting the surface
+ */
+static void detectFrames(FrameCorpus *corpus, std::vector<std::string> *surfaceModelFilenames, std::atomic<int> *nextIndex, std::vector<std::vector<Coord3D> > *results) {
+    PhysicalManager physicalManager;
+    int referenceSourceIndex = -1;
+
+    int index;
+    while ((index = (*nextIndex)++) < corpus->getFrameCount()) {
+        // Frames are grouped by source, so the reference rarely changes
+        int sourceIndex = corpus->getFrame(index).sourceIndex;
+        if (sourceIndex != referenceSourceIndex) {
+            if (surfaceModelFilenames->empty() ||
+                physicalManager.setReferenceFrameFromSurfaceModel(corpus->getReferenceFrame(sourceIndex), (*surfaceModelFilenames)[sourceIndex]) < 0) {
+                physicalManager.setReferenceFrame(corpus->getReferenceFrame(sourceIndex));
+            }
+            referenceSourceIndex = sourceIndex;
+        }
+
+        DepthBuffer *depthBuffer = corpus->readFrame(index);
+        if (depthBuffer == NULL) {
+            continue;
+        }
+        DepthView *depthFrame = depthBuffer->getView();
+        Interaction *interaction = physicalManager.detectInteraction(depthFrame);
+        if (interaction != NULL) {
+            (*results)[index].push_back(*interaction->physicalLocation);
+            delete interaction->physicalLocation;
+            delete interaction->virtualLocation;
+            delete interaction;
+        }
+        depthBuffer->release();
+    }
+}
+
+/*
+ * Saves the surface model of each source's reference, and checks that it is reused for that reference but not
+ * for a copy of it moved away from the sensor
+ * Output: number of failed checks
+ */
+static int saveSurfaceModels(FrameCorpus *corpus, std::vector<std::string> *surfaceModelFilenames) {
+    int failureCount = 0;
+    double coldMilliseconds = 0;
+    double warmMilliseconds = 0;
+    for (int sourceIndex = 0; sourceIndex < corpus->getSourceCount(); sourceIndex++) {
+        DepthView *referenceFrame = corpus->getReferenceFrame(sourceIndex);
+        std::string surfaceModelFilename = SURFACE_MODEL_FILENAME_PREFIX + std::to_string(sourceIndex) + SURFACE_MODEL_FILENAME_SUFFIX;
+        surfaceModelFilenames->push_back(surfaceModelFilename);
+
+        PhysicalManager coldPhysicalManager;
+        std::chrono::steady_clock::time_point coldStart = std::chrono::steady_clock::now();
+        coldPhysicalManager.setReferenceFrame(referenceFrame);
+        coldMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - coldStart).count();
+        if (coldPhysicalManager.writeSurfaceModel(surfaceModelFilename) < 0) {
+            failureCount++;
+            continue;
+        }
+
+        PhysicalManager warmPhysicalManager;
+        std::chrono::steady_clock::time_point warmStart = std::chrono::steady_clock::now();
+        if (warmPhysicalManager.setReferenceFrameFromSurfaceModel(referenceFrame, surfaceModelFilename) < 0) {
+            std::cout << "FAILED " << corpus->getSource(sourceIndex).name << ": surface model is not reused for its reference" << std::endl;
+            failureCount++;
+        }
+        warmMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - warmStart).count();
+
+        std::vector<float> movedDepths(referenceFrame->width * referenceFrame->height);
+        for (int y = 0; y < referenceFrame->height; y++) {
+            for (int x = 0; x < referenceFrame->width; x++) {
+                float depth = referenceFrame->row(y)[x];
+                movedDepths[y * referenceFrame->width + x] = (depth > 0) ? depth + MOVED_SURFACE_OFFSET / referenceFrame->millimetersPerUnit() : depth;
+            }
+        }
+        DepthView movedFrame(movedDepths.data(), referenceFrame->width, referenceFrame->height, 0, referenceFrame->units);
+        if (warmPhysicalManager.setReferenceFrameFromSurfaceModel(&movedFrame, surfaceModelFilename) == 0) {
+            std::cout << "FAILED " << corpus->getSource(sourceIndex).name << ": surface model is reused for a moved surface" << std::endl;
+            failureCount++;
+        }
+    }
+    std::cout << "DetectionRegressionTest: " << corpus->getSourceCount() << " surfaces fitted in " << coldMilliseconds
+              << " ms (cold start), reused in " << warmMilliseconds << " ms (warm start)" << std::endl;
+    return failureCount;
+}
+
+static bool isWithinTolerance(std::vector<Coord3D> &expected, std::vector<Coord3D> &actual, int tolerance) {
+    if (expected.size() != actual.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (std::abs(expected[i].x - actual[i].x) > tolerance ||
+            std::abs(expected[i].y - actual[i].y) > tolerance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void printUsage(const char *program) {
+    std::cout << "Usage: " << program << " CORPUS [options]" << std::endl
+              << "  CORPUS is a recording, or a directory of recordings and .bin frames with surface.bin as reference" << std::endl
+              << "  --golden FILE     golden results (default CORPUS/golden.txt)" << std::endl
+              << "  --tolerance N     allowed difference in pixels (default 2)" << std::endl
+              << "  --threads N       worker threads (default all cores)" << std::endl
+              << "  --update          write the current results as the new golden results" << std::endl
+              << "  --warm-start      reuse a surface model saved from each reference, rather than fitting the surface" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argv[1][0] == '-') {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    TestOptions options;
+    options.corpusPath = argv[1];
+    options.goldenFilename = options.corpusPath + "/" + GOLDEN_FILENAME;
+    options.tolerance = TOLERANCE_DEFAULT;
+    options.threadCount = std::max(1u, std::thread::hardware_concurrency());
+    options.shouldUpdate = false;
+    options.isWarmStart = false;
+
+    for (int i = 2; i < argc; i++) {
+        std::string option = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (option == "--golden" && hasValue) {
+            options.goldenFilename = argv[++i];
+        } else if (option == "--tolerance" && hasValue) {
+            options.tolerance = std::atoi(argv[++i]);
+        } else if (option == "--threads" && hasValue) {
+            options.threadCount = std::max(1, std::atoi(argv[++i]));
+        } else if (option == "--update") {
+            options.shouldUpdate = true;
+        } else if (option == "--warm-start") {
+            options.isWarmStart = true;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    FrameCorpus corpus;
+    if (corpus.load(options.corpusPath) < 0) {
+        return 1;
+    }
+
+    CorpusAnnotations golden;
+    if (!options.shouldUpdate && FrameCorpus::readAnnotationsFromFile(options.goldenFilename, golden) < 0) {
+        std::cout << "DetectionRegressionTest: Could not read " << options.goldenFilename << " (run with --update to create it)." << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> surfaceModelFilenames;
+    int surfaceModelFailureCount = 0;
+    if (options.isWarmStart) {
+        surfaceModelFailureCount = saveSurfaceModels(&corpus, &surfaceModelFilenames);
+    }
+
+    // Detect across all frames in parallel
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::vector<Coord3D> > results(corpus.getFrameCount());
+    std::atomic<int> nextIndex(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < options.threadCount; i++) {
+        threads.push_back(std::thread(detectFrames, &corpus, &surfaceModelFilenames, &nextIndex, &results));
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (size_t i = 0; i < surfaceModelFilenames.size(); i++) {
+        std::remove(surfaceModelFilenames[i].c_str());
+    }
+
+    std::vector<std::string> ids;
+    for (int index = 0; index < corpus.getFrameCount(); index++) {
+        ids.push_back(corpus.getFrame(index).id);
+    }
+
+    if (options.shouldUpdate) {
+        CorpusAnnotations updated;
+        for (int index = 0; index < corpus.getFrameCount(); index++) {
+            updated[ids[index]] = results[index];
+        }
+        if (FrameCorpus::writeAnnotationsToFile(options.goldenFilename, ids, updated) < 0) {
+            return 1;
+        }
+        std::cout << "DetectionRegressionTest: Wrote " << ids.size() << " golden results to " << options.goldenFilename << std::endl;
+        return 0;
+    }
+
+    int mismatchCount = 0;
+    for (int index = 0; index < corpus.getFrameCount(); index++) {
+        CorpusAnnotations::iterator expected = golden.find(ids[index]);
+        if (expected == golden.end()) {
+            std::cout << "MISSING " << ids[index] << ": no golden result, got " << describeContacts(results[index]) << std::endl;
+            mismatchCount++;
+        } else if (!isWithinTolerance(expected->second, results[index], options.tolerance)) {
+            std::cout << "MISMATCH " << ids[index] << ": expected " << describeContacts(expected->second)
+                      << ", got " << describeContacts(results[index]) << std::endl;
+            mismatchCount++;
+        }
+    }
+
+    std::cout << "DetectionRegressionTest: " << (corpus.getFrameCount() - mismatchCount) << "/" << corpus.getFrameCount()
+              << " frames match within " << options.tolerance << " px (" << options.threadCount << " threads, "
+              << seconds << " s)" << std::endl;
+    return (mismatchCount == 0 && surfaceModelFailureCount == 0) ? 0 : 1;
+}
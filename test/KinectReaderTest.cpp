@@ -0,0 +1,327 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    KinectReaderTest.cpp
+    Checks KinectReader's capture profiles, held depth frames, and background startup, using a fake Kinect.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "KinectReader.h"
+
+#define FRAME_PERIOD_MICROSECONDS 1000
+#define READ_TIMEOUT 1000
+// About how long libfreenect2 takes to find and open a Kinect
+#define SLOW_OPEN_MILLISECONDS 300
+// The constructor must return long before the Kinect opens
+#define CONSTRUCTOR_MILLISECONDS_MAX 50
+// Matches the frames KinectReader discards while warming up
+#define WARMUP_FRAME_COUNT 10
+
+using namespace virtualMonitor;
+
+/*
+ * A frame that counts how many frames of its source are still held
+ */
+class FakeFrame : public libfreenect2::Frame {
+    private:
+        std::atomic<int> *heldFrameCount;
+
+    public:
+        FakeFrame(size_t bytesPerPixel, std::atomic<int> *heldFrameCount) : libfreenect2::Frame(8, 8, bytesPerPixel) {
+            this->heldFrameCount = heldFrameCount;
+            (*this->heldFrameCount)++;
+        }
+
+        virtual ~FakeFrame() {
+            (*this->heldFrameCount)--;
+        }
+};
+
+/*
+ * Delivers small frames of each streamed type every millisecond, as the Kinect would at a much higher rate
+ * Each start() streams fresh frames, numbered from 0
+ */
+class FakeKinectFrameSource : public KinectFrameSource {
+    public:
+        bool isColorStreamed;
+        bool isDepthStreamed;
+        std::atomic<int> registrationCount;
+
+    private:
+        int openMilliseconds;
+        bool isPaced;
+        std::atomic<int> heldFrameCount;
+        libfreenect2::FrameListener *listener;
+        std::thread streamThread;
+        std::atomic<bool> isStreaming;
+
+    public:
+        /*
+         * Input: openMilliseconds is how long open() takes, as finding and opening a real Kinect does,
+         *        isPaced delivers each set of frames only once the last has been deleted, so none is skipped
+         */
+        FakeKinectFrameSource(int openMilliseconds=0, bool isPaced=false) {
+            this->openMilliseconds = openMilliseconds;
+            this->isPaced = isPaced;
+            this->heldFrameCount = 0;
+            this->isColorStreamed = false;
+            this->isDepthStreamed = false;
+            this->registrationCount = 0;
+            this->listener = NULL;
+            this->isStreaming = false;
+        }
+
+        virtual ~FakeKinectFrameSource() {
+            this->stop();
+        }
+
+        virtual int open(libfreenect2::FrameListener *listener) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(this->openMilliseconds));
+            this->listener = listener;
+            return 0;
+        }
+
+        virtual int start(bool streamColor, bool streamDepth) {
+            this->isColorStreamed = streamColor;
+            this->isDepthStreamed = streamDepth;
+            this->isStreaming = true;
+            this->streamThread = std::thread(&FakeKinectFrameSource::streamThreadFn, this);
+            return 0;
+        }
+
+        virtual int stop() {
+            if (this->isStreaming) {
+                this->isStreaming = false;
+                this->streamThread.join();
+            }
+            return 0;
+        }
+
+        virtual int close() {
+            return 0;
+        }
+
+        virtual void registerColorDepth(libfreenect2::Frame *color, libfreenect2::Frame *depth,
+                                        libfreenect2::Frame *colorDepthUndistorted, libfreenect2::Frame *colorDepthRegistered) {
+            this->registrationCount++;
+        }
+
+    private:
+        virtual void streamThreadFn() {
+            for (uint32_t sequence = 0; this->isStreaming; sequence++) {
+                while (this->isPaced && this->heldFrameCount > 0 && this->isStreaming) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(FRAME_PERIOD_MICROSECONDS));
+                }
+                // The Kinect's depth processor produces infrared and depth together, whichever the listener reads
+                if (this->isDepthStreamed) {
+                    this->deliverFrame(libfreenect2::Frame::Ir, sequence, 4);
+                    this->deliverFrame(libfreenect2::Frame::Depth, sequence, 4);
+                }
+                if (this->isColorStreamed) {
+                    this->deliverFrame(libfreenect2::Frame::Color, sequence, 4);
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(FRAME_PERIOD_MICROSECONDS));
+            }
+        }
+
+        virtual void deliverFrame(libfreenect2::Frame::Type type, uint32_t sequence, size_t bytesPerPixel) {
+            libfreenect2::Frame *frame = new FakeFrame(bytesPerPixel, &this->heldFrameCount);
+            frame->sequence = sequence;
+            // Like libfreenect2, keep the frame if the listener does not take it
+            if (!this->listener->onNewFrame(type, frame)) {
+                delete frame;
+            }
+        }
+};
+
+static int checkCount = 0;
+static int failureCount = 0;
+
+static void check(bool condition, std::string profileName, std::string description) {
+    checkCount++;
+    if (!condition) {
+        failureCount++;
+        std::cout << "FAILED " << profileName << ": " << description << std::endl;
+    }
+}
+
+static void testProfile(CaptureProfile profile, std::string profileName, bool expectsColor, bool expectsInfrared) {
+    FakeKinectFrameSource source;
+    KinectReader reader(profile, READ_TIMEOUT, true, &source);
+    check(reader.start() == 0, profileName, "starts");
+    check(source.isColorStreamed == expectsColor, profileName, "streams color only if read");
+    check(source.isDepthStreamed, profileName, "streams depth");
+
+    int registrationCount = 0;
+    for (int read = 0; read < 2; read++) {
+        KinectReaderFrames *frames = reader.readFrames();
+        check(frames != NULL, profileName, "reads frames");
+        if (frames == NULL) {
+            break;
+        }
+        check(frames->depth != NULL, profileName, "reads depth");
+        check((frames->infrared != NULL) == expectsInfrared, profileName, "reads infrared only if in profile");
+        check((frames->color != NULL) == expectsColor, profileName, "reads color only if in profile");
+        check(source.registrationCount == registrationCount, profileName, "does not register color until asked");
+
+        int result = reader.registerColorDepth(frames);
+        check((result == 0) == expectsColor, profileName, "registers color only if read");
+        reader.registerColorDepth(frames);
+        registrationCount += expectsColor ? 1 : 0;
+        check(source.registrationCount == registrationCount, profileName, "registers each frame at most once");
+
+        reader.releaseFrames(frames);
+    }
+    check(reader.getFramePoolExhaustedCount() == 0, profileName, "reuses pooled frames");
+    reader.stop();
+}
+
+/*
+ * A held depth frame must outlive releaseFrames() and later reads, and return to its pool when released
+ */
+static void testDepthBuffer() {
+    std::string testName = "depth buffer";
+    FakeKinectFrameSource source;
+    KinectReader reader(CaptureProfileDepthInfrared, READ_TIMEOUT, true, &source);
+    check(reader.start() == 0, testName, "starts");
+    int heldBufferCount = DepthBufferPool::shared()->getHeldBufferCount();
+
+    KinectReaderFrames *frames = reader.readFrames();
+    check(frames != NULL, testName, "reads frames");
+    if (frames == NULL) {
+        return;
+    }
+    libfreenect2::Frame *depth = frames->depth;
+    DepthBuffer *depthBuffer = reader.takeDepthBuffer(frames);
+    check(depthBuffer != NULL && depthBuffer->getView()->data == (float *)depth->data, testName, "holds the depth frame without copying it");
+    check(reader.takeDepthBuffer(frames) == NULL, testName, "takes the depth frame once");
+    reader.releaseFrames(frames);
+
+    // Shared with another holder, as the reference frame is
+    depthBuffer->retain();
+    uint32_t sequence = depth->sequence;
+    for (int read = 0; read < 4; read++) {
+        frames = reader.readFrames();
+        if (frames != NULL) {
+            reader.releaseFrames(frames);
+        }
+    }
+    check(depthBuffer->getView()->sequence == sequence && depth->sequence == sequence, testName, "keeps the depth frame after later reads");
+    depthBuffer->release();
+    check(DepthBufferPool::shared()->getHeldBufferCount() == heldBufferCount + 1, testName, "is held until the last holder releases it");
+    depthBuffer->release();
+    check(DepthBufferPool::shared()->getHeldBufferCount() == heldBufferCount, testName, "returns to the pool");
+    reader.stop();
+}
+
+/*
+ * Frames held across stop() must stay valid until released, and must not join the pool of the next start()
+ */
+static void testHeldAcrossStop() {
+    std::string testName = "held across stop";
+    FakeKinectFrameSource source;
+    KinectReader reader(CaptureProfileDepth, READ_TIMEOUT, true, &source);
+    reader.setFramePoolSize(2);
+    check(reader.start() == 0, testName, "starts");
+    KinectReaderFrames *heldFrames = reader.readFrames();
+    check(heldFrames != NULL, testName, "reads frames");
+    if (heldFrames == NULL) {
+        return;
+    }
+    uint32_t sequence = heldFrames->depth->sequence;
+    reader.stop();
+    check(heldFrames->depth->sequence == sequence, testName, "keeps held frames after stopping");
+
+    check(reader.start() == 0, testName, "restarts");
+    check(heldFrames->depth->sequence == sequence, testName, "keeps held frames after restarting");
+    reader.releaseFrames(heldFrames);
+    KinectReaderFrames *frames[3];
+    for (int i = 0; i < 3; i++) {
+        frames[i] = reader.readFrames();
+    }
+    check(frames[0] != NULL && frames[1] != NULL && frames[2] == NULL, testName, "frees frames released after their pool");
+    for (int i = 0; i < 3; i++) {
+        if (frames[i] != NULL) {
+            reader.releaseFrames(frames[i]);
+        }
+    }
+    reader.stop();
+}
+
+static int64_t millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * Opening a slow Kinect must not hold up the constructor, which the app calls before showing its window
+ */
+static void testColdStart() {
+    std::string testName = "cold start";
+    FakeKinectFrameSource source(SLOW_OPEN_MILLISECONDS, true);
+
+    std::chrono::steady_clock::time_point constructStart = std::chrono::steady_clock::now();
+    KinectReader reader(CaptureProfileDepth, READ_TIMEOUT, true, &source);
+    int64_t constructMilliseconds = millisecondsSince(constructStart);
+    check(constructMilliseconds < CONSTRUCTOR_MILLISECONDS_MAX, testName, "constructs without waiting for the device");
+    check(!reader.isReady(), testName, "is not ready while the device opens");
+
+    std::chrono::steady_clock::time_point startStart = std::chrono::steady_clock::now();
+    check(reader.start() == 0, testName, "starts once the device opens");
+    int64_t startMilliseconds = millisecondsSince(startStart);
+    check(reader.isReady(), testName, "is ready after starting");
+
+    KinectReaderFrames *frames = reader.readFrames();
+    check(frames != NULL, testName, "reads frames");
+    if (frames != NULL) {
+        check(frames->depth->sequence == WARMUP_FRAME_COUNT, testName, "discards warm-up frames");
+        reader.releaseFrames(frames);
+    }
+    check(reader.getSkippedFrameCount() == 0, testName, "does not count warm-up frames as skipped");
+    // Stopping with a set of frames delivered but not read
+    std::this_thread::sleep_for(std::chrono::microseconds(10 * FRAME_PERIOD_MICROSECONDS));
+    reader.stop();
+
+    // Restarting streams again, with a fresh warm-up rather than frames left from before stopping
+    check(reader.start() == 0, testName, "restarts");
+    frames = reader.readFrames();
+    check(frames != NULL && frames->depth->sequence == WARMUP_FRAME_COUNT, testName, "discards warm-up frames after restarting");
+    if (frames != NULL) {
+        reader.releaseFrames(frames);
+    }
+    reader.stop();
+
+    std::cout << "KinectReaderTest: constructed in " << constructMilliseconds << " ms, started in " << startMilliseconds
+              << " ms with a " << SLOW_OPEN_MILLISECONDS << " ms device open" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    testProfile(CaptureProfileDepth, "depth", false, false);
+    testProfile(CaptureProfileDepthInfrared, "depth+infrared", false, true);
+    testProfile(CaptureProfileFull, "full", true, true);
+    testDepthBuffer();
+    testHeldAcrossStop();
+    testColdStart();
+
+    std::cout << "KinectReaderTest: " << (checkCount - failureCount) << "/" << checkCount << " checks passed" << std::endl;
+    return (failureCount == 0) ? 0 : 1;
+}
@@ -0,0 +1,216 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    ReferenceUpdaterTest.cpp
+    Checks that references recaptured in the background are swapped in without holding up detection.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "PhysicalManager.h"
+#include "ReferenceUpdater.h"
+
+// Frames from the corpus: the reference, and frames without and with an interaction
+#define REFERENCE_FRAME_FILENAME "surface.bin"
+#define QUIET_FRAME_FILENAME "nointeraction1.bin"
+#define INTERACTION_FRAME_FILENAME "interaction1.bin"
+#define SURFACE_MODEL_FILENAME "/tmp/ReferenceUpdaterTest.vmsurf"
+// How long to wait for a model to be published
+#define UPDATE_TIMEOUT_SECONDS 30
+// Swapping is an atomic exchange, so this is only exceeded if it waits on the worker
+#define SWAP_MILLISECONDS_MAX 5
+
+using namespace virtualMonitor;
+
+static int checkCount = 0;
+static int failureCount = 0;
+
+static void check(bool condition, std::string testName, std::string description) {
+    checkCount++;
+    if (!condition) {
+        failureCount++;
+        std::cout << "FAILED " << testName << ": " << description << std::endl;
+    }
+}
+
+static void freeInteraction(Interaction *interaction) {
+    if (interaction != NULL) {
+        delete interaction->physicalLocation;
+        delete interaction->virtualLocation;
+        delete interaction;
+    }
+}
+
+static bool isSameInteraction(Interaction *interaction, Interaction *otherInteraction) {
+    if (interaction == NULL || otherInteraction == NULL) {
+        return interaction == otherInteraction;
+    }
+    return interaction->physicalLocation->x == otherInteraction->physicalLocation->x &&
+           interaction->physicalLocation->y == otherInteraction->physicalLocation->y;
+}
+
+/*
+ * Output: a copy of buffer from pool, held once by the caller, so pool counts only the updater's references
+ */
+static DepthBuffer *copyBuffer(DepthBufferPool *pool, DepthBuffer *buffer) {
+    DepthBuffer *copy = pool->acquire();
+    DepthView *view = buffer->getView();
+    std::memcpy(copy->getData(), view->data, view->width * view->height * sizeof(float));
+    copy->getView()->timestamp = view->timestamp;
+    copy->getView()->sequence = view->sequence;
+    return copy;
+}
+
+/*
+ * Detects on interactionFrame with the current reference until a model is swapped in
+ * Output: how many frames were detected while waiting, or -1 if no model was swapped in
+ */
+static int detectUntilSwapped(ReferenceUpdater *updater, PhysicalManager **physicalManager, DepthBuffer **referenceBuffer,
+                              DepthView *interactionFrame, double *maxSwapMilliseconds) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int frameCount = 0;
+    while (std::chrono::steady_clock::now() - start < std::chrono::seconds(UPDATE_TIMEOUT_SECONDS)) {
+        std::chrono::steady_clock::time_point swapStart = std::chrono::steady_clock::now();
+        bool isSwapped = updater->swapReference(physicalManager, referenceBuffer);
+        double swapMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - swapStart).count();
+        *maxSwapMilliseconds = std::max(*maxSwapMilliseconds, swapMilliseconds);
+        if (isSwapped) {
+            return frameCount;
+        }
+        freeInteraction((*physicalManager)->detectInteraction(interactionFrame));
+        frameCount++;
+    }
+    return -1;
+}
+
+static void testSwap(DepthBuffer *referenceFrame, DepthBuffer *quietFrame, DepthBuffer *interactionFrame) {
+    std::string testName = "swap";
+    DepthBufferPool pool(referenceFrame->getView()->width, referenceFrame->getView()->height);
+    ReferenceUpdater updater;
+    updater.start();
+
+    PhysicalManager *physicalManager = new PhysicalManager();
+    DepthBuffer *currentBuffer = copyBuffer(&pool, referenceFrame);
+    physicalManager->setReferenceFrame(currentBuffer->getView());
+    PhysicalManager *firstPhysicalManager = physicalManager;
+
+    // The updater holds the requested frame until its model is retired
+    DepthBuffer *quietBuffer = copyBuffer(&pool, quietFrame);
+    check(!updater.swapReference(&physicalManager, &currentBuffer), testName, "swaps nothing before an update");
+    check(updater.requestUpdate(quietBuffer, DetectionParameters(), SURFACE_MODEL_FILENAME), testName, "requests an update");
+    check(!updater.requestUpdate(interactionFrame, DetectionParameters()), testName, "refuses a request while updating");
+    check(updater.isBusy(), testName, "is busy while updating");
+    quietBuffer->release();
+
+    // Detection keeps using the first reference while the new one is fitted
+    double maxSwapMilliseconds = 0;
+    int frameCount = detectUntilSwapped(&updater, &physicalManager, &currentBuffer, interactionFrame->getView(), &maxSwapMilliseconds);
+    check(frameCount >= 0, testName, "swaps in the new reference");
+    check(frameCount > 0, testName, "detects while the new reference is fitted (" + std::to_string(frameCount) + " frames)");
+    check(maxSwapMilliseconds < SWAP_MILLISECONDS_MAX, testName, "swaps without waiting (" + std::to_string(maxSwapMilliseconds) + " ms)");
+    std::cout << "ReferenceUpdaterTest: detected " << frameCount << " frames while the reference was recaptured, swapping in at most "
+              << maxSwapMilliseconds << " ms" << std::endl;
+    check(physicalManager != firstPhysicalManager && currentBuffer == quietBuffer, testName, "holds the new reference");
+    check(physicalManager->getReferenceFrame()->data == quietBuffer->getView()->data, testName, "detects against the new reference");
+    check(updater.getPublishedCount() == 1, testName, "publishes one model");
+
+    // The background fit detects as a fit on the detection thread would
+    PhysicalManager syncPhysicalManager;
+    syncPhysicalManager.setReferenceFrame(quietFrame->getView());
+    Interaction *interaction = physicalManager->detectInteraction(interactionFrame->getView());
+    Interaction *syncInteraction = syncPhysicalManager.detectInteraction(interactionFrame->getView());
+    check(isSameInteraction(interaction, syncInteraction), testName, "detects as a reference set on the detection thread");
+    freeInteraction(interaction);
+    freeInteraction(syncInteraction);
+
+    PhysicalManager warmPhysicalManager;
+    check(warmPhysicalManager.setReferenceFrameFromSurfaceModel(quietFrame->getView(), SURFACE_MODEL_FILENAME) == 0, testName, "saves the new surface model");
+    std::remove(SURFACE_MODEL_FILENAME);
+
+    // A second update frees the first reference, which detection retired, and retires the second
+    DepthBuffer *otherBuffer = copyBuffer(&pool, referenceFrame);
+    check(updater.requestUpdate(otherBuffer, DetectionParameters()), testName, "requests another update");
+    otherBuffer->release();
+    check(detectUntilSwapped(&updater, &physicalManager, &currentBuffer, interactionFrame->getView(), &maxSwapMilliseconds) >= 0, testName, "swaps in another reference");
+    check(currentBuffer == otherBuffer && physicalManager->getReferenceFrame()->data == otherBuffer->getView()->data, testName, "holds the other reference");
+    check(pool.getHeldBufferCount() == 2, testName, "frees retired references (" + std::to_string(pool.getHeldBufferCount()) + " held)");
+
+    updater.stop();
+    check(pool.getHeldBufferCount() == 1, testName, "frees the retired reference once stopped");
+    delete physicalManager;
+    currentBuffer->release();
+    check(pool.getHeldBufferCount() == 0, testName, "releases every reference");
+}
+
+/*
+ * Stopping while a model is fitted waits for it, and frees it rather than publishing it
+ */
+static void testStop(DepthBuffer *quietFrame) {
+    std::string testName = "stop";
+    DepthBufferPool pool(quietFrame->getView()->width, quietFrame->getView()->height);
+    ReferenceUpdater updater;
+    updater.start();
+    DepthBuffer *quietBuffer = copyBuffer(&pool, quietFrame);
+    check(updater.requestUpdate(quietBuffer, DetectionParameters()), testName, "requests an update");
+    quietBuffer->release();
+    updater.stop();
+    check(!updater.isBusy(), testName, "is not busy once stopped");
+    check(pool.getHeldBufferCount() == 0, testName, "releases the requested frame");
+
+    // Restarting takes requests again
+    updater.start();
+    quietBuffer = copyBuffer(&pool, quietFrame);
+    check(updater.requestUpdate(quietBuffer, DetectionParameters()), testName, "requests an update after restarting");
+    quietBuffer->release();
+    updater.stop();
+    check(pool.getHeldBufferCount() == 0, testName, "releases the requested frame after restarting");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argv[1][0] == '-') {
+        std::cout << "Usage: " << argv[0] << " CORPUS" << std::endl
+                  << "  CORPUS is a directory with " << REFERENCE_FRAME_FILENAME << ", " << QUIET_FRAME_FILENAME << ", and "
+                  << INTERACTION_FRAME_FILENAME << std::endl;
+        return 1;
+    }
+    std::string corpusPath = argv[1];
+
+    PhysicalManager physicalManager;
+    DepthBuffer *referenceBuffer = physicalManager.readDepthFrameFromFile(corpusPath + "/" + REFERENCE_FRAME_FILENAME);
+    DepthBuffer *quietBuffer = physicalManager.readDepthFrameFromFile(corpusPath + "/" + QUIET_FRAME_FILENAME);
+    DepthBuffer *interactionBuffer = physicalManager.readDepthFrameFromFile(corpusPath + "/" + INTERACTION_FRAME_FILENAME);
+    if (referenceBuffer == NULL || quietBuffer == NULL || interactionBuffer == NULL) {
+        std::cout << "ReferenceUpdaterTest: Could not read frames from " << corpusPath << std::endl;
+        return 1;
+    }
+
+    testSwap(referenceBuffer, quietBuffer, interactionBuffer);
+    testStop(quietBuffer);
+
+    referenceBuffer->release();
+    quietBuffer->release();
+    interactionBuffer->release();
+
+    std::cout << "ReferenceUpdaterTest: " << (checkCount - failureCount) << "/" << checkCount << " checks passed" << std::endl;
+    return (failureCount == 0) ? 0 : 1;
+}
@@ -0,0 +1,186 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    SurfaceDriftTest.cpp
+    Checks that the fitted surface follows a synthetic surface as it drifts, without fitting it again.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "PhysicalManager.h"
+#include "SyntheticScene.h"
+
+// Frames without an interaction given to compensateDrift() per test (20 seconds at 30 fps)
+#define DRIFT_FRAME_COUNT 600
+// Frames detected to compare the cost of compensation to
+#define DETECTION_FRAME_COUNT 30
+// Drift of the surface regression's A, as from a few degrees of warming (3% is about 20 mm)
+#define DRIFT_FRACTION 0.03
+// Rows the regression is compared on, within the rows it is fitted from on the synthetic surface
+#define COMPARISON_Y_MIN 280
+#define COMPARISON_Y_MAX 370
+// Largest difference from a surface fitted to the drifted reference (mm), the adjustment tolerance plus noise
+#define DRIFT_DEPTH_TOLERANCE 6
+// Largest cost of compensation relative to detection
+#define DRIFT_COST_FRACTION_MAX 0.01
+
+using namespace virtualMonitor;
+
+static int checkCount = 0;
+static int failureCount = 0;
+
+static void check(bool condition, std::string testName, std::string description) {
+    checkCount++;
+    if (!condition) {
+        failureCount++;
+        std::cout << "FAILED " << testName << ": " << description << std::endl;
+    }
+}
+
+static void freeInteraction(Interaction *interaction) {
+    if (interaction != NULL) {
+        delete interaction->physicalLocation;
+        delete interaction->virtualLocation;
+        delete interaction;
+    }
+}
+
+/*
+ * Output: the largest difference between two managers' surface depths over the comparison rows (mm)
+ */
+static float surfaceDifference(PhysicalManager *physicalManager, PhysicalManager *otherPhysicalManager) {
+    float A, B, otherA, otherB;
+    physicalManager->getSurfaceRegression(&A, &B);
+    otherPhysicalManager->getSurfaceRegression(&otherA, &otherB);
+    float difference = 0;
+    for (int y = COMPARISON_Y_MIN; y <= COMPARISON_Y_MAX; y++) {
+        difference = std::max(difference, (float)std::abs(A * std::pow(y, B) - otherA * std::pow(y, otherB)));
+    }
+    return difference;
+}
+
+/*
+ * Gives the frames of scene to compensateDrift()
+ * Output: mean time per frame (us)
+ */
+static double compensateDriftFrames(PhysicalManager *physicalManager, SyntheticScene *scene, std::vector<float> *depthData) {
+    DepthView depthFrame(depthData->data(), scene->parameters.width, scene->parameters.height);
+    double totalMicroseconds = 0;
+    for (int frameIndex = 1; frameIndex <= DRIFT_FRAME_COUNT; frameIndex++) {
+        scene->renderDepthFrame(depthData->data(), frameIndex);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        physicalManager->compensateDrift(&depthFrame);
+        totalMicroseconds += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    }
+    return totalMicroseconds / DRIFT_FRAME_COUNT;
+}
+
+/*
+ * Frames of an unchanged surface, with only noise, leave the regression as fitted
+ */
+static void testSteadySurface() {
+    std::string testName = "steady";
+    SyntheticScene scene;
+    std::vector<float> referenceData(scene.parameters.width * scene.parameters.height);
+    std::vector<float> depthData(scene.parameters.width * scene.parameters.height);
+    scene.renderReferenceFrame(referenceData.data());
+    DepthView referenceFrame(referenceData.data(), scene.parameters.width, scene.parameters.height);
+
+    PhysicalManager physicalManager;
+    physicalManager.setReferenceFrame(&referenceFrame);
+    PhysicalManager fittedPhysicalManager;
+    fittedPhysicalManager.copyReferenceFrom(&physicalManager);
+
+    compensateDriftFrames(&physicalManager, &scene, &depthData);
+    check(physicalManager.getDriftAdjustmentCount() == 0, testName, "leaves the regression unadjusted (" + std::to_string(physicalManager.getDriftAdjustmentCount()) + " adjustments)");
+    check(surfaceDifference(&physicalManager, &fittedPhysicalManager) == 0, testName, "keeps the fitted surface");
+    check(physicalManager.compensateDrift(&referenceFrame) == 0, testName, "skips the reference frame");
+
+    PhysicalManager unreferencedPhysicalManager;
+    check(unreferencedPhysicalManager.compensateDrift(&referenceFrame) == -1, testName, "needs a reference");
+}
+
+/*
+ * Frames of a drifted surface move the regression to where fitting a reference of the drifted surface would,
+ * for a small fraction of the cost of detection
+ */
+static void testDriftedSurface() {
+    std::string testName = "drifted";
+    SyntheticScene scene;
+    std::vector<float> referenceData(scene.parameters.width * scene.parameters.height);
+    std::vector<float> depthData(scene.parameters.width * scene.parameters.height);
+    scene.renderReferenceFrame(referenceData.data());
+    DepthView referenceFrame(referenceData.data(), scene.parameters.width, scene.parameters.height);
+
+    PhysicalManager physicalManager;
+    physicalManager.setReferenceFrame(&referenceFrame);
+    PhysicalManager fittedPhysicalManager;
+    fittedPhysicalManager.copyReferenceFrom(&physicalManager);
+
+    SyntheticSceneParameters driftedParameters = scene.parameters;
+    driftedParameters.surfaceRegressionA *= (1 + DRIFT_FRACTION);
+    SyntheticScene driftedScene(driftedParameters);
+    std::vector<float> driftedReferenceData(scene.parameters.width * scene.parameters.height);
+    driftedScene.renderReferenceFrame(driftedReferenceData.data());
+    DepthView driftedReferenceFrame(driftedReferenceData.data(), scene.parameters.width, scene.parameters.height);
+    PhysicalManager driftedPhysicalManager;
+    driftedPhysicalManager.setReferenceFrame(&driftedReferenceFrame);
+
+    float driftDifference = surfaceDifference(&fittedPhysicalManager, &driftedPhysicalManager);
+    check(driftDifference > 2 * DRIFT_DEPTH_TOLERANCE, testName, "drifts the surface (" + std::to_string(driftDifference) + " mm)");
+
+    double driftMicroseconds = compensateDriftFrames(&physicalManager, &driftedScene, &depthData);
+    float compensatedDifference = surfaceDifference(&physicalManager, &driftedPhysicalManager);
+    check(physicalManager.getDriftAdjustmentCount() > 0, testName, "adjusts the regression");
+    check(compensatedDifference <= DRIFT_DEPTH_TOLERANCE, testName, "follows the drifted surface (" + std::to_string(compensatedDifference) + " mm off)");
+    std::cout << "SurfaceDriftTest: " << driftDifference << " mm of drift followed to within " << compensatedDifference << " mm in "
+              << physicalManager.getDriftAdjustmentCount() << " adjustments" << std::endl;
+
+    // The adjusted surface and bounds still find no interaction on the drifted surface
+    DepthView depthFrame(depthData.data(), scene.parameters.width, scene.parameters.height);
+    double detectionMicroseconds = 0;
+    int interactionCount = 0;
+    for (int frameIndex = 1; frameIndex <= DETECTION_FRAME_COUNT; frameIndex++) {
+        driftedScene.renderDepthFrame(depthData.data(), DRIFT_FRAME_COUNT + frameIndex);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Interaction *interaction = physicalManager.detectInteraction(&depthFrame);
+        detectionMicroseconds += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        interactionCount += (interaction != NULL) ? 1 : 0;
+        freeInteraction(interaction);
+    }
+    detectionMicroseconds /= DETECTION_FRAME_COUNT;
+    check(interactionCount == 0, testName, "finds no interaction on the drifted surface (" + std::to_string(interactionCount) + " found)");
+
+    double costFraction = driftMicroseconds / detectionMicroseconds;
+    check(costFraction < DRIFT_COST_FRACTION_MAX, testName, "costs under 1% of detection (" + std::to_string(costFraction * 100) + "%)");
+    std::cout << "SurfaceDriftTest: " << driftMicroseconds << " us per frame, " << (costFraction * 100) << "% of "
+              << detectionMicroseconds << " us detection" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    testSteadySurface();
+    testDriftedSurface();
+
+    std::cout << "SurfaceDriftTest: " << (checkCount - failureCount) << "/" << checkCount << " checks passed" << std::endl;
+    return (failureCount == 0) ? 0 : 1;
+}
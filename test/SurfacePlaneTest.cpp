@@ -0,0 +1,331 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    SurfacePlaneTest.cpp
+    Checks that with camera intrinsics the surface is fitted as a plane, on a synthetic surface seen by a rolled sensor.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "PhysicalManager.h"
+#include "Recording.h"
+#include "SyntheticScene.h"
+
+#define SURFACE_MODEL_FILENAME "/tmp/SurfacePlaneTest.vmsurf"
+#define RECORDING_FILENAME "/tmp/SurfacePlaneTest.vmrec"
+// Largest difference between a pixel and its undistorted ray distorted again (pixels)
+#define UNDISTORT_TOLERANCE 0.01
+// Largest height of the noiseless surface above the fitted plane (mm)
+#define PLANE_HEIGHT_TOLERANCE 2
+// Smallest height the regression misses the rolled surface by somewhere (mm), which the plane does not
+#define REGRESSION_MISFIT_MIN 20
+// Frames with a touch, and how close a detected touch is to a true contact (pixels)
+#define TOUCH_FRAME_COUNT 20
+#define TOUCH_TOLERANCE 10
+// Touch frames whose touches may be missed, on a flat table with the regression as well as on the rolled table with the plane:
+// each fingertip is low in the frame, so its arm from the top of the frame is long and rises slowly, and the finger
+// behind the tip is within the surface's depth and slope differences; the tip's anomaly (about 50 pixels) is then
+// cut off from the arm's, and is smaller than anomalySizeMin, so the arm is found above the tip instead
+#define TOUCH_MISSED_FRAME_INDICES {5, 7, 16}
+// Frames without an interaction given to compensateDrift(), and how far the surface moves between them (mm)
+#define DRIFT_FRAME_COUNT 600
+#define DRIFT_RENDERED_FRAME_COUNT 16
+#define DRIFT_DISTANCE 15
+#define DRIFT_TOLERANCE 6
+
+using namespace virtualMonitor;
+
+static int checkCount = 0;
+static int failureCount = 0;
+
+static void check(bool condition, std::string testName, std::string description) {
+    checkCount++;
+    if (!condition) {
+        failureCount++;
+        std::cout << "FAILED " << testName << ": " << description << std::endl;
+    }
+}
+
+static void freeInteraction(Interaction *interaction) {
+    if (interaction != NULL) {
+        delete interaction->physicalLocation;
+        delete interaction->virtualLocation;
+        delete interaction;
+    }
+}
+
+/*
+ * Output: intrinsics like a Kinect v2's depth camera
+ */
+static CameraIntrinsics kinectIntrinsics() {
+    CameraIntrinsics intrinsics;
+    intrinsics.fx = 365.5;
+    intrinsics.fy = 365.5;
+    intrinsics.cx = 254.9;
+    intrinsics.cy = 205.4;
+    intrinsics.k1 = 0.0905;
+    intrinsics.k2 = -0.2685;
+    intrinsics.k3 = 0.0950;
+    intrinsics.p1 = 0.0005;
+    intrinsics.p2 = -0.0003;
+    return intrinsics;
+}
+
+/*
+ * Output: a table below the camera, about a meter away at the center, seen by a sensor rolled about 10 degrees
+ */
+static SyntheticSceneParameters rolledSceneParameters() {
+    SyntheticSceneParameters parameters;
+    parameters.cameraIntrinsics = kinectIntrinsics();
+    float normal[3] = {0.15, 0.6, 0.8};
+    float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+    for (int i = 0; i < 3; i++) {
+        parameters.surfacePlaneNormal[i] = normal[i] / length;
+    }
+    parameters.surfacePlaneDistance = 800;
+    return parameters;
+}
+
+/*
+ * Output: the largest height of depthFrame above or below the surface of physicalManager, over the scene's surface
+ */
+static float maxSurfaceHeight(PhysicalManager *physicalManager, SyntheticScene *scene, DepthView *depthFrame) {
+    float maxHeight = 0;
+    SyntheticSceneParameters &parameters = scene->parameters;
+    for (int y = (int)(parameters.surfaceTop * parameters.height) + 1; y < (int)(parameters.surfaceBottom * parameters.height); y++) {
+        for (int x = (int)(parameters.surfaceLeft * parameters.width) + 1; x < (int)(parameters.surfaceRight * parameters.width); x++) {
+            maxHeight = std::max(maxHeight, std::abs(physicalManager->pixelHeightAboveSurface(depthFrame, x, y)));
+        }
+    }
+    return maxHeight;
+}
+
+static void testUndistort() {
+    std::string testName = "undistort";
+    CameraIntrinsics intrinsics = kinectIntrinsics();
+    float maxError = 0;
+    for (int y = 0; y < 424; y += 8) {
+        for (int x = 0; x < 512; x += 8) {
+            float rayX, rayY, pixelX, pixelY;
+            undistortPixel(intrinsics, x, y, &rayX, &rayY);
+            distortRay(intrinsics, rayX, rayY, &pixelX, &pixelY);
+            maxError = std::max(maxError, std::max(std::abs(pixelX - x), std::abs(pixelY - y)));
+        }
+    }
+    check(maxError < UNDISTORT_TOLERANCE, testName, "inverts distortion (" + std::to_string(maxError) + " pixels off)");
+    check(!CameraIntrinsics().isValid(), testName, "takes intrinsics without focal lengths as none");
+}
+
+static void testPlaneFit() {
+    std::string testName = "plane";
+    SyntheticScene scene(rolledSceneParameters());
+    std::vector<float> referenceData(scene.parameters.width * scene.parameters.height);
+    scene.renderReferenceFrame(referenceData.data());
+    DepthView referenceFrame(referenceData.data(), scene.parameters.width, scene.parameters.height);
+
+    SyntheticSceneParameters cleanParameters = scene.parameters;
+    cleanParameters.noiseScale = 0;
+    cleanParameters.dropoutRate = 0;
+    cleanParameters.edgeDropoutRate = 0;
+    SyntheticScene cleanScene(cleanParameters);
+    std::vector<float> cleanData(scene.parameters.width * scene.parameters.height);
+    cleanScene.renderReferenceFrame(cleanData.data());
+    DepthView cleanFrame(cleanData.data(), scene.parameters.width, scene.parameters.height);
+
+    PhysicalManager planePhysicalManager;
+    planePhysicalManager.setCameraIntrinsics(kinectIntrinsics());
+    planePhysicalManager.setReferenceFrame(&referenceFrame);
+    float normal[3];
+    float distance = 0;
+    check(planePhysicalManager.getSurfacePlane(normal, &distance), testName, "fits a plane");
+    float alignment = normal[0] * scene.parameters.surfacePlaneNormal[0] + normal[1] * scene.parameters.surfacePlaneNormal[1] +
+                      normal[2] * scene.parameters.surfacePlaneNormal[2];
+    check(alignment > 0.9999, testName, "finds the plane's normal (" + std::to_string(alignment) + " aligned)");
+    check(std::abs(distance - scene.parameters.surfacePlaneDistance) < PLANE_HEIGHT_TOLERANCE, testName,
+          "finds the plane's distance (" + std::to_string(distance) + " mm)");
+    float planeHeight = maxSurfaceHeight(&planePhysicalManager, &scene, &cleanFrame);
+    check(planeHeight < PLANE_HEIGHT_TOLERANCE, testName, "fits the surface everywhere (" + std::to_string(planeHeight) + " mm off)");
+
+    // A wall covering more of the frame than the surface is a plane too, and is not sampled
+    SyntheticSceneParameters narrowParameters = scene.parameters;
+    narrowParameters.surfaceLeft = 0.3;
+    narrowParameters.surfaceRight = 0.7;
+    narrowParameters.surfaceTop = 0.4;
+    SyntheticScene narrowScene(narrowParameters);
+    std::vector<float> narrowData(scene.parameters.width * scene.parameters.height);
+    narrowScene.renderReferenceFrame(narrowData.data());
+    DepthView narrowFrame(narrowData.data(), scene.parameters.width, scene.parameters.height);
+    PhysicalManager narrowPhysicalManager;
+    narrowPhysicalManager.setCameraIntrinsics(kinectIntrinsics());
+    narrowPhysicalManager.setReferenceFrame(&narrowFrame);
+    float narrowNormal[3];
+    float narrowDistance = 0;
+    check(narrowPhysicalManager.getSurfacePlane(narrowNormal, &narrowDistance) &&
+          std::abs(narrowDistance - scene.parameters.surfacePlaneDistance) < PLANE_HEIGHT_TOLERANCE, testName,
+          "fits the surface rather than a larger wall (" + std::to_string(narrowDistance) + " mm)");
+
+    // The regression is a function of y alone, so it misses a rolled surface
+    PhysicalManager regressionPhysicalManager;
+    regressionPhysicalManager.setReferenceFrame(&referenceFrame);
+    check(!regressionPhysicalManager.getSurfacePlane(normal, &distance), testName, "fits no plane without intrinsics");
+    float regressionHeight = maxSurfaceHeight(&regressionPhysicalManager, &scene, &cleanFrame);
+    check(regressionHeight > REGRESSION_MISFIT_MIN, testName, "misfits the regression to a rolled surface (" + std::to_string(regressionHeight) + " mm off)");
+    std::cout << "SurfacePlaneTest: rolled surface fitted to within " << planeHeight << " mm by the plane and "
+              << regressionHeight << " mm by the regression" << std::endl;
+
+    // Touches on the rolled surface are found against the plane
+    std::vector<float> depthData(scene.parameters.width * scene.parameters.height);
+    DepthView depthFrame(depthData.data(), scene.parameters.width, scene.parameters.height);
+    int touchFrameCount = 0;
+    int foundCount = 0;
+    std::vector<int> missedFrameIndices;
+    for (int frameIndex = 1; touchFrameCount < TOUCH_FRAME_COUNT && frameIndex < 10 * TOUCH_FRAME_COUNT; frameIndex++) {
+        scene.randomizeHands(frameIndex, 1, 1);
+        std::vector<Coord3D> contacts;
+        scene.renderDepthFrame(depthData.data(), frameIndex, &contacts);
+        if (contacts.empty()) {
+            continue;
+        }
+        touchFrameCount++;
+        Interaction *interaction = planePhysicalManager.detectInteraction(&depthFrame);
+        if (interaction != NULL && std::abs(interaction->physicalLocation->x - contacts[0].x) <= TOUCH_TOLERANCE &&
+            std::abs(interaction->physicalLocation->y - contacts[0].y) <= TOUCH_TOLERANCE) {
+            foundCount++;
+        } else {
+            missedFrameIndices.push_back(frameIndex);
+        }
+        freeInteraction(interaction);
+    }
+    // Misses are frame indices in order, so better detection may find known misses but never miss another touch
+    std::vector<int> knownMissedFrameIndices = TOUCH_MISSED_FRAME_INDICES;
+    check(touchFrameCount == TOUCH_FRAME_COUNT &&
+          std::includes(knownMissedFrameIndices.begin(), knownMissedFrameIndices.end(), missedFrameIndices.begin(), missedFrameIndices.end()), testName,
+          "finds every touch but the known misses (" + std::to_string(foundCount) + "/" + std::to_string(touchFrameCount) + ")");
+    std::cout << "SurfacePlaneTest: " << foundCount << "/" << touchFrameCount << " touches found on the rolled surface" << std::endl;
+
+    // Surface models keep the plane, only for the same intrinsics
+    check(planePhysicalManager.writeSurfaceModel(SURFACE_MODEL_FILENAME) == 0, testName, "writes a surface model");
+    PhysicalManager warmPhysicalManager;
+    warmPhysicalManager.setCameraIntrinsics(kinectIntrinsics());
+    check(warmPhysicalManager.setReferenceFrameFromSurfaceModel(&referenceFrame, SURFACE_MODEL_FILENAME) == 0, testName, "reuses the surface model");
+    float warmNormal[3];
+    float warmDistance = 0;
+    planePhysicalManager.getSurfacePlane(normal, &distance);
+    check(warmPhysicalManager.getSurfacePlane(warmNormal, &warmDistance) && warmDistance == distance && warmNormal[1] == normal[1], testName,
+          "reuses the plane");
+    check(maxSurfaceHeight(&warmPhysicalManager, &scene, &cleanFrame) == planeHeight, testName, "reuses the plane's depths");
+    PhysicalManager otherPhysicalManager;
+    check(otherPhysicalManager.setReferenceFrameFromSurfaceModel(&referenceFrame, SURFACE_MODEL_FILENAME) < 0, testName,
+          "refuses the surface model without intrinsics");
+
+    // The checksum covers the plane in the header
+    std::vector<char> modelBytes;
+    {
+        std::ifstream modelFile(SURFACE_MODEL_FILENAME, std::ios::binary);
+        modelBytes.assign(std::istreambuf_iterator<char>(modelFile), std::istreambuf_iterator<char>());
+    }
+    modelBytes[offsetof(SurfaceModelHeader, surfacePlaneDistance)] ^= 1;
+    std::ofstream(SURFACE_MODEL_FILENAME, std::ios::binary | std::ios::trunc).write(modelBytes.data(), modelBytes.size());
+    PhysicalManager corruptPhysicalManager;
+    corruptPhysicalManager.setCameraIntrinsics(kinectIntrinsics());
+    check(corruptPhysicalManager.setReferenceFrameFromSurfaceModel(&referenceFrame, SURFACE_MODEL_FILENAME) < 0, testName,
+          "refuses a surface model with an altered plane");
+    std::remove(SURFACE_MODEL_FILENAME);
+}
+
+/*
+ * The plane follows the surface as it moves, as the regression does
+ */
+static void testPlaneDrift() {
+    std::string testName = "drift";
+    SyntheticScene scene(rolledSceneParameters());
+    std::vector<float> referenceData(scene.parameters.width * scene.parameters.height);
+    scene.renderReferenceFrame(referenceData.data());
+    DepthView referenceFrame(referenceData.data(), scene.parameters.width, scene.parameters.height);
+    PhysicalManager physicalManager;
+    physicalManager.setCameraIntrinsics(kinectIntrinsics());
+    physicalManager.setReferenceFrame(&referenceFrame);
+
+    SyntheticSceneParameters driftedParameters = scene.parameters;
+    driftedParameters.surfacePlaneDistance += DRIFT_DISTANCE;
+    SyntheticScene driftedScene(driftedParameters);
+    // A few frames are rendered and given in turn, since only the surface moving matters here
+    int pixelCount = scene.parameters.width * scene.parameters.height;
+    std::vector<float> depthData(DRIFT_RENDERED_FRAME_COUNT * pixelCount);
+    for (int frameIndex = 0; frameIndex < DRIFT_RENDERED_FRAME_COUNT; frameIndex++) {
+        driftedScene.renderDepthFrame(&depthData[frameIndex * pixelCount], frameIndex + 1);
+    }
+    for (int frameIndex = 0; frameIndex < DRIFT_FRAME_COUNT; frameIndex++) {
+        DepthView depthFrame(&depthData[(frameIndex % DRIFT_RENDERED_FRAME_COUNT) * pixelCount], scene.parameters.width, scene.parameters.height);
+        physicalManager.compensateDrift(&depthFrame);
+    }
+
+    float normal[3];
+    float distance = 0;
+    physicalManager.getSurfacePlane(normal, &distance);
+    check(physicalManager.getDriftAdjustmentCount() > 0, testName, "adjusts the plane");
+    check(std::abs(distance - driftedParameters.surfacePlaneDistance) < DRIFT_TOLERANCE, testName,
+          "follows the drifted plane (" + std::to_string(distance) + " mm)");
+}
+
+/*
+ * Recordings keep the intrinsics of the camera they are from
+ */
+static void testRecording() {
+    std::string testName = "recording";
+    std::vector<float> depthData(512 * 424, 1000);
+    DepthView depthFrame(depthData.data(), 512, 424);
+
+    RecordingWriter writer;
+    writer.open(RECORDING_FILENAME, 512, 424, kinectIntrinsics());
+    writer.writeFrame(&depthFrame);
+    writer.close();
+    RecordingReader reader;
+    CameraIntrinsics intrinsics;
+    check(reader.open(RECORDING_FILENAME) == 0 && reader.getFrameCount() == 1, testName, "reads the recording");
+    check(reader.getCameraIntrinsics(&intrinsics) == 0 && intrinsics.fx == kinectIntrinsics().fx && intrinsics.k2 == kinectIntrinsics().k2,
+          testName, "keeps the intrinsics");
+    DepthView readFrame;
+    check(reader.readFrame(0, &readFrame) == 0 && readFrame.row(423)[511] == 1000, testName, "reads frames after the intrinsics");
+    reader.close();
+
+    writer.open(RECORDING_FILENAME, 512, 424);
+    writer.writeFrame(&depthFrame);
+    writer.close();
+    check(reader.open(RECORDING_FILENAME) == 0 && reader.getCameraIntrinsics(&intrinsics) < 0, testName, "records no intrinsics without them");
+    reader.close();
+    std::remove(RECORDING_FILENAME);
+}
+
+int main(int argc, char **argv) {
+    testUndistort();
+    testPlaneFit();
+    testPlaneDrift();
+    testRecording();
+
+    std::cout << "SurfacePlaneTest: " << (checkCount - failureCount) << "/" << checkCount << " checks passed" << std::endl;
+    return (failureCount == 0) ? 0 : 1;
+}
@@ -0,0 +1,670 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    VirtualManagerTest.cpp
+    Checks VirtualManager's mapping table against mapping each coordinate from its calibration cell.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "VirtualManager.h"
+
+// Kinect v2 depth frames
+#define DEPTH_FRAME_WIDTH 512
+#define DEPTH_FRAME_HEIGHT 424
+// Interpolating the table between its entries can land a coordinate one pixel past the entries around it
+#define INTERPOLATION_TOLERANCE_PIXELS 1
+// The linear search adds up its fractions of the screen in another order, so a coordinate on a whole pixel can truncate to the one before
+#define LINEAR_SEARCH_TOLERANCE_PIXELS 1
+// Pixels per mapping off the screen from one path and on its edge from the other, at most 1/256 px past the limit of clamping 
+// (which the table's fixed point cannot tell from on it), or interpolated across the limit
+#define MAX_CLAMPING_LIMIT_COUNT 2
+// Written and removed by testCalibrationProfile()
+#define PROFILE_FILENAME "/tmp/VirtualManagerTest.vmprof"
+#define CALIBRATION_FILENAME "/tmp/VirtualManagerTest.vmcal"
+// largest difference from the mapping a lens without distortion would give through the calibration points, with the camera's intrinsics (virtual pixels)
+#define UNDISTORTED_TOLERANCE_PIXELS 1
+
+using namespace virtualMonitor;
+
+static int checkCount = 0;
+static int failureCount = 0;
+
+static void check(bool condition, std::string testName, std::string description) {
+    checkCount++;
+    if (!condition) {
+        failureCount++;
+        std::cout << "FAILED " << testName << ": " << description << std::endl;
+    }
+}
+
+/*
+ * A calibration of rows by cols points, narrowing toward the top of the frame as a projected screen does
+ * In a mirrored calibration the first col is on the right of the depth frame, as the Kinect sees the screen
+ */
+class Calibration {
+    public:
+        int rows;
+        int cols;
+        Coord3D **coordsPhysical;
+        Coord2D **coordsVirtual;
+
+        Calibration(int rows, int cols, int screenWidth, int screenHeight, bool isMirrored=false) {
+            this->rows = rows;
+            this->cols = cols;
+            this->coordsPhysical = new Coord3D*[rows * cols];
+            this->coordsVirtual = new Coord2D*[rows * cols];
+            for (int row = 0; row < rows; row++) {
+                int physicalY = 110 + (row * 260) / (rows - 1);
+                int xInset = 90 - (row * 40) / (rows - 1);
+                for (int col = 0; col < cols; col++) {
+                    int index = row * cols + col;
+                    this->coordsPhysical[index] = new Coord3D();
+                    int physicalCol = isMirrored ? (cols - 1 - col) : col;
+                    this->coordsPhysical[index]->x = xInset + (physicalCol * (DEPTH_FRAME_WIDTH - 2 * xInset)) / (cols - 1);
+                    // rows are not quite level, as in a real calibration
+                    this->coordsPhysical[index]->y = physicalY + ((col % 2 == 0) ? 1 : -1);
+                    this->coordsPhysical[index]->z = 176000 * std::pow(physicalY, -0.98);
+                    this->coordsVirtual[index] = new Coord2D();
+                    this->coordsVirtual[index]->x = (col * screenWidth) / (cols - 1);
+                    this->coordsVirtual[index]->y = (row * screenHeight) / (rows - 1);
+                }
+            }
+        }
+
+        ~Calibration() {
+            for (int i = 0; i < this->rows * this->cols; i++) {
+                delete this->coordsPhysical[i];
+                delete this->coordsVirtual[i];
+            }
+            delete[] this->coordsPhysical;
+            delete[] this->coordsVirtual;
+        }
+};
+
+/*
+ * Whether one coordinate is off the screen and the other is clamped to its edge
+ */
+static bool isClampingLimit(int coordinate, int otherCoordinate, int screenSize) {
+    bool isEdge = (coordinate == 0 || coordinate == screenSize);
+    bool isOtherEdge = (otherCoordinate == 0 || otherCoordinate == screenSize);
+    return (isEdge && otherCoordinate == -screenSize) || (isOtherEdge && coordinate == -screenSize);
+}
+
+/*
+ * Maps every pixel of the depth frame (and a margin around it) through the table and from the calibration cells
+ * inputs: tolerancePixels is 0 when pixels are read from the table as they are, 
+           and INTERPOLATION_TOLERANCE_PIXELS when they are undistorted to between its entries
+ */
+static void checkParity(VirtualManager *virtualManager, int screenWidth, int screenHeight, std::string testName, int tolerancePixels) {
+    Interaction interaction;
+    Coord3D physicalLocation;
+    Coord2D tableLocation;
+    Coord2D calibrationLocation;
+    interaction.physicalLocation = &physicalLocation;
+    interaction.surfaceRegressionA = 176000;
+    interaction.surfaceRegressionB = -0.98;
+    physicalLocation.z = 0;
+
+    int mismatchCount = 0;
+    int clampingLimitCount = 0;
+    int largestDifference = 0;
+    for (int y = -2; y < DEPTH_FRAME_HEIGHT + 2; y++) {
+        for (int x = -2; x < DEPTH_FRAME_WIDTH + 2; x++) {
+            physicalLocation.x = x;
+            physicalLocation.y = y;
+            interaction.virtualLocation = &tableLocation;
+            virtualManager->setVirtualCoord(&interaction);
+            interaction.virtualLocation = &calibrationLocation;
+            virtualManager->setVirtualCoordFromCalibration(&interaction);
+            if (isClampingLimit(tableLocation.x, calibrationLocation.x, screenWidth)
+                || isClampingLimit(tableLocation.y, calibrationLocation.y, screenHeight)) {
+                clampingLimitCount++;
+                continue;
+            }
+            int difference = std::max(std::abs(tableLocation.x - calibrationLocation.x), std::abs(tableLocation.y - calibrationLocation.y));
+            largestDifference = std::max(largestDifference, difference);
+            mismatchCount += (difference > tolerancePixels) ? 1 : 0;
+        }
+    }
+    check(mismatchCount == 0, testName, "maps every pixel as the calibration cells do (" + std::to_string(mismatchCount)
+          + " mismatched, largest difference " + std::to_string(largestDifference) + " px)");
+    check(clampingLimitCount <= MAX_CLAMPING_LIMIT_COUNT, testName, "clamps to the screen as the calibration cells do ("
+          + std::to_string(clampingLimitCount) + " at the limit)");
+}
+
+/*
+ * Between pixels, the mapping lies between the pixels around it
+ */
+static void checkSubPixel(VirtualManager *virtualManager, std::string testName) {
+    Interaction interaction;
+    Coord3D physicalLocation;
+    Coord2D virtualLocation;
+    interaction.physicalLocation = &physicalLocation;
+    interaction.virtualLocation = &virtualLocation;
+    interaction.surfaceRegressionA = 176000;
+    interaction.surfaceRegressionB = -0.98;
+
+    int outsideCount = 0;
+    for (int y = 120; y < 360; y += 7) {
+        for (int x = 100; x < 400; x += 11) {
+            int minX = 1 << 30, maxX = -(1 << 30), minY = 1 << 30, maxY = -(1 << 30);
+            for (int corner = 0; corner < 4; corner++) {
+                physicalLocation.x = x + (corner & 1);
+                physicalLocation.y = y + (corner >> 1);
+                virtualManager->setVirtualCoord(&interaction);
+                minX = std::min(minX, virtualLocation.x);
+                maxX = std::max(maxX, virtualLocation.x);
+                minY = std::min(minY, virtualLocation.y);
+                maxY = std::max(maxY, virtualLocation.y);
+            }
+            Coord2D subPixelLocation;
+            if (virtualManager->mapPhysicalLocation(x + 0.5f, y + 0.25f, &subPixelLocation) < 0
+                || subPixelLocation.x < minX - INTERPOLATION_TOLERANCE_PIXELS || subPixelLocation.x > maxX + INTERPOLATION_TOLERANCE_PIXELS
+                || subPixelLocation.y < minY - INTERPOLATION_TOLERANCE_PIXELS || subPixelLocation.y > maxY + INTERPOLATION_TOLERANCE_PIXELS) {
+                outsideCount++;
+            }
+        }
+    }
+    check(outsideCount == 0, testName, "interpolates between pixels");
+
+    physicalLocation.x = 256;
+    physicalLocation.y = 212;
+    virtualManager->setVirtualCoord(&interaction);
+    Coord2D pixelLocation;
+    virtualManager->mapPhysicalLocation(256.0f, 212.0f, &pixelLocation);
+    check(pixelLocation.x == virtualLocation.x && pixelLocation.y == virtualLocation.y, testName, "maps whole pixels as setVirtualCoord does");
+    check(virtualManager->mapPhysicalLocation(-1.0f, 212.0f, &pixelLocation) < 0, testName, "rejects coordinates outside the depth frame");
+}
+
+/*
+ * VirtualManager's mapping before it had a table and cell search (linear search of rows, then cols from the right),
+ * which is correct for mirrored calibrations, from calibration points at sub-pixel physical coordinates
+ */
+static void referenceVirtualCoord(int numRows, int numCols, const std::vector<double> &physicalX, const std::vector<double> &physicalY,
+                                  Coord2D **virtualCoords, int screenWidth, int screenHeight, double interactionX, double interactionY, Coord2D *virtualLocation) {
+    std::vector<double> averageYValues(numRows);
+    for (int row = 0; row < numRows; row++) {
+        double sumYValues = 0.0;
+        for (int col = 0; col < numCols; col++) {
+            sumYValues += physicalY[row * numCols + col];
+        }
+        averageYValues[row] = sumYValues / numCols;
+    }
+    auto getXValue = [&](int topIndex, int bottomIndex, double y) {
+        double yBottom_d = averageYValues[bottomIndex / numCols];
+        double yTop_d = averageYValues[topIndex / numCols];
+        double xBottom_d = physicalX[bottomIndex];
+        double xTop_d = physicalX[topIndex];
+        double slopeInverse_d = (xTop_d - xBottom_d) / (yTop_d - yBottom_d);
+        return (y - yTop_d) * slopeInverse_d + xTop_d;
+    };
+
+    int calibrationRow;
+    for (calibrationRow = 1; calibrationRow < numRows - 1; calibrationRow++) {
+        if (averageYValues[calibrationRow] >= interactionY) {
+            break;
+        }
+    }
+    int calibrationCol;
+    for (calibrationCol = numCols - 2; calibrationCol >= 1; calibrationCol--) {
+        double colXValue = getXValue((calibrationRow - 1) * numCols + calibrationCol, calibrationRow * numCols + calibrationCol, interactionY);
+        if (colXValue >= interactionX) {
+            break;
+        }
+    }
+    int topLeftIndex = (calibrationRow - 1) * numCols + calibrationCol;
+    int bottomLeftIndex = calibrationRow * numCols + calibrationCol;
+    int topRightIndex = topLeftIndex + 1;
+    int bottomRightIndex = bottomLeftIndex + 1;
+
+    double screenWidth_d = (double)screenWidth;
+    double screenHeight_d = (double)screenHeight;
+    double leftVirtualX_d = (double)virtualCoords[topLeftIndex]->x;
+    double rightVirtualX_d = (double)virtualCoords[topRightIndex]->x;
+    double xLeft_d = getXValue(topLeftIndex, bottomLeftIndex, interactionY);
+    double xRight_d = getXValue(topRightIndex, bottomRightIndex, interactionY);
+    double percentRightInteraction_d = (xLeft_d - interactionX) / (xLeft_d - xRight_d);
+    double percentRight_d = leftVirtualX_d / screenWidth_d + percentRightInteraction_d * (rightVirtualX_d - leftVirtualX_d) / screenWidth_d;
+    double topVirtualY_d = (double)virtualCoords[topLeftIndex]->y;
+    double bottomVirtualY_d = (double)virtualCoords[bottomLeftIndex]->y;
+    double yLess_d = averageYValues[calibrationRow - 1];
+    double yGreater_d = averageYValues[calibrationRow];
+    double percentDownInteraction_d = (interactionY - yLess_d) / (yGreater_d - yLess_d);
+    double percentDown_d = topVirtualY_d / screenHeight_d + percentDownInteraction_d * (bottomVirtualY_d - topVirtualY_d) / screenHeight_d;
+
+    double percents_d[2] = {percentRight_d, percentDown_d};
+    for (int i = 0; i < 2; i++) {
+        if (-0.05 <= percents_d[i] && percents_d[i] < 0.0) {
+            percents_d[i] = 0.0;
+        }
+        if (1.0 < percents_d[i] && percents_d[i] <= 1.05) {
+            percents_d[i] = 1.0;
+        }
+        if (percents_d[i] > 1.05 || percents_d[i] < -0.05) {
+            percents_d[i] = -1.0;
+        }
+    }
+    virtualLocation->x = (int)(screenWidth_d * percents_d[0]);
+    virtualLocation->y = (int)(screenHeight_d * percents_d[1]);
+}
+
+/*
+ * The cell search finds the same cells as the linear search did, for mirrored calibrations of any size
+ */
+static void testLinearSearchParity(int rows, int cols) {
+    std::string testName = std::to_string(rows) + "x" + std::to_string(cols) + " mirrored";
+    Calibration calibration(rows, cols, 1920, 1080, true);
+    VirtualManager virtualManager;
+    virtualManager.setCalibrationPoints(rows, cols, calibration.coordsPhysical, calibration.coordsVirtual);
+    virtualManager.setScreenVirtual(1080, 1920);
+    checkParity(&virtualManager, 1920, 1080, testName, 0);
+    std::vector<double> physicalX(rows * cols);
+    std::vector<double> physicalY(rows * cols);
+    for (int i = 0; i < rows * cols; i++) {
+        physicalX[i] = calibration.coordsPhysical[i]->x;
+        physicalY[i] = calibration.coordsPhysical[i]->y;
+    }
+
+    Interaction interaction;
+    Coord3D physicalLocation;
+    Coord2D virtualLocation;
+    interaction.physicalLocation = &physicalLocation;
+    interaction.virtualLocation = &virtualLocation;
+    int mismatchCount = 0;
+    for (int y = 0; y < DEPTH_FRAME_HEIGHT; y++) {
+        for (int x = 0; x < DEPTH_FRAME_WIDTH; x++) {
+            physicalLocation.x = x;
+            physicalLocation.y = y;
+            virtualManager.setVirtualCoordFromCalibration(&interaction);
+            Coord2D referenceLocation;
+            referenceVirtualCoord(rows, cols, physicalX, physicalY, calibration.coordsVirtual, 1920, 1080, x, y, &referenceLocation);
+            if (std::abs(virtualLocation.x - referenceLocation.x) > LINEAR_SEARCH_TOLERANCE_PIXELS
+                || std::abs(virtualLocation.y - referenceLocation.y) > LINEAR_SEARCH_TOLERANCE_PIXELS) {
+                mismatchCount++;
+            }
+        }
+    }
+    check(mismatchCount == 0, testName, "maps every pixel as the linear search did (" + std::to_string(mismatchCount) + " mismatched)");
+}
+
+/*
+ * Mapping a batch gives each coordinate what setVirtualCoord() gives it, including off the depth frame and
+ * batches that do not fill a block
+ */
+static void checkBatch(VirtualManager *virtualManager, std::string testName) {
+    std::vector<int> physicalX;
+    std::vector<int> physicalY;
+    for (int y = -3; y < DEPTH_FRAME_HEIGHT + 3; y++) {
+        for (int x = -3; x < DEPTH_FRAME_WIDTH + 3; x++) {
+            physicalX.push_back(x);
+            physicalY.push_back(y);
+        }
+    }
+    // one more than a multiple of the block size
+    physicalX.push_back(DEPTH_FRAME_WIDTH / 2);
+    physicalY.push_back(DEPTH_FRAME_HEIGHT / 2);
+    int count = (int)physicalX.size();
+    std::vector<int> virtualX(count);
+    std::vector<int> virtualY(count);
+    check(virtualManager->mapPhysicalLocations(count, physicalX.data(), physicalY.data(), virtualX.data(), virtualY.data()) == 0, testName, "maps a batch");
+
+    Interaction interaction;
+    Coord3D physicalLocation;
+    Coord2D virtualLocation;
+    interaction.physicalLocation = &physicalLocation;
+    interaction.virtualLocation = &virtualLocation;
+    interaction.surfaceRegressionA = 176000;
+    interaction.surfaceRegressionB = -0.98;
+    int mismatchCount = 0;
+    for (int i = 0; i < count; i++) {
+        physicalLocation.x = physicalX[i];
+        physicalLocation.y = physicalY[i];
+        virtualManager->setVirtualCoord(&interaction);
+        mismatchCount += (virtualLocation.x != virtualX[i] || virtualLocation.y != virtualY[i]) ? 1 : 0;
+    }
+    check(mismatchCount == 0, testName, "maps a batch as one at a time (" + std::to_string(mismatchCount) + " mismatched)");
+
+    for (int batchCount = 0; batchCount < 20; batchCount++) {
+        std::vector<int> partialX(batchCount, -1);
+        std::vector<int> partialY(batchCount, -1);
+        virtualManager->mapPhysicalLocations(batchCount, physicalX.data() + 1000, physicalY.data() + 1000, partialX.data(), partialY.data());
+        bool isMatch = true;
+        for (int i = 0; i < batchCount; i++) {
+            isMatch = isMatch && (partialX[i] == virtualX[1000 + i] && partialY[i] == virtualY[1000 + i]);
+        }
+        check(isMatch, testName, "maps a batch of " + std::to_string(batchCount));
+    }
+}
+
+/*
+ * Length of a power regression curve as findArcLength() used to sum it, over each step of one in y
+ */
+static double referenceArcLength(float A_f, float B_f, int y1, int y2) {
+    double len_d = 0.0;
+    double invB_d = 1.0 / (double)B_f;
+    for (int y = std::min(y1, y2); y < std::max(y1, y2); y++) {
+        double z_d = std::pow((double)y / (double)A_f, invB_d);
+        double zPlus1_d = std::pow(((double)y + 1.0) / (double)A_f, invB_d);
+        len_d += std::sqrt(1.0 + (zPlus1_d - z_d) * (zPlus1_d - z_d));
+    }
+    return len_d;
+}
+
+/*
+ * Arc lengths match the summed ones, and near-identical regressions reuse a cached length
+ */
+static void testArcLength() {
+    std::string testName = "arc length";
+    VirtualManager virtualManager;
+    const float regressionsA[] = {176000.0f, 90000.0f, 400000.0f};
+    const float regressionsB[] = {-0.98f, -0.9f, -1.1f};
+    for (int i = 0; i < 3; i++) {
+        for (int y1 = 20; y1 < 300; y1 += 70) {
+            int y2 = y1 + 150;
+            double expected_d = referenceArcLength(regressionsA[i], regressionsB[i], y1, y2);
+            double length_d = virtualManager.findArcLength(regressionsA[i], regressionsB[i], y1, y2);
+            check(std::abs(length_d - expected_d) <= 1e-5 * expected_d, testName,
+                  "matches the summed length for A=" + std::to_string(regressionsA[i]) + " from y=" + std::to_string(y1)
+                  + " (" + std::to_string(length_d) + " vs " + std::to_string(expected_d) + ")");
+        }
+    }
+
+    double length_d = virtualManager.findArcLength(176000.0f, -0.98f, 370, 110);
+    check(length_d == virtualManager.findArcLength(176000.0f, -0.98f, 110, 370), testName, "is the same in either direction");
+    check(length_d == virtualManager.findArcLength(176001.0f, -0.98f, 110, 370), testName, "reuses the length of a near-identical regression");
+    check(length_d != virtualManager.findArcLength(150000.0f, -0.98f, 110, 370), testName, "integrates a different regression");
+    check(virtualManager.findArcLength(176000.0f, -0.98f, 200, 200) == 0.0, testName, "is zero between equal y-values");
+    check(virtualManager.findArcLength(0.0f, 0.0f, 110, 370) == 260.0, testName, "is the distance without a regression");
+}
+
+/*
+ * Whether two managers map every physical pixel, and a margin off the depth frame, to the same virtual coordinate
+ */
+static bool isSameMapping(VirtualManager *virtualManager, VirtualManager *otherVirtualManager) {
+    std::vector<int> physicalX;
+    std::vector<int> physicalY;
+    for (int y = -3; y < DEPTH_FRAME_HEIGHT + 3; y++) {
+        for (int x = -3; x < DEPTH_FRAME_WIDTH + 3; x++) {
+            physicalX.push_back(x);
+            physicalY.push_back(y);
+        }
+    }
+    int count = (int)physicalX.size();
+    std::vector<int> virtualX(count), virtualY(count), otherVirtualX(count), otherVirtualY(count);
+    virtualManager->mapPhysicalLocations(count, physicalX.data(), physicalY.data(), virtualX.data(), virtualY.data());
+    otherVirtualManager->mapPhysicalLocations(count, physicalX.data(), physicalY.data(), otherVirtualX.data(), otherVirtualY.data());
+    return virtualX == otherVirtualX && virtualY == otherVirtualY;
+}
+
+/*
+ * A profile restores the calibration points and the mapping exactly, and is refused for another grid or screen,
+ * or when it is damaged, leaving the calibration as it was
+ */
+static void testCalibrationProfile(int rows, int cols) {
+    std::string testName = std::to_string(rows) + "x" + std::to_string(cols) + " profile";
+    Calibration calibration(rows, cols, 1920, 1080, true);
+    VirtualManager virtualManager;
+    uint64_t calibrationHash = VirtualManager::hashCalibrationPoints(rows * cols, calibration.coordsPhysical, calibration.coordsVirtual);
+    check(virtualManager.writeCalibrationProfile(PROFILE_FILENAME, calibrationHash, calibration.coordsPhysical, calibration.coordsVirtual) < 0, testName, "is not written before calibrating");
+    virtualManager.setCalibrationPoints(rows, cols, calibration.coordsPhysical, calibration.coordsVirtual);
+    virtualManager.setScreenVirtual(1080, 1920);
+    check(virtualManager.writeCalibrationProfile(PROFILE_FILENAME, calibrationHash, calibration.coordsPhysical, calibration.coordsVirtual) == 0, testName, "is written");
+
+    Calibration restored(rows, cols, 0, 0);
+    VirtualManager restoredVirtualManager;
+    std::chrono::steady_clock::time_point readStart = std::chrono::steady_clock::now();
+    int readResult = restoredVirtualManager.readCalibrationProfile(PROFILE_FILENAME, rows, cols, 1080, 1920, calibrationHash, restored.coordsPhysical, restored.coordsVirtual);
+    double readMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - readStart).count();
+    std::cout << "VirtualManagerTest: " << testName << " read in " << readMilliseconds << " ms" << std::endl;
+    check(readResult == 0, testName, "is read");
+    bool isSamePoints = true;
+    for (int i = 0; i < rows * cols; i++) {
+        isSamePoints = isSamePoints && restored.coordsPhysical[i]->x == calibration.coordsPhysical[i]->x
+                                    && restored.coordsPhysical[i]->y == calibration.coordsPhysical[i]->y
+                                    && restored.coordsPhysical[i]->z == calibration.coordsPhysical[i]->z
+                                    && restored.coordsVirtual[i]->x == calibration.coordsVirtual[i]->x
+                                    && restored.coordsVirtual[i]->y == calibration.coordsVirtual[i]->y;
+    }
+    check(isSamePoints, testName, "restores the calibration points");
+    check(isSameMapping(&virtualManager, &restoredVirtualManager), testName, "restores the mapping");
+    checkParity(&restoredVirtualManager, 1920, 1080, testName, 0);
+
+    // Refused profiles leave the restored calibration in place
+    check(restoredVirtualManager.readCalibrationProfile(PROFILE_FILENAME, rows, cols, 1440, 2560, calibrationHash, NULL, NULL) < 0, testName, "is refused for another screen size");
+    check(restoredVirtualManager.readCalibrationProfile(PROFILE_FILENAME, rows + 1, cols, 1080, 1920, calibrationHash, NULL, NULL) < 0, testName, "is refused for another grid");
+    // An edited calibration is not the one the profile was built from
+    calibration.coordsPhysical[0]->x += 1;
+    uint64_t editedCalibrationHash = VirtualManager::hashCalibrationPoints(rows * cols, calibration.coordsPhysical, calibration.coordsVirtual);
+    calibration.coordsPhysical[0]->x -= 1;
+    check(restoredVirtualManager.readCalibrationProfile(PROFILE_FILENAME, rows, cols, 1080, 1920, editedCalibrationHash, NULL, NULL) < 0, testName, "is refused for edited calibration points");
+    check(restoredVirtualManager.readCalibrationProfile("/tmp/VirtualManagerTest.missing.vmprof", rows, cols, 1080, 1920, calibrationHash, NULL, NULL) < 0, testName, "is refused when missing");
+
+    // A profile written for a calibration file is used until the file changes, without reading it
+    std::ofstream(CALIBRATION_FILENAME, std::ios::trunc) << "calibration" << std::endl;
+    uint64_t calibrationFileHash = VirtualManager::hashCalibrationFile(CALIBRATION_FILENAME);
+    virtualManager.writeCalibrationProfile(PROFILE_FILENAME, calibrationFileHash, calibration.coordsPhysical, calibration.coordsVirtual);
+    check(restoredVirtualManager.readCalibrationProfile(PROFILE_FILENAME, rows, cols, 1080, 1920, VirtualManager::hashCalibrationFile(CALIBRATION_FILENAME), NULL, NULL) == 0,
+          testName, "is read for its unchanged calibration file");
+    std::ofstream(CALIBRATION_FILENAME, std::ios::app) << "edited" << std::endl;
+    check(restoredVirtualManager.readCalibrationProfile(PROFILE_FILENAME, rows, cols, 1080, 1920, VirtualManager::hashCalibrationFile(CALIBRATION_FILENAME), NULL, NULL) < 0,
+          testName, "is refused for an edited calibration file");
+    std::remove(CALIBRATION_FILENAME);
+    check(VirtualManager::hashCalibrationFile(CALIBRATION_FILENAME) == 0, testName, "has no hash for a missing calibration file");
+    virtualManager.writeCalibrationProfile(PROFILE_FILENAME, calibrationHash, calibration.coordsPhysical, calibration.coordsVirtual);
+
+    std::vector<char> profileBytes;
+    {
+        std::ifstream profileFile(PROFILE_FILENAME, std::ios::binary);
+        profileBytes.assign(std::istreambuf_iterator<char>(profileFile), std::istreambuf_iterator<char>());
+    }
+    std::vector<char> corruptBytes = profileBytes;
+    corruptBytes[corruptBytes.size() / 2] ^= 1;
+    std::ofstream(PROFILE_FILENAME, std::ios::binary | std::ios::trunc).write(corruptBytes.data(), corruptBytes.size());
+    check(restoredVirtualManager.readCalibrationProfile(PROFILE_FILENAME, rows, cols, 1080, 1920, calibrationHash, NULL, NULL) < 0, testName, "is refused when corrupt");
+    // The header is checksummed too, so its fields are not trusted when altered
+    corruptBytes = profileBytes;
+    corruptBytes[offsetof(CalibrationProfileHeader, areColumnsDescending)] ^= 1;
+    std::ofstream(PROFILE_FILENAME, std::ios::binary | std::ios::trunc).write(corruptBytes.data(), corruptBytes.size());
+    check(restoredVirtualManager.readCalibrationProfile(PROFILE_FILENAME, rows, cols, 1080, 1920, calibrationHash, NULL, NULL) < 0, testName, "is refused when its header is corrupt");
+    std::ofstream(PROFILE_FILENAME, std::ios::binary | std::ios::trunc).write(profileBytes.data(), profileBytes.size() - 4);
+    check(restoredVirtualManager.readCalibrationProfile(PROFILE_FILENAME, rows, cols, 1080, 1920, calibrationHash, NULL, NULL) < 0, testName, "is refused when truncated");
+    check(isSameMapping(&virtualManager, &restoredVirtualManager), testName, "keeps the mapping when refused");
+
+    // Calibrating again replaces the mapped table with a built one
+    restoredVirtualManager.setCalibrationPoints(rows, cols, calibration.coordsPhysical, calibration.coordsVirtual);
+    check(isSameMapping(&virtualManager, &restoredVirtualManager), testName, "is replaced by calibrating");
+    std::remove(PROFILE_FILENAME);
+}
+
+/*
+ * Intrinsics like a Kinect v2's depth camera, whose lens bends pixels by several pixels toward the corners
+ */
+static CameraIntrinsics kinectIntrinsics() {
+    CameraIntrinsics intrinsics;
+    intrinsics.fx = 365.5;
+    intrinsics.fy = 365.5;
+    intrinsics.cx = 254.9;
+    intrinsics.cy = 205.4;
+    intrinsics.k1 = 0.0905;
+    intrinsics.k2 = -0.2685;
+    intrinsics.k3 = 0.0950;
+    return intrinsics;
+}
+
+/*
+ * Moves each calibration point to the pixel it is detected at through the lens
+ */
+static void distortCalibration(Calibration *calibration, CameraIntrinsics intrinsics) {
+    for (int i = 0; i < calibration->rows * calibration->cols; i++) {
+        Coord3D *coord = calibration->coordsPhysical[i];
+        float pixelX, pixelY;
+        distortRay(intrinsics, (coord->x - intrinsics.cx) / intrinsics.fx, (coord->y - intrinsics.cy) / intrinsics.fy, &pixelX, &pixelY);
+        coord->x = (int)std::lround(pixelX);
+        coord->y = (int)std::lround(pixelY);
+    }
+}
+
+/*
+ * Largest difference between mapping each pixel as detected, and mapping where it would be without the lens's distortion
+ * through where the calibration points would be without it, where both are on the screen
+ * inputs: calibration is the points as detected through the lens
+ */
+static int largestDistortionDifference(VirtualManager *virtualManager, Calibration *calibration, CameraIntrinsics intrinsics) {
+    int rows = calibration->rows;
+    int cols = calibration->cols;
+    std::vector<double> idealX(rows * cols);
+    std::vector<double> idealY(rows * cols);
+    for (int i = 0; i < rows * cols; i++) {
+        float rayX, rayY;
+        undistortPixel(intrinsics, calibration->coordsPhysical[i]->x, calibration->coordsPhysical[i]->y, &rayX, &rayY);
+        idealX[i] = rayX * intrinsics.fx + intrinsics.cx;
+        idealY[i] = rayY * intrinsics.fy + intrinsics.cy;
+    }
+
+    Interaction interaction;
+    Coord3D physicalLocation;
+    Coord2D virtualLocation;
+    interaction.physicalLocation = &physicalLocation;
+    interaction.virtualLocation = &virtualLocation;
+    interaction.surfaceRegressionA = 176000;
+    interaction.surfaceRegressionB = -0.98;
+
+    int largestDifference = 0;
+    for (int y = 110; y <= 370; y += 4) {
+        for (int x = 70; x <= DEPTH_FRAME_WIDTH - 70; x += 4) {
+            physicalLocation.x = x;
+            physicalLocation.y = y;
+            virtualManager->setVirtualCoord(&interaction);
+            float rayX, rayY;
+            undistortPixel(intrinsics, x, y, &rayX, &rayY);
+            Coord2D idealLocation;
+            referenceVirtualCoord(rows, cols, idealX, idealY, calibration->coordsVirtual, 1920, 1080,
+                                  rayX * intrinsics.fx + intrinsics.cx, rayY * intrinsics.fy + intrinsics.cy, &idealLocation);
+            // too far off the screen is an error value rather than a coordinate
+            if (virtualLocation.x < 0 || virtualLocation.y < 0 || idealLocation.x < 0 || idealLocation.y < 0) {
+                continue;
+            }
+            largestDifference = std::max(largestDifference, std::max(std::abs(virtualLocation.x - idealLocation.x), std::abs(virtualLocation.y - idealLocation.y)));
+        }
+    }
+    return largestDifference;
+}
+
+/*
+ * With the camera's intrinsics, calibration points and interactions are undistorted before they are mapped,
+ * so they map as they would through a lens without distortion
+ */
+static void testUndistortion(int rows, int cols) {
+    std::string testName = std::to_string(rows) + "x" + std::to_string(cols) + " undistorted";
+    CameraIntrinsics intrinsics = kinectIntrinsics();
+    Calibration calibration(rows, cols, 1920, 1080, true);
+    distortCalibration(&calibration, intrinsics);
+    VirtualManager distortedVirtualManager;
+    distortedVirtualManager.setCalibrationPoints(rows, cols, calibration.coordsPhysical, calibration.coordsVirtual);
+    distortedVirtualManager.setScreenVirtual(1080, 1920);
+    VirtualManager virtualManager;
+    check(virtualManager.setCameraIntrinsics(intrinsics) == 0, testName, "has nothing to rebuild before calibrating");
+    virtualManager.setCalibrationPoints(rows, cols, calibration.coordsPhysical, calibration.coordsVirtual);
+    virtualManager.setScreenVirtual(1080, 1920);
+
+    int undistortedDifference = largestDistortionDifference(&virtualManager, &calibration, intrinsics);
+    int distortedDifference = largestDistortionDifference(&distortedVirtualManager, &calibration, intrinsics);
+    std::cout << "VirtualManagerTest: " << testName << " mapping off by at most " << undistortedDifference << " px, and "
+              << distortedDifference << " px without intrinsics" << std::endl;
+    check(undistortedDifference <= UNDISTORTED_TOLERANCE_PIXELS, testName, "maps as without distortion (" + std::to_string(undistortedDifference) + " px off)");
+    check(undistortedDifference < distortedDifference, testName, "maps closer than without intrinsics");
+    checkParity(&virtualManager, 1920, 1080, testName, INTERPOLATION_TOLERANCE_PIXELS);
+    checkSubPixel(&virtualManager, testName);
+    checkBatch(&virtualManager, testName);
+
+    // Setting intrinsics after calibrating rebuilds the mapping, and taking them away maps pixels as they are
+    VirtualManager lateVirtualManager;
+    lateVirtualManager.setCalibrationPoints(rows, cols, calibration.coordsPhysical, calibration.coordsVirtual);
+    lateVirtualManager.setScreenVirtual(1080, 1920);
+    check(lateVirtualManager.setCameraIntrinsics(intrinsics) == 1, testName, "rebuilds the mapping");
+    check(isSameMapping(&virtualManager, &lateVirtualManager), testName, "maps as if set before calibrating");
+    check(lateVirtualManager.setCameraIntrinsics(intrinsics) == 0, testName, "keeps the mapping for the same intrinsics");
+
+    // Profiles are for the intrinsics they were undistorted with
+    uint64_t calibrationHash = VirtualManager::hashCalibrationPoints(rows * cols, calibration.coordsPhysical, calibration.coordsVirtual);
+    check(virtualManager.writeCalibrationProfile(PROFILE_FILENAME, calibrationHash, calibration.coordsPhysical, calibration.coordsVirtual) == 0, testName, "writes a profile");
+    VirtualManager restoredVirtualManager;
+    check(restoredVirtualManager.readCalibrationProfile(PROFILE_FILENAME, rows, cols, 1080, 1920, calibrationHash, NULL, NULL) < 0, testName, "refuses a profile without intrinsics");
+    restoredVirtualManager.setCameraIntrinsics(intrinsics);
+    check(restoredVirtualManager.readCalibrationProfile(PROFILE_FILENAME, rows, cols, 1080, 1920, calibrationHash, NULL, NULL) == 0, testName, "reads a profile with intrinsics");
+    check(isSameMapping(&virtualManager, &restoredVirtualManager), testName, "restores the mapping");
+    check(restoredVirtualManager.setCameraIntrinsics(CameraIntrinsics()) == 1, testName, "rebuilds a restored mapping");
+    check(isSameMapping(&distortedVirtualManager, &restoredVirtualManager), testName, "maps pixels as they are without intrinsics");
+    std::remove(PROFILE_FILENAME);
+}
+
+static void testCalibration(int rows, int cols) {
+    std::string testName = std::to_string(rows) + "x" + std::to_string(cols);
+    Calibration calibration(rows, cols, 1920, 1080);
+    VirtualManager virtualManager;
+
+    std::chrono::steady_clock::time_point buildStart = std::chrono::steady_clock::now();
+    virtualManager.setCalibrationPoints(rows, cols, calibration.coordsPhysical, calibration.coordsVirtual);
+    double buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+    std::cout << "VirtualManagerTest: " << testName << " mapping table built in " << buildMilliseconds << " ms" << std::endl;
+
+    virtualManager.setScreenVirtual(1080, 1920);
+    checkParity(&virtualManager, 1920, 1080, testName, 0);
+    checkSubPixel(&virtualManager, testName);
+    checkBatch(&virtualManager, testName);
+
+    // Only the screen size changes, so the table is reused
+    virtualManager.setScreenVirtual(1440, 2560);
+    checkParity(&virtualManager, 2560, 1440, testName + " resized", 0);
+    virtualManager.setScreenVirtual(900, 1600);
+    checkParity(&virtualManager, 1600, 900, testName + " shrunk", 0);
+    checkBatch(&virtualManager, testName + " shrunk");
+
+    // Calibrating again replaces the table
+    Calibration recalibration(rows, cols, 1600, 900);
+    virtualManager.setCalibrationPoints(rows, cols, recalibration.coordsPhysical, recalibration.coordsVirtual);
+    checkParity(&virtualManager, 1600, 900, testName + " recalibrated", 0);
+}
+
+int main(int argc, char **argv) {
+    testCalibration(3, 3);
+    testCalibration(4, 5);
+    testCalibration(2, 2);
+    testCalibration(8, 8);
+    testLinearSearchParity(3, 3);
+    testLinearSearchParity(8, 8);
+    testLinearSearchParity(5, 12);
+    testArcLength();
+    testCalibrationProfile(3, 3);
+    testCalibrationProfile(8, 8);
+    testUndistortion(3, 3);
+    testUndistortion(8, 8);
+
+    std::cout << "VirtualManagerTest: " << (checkCount - failureCount) << "/" << checkCount << " checks passed" << std::endl;
+    return (failureCount == 0) ? 0 : 1;
+}
@@ -0,0 +1,329 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    BatchAnalyzer.cpp
+    Detects interactions across recorded sessions in parallel and writes an interaction timeline.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FrameCorpus.h"
+#include "InteractionHandler.h"
+#include "PhysicalManager.h"
+#include "ThreadPool.h"
+
+#define CHUNK_SIZE_DEFAULT 64
+#define TIMELINE_FILENAME_DEFAULT "timeline.csv"
+
+using namespace virtualMonitor;
+
+struct AnalyzerOptions {
+    std::string corpusPath;
+    std::string timelineFilename;
+    int chunkSize;
+    int threadCount;
+};
+
+struct FrameResult {
+    bool isRead;
+    bool isDetected;
+    Coord3D location;
+    uint32_t sequence;
+    uint32_t timestamp;
+    double detectMicroseconds;
+    std::string event;
+};
+
+// A run of consecutive frames from one source, processed as a single task
+struct FrameChunk {
+    int sourceIndex;
+    int firstIndex;
+    int endIndex;
+};
+
+/*
+ * Replays detection results through the interaction hysteresis, labelling the frames where interactions start and stop
+ */
+class TimelineInteractionHandler : public InteractionHandler {
+    private:
+        std::vector<FrameResult> *results;
+        int currentIndex;
+
+    public:
+        TimelineInteractionHandler(std::vector<FrameResult> *results) {
+            this->results = results;
+            this->currentIndex = -1;
+        }
+
+        virtual void setCurrentIndex(int index) { this->currentIndex = index; }
+
+    private:
+        virtual int handleInteractionStartEvent() {
+            (*this->results)[this->currentIndex].event = "START";
+            return 0;
+        }
+
+        virtual int handleInteractionEndEvent() {
+            (*this->results)[this->currentIndex].event = "STOP";
+            return 0;
+        }
+};
+
+static void freeInteraction(Interaction *interaction) {
+    delete interaction->physicalLocation;
+    delete interaction->virtualLocation;
+    delete interaction;
+}
+
+/*
+ * Detects interactions on one chunk, on the calling worker's own PhysicalManager
+ * The worker copies the chunk's reference state only when its previous chunk came from another source
+ */
+static void analyzeChunk(ThreadPool *pool, FrameCorpus *corpus, FrameChunk chunk, std::vector<PhysicalManager *> *referenceManagers,
+                         std::vector<PhysicalManager *> *workerManagers, std::vector<int> *workerSourceIndices,
+                         std::vector<FrameResult> *results) {
+    int workerIndex = pool->currentWorkerIndex();
+    PhysicalManager *physicalManager = (*workerManagers)[workerIndex];
+    if ((*workerSourceIndices)[workerIndex] != chunk.sourceIndex) {
+        physicalManager->copyReferenceFrom((*referenceManagers)[chunk.sourceIndex]);
+        (*workerSourceIndices)[workerIndex] = chunk.sourceIndex;
+    }
+
+    for (int index = chunk.firstIndex; index < chunk.endIndex; index++) {
+        FrameResult &result = (*results)[index];
+        DepthBuffer *depthBuffer = corpus->readFrame(index);
+        if (depthBuffer == NULL) {
+            continue;
+        }
+        DepthView *depthFrame = depthBuffer->getView();
+        result.isRead = true;
+        result.sequence = depthFrame->sequence;
+        result.timestamp = depthFrame->timestamp;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Interaction *interaction = physicalManager->detectInteraction(depthFrame);
+        result.detectMicroseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+        if (interaction != NULL) {
+            result.isDetected = true;
+            result.location = *interaction->physicalLocation;
+            freeInteraction(interaction);
+        }
+        depthBuffer->release();
+    }
+}
+
+/*
+ * Labels interaction events source by source, in recorded order
+ * Without calibration data the physical location stands in for the virtual location
+ */
+static void buildTimeline(FrameCorpus *corpus, std::vector<FrameResult> *results) {
+    TimelineInteractionHandler *handler = NULL;
+    int handlerSourceIndex = -1;
+    for (int index = 0; index < corpus->getFrameCount(); index++) {
+        int sourceIndex = corpus->getFrame(index).sourceIndex;
+        if (sourceIndex != handlerSourceIndex) {
+            delete handler;
+            handler = new TimelineInteractionHandler(results);
+            handlerSourceIndex = sourceIndex;
+        }
+
+        FrameResult &result = (*results)[index];
+        if (!result.isRead) {
+            continue;
+        }
+        handler->setCurrentIndex(index);
+        if (!result.isDetected) {
+            handler->handleInteraction(NULL);
+            continue;
+        }
+        Coord3D physicalLocation = result.location;
+        Coord2D virtualLocation;
+        virtualLocation.x = physicalLocation.x;
+        virtualLocation.y = physicalLocation.y;
+        Interaction interaction;
+        interaction.type = InteractionType::Tap;
+        interaction.time = result.timestamp;
+        interaction.physicalLocation = &physicalLocation;
+        interaction.virtualLocation = &virtualLocation;
+        handler->handleInteraction(&interaction);
+    }
+    delete handler;
+}
+
+static int writeTimelineToFile(FrameCorpus *corpus, std::vector<FrameResult> &results, std::string timelineFilename) {
+    std::ofstream timelineFile(timelineFilename);
+    if (!timelineFile.is_open()) {
+        std::cout << "BatchAnalyzer: Could not write " << timelineFilename << "." << std::endl;
+        return -1;
+    }
+
+    timelineFile << "id,source,frame,sequence,timestamp,detected,x,y,z,detect_us,event\n";
+    for (int index = 0; index < corpus->getFrameCount(); index++) {
+        CorpusFrame &frame = corpus->getFrame(index);
+        FrameResult &result = results[index];
+        if (!result.isRead) {
+            continue;
+        }
+        timelineFile << frame.id << "," << corpus->getSource(frame.sourceIndex).name << "," << frame.frameIndex << ","
+                     << result.sequence << "," << result.timestamp << "," << (result.isDetected ? 1 : 0) << ",";
+        if (result.isDetected) {
+            timelineFile << result.location.x << "," << result.location.y << "," << result.location.z;
+        } else {
+            timelineFile << ",,";
+        }
+        timelineFile << "," << result.detectMicroseconds << "," << result.event << "\n";
+    }
+
+    timelineFile.close();
+    return 0;
+}
+
+static void printUsage(const char *program) {
+    std::cout << "Usage: " << program << " CORPUS [options]" << std::endl
+              << "  CORPUS is a recording, or a directory of recordings and .bin frames with surface.bin as reference" << std::endl
+              << "  --output FILE     timeline CSV (default timeline.csv)" << std::endl
+              << "  --chunk N         frames per task (default 64)" << std::endl
+              << "  --threads N       worker threads (default all cores)" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argv[1][0] == '-') {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    AnalyzerOptions options;
+    options.corpusPath = argv[1];
+    options.timelineFilename = TIMELINE_FILENAME_DEFAULT;
+    options.chunkSize = CHUNK_SIZE_DEFAULT;
+    options.threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int i = 2; i < argc; i++) {
+        std::string option = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (option == "--output" && hasValue) {
+            options.timelineFilename = argv[++i];
+        } else if (option == "--chunk" && hasValue) {
+            options.chunkSize = std::max(1, std::atoi(argv[++i]));
+        } else if (option == "--threads" && hasValue) {
+            options.threadCount = std::max(1, std::atoi(argv[++i]));
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    FrameCorpus corpus;
+    if (corpus.load(options.corpusPath) < 0) {
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ThreadPool pool(options.threadCount);
+
+    // Fit each source's surface once, in parallel, so chunks only copy the reference state
+    std::vector<PhysicalManager *> referenceManagers;
+    for (int sourceIndex = 0; sourceIndex < corpus.getSourceCount(); sourceIndex++) {
+        PhysicalManager *referenceManager = new PhysicalManager();
+        referenceManagers.push_back(referenceManager);
+        DepthView *referenceFrame = corpus.getReferenceFrame(sourceIndex);
+        pool.submit([referenceManager, referenceFrame]() { referenceManager->setReferenceFrame(referenceFrame); });
+    }
+    pool.wait();
+    double referenceSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Split each source into chunks, which never span two sources
+    std::vector<FrameChunk> chunks;
+    for (int index = 0; index < corpus.getFrameCount(); index++) {
+        int sourceIndex = corpus.getFrame(index).sourceIndex;
+        if (chunks.empty() || chunks.back().sourceIndex != sourceIndex ||
+            chunks.back().endIndex - chunks.back().firstIndex >= options.chunkSize) {
+            FrameChunk chunk;
+            chunk.sourceIndex = sourceIndex;
+            chunk.firstIndex = index;
+            chunk.endIndex = index;
+            chunks.push_back(chunk);
+        }
+        chunks.back().endIndex = index + 1;
+    }
+
+    std::vector<PhysicalManager *> workerManagers;
+    for (int i = 0; i < pool.getThreadCount(); i++) {
+        workerManagers.push_back(new PhysicalManager());
+    }
+    std::vector<int> workerSourceIndices(pool.getThreadCount(), -1);
+
+    FrameResult emptyResult;
+    emptyResult.isRead = false;
+    emptyResult.isDetected = false;
+    emptyResult.sequence = 0;
+    emptyResult.timestamp = 0;
+    emptyResult.detectMicroseconds = 0;
+    std::vector<FrameResult> results(corpus.getFrameCount(), emptyResult);
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        FrameChunk chunk = chunks[i];
+        pool.submit([&pool, &corpus, chunk, &referenceManagers, &workerManagers, &workerSourceIndices, &results]() {
+            analyzeChunk(&pool, &corpus, chunk, &referenceManagers, &workerManagers, &workerSourceIndices, &results);
+        });
+    }
+    pool.wait();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    buildTimeline(&corpus, &results);
+    if (writeTimelineToFile(&corpus, results, options.timelineFilename) < 0) {
+        return 1;
+    }
+
+    int frameCount = 0;
+    int detectedCount = 0;
+    int interactionCount = 0;
+    double detectSeconds = 0;
+    for (size_t index = 0; index < results.size(); index++) {
+        if (!results[index].isRead) {
+            continue;
+        }
+        frameCount++;
+        detectedCount += results[index].isDetected ? 1 : 0;
+        interactionCount += (results[index].event == "START") ? 1 : 0;
+        detectSeconds += results[index].detectMicroseconds / 1000000.0;
+    }
+
+    std::cout << "BatchAnalyzer: " << frameCount << " frames from " << corpus.getSourceCount() << " sources in "
+              << chunks.size() << " chunks, " << detectedCount << " detections, " << interactionCount << " interactions" << std::endl
+              << "BatchAnalyzer: " << seconds << " s wall (" << referenceSeconds << " s references), "
+              << (frameCount / seconds) << " frames/s, " << detectSeconds << " s detection, "
+              << (detectSeconds / (seconds - referenceSeconds)) << "x speedup on " << pool.getThreadCount() << " threads" << std::endl
+              << "BatchAnalyzer: Wrote timeline to " << options.timelineFilename << std::endl;
+
+    for (size_t i = 0; i < workerManagers.size(); i++) {
+        delete workerManagers[i];
+    }
+    for (size_t i = 0; i < referenceManagers.size(); i++) {
+        delete referenceManagers[i];
+    }
+    return 0;
+}
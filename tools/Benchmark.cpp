@@ -0,0 +1,455 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    Benchmark.cpp
+    Times each stage of the detection pipeline without a Kinect or display.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "LatencyStats.h"
+#include "PhysicalManager.h"
+#include "VirtualManager.h"
+
+#define INPUTS_DIR "inputs"
+#define REFERENCE_FRAME_FILENAME "surface.bin"
+
+#define ITERATIONS_MIN 3
+#define ITERATIONS_MAX 1000
+#define SECONDS_MIN 1.0
+
+#define CALIBRATION_ROWS 3
+#define CALIBRATION_COLS 3
+// Square calibration grids timed for cell search, up to dense grids for large curved surfaces
+#define CALIBRATION_GRID_SIZES {2, 3, 5, 8, 16, 32}
+// Locations mapped per iteration when comparing grids, so each iteration is well above the clock's resolution
+#define MAPPING_BATCH_SIZE 1000
+#define SCREEN_WIDTH 1920
+#define SCREEN_HEIGHT 1080
+
+// Focal length of a Kinect v2's depth camera (pixels), for fitting the fixtures' surface as a plane
+#define KINECT_FOCAL_LENGTH 365.5
+
+using namespace virtualMonitor;
+
+struct BenchmarkResult {
+    std::string name;
+    int iterations;
+    double minMicroseconds;
+    double medianMicroseconds;
+    double p99Microseconds;
+    double meanMicroseconds;
+};
+
+struct BenchmarkOptions {
+    std::string inputsDir;
+    std::string outputDir;
+    std::string filter;
+    std::string format;
+    int iterationsMin;
+    int iterationsMax;
+    double secondsMin;
+};
+
+/*
+ * Runs fn until it has run at least iterationsMin times and secondsMin have passed (or iterationsMax is reached)
+ */
+static bool runBenchmark(BenchmarkOptions &options, std::string name, std::function<void()> fn, std::vector<BenchmarkResult> &results) {
+    if (options.filter.length() > 0 && name.find(options.filter) == std::string::npos) {
+        return false;
+    }
+
+    std::vector<double> samples;
+    double totalMicroseconds = 0;
+    while ((int)samples.size() < options.iterationsMax &&
+           ((int)samples.size() < options.iterationsMin || totalMicroseconds < options.secondsMin * 1e6)) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        double microseconds = std::chrono::duration<double, std::micro>(end - start).count();
+        samples.push_back(microseconds);
+        totalMicroseconds += microseconds;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    int n = samples.size();
+    BenchmarkResult result;
+    result.name = name;
+    result.iterations = n;
+    result.minMicroseconds = samples[0];
+    result.medianMicroseconds = samples[n / 2];
+    result.p99Microseconds = samples[std::min(n - 1, (int)std::ceil(0.99 * n) - 1)];
+    result.meanMicroseconds = totalMicroseconds / n;
+    results.push_back(result);
+
+    // Progress goes to stderr so stdout stays machine-readable
+    std::cerr << "Benchmark: " << name << " (" << n << " iterations)" << std::endl;
+    return true;
+}
+
+static void writeResultsCSV(std::vector<BenchmarkResult> &results) {
+    std::cout << "name,iterations,min_us,median_us,p99_us,mean_us" << std::endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        BenchmarkResult &result = results[i];
+        std::cout << result.name << "," << result.iterations << "," << result.minMicroseconds << ","
+                  << result.medianMicroseconds << "," << result.p99Microseconds << "," << result.meanMicroseconds << std::endl;
+    }
+}
+
+static void writeResultsJSON(std::vector<BenchmarkResult> &results) {
+    std::cout << "{\"benchmarks\": [" << std::endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        BenchmarkResult &result = results[i];
+        std::cout << "  {\"name\": \"" << result.name << "\", \"iterations\": " << result.iterations
+                  << ", \"min_us\": " << result.minMicroseconds << ", \"median_us\": " << result.medianMicroseconds
+                  << ", \"p99_us\": " << result.p99Microseconds << ", \"mean_us\": " << result.meanMicroseconds << "}"
+                  << ((i + 1 < results.size()) ? "," : "") << std::endl;
+    }
+    std::cout << "]}" << std::endl;
+}
+
+static std::vector<std::string> listFrameFiles(std::string dir) {
+    std::vector<std::string> filenames;
+    DIR *dirHandle = opendir(dir.c_str());
+    if (dirHandle == NULL) {
+        return filenames;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dirHandle)) != NULL) {
+        std::string filename = entry->d_name;
+        if (filename.length() > 4 && filename.compare(filename.length() - 4, 4, ".bin") == 0) {
+            filenames.push_back(filename);
+        }
+    }
+    closedir(dirHandle);
+    std::sort(filenames.begin(), filenames.end());
+    return filenames;
+}
+
+static void freeInteraction(Interaction *interaction) {
+    if (interaction != NULL) {
+        delete interaction->physicalLocation;
+        delete interaction->virtualLocation;
+        delete interaction;
+    }
+}
+
+/*
+ * A rows x cols calibration resembling one captured with the inputs/ fixtures, corners at the screen edges
+ * (rows from y = 110 to 370, inset 90 to 50 pixels from the sides)
+ */
+static void createCalibration(int rows, int cols, Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual) {
+    for (int row = 0; row < rows; row++) {
+        int physicalY = 110 + (row * 260) / (rows - 1);
+        int physicalXInset = 90 - (row * 40) / (rows - 1);
+        for (int col = 0; col < cols; col++) {
+            int index = row * cols + col;
+            int xLeft = physicalXInset;
+            int xRight = 512 - physicalXInset;
+            calibrationCoordsPhysical[index] = new Coord3D();
+            calibrationCoordsPhysical[index]->x = xLeft + (col * (xRight - xLeft)) / (cols - 1);
+            calibrationCoordsPhysical[index]->y = physicalY;
+            calibrationCoordsPhysical[index]->z = 176000 * std::pow(physicalY, -0.98);
+            calibrationCoordsVirtual[index] = new Coord2D();
+            calibrationCoordsVirtual[index]->x = (col * SCREEN_WIDTH) / (cols - 1);
+            calibrationCoordsVirtual[index]->y = (row * SCREEN_HEIGHT) / (rows - 1);
+        }
+    }
+}
+
+static void deleteCalibration(int rows, int cols, Coord3D **calibrationCoordsPhysical, Coord2D **calibrationCoordsVirtual) {
+    for (int i = 0; i < rows * cols; i++) {
+        delete calibrationCoordsPhysical[i];
+        delete calibrationCoordsVirtual[i];
+    }
+}
+
+static void printUsage(const char *program) {
+    std::cout << "Usage: " << program << " [options]" << std::endl
+              << "  --inputs DIR      directory of .bin depth frames, with surface.bin as reference (default inputs)" << std::endl
+              << "  --output DIR      directory for PPM output (default /tmp)" << std::endl
+              << "  --filter TEXT     only run benchmarks whose name contains TEXT" << std::endl
+              << "  --format FORMAT   csv or json (default csv)" << std::endl
+              << "  --min-iterations N, --max-iterations N, --min-time SECONDS" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    BenchmarkOptions options;
+    options.inputsDir = INPUTS_DIR;
+    options.outputDir = "/tmp";
+    options.format = "csv";
+    options.iterationsMin = ITERATIONS_MIN;
+    options.iterationsMax = ITERATIONS_MAX;
+    options.secondsMin = SECONDS_MIN;
+
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (option == "--inputs" && hasValue) {
+            options.inputsDir = argv[++i];
+        } else if (option == "--output" && hasValue) {
+            options.outputDir = argv[++i];
+        } else if (option == "--filter" && hasValue) {
+            options.filter = argv[++i];
+        } else if (option == "--format" && hasValue) {
+            options.format = argv[++i];
+        } else if (option == "--min-iterations" && hasValue) {
+            options.iterationsMin = std::max(1, std::atoi(argv[++i]));
+        } else if (option == "--max-iterations" && hasValue) {
+            options.iterationsMax = std::max(1, std::atoi(argv[++i]));
+        } else if (option == "--min-time" && hasValue) {
+            options.secondsMin = std::atof(argv[++i]);
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    options.iterationsMax = std::max(options.iterationsMin, options.iterationsMax);
+
+    std::vector<BenchmarkResult> results;
+    PhysicalManager physicalManager;
+
+    std::string referenceFrameFilename = options.inputsDir + "/" + REFERENCE_FRAME_FILENAME;
+    DepthBuffer *referenceBuffer = physicalManager.readDepthFrameFromFile(referenceFrameFilename);
+    if (referenceBuffer == NULL) {
+        std::cout << "Benchmark: Could not read " << referenceFrameFilename << std::endl;
+        return 1;
+    }
+    DepthView *referenceFrame = referenceBuffer->getView();
+
+    /*** Frame loading ***/
+    runBenchmark(options, "readDepthFrameFromFile", [&]() {
+        physicalManager.readDepthFrameFromFile(referenceFrameFilename)->release();
+    }, results);
+
+    /*** Reference (surface regression and bounds) ***/
+    runBenchmark(options, "setReferenceFrame", [&]() {
+        physicalManager.setReferenceFrame(referenceFrame);
+    }, results);
+    physicalManager.setReferenceFrame(referenceFrame);
+
+    // Fits the surface as a plane through each pixel's ray, as detection does with the camera's intrinsics
+    CameraIntrinsics cameraIntrinsics;
+    cameraIntrinsics.fx = KINECT_FOCAL_LENGTH;
+    cameraIntrinsics.fy = KINECT_FOCAL_LENGTH;
+    cameraIntrinsics.cx = referenceFrame->width / 2.0f;
+    cameraIntrinsics.cy = referenceFrame->height / 2.0f;
+    PhysicalManager planePhysicalManager;
+    planePhysicalManager.setCameraIntrinsics(cameraIntrinsics);
+    runBenchmark(options, "setReferenceFrame/plane", [&]() {
+        planePhysicalManager.setReferenceFrame(referenceFrame);
+    }, results);
+
+    // Reuses the surface saved from the same reference, as a warm start of detection does
+    std::string surfaceModelFilename = options.outputDir + "/benchmark.vmsurf";
+    physicalManager.writeSurfaceModel(surfaceModelFilename);
+    PhysicalManager warmPhysicalManager;
+    runBenchmark(options, "setReferenceFrameFromSurfaceModel", [&]() {
+        warmPhysicalManager.setReferenceFrameFromSurfaceModel(referenceFrame, surfaceModelFilename);
+    }, results);
+    unlink(surfaceModelFilename.c_str());
+
+    /*** Detection on each fixture ***/
+    std::vector<std::string> frameFilenames = listFrameFiles(options.inputsDir);
+    for (size_t i = 0; i < frameFilenames.size(); i++) {
+        DepthBuffer *depthBuffer = physicalManager.readDepthFrameFromFile(options.inputsDir + "/" + frameFilenames[i]);
+        if (depthBuffer == NULL) {
+            continue;
+        }
+        DepthView *depthFrame = depthBuffer->getView();
+        runBenchmark(options, "detectInteraction/" + frameFilenames[i], [&]() {
+            freeInteraction(physicalManager.detectInteraction(depthFrame));
+        }, results);
+        depthBuffer->release();
+    }
+
+    // Follows the surface on a frame without an interaction, as detection does after each one, on its own copy of the surface
+    DepthBuffer *quietBuffer = physicalManager.readDepthFrameFromFile(options.inputsDir + "/nointeraction1.bin");
+    if (quietBuffer != NULL) {
+        PhysicalManager driftPhysicalManager;
+        driftPhysicalManager.copyReferenceFrom(&physicalManager);
+        runBenchmark(options, "compensateDrift", [&]() {
+            driftPhysicalManager.compensateDrift(quietBuffer->getView());
+        }, results);
+        quietBuffer->release();
+    }
+
+    /*** PPM writers ***/
+    std::string ppmFilename = options.outputDir + "/virtualmonitor-bench.ppm";
+    runBenchmark(options, "writeDepthFrameToPPM", [&]() {
+        physicalManager.writeDepthFrameToPPM(referenceFrame, ppmFilename);
+    }, results);
+    runBenchmark(options, "writeDepthFrameToSurfaceDepthPPM", [&]() {
+        physicalManager.writeDepthFrameToSurfaceDepthPPM(referenceFrame, ppmFilename);
+    }, results);
+    runBenchmark(options, "writeDepthFrameToSurfaceSlopePPM", [&]() {
+        physicalManager.writeDepthFrameToSurfaceSlopePPM(referenceFrame, ppmFilename);
+    }, results);
+    unlink(ppmFilename.c_str());
+
+    /*** Virtual coordinate mapping ***/
+    Coord3D *calibrationCoordsPhysical[CALIBRATION_ROWS * CALIBRATION_COLS];
+    Coord2D *calibrationCoordsVirtual[CALIBRATION_ROWS * CALIBRATION_COLS];
+    createCalibration(CALIBRATION_ROWS, CALIBRATION_COLS, calibrationCoordsPhysical, calibrationCoordsVirtual);
+    VirtualManager virtualManager;
+    // Builds the mapping table
+    runBenchmark(options, "setCalibrationPoints", [&]() {
+        virtualManager.setCalibrationPoints(CALIBRATION_ROWS, CALIBRATION_COLS, calibrationCoordsPhysical, calibrationCoordsVirtual);
+    }, results);
+    virtualManager.setCalibrationPoints(CALIBRATION_ROWS, CALIBRATION_COLS, calibrationCoordsPhysical, calibrationCoordsVirtual);
+    virtualManager.setScreenVirtual(SCREEN_HEIGHT, SCREEN_WIDTH);
+
+    // Restores the mapping table from a profile instead of building it
+    std::string profileFilename = options.outputDir + "/benchmark.vmprof";
+    uint64_t calibrationHash = VirtualManager::hashCalibrationPoints(CALIBRATION_ROWS * CALIBRATION_COLS, calibrationCoordsPhysical, calibrationCoordsVirtual);
+    virtualManager.writeCalibrationProfile(profileFilename, calibrationHash, calibrationCoordsPhysical, calibrationCoordsVirtual);
+    VirtualManager profileVirtualManager;
+    runBenchmark(options, "readCalibrationProfile", [&]() {
+        profileVirtualManager.readCalibrationProfile(profileFilename, CALIBRATION_ROWS, CALIBRATION_COLS, SCREEN_HEIGHT, SCREEN_WIDTH, calibrationHash, NULL, NULL);
+    }, results);
+    unlink(profileFilename.c_str());
+
+    Interaction interaction;
+    Coord3D physicalLocation;
+    Coord2D virtualLocation;
+    interaction.type = InteractionType::Tap;
+    interaction.time = 0;
+    interaction.physicalLocation = &physicalLocation;
+    interaction.virtualLocation = &virtualLocation;
+    interaction.surfaceRegressionA = 176000;
+    interaction.surfaceRegressionB = -0.98;
+
+    // Sweep interactions across the calibrated area, with the regression unchanged
+    int mappingIndex = 0;
+    runBenchmark(options, "setVirtualCoord", [&]() {
+        physicalLocation.x = 60 + (mappingIndex * 37) % 390;
+        physicalLocation.y = 115 + (mappingIndex * 53) % 250;
+        mappingIndex++;
+        virtualManager.setVirtualCoord(&interaction);
+    }, results);
+
+    // The same sweep computed from the calibration cells rather than read from the mapping table
+    mappingIndex = 0;
+    runBenchmark(options, "setVirtualCoordFromCalibration", [&]() {
+        physicalLocation.x = 60 + (mappingIndex * 37) % 390;
+        physicalLocation.y = 115 + (mappingIndex * 53) % 250;
+        mappingIndex++;
+        virtualManager.setVirtualCoordFromCalibration(&interaction);
+    }, results);
+
+    // The same sweep undistorted through the camera's intrinsics, one lookup and interpolation per interaction
+    VirtualManager undistortedVirtualManager;
+    undistortedVirtualManager.setCameraIntrinsics(cameraIntrinsics);
+    undistortedVirtualManager.setCalibrationPoints(CALIBRATION_ROWS, CALIBRATION_COLS, calibrationCoordsPhysical, calibrationCoordsVirtual);
+    undistortedVirtualManager.setScreenVirtual(SCREEN_HEIGHT, SCREEN_WIDTH);
+    mappingIndex = 0;
+    runBenchmark(options, "setVirtualCoord/undistorted", [&]() {
+        physicalLocation.x = 60 + (mappingIndex * 37) % 390;
+        physicalLocation.y = 115 + (mappingIndex * 53) % 250;
+        mappingIndex++;
+        undistortedVirtualManager.setVirtualCoord(&interaction);
+    }, results);
+
+    // Alternate the regression so every call recomputes the screen arc length
+    runBenchmark(options, "setVirtualCoord/newRegression", [&]() {
+        interaction.surfaceRegressionA = (interaction.surfaceRegressionA == 176000) ? 176001 : 176000;
+        virtualManager.setVirtualCoord(&interaction);
+    }, results);
+
+    // Many contacts at once, from contiguous arrays, against the same locations one at a time
+    std::vector<int> batchPhysicalX(MAPPING_BATCH_SIZE);
+    std::vector<int> batchPhysicalY(MAPPING_BATCH_SIZE);
+    std::vector<int> batchVirtualX(MAPPING_BATCH_SIZE);
+    std::vector<int> batchVirtualY(MAPPING_BATCH_SIZE);
+    for (int i = 0; i < MAPPING_BATCH_SIZE; i++) {
+        batchPhysicalX[i] = 60 + (i * 37) % 390;
+        batchPhysicalY[i] = 115 + (i * 53) % 250;
+    }
+    runBenchmark(options, "setVirtualCoord/x" + std::to_string(MAPPING_BATCH_SIZE), [&]() {
+        for (int i = 0; i < MAPPING_BATCH_SIZE; i++) {
+            physicalLocation.x = batchPhysicalX[i];
+            physicalLocation.y = batchPhysicalY[i];
+            virtualManager.setVirtualCoord(&interaction);
+            batchVirtualX[i] = virtualLocation.x;
+            batchVirtualY[i] = virtualLocation.y;
+        }
+    }, results);
+    runBenchmark(options, "mapPhysicalLocations/x" + std::to_string(MAPPING_BATCH_SIZE), [&]() {
+        virtualManager.mapPhysicalLocations(MAPPING_BATCH_SIZE, batchPhysicalX.data(), batchPhysicalY.data(), batchVirtualX.data(), batchVirtualY.data());
+    }, results);
+
+    // Cell search on denser grids, which should grow with the log of the grid's rows and cols
+    int gridSizes[] = CALIBRATION_GRID_SIZES;
+    for (int gridSize : gridSizes) {
+        std::string gridName = std::to_string(gridSize) + "x" + std::to_string(gridSize);
+        std::vector<Coord3D *> gridCoordsPhysical(gridSize * gridSize);
+        std::vector<Coord2D *> gridCoordsVirtual(gridSize * gridSize);
+        createCalibration(gridSize, gridSize, gridCoordsPhysical.data(), gridCoordsVirtual.data());
+        VirtualManager gridVirtualManager;
+        runBenchmark(options, "setCalibrationPoints/" + gridName, [&]() {
+            gridVirtualManager.setCalibrationPoints(gridSize, gridSize, gridCoordsPhysical.data(), gridCoordsVirtual.data());
+        }, results);
+        gridVirtualManager.setCalibrationPoints(gridSize, gridSize, gridCoordsPhysical.data(), gridCoordsVirtual.data());
+        gridVirtualManager.setScreenVirtual(SCREEN_HEIGHT, SCREEN_WIDTH);
+
+        mappingIndex = 0;
+        runBenchmark(options, "setVirtualCoordFromCalibration/" + gridName + "/x" + std::to_string(MAPPING_BATCH_SIZE), [&]() {
+            for (int i = 0; i < MAPPING_BATCH_SIZE; i++) {
+                physicalLocation.x = 60 + (mappingIndex * 37) % 390;
+                physicalLocation.y = 115 + (mappingIndex * 53) % 250;
+                mappingIndex++;
+                gridVirtualManager.setVirtualCoordFromCalibration(&interaction);
+            }
+        }, results);
+        deleteCalibration(gridSize, gridSize, gridCoordsPhysical.data(), gridCoordsVirtual.data());
+    }
+
+    // Cost of one instrumented stage, to compare against the detection loop's frame time
+    LatencyStats latencyStats;
+    runBenchmark(options, "latencySpan", [&]() {
+        std::chrono::steady_clock::time_point spanStart = std::chrono::steady_clock::now();
+        latencyStats.record(LatencyStageClassify, spanStart, std::chrono::steady_clock::now());
+    }, results);
+
+    Tracer::shared()->start();
+    runBenchmark(options, "traceSpan", [&]() {
+        std::chrono::steady_clock::time_point spanStart = std::chrono::steady_clock::now();
+        Tracer::shared()->record("benchmark", spanStart, std::chrono::steady_clock::now());
+    }, results);
+    Tracer::shared()->stop();
+
+    deleteCalibration(CALIBRATION_ROWS, CALIBRATION_COLS, calibrationCoordsPhysical, calibrationCoordsVirtual);
+    referenceBuffer->release();
+
+    if (options.format == "json") {
+        writeResultsJSON(results);
+    } else {
+        writeResultsCSV(results);
+    }
+    return 0;
+}
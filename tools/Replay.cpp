@@ -0,0 +1,198 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    Replay.cpp
+    Replays a recorded session at the pace it was captured and reports touch-to-event latency.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FrameClock.h"
+#include "InteractionHandler.h"
+#include "LatencyStats.h"
+#include "PhysicalManager.h"
+#include "Recording.h"
+
+#define SPEED_DEFAULT 1.0
+#define DEVICE_TICK_MICROSECONDS 100
+
+using namespace virtualMonitor;
+
+/*
+ * Stands in for MouseInteractionHandler, recording latency from the frame's capture to each event
+ */
+class ReplayInteractionHandler : public InteractionHandler {
+    private:
+        virtual int handleInteractionStartEvent() {
+            LatencyStats::shared()->record(LatencyStageTouchDown, this->frameTime, std::chrono::steady_clock::now());
+            return 0;
+        }
+
+        virtual int handleInteractionMoveEvent() {
+            LatencyStats::shared()->record(LatencyStageTouchMove, this->frameTime, std::chrono::steady_clock::now());
+            return 0;
+        }
+
+        virtual int handleInteractionEndEvent() {
+            LatencyStats::shared()->record(LatencyStageTouchUp, this->frameTime, std::chrono::steady_clock::now());
+            return 0;
+        }
+};
+
+static void freeInteraction(Interaction *interaction) {
+    delete interaction->physicalLocation;
+    delete interaction->virtualLocation;
+    delete interaction;
+}
+
+static void printUsage(const char *program) {
+    std::cout << "Usage: " << program << " RECORDING [options]" << std::endl
+              << "  RECORDING is a .vmrec session, replayed at the pace its frames were captured" << std::endl
+              << "  --speed F         replay speed, where 2 replays twice as fast (default 1)" << std::endl
+              << "  --queue           detect every frame in order, rather than skipping to the latest frame when behind" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argv[1][0] == '-') {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::string recordingFilename = argv[1];
+    double speed = SPEED_DEFAULT;
+    bool readLatestFrame = true;
+    for (int i = 2; i < argc; i++) {
+        std::string option = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (option == "--speed" && hasValue) {
+            speed = std::atof(argv[++i]);
+        } else if (option == "--queue") {
+            readLatestFrame = false;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (speed <= 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    RecordingReader reader;
+    if (reader.open(recordingFilename) < 0) {
+        return 1;
+    }
+    if (reader.getFrameCount() < 2) {
+        std::cout << "Replay: " << recordingFilename << " has no frames after its reference frame." << std::endl;
+        return 1;
+    }
+
+    // Recordings with the camera's intrinsics fit the surface as a plane, as detection did when recording
+    PhysicalManager physicalManager;
+    CameraIntrinsics cameraIntrinsics;
+    if (reader.getCameraIntrinsics(&cameraIntrinsics) == 0) {
+        physicalManager.setCameraIntrinsics(cameraIntrinsics);
+    }
+    DepthView referenceFrame;
+    reader.readFrame(0, &referenceFrame);
+    physicalManager.setReferenceFrame(&referenceFrame);
+
+    // Timestamps are read ahead of the frames, so a frame can be skipped once its successor is due
+    std::vector<uint32_t> timestamps;
+    std::vector<uint32_t> sequences;
+    for (int frameIndex = 1; frameIndex < reader.getFrameCount(); frameIndex++) {
+        DepthView depthFrame;
+        reader.readFrame(frameIndex, &depthFrame);
+        timestamps.push_back(depthFrame.timestamp);
+        sequences.push_back(depthFrame.sequence);
+    }
+
+    ReplayInteractionHandler handler;
+    FrameClock frameClock;
+    LatencyStats::shared()->reset();
+    int skippedCount = 0;
+    int interactionCount = 0;
+    bool hasLastSequence = false;
+    uint32_t lastSequence = 0;
+    uint64_t missingFrameCount = 0;
+    uint32_t largestSequenceGap = 0;
+
+    // A frame is due when the device would have delivered it, with the device clock scaled by speed
+    // Like KinectReader reading the latest frame, frames that fall behind are skipped rather than queued
+    std::chrono::steady_clock::time_point replayStart = std::chrono::steady_clock::now();
+    uint32_t firstTimestamp = timestamps[0];
+    for (size_t i = 0; i < timestamps.size(); i++) {
+        uint32_t replayTicks = (uint32_t)((uint32_t)(timestamps[i] - firstTimestamp) / speed);
+        std::chrono::steady_clock::time_point due = replayStart + std::chrono::microseconds((int64_t)replayTicks * DEVICE_TICK_MICROSECONDS);
+        if (readLatestFrame && i + 1 < timestamps.size()) {
+            uint32_t nextReplayTicks = (uint32_t)((uint32_t)(timestamps[i + 1] - firstTimestamp) / speed);
+            if (std::chrono::steady_clock::now() >= replayStart + std::chrono::microseconds((int64_t)nextReplayTicks * DEVICE_TICK_MICROSECONDS)) {
+                skippedCount++;
+                continue;
+            }
+        }
+        std::this_thread::sleep_until(due);
+
+        // Gaps include frames skipped here and frames missing from the recording
+        uint32_t sequenceGap = hasLastSequence ? sequences[i] - lastSequence - 1 : 0;
+        missingFrameCount += sequenceGap;
+        largestSequenceGap = std::max(largestSequenceGap, sequenceGap);
+        lastSequence = sequences[i];
+        hasLastSequence = true;
+
+        LATENCY_SPAN_BEGIN(frameSpan);
+        frameClock.observeFrame(firstTimestamp + replayTicks, std::chrono::steady_clock::now());
+        std::chrono::steady_clock::time_point frameTime = frameClock.hostTimeForFrame(firstTimestamp + replayTicks);
+
+        LATENCY_SPAN_BEGIN(captureSpan);
+        DepthView depthFrame;
+        reader.readFrame(i + 1, &depthFrame);
+        LATENCY_SPAN_END(captureSpan, LatencyStageCapture);
+        LATENCY_SPAN_BEGIN(classifySpan);
+        Interaction *interaction = physicalManager.detectInteraction(&depthFrame);
+        LATENCY_SPAN_END(classifySpan, LatencyStageClassify);
+
+        // Without calibration data the physical location stands in for the virtual location
+        if (interaction != NULL) {
+            interaction->virtualLocation->x = interaction->physicalLocation->x;
+            interaction->virtualLocation->y = interaction->physicalLocation->y;
+        }
+        LATENCY_SPAN_BEGIN(handleSpan);
+        interactionCount += handler.handleInteraction(interaction, frameTime) ? 1 : 0;
+        LATENCY_SPAN_END(handleSpan, LatencyStageHandle);
+
+        if (interaction != NULL) {
+            freeInteraction(interaction);
+        }
+        LATENCY_SPAN_END(frameSpan, LatencyStageFrame);
+    }
+
+    std::cout << "Replay: " << timestamps.size() << " frames at " << speed << "x, " << skippedCount << " skipped for newer frames, "
+              << missingFrameCount << " missing from the sequence (largest gap " << largestSequenceGap << "), "
+              << interactionCount << " interactions" << std::endl;
+    LatencyStats::shared()->writeReport(std::cout);
+
+    reader.close();
+    return 0;
+}
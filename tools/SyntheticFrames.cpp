@@ -0,0 +1,128 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    SyntheticFrames.cpp
+    Writes a directory of synthetic depth frames with ground-truth contacts.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "SyntheticScene.h"
+
+#define REFERENCE_FRAME_FILENAME "surface.bin"
+#define TRUTH_FILENAME "truth.txt"
+
+using namespace virtualMonitor;
+
+static void printUsage(const char *program) {
+    std::cout << "Usage: " << program << " OUTPUT_DIR [options]" << std::endl
+              << "  --frames N        number of frames to write (default 100)" << std::endl
+              << "  --seed N          random seed (default 0)" << std::endl
+              << "  --hands N         maximum hands per frame (default 2)" << std::endl
+              << "  --touch P         probability a hand touches the surface (default 0.5)" << std::endl
+              << "  --width N         frame width (default 512)" << std::endl
+              << "  --height N        frame height (default 424)" << std::endl
+              << "  --tilt F          fractional depth change across the surface (default 0.03)" << std::endl
+              << "  --regression A B  surface depth A * y^B (default 176000 -0.98)" << std::endl
+              << "  --noise F         depth noise at 1 m in mm (default 1.5)" << std::endl
+              << "  --dropout F       invalid pixel probability (default 0.002)" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argv[1][0] == '-') {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::string outputDir = argv[1];
+    int frameCount = 100;
+    int maxHands = 2;
+    float touchProbability = 0.5;
+    SyntheticSceneParameters parameters;
+
+    for (int i = 2; i < argc; i++) {
+        std::string option = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (option == "--frames" && hasValue) {
+            frameCount = std::atoi(argv[++i]);
+        } else if (option == "--seed" && hasValue) {
+            parameters.seed = (uint32_t)std::strtoul(argv[++i], NULL, 10);
+        } else if (option == "--hands" && hasValue) {
+            maxHands = std::atoi(argv[++i]);
+        } else if (option == "--touch" && hasValue) {
+            touchProbability = std::atof(argv[++i]);
+        } else if (option == "--width" && hasValue) {
+            parameters.width = std::atoi(argv[++i]);
+        } else if (option == "--height" && hasValue) {
+            parameters.height = std::atoi(argv[++i]);
+        } else if (option == "--tilt" && hasValue) {
+            parameters.surfaceTiltX = std::atof(argv[++i]);
+        } else if (option == "--regression" && i + 2 < argc) {
+            parameters.surfaceRegressionA = std::atof(argv[++i]);
+            parameters.surfaceRegressionB = std::atof(argv[++i]);
+        } else if (option == "--noise" && hasValue) {
+            parameters.noiseScale = std::atof(argv[++i]);
+        } else if (option == "--dropout" && hasValue) {
+            parameters.dropoutRate = std::atof(argv[++i]);
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    SyntheticScene scene(parameters);
+    std::vector<float> depthData(parameters.width * parameters.height);
+
+    // The reference frame is the bare surface, named like the captured fixtures in inputs/
+    scene.renderReferenceFrame(depthData.data());
+    if (scene.writeDepthFrameToFile(depthData.data(), outputDir + "/" + REFERENCE_FRAME_FILENAME) < 0) {
+        return 1;
+    }
+
+    std::ofstream truthFile(outputDir + "/" + TRUTH_FILENAME);
+    if (!truthFile.is_open()) {
+        std::cout << "SyntheticFrames: Could not write ground truth." << std::endl;
+        return 1;
+    }
+
+    int contactCount = 0;
+    for (int frameIndex = 0; frameIndex < frameCount; frameIndex++) {
+        char frameId[32];
+        std::snprintf(frameId, sizeof(frameId), "frame%05d.bin", frameIndex);
+
+        std::vector<Coord3D> contacts;
+        scene.randomizeHands(frameIndex, maxHands, touchProbability);
+        scene.renderDepthFrame(depthData.data(), frameIndex, &contacts);
+        if (scene.writeDepthFrameToFile(depthData.data(), outputDir + "/" + frameId) < 0) {
+            return 1;
+        }
+        scene.writeContactsToStream(truthFile, frameId, contacts);
+        contactCount += contacts.size();
+    }
+
+    truthFile.close();
+    std::cout << "SyntheticFrames: Wrote " << frameCount << " frames (" << parameters.width << "x" << parameters.height
+              << ", " << contactCount << " contacts) to " << outputDir << std::endl;
+    return 0;
+}
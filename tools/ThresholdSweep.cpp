@@ -0,0 +1,531 @@
+/*
+    Virtual Monitor
+    Transforms a projected computer screen into an intuitive touchscreen device.
+    Copyright (C) 2018 Devin Gund (https://dgund.com)
+
+    ThresholdSweep.cpp
+    Scores detection parameter settings against ground truth to find the best latency/accuracy tradeoffs.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FrameCorpus.h"
+#include "PhysicalManager.h"
+#include "ThreadPool.h"
+
+#define TRUTH_FILENAME "truth.txt"
+#define SWEEP_FILENAME_DEFAULT "sweep.csv"
+#define CHUNK_SIZE_DEFAULT 16
+#define TOLERANCE_DEFAULT 10
+
+using namespace virtualMonitor;
+
+// A DetectionParameters field that can be swept from the command line
+struct SweepParameter {
+    std::string name;
+    bool fitsSurface;   // whether changing it requires fitting the surface again
+    std::function<void(DetectionParameters &, float)> set;
+    std::function<float(DetectionParameters &)> get;
+};
+
+struct SweepOptions {
+    std::string corpusPath;
+    std::string truthFilename;
+    std::string sweepFilename;
+    std::map<std::string, std::vector<float> > values;
+    int randomCount;
+    unsigned int seed;
+    int tolerance;
+    int chunkSize;
+    int threadCount;
+};
+
+struct SweepSetting {
+    DetectionParameters parameters;
+    int fitIndex;   // which surface fit the setting shares
+    int truePositiveCount;
+    int falsePositiveCount;
+    int falseNegativeCount;
+    double precision;
+    double recall;
+    double f1;
+    double meanMicroseconds;
+    double p99Microseconds;
+    bool isParetoOptimal;
+};
+
+struct FrameOutcome {
+    bool isDetected;
+    Coord3D location;
+    double detectMicroseconds;
+};
+
+static std::vector<SweepParameter> sweepParameters() {
+    std::vector<SweepParameter> parameters;
+#define SWEEP_PARAMETER(field, fitsSurface) \
+    parameters.push_back((SweepParameter){#field, fitsSurface, \
+        [](DetectionParameters &p, float value) { p.field = value; }, \
+        [](DetectionParameters &p) { return (float)p.field; }})
+    SWEEP_PARAMETER(depthMin, true);
+    SWEEP_PARAMETER(depthMax, true);
+    SWEEP_PARAMETER(depthSmoothingDelta, true);
+    SWEEP_PARAMETER(referenceDepthSmoothingDelta, false);
+    SWEEP_PARAMETER(varianceBoxSideLength, false);
+    SWEEP_PARAMETER(surfaceDepthDifferenceMin, true);
+    SWEEP_PARAMETER(surfaceSlopeDifferenceMin, true);
+    SWEEP_PARAMETER(referenceDepthDifferenceMin, false);
+    SWEEP_PARAMETER(referenceSlopeDifferenceMin, false);
+    SWEEP_PARAMETER(anomalySizeMin, false);
+    SWEEP_PARAMETER(varianceMax, false);
+#undef SWEEP_PARAMETER
+    return parameters;
+}
+
+static std::string describeFitParameters(std::vector<SweepParameter> &parameters, DetectionParameters &detectionParameters) {
+    std::ostringstream description;
+    for (size_t i = 0; i < parameters.size(); i++) {
+        if (parameters[i].fitsSurface) {
+            description << parameters[i].get(detectionParameters) << " ";
+        }
+    }
+    return description.str();
+}
+
+/*
+ * Expands the swept values into settings, either every combination or randomCount random combinations
+ */
+static std::vector<DetectionParameters> createSettings(std::vector<SweepParameter> &parameters, SweepOptions &options) {
+    std::vector<DetectionParameters> settings;
+    std::vector<int> sweptIndices;
+    for (size_t i = 0; i < parameters.size(); i++) {
+        if (options.values.count(parameters[i].name) > 0) {
+            sweptIndices.push_back(i);
+        }
+    }
+
+    if (options.randomCount > 0) {
+        std::mt19937 random(options.seed);
+        for (int n = 0; n < options.randomCount; n++) {
+            DetectionParameters setting;
+            for (size_t i = 0; i < sweptIndices.size(); i++) {
+                SweepParameter &parameter = parameters[sweptIndices[i]];
+                std::vector<float> &values = options.values[parameter.name];
+                parameter.set(setting, values[std::uniform_int_distribution<int>(0, values.size() - 1)(random)]);
+            }
+            settings.push_back(setting);
+        }
+        return settings;
+    }
+
+    // Count through every combination, with the first swept parameter changing slowest
+    std::vector<size_t> counters(sweptIndices.size(), 0);
+    while (true) {
+        DetectionParameters setting;
+        for (size_t i = 0; i < sweptIndices.size(); i++) {
+            SweepParameter &parameter = parameters[sweptIndices[i]];
+            parameter.set(setting, options.values[parameter.name][counters[i]]);
+        }
+        settings.push_back(setting);
+
+        int digit = sweptIndices.size() - 1;
+        while (digit >= 0 && ++counters[digit] == options.values[parameters[sweptIndices[digit]].name].size()) {
+            counters[digit] = 0;
+            digit--;
+        }
+        if (digit < 0) {
+            return settings;
+        }
+    }
+}
+
+/*
+ * Reads truth.txt next to each source, with ids relative to the corpus
+ */
+static void readSourceAnnotations(FrameCorpus *corpus, CorpusAnnotations &annotations) {
+    std::set<std::string> annotationsFilenames;
+    for (int index = 0; index < corpus->getFrameCount(); index++) {
+        CorpusFrame &frame = corpus->getFrame(index);
+        CorpusSource &source = corpus->getSource(frame.sourceIndex);
+        std::string annotationsFilename = source.dir + "/" + TRUTH_FILENAME;
+        if (annotationsFilenames.count(annotationsFilename) > 0) {
+            continue;
+        }
+        annotationsFilenames.insert(annotationsFilename);
+        std::string idPrefix = frame.id.substr(0, frame.id.find_last_of('/') + 1);
+        FrameCorpus::readAnnotationsFromFile(annotationsFilename, annotations, idPrefix);
+    }
+}
+
+static void freeInteraction(Interaction *interaction) {
+    delete interaction->physicalLocation;
+    delete interaction->virtualLocation;
+    delete interaction;
+}
+
+/*
+ * Detects interactions on a run of frames from one source with one setting
+ */
+static void evaluateFrames(FrameCorpus *corpus, DetectionParameters parameters, PhysicalManager *fitManager,
+                           std::vector<int> *frameIndices, int first, int end, std::vector<FrameOutcome> *outcomes) {
+    PhysicalManager physicalManager(parameters);
+    physicalManager.copyReferenceFrom(fitManager);
+
+    for (int k = first; k < end; k++) {
+        int index = (*frameIndices)[k];
+        FrameOutcome &outcome = (*outcomes)[k];
+        outcome.isDetected = false;
+        outcome.detectMicroseconds = 0;
+        DepthBuffer *depthBuffer = corpus->readFrame(index);
+        if (depthBuffer == NULL) {
+            continue;
+        }
+        DepthView *depthFrame = depthBuffer->getView();
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Interaction *interaction = physicalManager.detectInteraction(depthFrame);
+        outcome.detectMicroseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+        if (interaction != NULL) {
+            outcome.isDetected = true;
+            outcome.location = *interaction->physicalLocation;
+            freeInteraction(interaction);
+        }
+        depthBuffer->release();
+    }
+}
+
+/*
+ * A detection is a true positive when it lands within tolerance of any annotated contact
+ * A frame with contacts and no true positive is a false negative
+ */
+static void scoreSetting(SweepSetting &setting, std::vector<FrameOutcome> &outcomes, std::vector<std::vector<Coord3D> *> &expected, int tolerance) {
+    setting.truePositiveCount = 0;
+    setting.falsePositiveCount = 0;
+    setting.falseNegativeCount = 0;
+    std::vector<double> latencies;
+    for (size_t k = 0; k < outcomes.size(); k++) {
+        latencies.push_back(outcomes[k].detectMicroseconds);
+        bool isMatched = false;
+        if (outcomes[k].isDetected) {
+            for (size_t j = 0; j < expected[k]->size(); j++) {
+                Coord3D &contact = (*expected[k])[j];
+                if (std::abs(contact.x - outcomes[k].location.x) <= tolerance &&
+                    std::abs(contact.y - outcomes[k].location.y) <= tolerance) {
+                    isMatched = true;
+                }
+            }
+            if (isMatched) {
+                setting.truePositiveCount++;
+            } else {
+                setting.falsePositiveCount++;
+            }
+        }
+        if (!isMatched && !expected[k]->empty()) {
+            setting.falseNegativeCount++;
+        }
+    }
+
+    int detectedCount = setting.truePositiveCount + setting.falsePositiveCount;
+    int contactFrameCount = setting.truePositiveCount + setting.falseNegativeCount;
+    setting.precision = (detectedCount > 0) ? (double)setting.truePositiveCount / detectedCount : 1.0;
+    setting.recall = (contactFrameCount > 0) ? (double)setting.truePositiveCount / contactFrameCount : 1.0;
+    setting.f1 = (setting.precision + setting.recall > 0) ?
+                 2 * setting.precision * setting.recall / (setting.precision + setting.recall) : 0;
+
+    double latencySum = 0;
+    for (size_t k = 0; k < latencies.size(); k++) {
+        latencySum += latencies[k];
+    }
+    std::sort(latencies.begin(), latencies.end());
+    setting.meanMicroseconds = latencies.empty() ? 0 : latencySum / latencies.size();
+    setting.p99Microseconds = latencies.empty() ? 0 : latencies[std::min(latencies.size() - 1, (size_t)(latencies.size() * 0.99))];
+}
+
+/*
+ * A setting is Pareto-optimal when no other setting is at least as fast and as accurate (F1), and better in one
+ */
+static void markParetoOptimal(std::vector<SweepSetting> &settings) {
+    for (size_t i = 0; i < settings.size(); i++) {
+        settings[i].isParetoOptimal = true;
+        for (size_t j = 0; j < settings.size(); j++) {
+            bool isAsGood = (settings[j].meanMicroseconds <= settings[i].meanMicroseconds && settings[j].f1 >= settings[i].f1);
+            bool isBetter = (settings[j].meanMicroseconds < settings[i].meanMicroseconds || settings[j].f1 > settings[i].f1);
+            if (j != i && isAsGood && isBetter) {
+                settings[i].isParetoOptimal = false;
+                break;
+            }
+        }
+    }
+}
+
+static int writeSweepToFile(std::vector<SweepParameter> &parameters, std::vector<SweepSetting> &settings, std::string sweepFilename) {
+    std::ofstream sweepFile(sweepFilename);
+    if (!sweepFile.is_open()) {
+        std::cout << "ThresholdSweep: Could not write " << sweepFilename << "." << std::endl;
+        return -1;
+    }
+
+    sweepFile << "setting";
+    for (size_t i = 0; i < parameters.size(); i++) {
+        sweepFile << "," << parameters[i].name;
+    }
+    sweepFile << ",tp,fp,fn,precision,recall,f1,mean_us,p99_us,pareto\n";
+    for (size_t s = 0; s < settings.size(); s++) {
+        SweepSetting &setting = settings[s];
+        sweepFile << s;
+        for (size_t i = 0; i < parameters.size(); i++) {
+            sweepFile << "," << parameters[i].get(setting.parameters);
+        }
+        sweepFile << "," << setting.truePositiveCount << "," << setting.falsePositiveCount << "," << setting.falseNegativeCount
+                  << "," << setting.precision << "," << setting.recall << "," << setting.f1
+                  << "," << setting.meanMicroseconds << "," << setting.p99Microseconds << "," << (setting.isParetoOptimal ? 1 : 0) << "\n";
+    }
+
+    sweepFile.close();
+    return 0;
+}
+
+static bool parseValues(std::string assignment, SweepOptions &options) {
+    size_t equals = assignment.find('=');
+    if (equals == std::string::npos) {
+        return false;
+    }
+    std::vector<float> values;
+    std::istringstream valueStream(assignment.substr(equals + 1));
+    std::string value;
+    while (std::getline(valueStream, value, ',')) {
+        values.push_back(std::atof(value.c_str()));
+    }
+    if (values.empty()) {
+        return false;
+    }
+    options.values[assignment.substr(0, equals)] = values;
+    return true;
+}
+
+static void printUsage(const char *program, std::vector<SweepParameter> &parameters) {
+    std::cout << "Usage: " << program << " CORPUS [options]" << std::endl
+              << "  CORPUS is a recording, or a directory of recordings and .bin frames with surface.bin as reference" << std::endl
+              << "  --vary NAME=V1,V2,...  values to sweep for a parameter (repeatable)" << std::endl
+              << "  --random N        evaluate N random combinations instead of every combination" << std::endl
+              << "  --seed N          random seed (default 0)" << std::endl
+              << "  --truth FILE      ground truth (default truth.txt next to each source)" << std::endl
+              << "  --tolerance N     distance from a contact that counts as a hit in pixels (default 10)" << std::endl
+              << "  --output FILE     results CSV (default sweep.csv)" << std::endl
+              << "  --chunk N         frames per task (default 16)" << std::endl
+              << "  --threads N       worker threads (default all cores)" << std::endl
+              << "  Parameters (* fits the surface again):";
+    DetectionParameters defaults;
+    for (size_t i = 0; i < parameters.size(); i++) {
+        std::cout << (i % 3 == 0 ? "\n    " : ", ") << parameters[i].name << (parameters[i].fitsSurface ? "*" : "")
+                  << " (" << parameters[i].get(defaults) << ")";
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char **argv) {
+    std::vector<SweepParameter> parameters = sweepParameters();
+    if (argc < 2 || argv[1][0] == '-') {
+        printUsage(argv[0], parameters);
+        return 1;
+    }
+
+    SweepOptions options;
+    options.corpusPath = argv[1];
+    options.sweepFilename = SWEEP_FILENAME_DEFAULT;
+    options.randomCount = 0;
+    options.seed = 0;
+    options.tolerance = TOLERANCE_DEFAULT;
+    options.chunkSize = CHUNK_SIZE_DEFAULT;
+    options.threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int i = 2; i < argc; i++) {
+        std::string option = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (option == "--vary" && hasValue && parseValues(argv[i + 1], options)) {
+            i++;
+        } else if (option == "--random" && hasValue) {
+            options.randomCount = std::max(1, std::atoi(argv[++i]));
+        } else if (option == "--seed" && hasValue) {
+            options.seed = (unsigned int)std::strtoul(argv[++i], NULL, 10);
+        } else if (option == "--truth" && hasValue) {
+            options.truthFilename = argv[++i];
+        } else if (option == "--tolerance" && hasValue) {
+            options.tolerance = std::atoi(argv[++i]);
+        } else if (option == "--output" && hasValue) {
+            options.sweepFilename = argv[++i];
+        } else if (option == "--chunk" && hasValue) {
+            options.chunkSize = std::max(1, std::atoi(argv[++i]));
+        } else if (option == "--threads" && hasValue) {
+            options.threadCount = std::max(1, std::atoi(argv[++i]));
+        } else {
+            printUsage(argv[0], parameters);
+            return 1;
+        }
+    }
+
+    // By default, sweep the thresholds that do not need the surface fit again
+    if (options.values.empty()) {
+        parseValues("anomalySizeMin=350,700,1400", options);
+        parseValues("varianceMax=1000,2000,4000", options);
+        parseValues("referenceDepthDifferenceMin=50,100,200", options);
+    }
+    for (std::map<std::string, std::vector<float> >::iterator it = options.values.begin(); it != options.values.end(); it++) {
+        bool isKnown = false;
+        for (size_t i = 0; i < parameters.size(); i++) {
+            isKnown = isKnown || (parameters[i].name == it->first);
+        }
+        if (!isKnown) {
+            std::cout << "ThresholdSweep: Unknown parameter " << it->first << "." << std::endl;
+            return 1;
+        }
+    }
+
+    FrameCorpus corpus;
+    if (corpus.load(options.corpusPath) < 0) {
+        return 1;
+    }
+
+    CorpusAnnotations annotations;
+    if (options.truthFilename.length() > 0) {
+        if (FrameCorpus::readAnnotationsFromFile(options.truthFilename, annotations) < 0) {
+            std::cout << "ThresholdSweep: Could not read " << options.truthFilename << "." << std::endl;
+            return 1;
+        }
+    } else {
+        readSourceAnnotations(&corpus, annotations);
+    }
+
+    // Only annotated frames are scored
+    std::vector<int> frameIndices;
+    std::vector<std::vector<Coord3D> *> expected;
+    for (int index = 0; index < corpus.getFrameCount(); index++) {
+        CorpusAnnotations::iterator annotation = annotations.find(corpus.getFrame(index).id);
+        if (annotation != annotations.end()) {
+            frameIndices.push_back(index);
+            expected.push_back(&annotation->second);
+        }
+    }
+    if (frameIndices.empty()) {
+        std::cout << "ThresholdSweep: No annotated frames in " << options.corpusPath << "." << std::endl;
+        return 1;
+    }
+
+    std::vector<DetectionParameters> detectionSettings = createSettings(parameters, options);
+    std::vector<SweepSetting> settings(detectionSettings.size());
+    std::map<std::string, int> fitIndices;
+    std::vector<DetectionParameters> fitParameters;
+    for (size_t s = 0; s < settings.size(); s++) {
+        settings[s].parameters = detectionSettings[s];
+        std::string fitKey = describeFitParameters(parameters, detectionSettings[s]);
+        if (fitIndices.count(fitKey) == 0) {
+            fitIndices[fitKey] = fitParameters.size();
+            fitParameters.push_back(detectionSettings[s]);
+        }
+        settings[s].fitIndex = fitIndices[fitKey];
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ThreadPool pool(options.threadCount);
+
+    // Fit each source's surface once per distinct set of surface parameters
+    std::vector<std::vector<PhysicalManager *> > fitManagers(fitParameters.size());
+    for (size_t f = 0; f < fitParameters.size(); f++) {
+        for (int sourceIndex = 0; sourceIndex < corpus.getSourceCount(); sourceIndex++) {
+            PhysicalManager *fitManager = new PhysicalManager(fitParameters[f]);
+            fitManagers[f].push_back(fitManager);
+            DepthView *referenceFrame = corpus.getReferenceFrame(sourceIndex);
+            pool.submit([fitManager, referenceFrame]() { fitManager->setReferenceFrame(referenceFrame); });
+        }
+    }
+    pool.wait();
+
+    // Each task runs one setting over a chunk of annotated frames from one source
+    std::vector<std::vector<FrameOutcome> > outcomes(settings.size(), std::vector<FrameOutcome>(frameIndices.size()));
+    for (size_t s = 0; s < settings.size(); s++) {
+        int first = 0;
+        while (first < (int)frameIndices.size()) {
+            int sourceIndex = corpus.getFrame(frameIndices[first]).sourceIndex;
+            int end = first + 1;
+            while (end < (int)frameIndices.size() && end - first < options.chunkSize &&
+                   corpus.getFrame(frameIndices[end]).sourceIndex == sourceIndex) {
+                end++;
+            }
+            DetectionParameters detectionParameters = settings[s].parameters;
+            PhysicalManager *fitManager = fitManagers[settings[s].fitIndex][sourceIndex];
+            std::vector<FrameOutcome> *settingOutcomes = &outcomes[s];
+            pool.submit([&corpus, detectionParameters, fitManager, &frameIndices, first, end, settingOutcomes]() {
+                evaluateFrames(&corpus, detectionParameters, fitManager, &frameIndices, first, end, settingOutcomes);
+            });
+            first = end;
+        }
+    }
+    pool.wait();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t s = 0; s < settings.size(); s++) {
+        scoreSetting(settings[s], outcomes[s], expected, options.tolerance);
+    }
+    markParetoOptimal(settings);
+    if (writeSweepToFile(parameters, settings, options.sweepFilename) < 0) {
+        return 1;
+    }
+
+    std::cout << "ThresholdSweep: " << settings.size() << " settings (" << fitParameters.size() << " surface fits) over "
+              << frameIndices.size() << " annotated frames in " << seconds << " s on " << pool.getThreadCount() << " threads" << std::endl;
+
+    // Print the Pareto front from fastest to most accurate
+    std::vector<int> front;
+    for (size_t s = 0; s < settings.size(); s++) {
+        if (settings[s].isParetoOptimal) {
+            front.push_back(s);
+        }
+    }
+    std::sort(front.begin(), front.end(), [&settings](int a, int b) { return settings[a].meanMicroseconds < settings[b].meanMicroseconds; });
+    for (size_t i = 0; i < front.size(); i++) {
+        SweepSetting &setting = settings[front[i]];
+        std::cout << "PARETO setting " << front[i] << ": precision " << setting.precision << ", recall " << setting.recall
+                  << ", f1 " << setting.f1 << ", mean " << setting.meanMicroseconds << " us, p99 " << setting.p99Microseconds << " us (";
+        for (std::map<std::string, std::vector<float> >::iterator it = options.values.begin(); it != options.values.end(); it++) {
+            for (size_t p = 0; p < parameters.size(); p++) {
+                if (parameters[p].name == it->first) {
+                    std::cout << (it == options.values.begin() ? "" : " ") << it->first << "=" << parameters[p].get(setting.parameters);
+                }
+            }
+        }
+        std::cout << ")" << std::endl;
+    }
+    std::cout << "ThresholdSweep: Wrote results to " << options.sweepFilename << std::endl;
+
+    for (size_t f = 0; f < fitManagers.size(); f++) {
+        for (size_t i = 0; i < fitManagers[f].size(); i++) {
+            delete fitManagers[f][i];
+        }
+    }
+    return 0;
+}